@@ -86,6 +86,14 @@ ngx_create_listening(ngx_conf_t *cf, void *sockaddr, socklen_t socklen)
     ls->fastopen = -1;
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+    ls->busy_poll = -1;
+#endif
+
+#if (NGX_HAVE_INCOMING_CPU)
+    ls->incoming_cpu = -1;
+#endif
+
     return ls;
 }
 
@@ -236,6 +244,40 @@ ngx_set_inherited_sockets(ngx_cycle_t *cycle)
 
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+
+        olen = sizeof(int);
+
+        if (getsockopt(ls[i].fd, SOL_SOCKET, SO_BUSY_POLL,
+                       (void *) &ls[i].busy_poll, &olen)
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_socket_errno,
+                          "getsockopt(SO_BUSY_POLL) %V failed, ignored",
+                          &ls[i].addr_text);
+
+            ls[i].busy_poll = -1;
+        }
+
+#endif
+
+#if (NGX_HAVE_INCOMING_CPU)
+
+        olen = sizeof(int);
+
+        if (getsockopt(ls[i].fd, SOL_SOCKET, SO_INCOMING_CPU,
+                       (void *) &ls[i].incoming_cpu, &olen)
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_socket_errno,
+                          "getsockopt(SO_INCOMING_CPU) %V failed, ignored",
+                          &ls[i].addr_text);
+
+            ls[i].incoming_cpu = -1;
+        }
+
+#endif
+
 #if (NGX_HAVE_DEFERRED_ACCEPT && defined SO_ACCEPTFILTER)
 
         ngx_memzero(&af, sizeof(struct accept_filter_arg));
@@ -622,6 +664,32 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+        if (ls[i].busy_poll != -1) {
+            if (setsockopt(ls[i].fd, SOL_SOCKET, SO_BUSY_POLL,
+                           (const void *) &ls[i].busy_poll, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_BUSY_POLL, %d) %V failed, ignored",
+                              ls[i].busy_poll, &ls[i].addr_text);
+            }
+        }
+#endif
+
+#if (NGX_HAVE_INCOMING_CPU)
+        if (ls[i].incoming_cpu != -1) {
+            if (setsockopt(ls[i].fd, SOL_SOCKET, SO_INCOMING_CPU,
+                           (const void *) &ls[i].incoming_cpu, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_INCOMING_CPU, %d) %V failed, "
+                              "ignored", ls[i].incoming_cpu, &ls[i].addr_text);
+            }
+        }
+#endif
+
 #if 0
         if (1) {
             int tcp_nodelay = 1;
@@ -83,6 +83,12 @@ struct ngx_listening_s {                                     /*与一个监听
 #if (NGX_HAVE_TCP_FASTOPEN)
     int                 fastopen;
 #endif
+#if (NGX_HAVE_BUSY_POLL)
+    int                 busy_poll;
+#endif
+#if (NGX_HAVE_INCOMING_CPU)
+    int                 incoming_cpu;
+#endif
 
 };
 
@@ -78,6 +78,7 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_os.h>
 #include <ngx_connection.h>
 #include <ngx_proxy_protocol.h>
+#include <ngx_syslog.h>
 
 
 #define LF     (u_char) 10 					/*换行符号*/
@@ -91,6 +92,8 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 
 void ngx_cpuinfo(void);
 
+extern ngx_uint_t  ngx_cpu_invariant_tsc;
+
 #if (NGX_HAVE_OPENAT)
 #define NGX_DISABLE_SYMLINKS_OFF        0
 #define NGX_DISABLE_SYMLINKS_ON         1
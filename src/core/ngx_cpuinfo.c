@@ -9,6 +9,9 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_invariant_tsc;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -125,6 +128,16 @@ ngx_cpuinfo(void)
     } else if (ngx_strcmp(vendor, "AuthenticAMD") == 0) {
         ngx_cacheline_size = 64;
     }
+
+    /* the TSC runs at a constant rate in all ACPI P-, C- and T-states */
+
+    ngx_cpuid(0x80000000, cpu);
+
+    if (cpu[0] >= 0x80000007) {
+        ngx_cpuid(0x80000007, cpu);
+
+        ngx_cpu_invariant_tsc = (cpu[2] & 0x100) ? 1 : 0;
+    }
 }
 
 #else
@@ -16,6 +16,7 @@
 #if (NGX_HAVE_MD5)
 
 #if (NGX_HAVE_OPENSSL_MD5_H)
+#define OPENSSL_SUPPRESS_DEPRECATED
 #include <openssl/md5.h>
 #else
 #include <md5.h>
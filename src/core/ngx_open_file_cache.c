@@ -21,6 +21,43 @@
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
 
+/*
+ * the shared zone keeps the last stat() result of each name, so a worker
+ * whose entry is older than open_file_cache_valid may revalidate it without
+ * syscalls if another worker has tested the file recently
+ */
+
+typedef struct {
+    ngx_str_node_t           sn;
+    ngx_queue_t              queue;
+
+    time_t                   validated;
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+    off_t                    size;
+    ngx_err_t                err;
+
+#if (NGX_HAVE_OPENAT)
+    size_t                   disable_symlinks_from;
+    unsigned                 disable_symlinks:2;
+#endif
+
+    unsigned                 is_dir:1;
+    unsigned                 is_file:1;
+    unsigned                 is_link:1;
+    unsigned                 is_exec:1;
+
+    u_char                   data[1];
+} ngx_open_file_cache_shared_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+} ngx_open_file_cache_shared_t;
+
+
 static void ngx_open_file_cache_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
 static ngx_fd_t ngx_openat_file_owner(ngx_fd_t at_fd, const u_char *name,
@@ -42,7 +79,16 @@ static void ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 static void ngx_open_file_cleanup(void *data);
 static void ngx_close_cached_file(ngx_open_file_cache_t *cache,
     ngx_cached_open_file_t *file, ngx_uint_t min_uses, ngx_log_t *log);
-static void ngx_open_file_del_event(ngx_cached_open_file_t *file);
+static void ngx_open_file_del_event(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file);
+#if (NGX_HAVE_INOTIFY)
+static void ngx_open_file_add_watch(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file, ngx_log_t *log);
+static ngx_int_t ngx_open_file_inotify_init(ngx_open_file_cache_t *cache,
+    ngx_log_t *log);
+static void ngx_open_file_inotify_handler(ngx_event_t *ev);
+static void ngx_open_file_inotify_close(ngx_open_file_cache_t *cache);
+#endif
 static void ngx_expire_old_cached_files(ngx_open_file_cache_t *cache,
     ngx_uint_t n, ngx_log_t *log);
 static void ngx_open_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
@@ -51,6 +97,15 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+static ngx_int_t ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_open_file_shared_test(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, ngx_cached_open_file_t *file, ngx_open_file_info_t *of,
+    time_t now);
+static void ngx_open_file_shared_update(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, ngx_cached_open_file_t *file);
+static void ngx_open_file_shared_delete(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file);
 
 
 ngx_open_file_cache_t *
@@ -72,6 +127,15 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->shm_zone = NULL;
+
+#if (NGX_HAVE_INOTIFY)
+    cache->inotify = NULL;
+    cache->inotify_failed = 0;
+
+    ngx_rbtree_init(&cache->watches, &cache->watch_sentinel,
+                    ngx_rbtree_insert_value);
+#endif
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -137,6 +201,27 @@ ngx_open_file_cache_cleanup(void *data)
                       "rbtree still is not empty in open file cache");
 
     }
+
+#if (NGX_HAVE_INOTIFY)
+    if (cache->inotify) {
+        ngx_open_file_inotify_close(cache);
+    }
+#endif
+}
+
+
+ngx_int_t
+ngx_open_file_cache_add_zone(ngx_conf_t *cf, ngx_open_file_cache_t *cache,
+    ngx_str_t *name, size_t size, void *tag)
+{
+    cache->shm_zone = ngx_shared_memory_add(cf, name, size, tag);
+    if (cache->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shm_zone->init = ngx_open_file_cache_init_zone;
+
+    return NGX_OK;
 }
 
 
@@ -229,12 +314,18 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
         if (file->use_event
             || (file->event == NULL
+#if (NGX_HAVE_INOTIFY)
+                && !file->watched
+#endif
                 && (of->uniq == 0 || of->uniq == file->uniq)
-                && now - file->created < of->valid
 #if (NGX_HAVE_OPENAT)
                 && of->disable_symlinks == file->disable_symlinks
                 && of->disable_symlinks_from == file->disable_symlinks_from
 #endif
+                && (now - file->created < of->valid
+                    || (cache->shm_zone
+                        && ngx_open_file_shared_test(cache, name, file, of, now)
+                           == NGX_OK))
             ))
         {
             if (file->err == 0) {
@@ -312,6 +403,12 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
                     file->use_event = 1;
                 }
 
+#if (NGX_HAVE_INOTIFY)
+                if (file->watched) {
+                    file->use_event = 1;
+                }
+#endif
+
                 of->is_directio = file->is_directio;
 
                 goto update;
@@ -330,7 +427,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
         if (file->count == 0) {
 
-            ngx_open_file_del_event(file);
+            ngx_open_file_del_event(cache, file);
 
             if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
                 ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
@@ -389,6 +486,9 @@ create:
     file->count = 0;
     file->use_event = 0;
     file->event = NULL;
+#if (NGX_HAVE_INOTIFY)
+    file->watched = 0;
+#endif
 
 add_event:
 
@@ -423,6 +523,10 @@ update:
 
     file->created = now;
 
+    if (cache->shm_zone) {
+        ngx_open_file_shared_update(cache, name, file);
+    }
+
 found:
 
     file->accessed = now;
@@ -956,8 +1060,7 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 {
     ngx_open_file_cache_event_t  *fev;
 
-    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)
-        || !of->events
+    if (!of->events
         || file->event
         || of->fd == NGX_INVALID_FILE
         || file->uses < of->min_uses)
@@ -965,6 +1068,13 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
         return;
     }
 
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+#if (NGX_HAVE_INOTIFY)
+        ngx_open_file_add_watch(cache, file, log);
+#endif
+        return;
+    }
+
     file->use_event = 0;
 
     file->event = ngx_calloc(sizeof(ngx_event_t), log);
@@ -1049,7 +1159,7 @@ ngx_close_cached_file(ngx_open_file_cache_t *cache,
         }
     }
 
-    ngx_open_file_del_event(file);
+    ngx_open_file_del_event(cache, file);
 
     if (file->count) {
         return;
@@ -1075,8 +1185,24 @@ ngx_close_cached_file(ngx_open_file_cache_t *cache,
 
 
 static void
-ngx_open_file_del_event(ngx_cached_open_file_t *file)
+ngx_open_file_del_event(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file)
 {
+#if (NGX_HAVE_INOTIFY)
+    ngx_open_file_cache_event_t  *fev;
+
+    if (file->watched) {
+        fev = cache->inotify->data;
+
+        ngx_rbtree_delete(&cache->watches, &file->watch);
+
+        (void) inotify_rm_watch(fev->fd, (int) file->watch.key);
+
+        file->watched = 0;
+        file->use_event = 0;
+    }
+#endif
+
     if (file->event == NULL) {
         return;
     }
@@ -1091,6 +1217,302 @@ ngx_open_file_del_event(ngx_cached_open_file_t *file)
 }
 
 
+#if (NGX_HAVE_INOTIFY)
+
+static void
+ngx_open_file_add_watch(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file, ngx_log_t *log)
+{
+    int                           wd;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_open_file_cache_event_t  *fev;
+
+    /* the inotify descriptor is not in the cycle files table */
+
+    if (file->watched
+        || cache->inotify_failed
+        || (ngx_event_flags & NGX_USE_FD_EVENT))
+    {
+        return;
+    }
+
+    if (cache->inotify == NULL) {
+        if (ngx_open_file_inotify_init(cache, log) != NGX_OK) {
+            cache->inotify_failed = 1;
+            return;
+        }
+    }
+
+    fev = cache->inotify->data;
+
+    wd = inotify_add_watch(fev->fd, (char *) file->name,
+                           IN_MODIFY|IN_ATTRIB|IN_MOVE_SELF|IN_DELETE_SELF);
+
+    if (wd == -1) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, ngx_errno,
+                       "inotify_add_watch(\"%s\") failed", file->name);
+        return;
+    }
+
+    /* the same file may be already watched under another name */
+
+    node = cache->watches.root;
+    sentinel = cache->watches.sentinel;
+
+    while (node != sentinel) {
+
+        if ((ngx_rbtree_key_t) wd == node->key) {
+            return;
+        }
+
+        node = ((ngx_rbtree_key_t) wd < node->key) ? node->left : node->right;
+    }
+
+    file->watch.key = wd;
+    ngx_rbtree_insert(&cache->watches, &file->watch);
+
+    file->watched = 1;
+
+    /*
+     * as with vnode events, file->use_event is set only after
+     * the next file revalidation
+     */
+
+    file->use_event = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify watch: %s, wd:%d", file->name, wd);
+}
+
+
+static ngx_int_t
+ngx_open_file_inotify_init(ngx_open_file_cache_t *cache, ngx_log_t *log)
+{
+    int                           fd;
+    ngx_event_t                  *rev;
+    ngx_open_file_cache_event_t  *fev;
+
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "inotify_init1() failed");
+        return NGX_ERROR;
+    }
+
+    /* the read and write events, the write one is never used */
+
+    rev = ngx_calloc(2 * sizeof(ngx_event_t), log);
+    if (rev == NULL) {
+        goto failed;
+    }
+
+    fev = ngx_calloc(sizeof(ngx_open_file_cache_event_t), log);
+    if (fev == NULL) {
+        ngx_free(rev);
+        goto failed;
+    }
+
+    fev->read = rev;
+    fev->write = rev + 1;
+    fev->fd = fd;
+    fev->cache = cache;
+
+    rev->data = fev;
+    rev->handler = ngx_open_file_inotify_handler;
+    rev->log = ngx_cycle->log;
+    rev->index = NGX_INVALID_INDEX;
+
+    fev->write->data = fev;
+    fev->write->log = ngx_cycle->log;
+    fev->write->index = NGX_INVALID_INDEX;
+    fev->write->write = 1;
+
+    cache->inotify = rev;
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        cache->inotify = NULL;
+        ngx_free(fev);
+        ngx_free(rev);
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (close(fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "inotify close() failed");
+    }
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_open_file_inotify_handler(ngx_event_t *ev)
+{
+    u_char                       *p, *last;
+    ssize_t                       n;
+    ngx_err_t                     err;
+    ngx_queue_t                  *q;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_open_file_cache_t        *cache;
+    ngx_cached_open_file_t       *file;
+    ngx_open_file_cache_event_t  *fev;
+    struct inotify_event          ie;
+    u_char                        buf[4096];
+
+    fev = ev->data;
+    cache = fev->cache;
+
+    for ( ;; ) {
+
+        n = read(fev->fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err == NGX_EAGAIN) {
+                /* level-triggered methods keep the event if it is not ready */
+                ev->ready = 0;
+
+            } else {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "inotify read() failed");
+            }
+
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        last = buf + n;
+
+        for (p = buf;
+             p + sizeof(struct inotify_event) <= last;
+             p += sizeof(struct inotify_event) + ie.len)
+        {
+            ngx_memcpy(&ie, p, sizeof(struct inotify_event));
+
+            if (ie.mask & IN_Q_OVERFLOW) {
+
+                /*
+                 * the events were lost, so all watched files are
+                 * revalidated with stat() on their next use
+                 */
+
+                ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                              "inotify event queue overflow");
+
+                for (q = ngx_queue_head(&cache->expire_queue);
+                     q != ngx_queue_sentinel(&cache->expire_queue);
+                     q = ngx_queue_next(q))
+                {
+                    file = ngx_queue_data(q, ngx_cached_open_file_t, queue);
+
+                    if (file->watched) {
+                        file->use_event = 0;
+                    }
+                }
+
+                continue;
+            }
+
+            node = cache->watches.root;
+            sentinel = cache->watches.sentinel;
+
+            while (node != sentinel
+                   && node->key != (ngx_rbtree_key_t) ie.wd)
+            {
+                node = ((ngx_rbtree_key_t) ie.wd < node->key) ? node->left
+                                                              : node->right;
+            }
+
+            if (node == sentinel) {
+                continue;
+            }
+
+            file = (ngx_cached_open_file_t *)
+                       ((u_char *) node
+                        - offsetof(ngx_cached_open_file_t, watch));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "inotify event: %s, mask:%08XD",
+                           file->name, ie.mask);
+
+            ngx_rbtree_delete(&cache->watches, node);
+
+            if (!(ie.mask & IN_IGNORED)) {
+                (void) inotify_rm_watch(fev->fd, ie.wd);
+            }
+
+            file->watched = 0;
+            file->use_event = 0;
+
+            if (file->close) {
+                /* the file was already removed from the cache */
+                continue;
+            }
+
+            if (cache->shm_zone) {
+                ngx_open_file_shared_delete(cache, file);
+            }
+
+            ngx_queue_remove(&file->queue);
+
+            ngx_rbtree_delete(&cache->rbtree, &file->node);
+
+            cache->current--;
+
+            file->close = 1;
+
+            ngx_close_cached_file(cache, file, 0, ev->log);
+        }
+    }
+
+    (void) ngx_handle_read_event(ev, 0);
+}
+
+
+static void
+ngx_open_file_inotify_close(ngx_open_file_cache_t *cache)
+{
+    ngx_event_t                  *rev;
+    ngx_open_file_cache_event_t  *fev;
+
+    rev = cache->inotify;
+    fev = rev->data;
+
+    if (rev->active) {
+        (void) ngx_del_event(rev, NGX_READ_EVENT, NGX_CLOSE_EVENT);
+    }
+
+    if (rev->prev) {
+        ngx_delete_posted_event(rev);
+    }
+
+    if (close(fev->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "inotify close() failed");
+    }
+
+    ngx_free(fev);
+    ngx_free(rev);
+
+    cache->inotify = NULL;
+}
+
+#endif
+
+
 static void
 ngx_expire_old_cached_files(ngx_open_file_cache_t *cache, ngx_uint_t n,
     ngx_log_t *log)
@@ -1251,3 +1673,210 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+static ngx_int_t
+ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_cache_shared_t  *osh = data;
+
+    size_t                         len;
+    ngx_slab_pool_t               *shpool;
+    ngx_open_file_cache_shared_t  *sh;
+
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_open_file_cache_shared_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel, ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    len = sizeof(" in open file cache zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in open file cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the least recently tested files are evicted when the zone is full */
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_test(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    ngx_cached_open_file_t *file, ngx_open_file_info_t *of, time_t now)
+{
+    ngx_slab_pool_t                    *shpool;
+    ngx_open_file_cache_shared_t       *sh;
+    ngx_open_file_cache_shared_node_t  *sn;
+
+    sh = cache->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) cache->shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = (ngx_open_file_cache_shared_node_t *)
+             ngx_str_rbtree_lookup(&sh->rbtree, name, file->node.key);
+
+    if (sn == NULL
+        || now - sn->validated >= of->valid
+        || sn->validated < file->created
+        || sn->err != file->err
+#if (NGX_HAVE_OPENAT)
+        || sn->disable_symlinks != file->disable_symlinks
+        || sn->disable_symlinks_from != file->disable_symlinks_from
+#endif
+        || (file->err == 0
+            && (sn->is_dir != file->is_dir || sn->uniq != file->uniq)))
+    {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    /* the file may be changed in place, the descriptor is still valid */
+
+    file->created = sn->validated;
+    file->mtime = sn->mtime;
+    file->size = sn->size;
+    file->is_link = sn->is_link;
+    file->is_exec = sn->is_exec;
+
+    ngx_queue_remove(&sn->queue);
+    ngx_queue_insert_head(&sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file: %s", file->name);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_open_file_shared_update(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    ngx_cached_open_file_t *file)
+{
+    size_t                              size;
+    ngx_queue_t                        *q;
+    ngx_slab_pool_t                    *shpool;
+    ngx_open_file_cache_shared_t       *sh;
+    ngx_open_file_cache_shared_node_t  *sn;
+
+    sh = cache->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) cache->shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = (ngx_open_file_cache_shared_node_t *)
+             ngx_str_rbtree_lookup(&sh->rbtree, name, file->node.key);
+
+    if (sn) {
+        ngx_queue_remove(&sn->queue);
+        goto update;
+    }
+
+    size = offsetof(ngx_open_file_cache_shared_node_t, data) + name->len;
+
+    for ( ;; ) {
+        sn = ngx_slab_alloc_locked(shpool, size);
+        if (sn) {
+            break;
+        }
+
+        if (ngx_queue_empty(&sh->queue)) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+
+        q = ngx_queue_last(&sh->queue);
+        ngx_queue_remove(q);
+
+        sn = ngx_queue_data(q, ngx_open_file_cache_shared_node_t, queue);
+
+        ngx_rbtree_delete(&sh->rbtree, &sn->sn.node);
+        ngx_slab_free_locked(shpool, sn);
+    }
+
+    sn->sn.node.key = file->node.key;
+    sn->sn.str.len = name->len;
+    sn->sn.str.data = sn->data;
+
+    ngx_memcpy(sn->data, name->data, name->len);
+
+    ngx_rbtree_insert(&sh->rbtree, &sn->sn.node);
+
+update:
+
+    sn->validated = file->created;
+    sn->uniq = file->uniq;
+    sn->mtime = file->mtime;
+    sn->size = file->size;
+    sn->err = file->err;
+#if (NGX_HAVE_OPENAT)
+    sn->disable_symlinks = file->disable_symlinks;
+    sn->disable_symlinks_from = file->disable_symlinks_from;
+#endif
+    sn->is_dir = file->is_dir;
+    sn->is_file = file->is_file;
+    sn->is_link = file->is_link;
+    sn->is_exec = file->is_exec;
+
+    ngx_queue_insert_head(&sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static void
+ngx_open_file_shared_delete(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file)
+{
+    ngx_str_t                           name;
+    ngx_slab_pool_t                    *shpool;
+    ngx_open_file_cache_shared_t       *sh;
+    ngx_open_file_cache_shared_node_t  *sn;
+
+    sh = cache->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) cache->shm_zone->shm.addr;
+
+    name.len = ngx_strlen(file->name);
+    name.data = file->name;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = (ngx_open_file_cache_shared_node_t *)
+             ngx_str_rbtree_lookup(&sh->rbtree, &name, file->node.key);
+
+    if (sn) {
+        ngx_rbtree_delete(&sh->rbtree, &sn->sn.node);
+        ngx_queue_remove(&sn->queue);
+        ngx_slab_free_locked(shpool, sn);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
@@ -84,6 +84,13 @@ struct ngx_cached_open_file_s {
     unsigned                 is_exec:1;
     unsigned                 is_directio:1;
 
+#if (NGX_HAVE_INOTIFY)
+    unsigned                 watched:1;
+
+    /* inotify watch descriptor is the key */
+    ngx_rbtree_node_t        watch;
+#endif
+
     ngx_event_t             *event;
 };
 
@@ -96,6 +103,15 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    ngx_shm_zone_t          *shm_zone;
+
+#if (NGX_HAVE_INOTIFY)
+    ngx_event_t             *inotify;
+    ngx_uint_t               inotify_failed;
+    ngx_rbtree_t             watches;
+    ngx_rbtree_node_t        watch_sentinel;
+#endif
 } ngx_open_file_cache_t;                            /*一个打开文件的缓存*/
 
 
@@ -122,6 +138,8 @@ typedef struct {
 
 ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
+ngx_int_t ngx_open_file_cache_add_zone(ngx_conf_t *cf,
+    ngx_open_file_cache_t *cache, ngx_str_t *name, size_t size, void *tag);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
 
@@ -10,17 +10,30 @@
 
 
 typedef struct {
-    ngx_flag_t  pcre_jit;
+    ngx_flag_t   pcre_jit;
+    size_t       pcre_jit_stack_size;
+    ngx_flag_t   pcre_stats;
+    ngx_list_t  *studies;
 } ngx_regex_conf_t;
 
 
+#if (NGX_PCRE2)
+static void * ngx_libc_cdecl ngx_regex_malloc(size_t size, void *data);
+static void ngx_libc_cdecl ngx_regex_free(void *p, void *data);
+#else
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
-#if (NGX_HAVE_PCRE_JIT)
+#endif
+#if (NGX_PCRE2 || NGX_HAVE_PCRE_JIT)
 static void ngx_pcre_free_studies(void *data);
 #endif
 
+static ngx_inline ngx_int_t ngx_regex_match(ngx_regex_t *re, ngx_str_t *s,
+    int *captures, ngx_uint_t size);
+
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
+static ngx_int_t ngx_regex_process_init(ngx_cycle_t *cycle);
+static void ngx_regex_process_exit(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
 static char *ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf);
@@ -38,6 +51,20 @@ static ngx_command_t  ngx_regex_commands[] = {
       offsetof(ngx_regex_conf_t, pcre_jit),
       &ngx_regex_pcre_jit_post },
 
+    { ngx_string("pcre_jit_stack_size"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_regex_conf_t, pcre_jit_stack_size),
+      NULL },
+
+    { ngx_string("pcre_stats"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_regex_conf_t, pcre_stats),
+      NULL },
+
       ngx_null_command
 };
 
@@ -56,10 +83,10 @@ ngx_module_t  ngx_regex_module = {
     NGX_CORE_MODULE,                       /* module type */
     NULL,                                  /* init master */
     ngx_regex_module_init,                 /* init module */
-    NULL,                                  /* init process */
+    ngx_regex_process_init,                /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_regex_process_exit,                /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -67,13 +94,34 @@ ngx_module_t  ngx_regex_module = {
 
 static ngx_pool_t  *ngx_pcre_pool;
 static ngx_list_t  *ngx_pcre_studies;
+static ngx_uint_t   ngx_regex_stats;
+
+#if (NGX_PCRE2)
+
+/*
+ * the match data and the JIT stack are per process and are reused
+ * by all matches, the match data grows to the largest ovector used
+ */
+
+static pcre2_match_data     *ngx_regex_match_data;
+static ngx_uint_t            ngx_regex_match_data_size;
+static pcre2_match_context  *ngx_regex_match_context;
+static pcre2_jit_stack      *ngx_regex_jit_stack;
+
+#elif (NGX_HAVE_PCRE_JIT)
+
+static pcre_jit_stack       *ngx_regex_jit_stack;
+
+#endif
 
 
 void
 ngx_regex_init(void)
 {
+#if !(NGX_PCRE2)
     pcre_malloc = ngx_regex_malloc;
     pcre_free = ngx_regex_free;
+#endif
 }
 
 
@@ -113,18 +161,220 @@ ngx_regex_malloc_done(void)
 }
 
 
+#if (NGX_PCRE2)
+
+ngx_int_t
+ngx_regex_compile(ngx_regex_compile_t *rc)
+{
+    int                     n, errcode;
+    char                   *p;
+    u_char                  errstr[128];
+    size_t                  erroff;
+    uint32_t                options;
+    pcre2_code             *re;
+    ngx_regex_elt_t        *elt;
+    pcre2_general_context  *gctx;
+    pcre2_compile_context  *cctx;
+
+    options = 0;
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        options |= PCRE2_CASELESS;
+    }
+
+    ngx_regex_malloc_init(rc->pool);
+
+    gctx = pcre2_general_context_create(ngx_regex_malloc, ngx_regex_free,
+                                        NULL);
+    if (gctx == NULL) {
+        ngx_regex_malloc_done();
+        goto nomem;
+    }
+
+    cctx = pcre2_compile_context_create(gctx);
+    if (cctx == NULL) {
+        ngx_regex_malloc_done();
+        goto nomem;
+    }
+
+    re = pcre2_compile(rc->pattern.data, rc->pattern.len, options,
+                       &errcode, &erroff, cctx);
+
+    /* ensure that there is no current pool */
+    ngx_regex_malloc_done();
+
+    if (re == NULL) {
+        pcre2_get_error_message(errcode, errstr, 128);
+
+        if ((size_t) erroff == rc->pattern.len) {
+            rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                              "pcre2_compile() failed: %s in \"%V\"",
+                               errstr, &rc->pattern)
+                      - rc->err.data;
+
+        } else {
+            rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                              "pcre2_compile() failed: %s in \"%V\" at \"%s\"",
+                               errstr, &rc->pattern, rc->pattern.data + erroff)
+                      - rc->err.data;
+        }
+
+        return NGX_ERROR;
+    }
+
+    rc->regex = ngx_pcalloc(rc->pool, sizeof(ngx_regex_t));
+    if (rc->regex == NULL) {
+        goto nomem;
+    }
+
+    rc->regex->code = re;
+
+    /* the pattern may point to the configuration file buffer */
+
+    rc->regex->name = ngx_pnalloc(rc->pool, rc->pattern.len + 1);
+    if (rc->regex->name == NULL) {
+        goto nomem;
+    }
+
+    ngx_cpystrn(rc->regex->name, rc->pattern.data, rc->pattern.len + 1);
+
+    /* JIT compile at module init, not at runtime */
+
+    if (ngx_pcre_studies != NULL) {
+        elt = ngx_list_push(ngx_pcre_studies);
+        if (elt == NULL) {
+            goto nomem;
+        }
+
+        elt->regex = rc->regex;
+        elt->name = rc->regex->name;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &rc->captures);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_CAPTURECOUNT) failed: %d";
+        goto failed;
+    }
+
+    if (rc->captures == 0) {
+        return NGX_OK;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMECOUNT, &rc->named_captures);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMECOUNT) failed: %d";
+        goto failed;
+    }
+
+    if (rc->named_captures == 0) {
+        return NGX_OK;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMEENTRYSIZE, &rc->name_size);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMEENTRYSIZE) failed: %d";
+        goto failed;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMETABLE, &rc->names);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMETABLE) failed: %d";
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len, p, &rc->pattern, n)
+                  - rc->err.data;
+    return NGX_ERROR;
+
+nomem:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                               "regex \"%V\" compilation failed: no memory",
+                               &rc->pattern)
+                  - rc->err.data;
+    return NGX_ERROR;
+}
+
+
+static ngx_inline ngx_int_t
+ngx_regex_match(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    int          rc;
+    size_t      *ov;
+    ngx_uint_t   n, i;
+
+    /*
+     * the match data is created once per process and grows only when
+     * a regex with more captures than the current one is matched
+     */
+
+    if (ngx_regex_match_data == NULL || size > ngx_regex_match_data_size) {
+
+        if (ngx_regex_match_data) {
+            pcre2_match_data_free(ngx_regex_match_data);
+        }
+
+        ngx_regex_match_data_size = size;
+        ngx_regex_match_data = pcre2_match_data_create(size / 3, NULL);
+
+        if (ngx_regex_match_data == NULL) {
+            ngx_regex_match_data_size = 0;
+            return PCRE2_ERROR_NOMEMORY;
+        }
+    }
+
+    rc = pcre2_match(re->code, s->data, s->len, 0, 0, ngx_regex_match_data,
+                     ngx_regex_match_context);
+
+    if (rc < 0) {
+        return rc;
+    }
+
+    n = pcre2_get_ovector_count(ngx_regex_match_data);
+    ov = pcre2_get_ovector_pointer(ngx_regex_match_data);
+
+    if (n > size / 3) {
+        n = size / 3;
+    }
+
+    for (i = 0; i < n; i++) {
+        captures[i * 2] = ov[i * 2];
+        captures[i * 2 + 1] = ov[i * 2 + 1];
+    }
+
+    /* pcre_exec() returns 0 if the ovector is too small */
+
+    if ((ngx_uint_t) rc > size / 3) {
+        rc = 0;
+    }
+
+    return rc;
+}
+
+#else
+
 ngx_int_t
 ngx_regex_compile(ngx_regex_compile_t *rc)
 {
-    int               n, erroff;
+    int               n, erroff, options;
     char             *p;
     pcre             *re;
     const char       *errstr;
     ngx_regex_elt_t  *elt;
 
+    options = 0;
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        options |= PCRE_CASELESS;
+    }
+
     ngx_regex_malloc_init(rc->pool);
 
-    re = pcre_compile((const char *) rc->pattern.data, (int) rc->options,
+    re = pcre_compile((const char *) rc->pattern.data, options,
                       &errstr, &erroff, NULL);
 
     /* ensure that there is no current pool */
@@ -154,6 +404,15 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
 
     rc->regex->code = re;
 
+    /* the pattern may point to the configuration file buffer */
+
+    rc->regex->name = ngx_pnalloc(rc->pool, rc->pattern.len + 1);
+    if (rc->regex->name == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_cpystrn(rc->regex->name, rc->pattern.data, rc->pattern.len + 1);
+
     /* do not study at runtime */
 
     if (ngx_pcre_studies != NULL) {
@@ -163,7 +422,7 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
         }
 
         elt->regex = rc->regex;
-        elt->name = rc->pattern.data;
+        elt->name = rc->regex->name;
     }
 
     n = pcre_fullinfo(re, NULL, PCRE_INFO_CAPTURECOUNT, &rc->captures);
@@ -208,6 +467,50 @@ failed:
 }
 
 
+static ngx_inline ngx_int_t
+ngx_regex_match(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    return pcre_exec(re->code, re->extra, (const char *) s->data, s->len, 0, 0,
+                     captures, size);
+}
+
+#endif
+
+
+ngx_int_t
+ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    ngx_int_t       rc;
+    ngx_uint_t      us;
+    struct timeval  tv;
+
+    if (!ngx_regex_stats) {
+        return ngx_regex_match(re, s, captures, size);
+    }
+
+    ngx_gettimeofday(&tv);
+    us = tv.tv_sec * 1000000 + tv.tv_usec;
+
+    rc = ngx_regex_match(re, s, captures, size);
+
+    ngx_gettimeofday(&tv);
+    us = tv.tv_sec * 1000000 + tv.tv_usec - us;
+
+    re->calls++;
+    re->time += us;
+
+    if (us > re->max_time) {
+        re->max_time = us;
+    }
+
+    if (rc >= 0) {
+        re->matches++;
+    }
+
+    return rc;
+}
+
+
 ngx_int_t
 ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 {
@@ -241,8 +544,17 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+#if (NGX_PCRE2)
+
+static void * ngx_libc_cdecl
+ngx_regex_malloc(size_t size, void *data)
+
+#else
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
+
+#endif
 {
     ngx_pool_t      *pool;
 #if (NGX_THREADS)
@@ -270,14 +582,23 @@ ngx_regex_malloc(size_t size)
 }
 
 
+#if (NGX_PCRE2)
+
+static void ngx_libc_cdecl
+ngx_regex_free(void *p, void *data)
+
+#else
+
 static void ngx_libc_cdecl
 ngx_regex_free(void *p)
+
+#endif
 {
     return;
 }
 
 
-#if (NGX_HAVE_PCRE_JIT)
+#if (NGX_PCRE2 || NGX_HAVE_PCRE_JIT)
 
 static void
 ngx_pcre_free_studies(void *data)
@@ -303,9 +624,15 @@ ngx_pcre_free_studies(void *data)
             i = 0;
         }
 
+#if (NGX_PCRE2)
+        if (elts[i].regex->code != NULL) {
+            pcre2_code_free(elts[i].regex->code);
+        }
+#else
         if (elts[i].regex->extra != NULL) {
             pcre_free_study(elts[i].regex->extra);
         }
+#endif
     }
 }
 
@@ -315,21 +642,48 @@ ngx_pcre_free_studies(void *data)
 static ngx_int_t
 ngx_regex_module_init(ngx_cycle_t *cycle)
 {
-    int               opt;
-    const char       *errstr;
-    ngx_uint_t        i;
-    ngx_list_part_t  *part;
-    ngx_regex_elt_t  *elts;
-
-    opt = 0;
-
-#if (NGX_HAVE_PCRE_JIT)
-    {
+    int                  opt;
+    ngx_uint_t           i;
+    ngx_list_part_t     *part;
+    ngx_regex_elt_t     *elts;
     ngx_regex_conf_t    *rcf;
+#if !(NGX_PCRE2)
+    const char          *errstr;
+#endif
+#if (NGX_PCRE2 || NGX_HAVE_PCRE_JIT)
     ngx_pool_cleanup_t  *cln;
+#endif
+
+    opt = 0;
 
     rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
 
+    ngx_regex_stats = rcf->pcre_stats;
+
+    /* keep the list for the worker processes */
+    rcf->studies = ngx_pcre_studies;
+
+#if (NGX_PCRE2)
+
+    if (rcf->pcre_jit) {
+        opt = 1;
+
+        /*
+         * The JIT codes are mmap()ed by the library, so the compiled
+         * patterns have to be freed explicitly with pcre2_code_free().
+         */
+
+        cln = ngx_pool_cleanup_add(cycle->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_pcre_free_studies;
+        cln->data = ngx_pcre_studies;
+    }
+
+#elif (NGX_HAVE_PCRE_JIT)
+
     if (rcf->pcre_jit) {
         opt = PCRE_STUDY_JIT_COMPILE;
 
@@ -347,7 +701,7 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
         cln->handler = ngx_pcre_free_studies;
         cln->data = ngx_pcre_studies;
     }
-    }
+
 #endif
 
     ngx_regex_malloc_init(cycle->pool);
@@ -367,6 +721,30 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
             i = 0;
         }
 
+#if (NGX_PCRE2)
+
+        if (opt) {
+            int     n;
+            size_t  jitsize;
+
+            n = pcre2_jit_compile(elts[i].regex->code, PCRE2_JIT_COMPLETE);
+
+            jitsize = 0;
+
+            if (n == 0) {
+                n = pcre2_pattern_info(elts[i].regex->code,
+                                       PCRE2_INFO_JITSIZE, &jitsize);
+            }
+
+            if (n != 0 || jitsize == 0) {
+                ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                              "JIT compiler does not support pattern: \"%s\"",
+                              elts[i].name);
+            }
+        }
+
+#else
+
         elts[i].regex->extra = pcre_study(elts[i].regex->code, opt, &errstr);
 
         if (errstr != NULL) {
@@ -389,6 +767,8 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
                               elts[i].name);
             }
         }
+#endif
+
 #endif
     }
 
@@ -400,6 +780,161 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
 }
 
 
+static ngx_int_t
+ngx_regex_process_init(ngx_cycle_t *cycle)
+{
+#if (NGX_HAVE_PCRE_JIT)
+    ngx_regex_conf_t  *rcf;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    if (!rcf->pcre_jit || rcf->pcre_jit_stack_size == 0) {
+        return NGX_OK;
+    }
+
+    /*
+     * the default JIT stack of 32K is allocated on the machine stack,
+     * a larger one is allocated once per worker and shared by all regexes
+     */
+
+#if (NGX_PCRE2)
+
+    ngx_regex_jit_stack = pcre2_jit_stack_create(32 * 1024,
+                                                 rcf->pcre_jit_stack_size,
+                                                 NULL);
+    if (ngx_regex_jit_stack == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "pcre2_jit_stack_create(%uz) failed",
+                      rcf->pcre_jit_stack_size);
+        return NGX_OK;
+    }
+
+    ngx_regex_match_context = pcre2_match_context_create(NULL);
+    if (ngx_regex_match_context == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "pcre2_match_context_create() failed");
+        return NGX_OK;
+    }
+
+    pcre2_jit_stack_assign(ngx_regex_match_context, NULL, ngx_regex_jit_stack);
+
+#else
+
+    {
+    ngx_uint_t         i;
+    ngx_list_part_t   *part;
+    ngx_regex_elt_t   *elts;
+
+    ngx_regex_jit_stack = pcre_jit_stack_alloc(32 * 1024,
+                                               rcf->pcre_jit_stack_size);
+    if (ngx_regex_jit_stack == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "pcre_jit_stack_alloc(%uz) failed",
+                      rcf->pcre_jit_stack_size);
+        return NGX_OK;
+    }
+
+    part = &rcf->studies->part;
+    elts = part->elts;
+
+    for (i = 0 ; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            elts = part->elts;
+            i = 0;
+        }
+
+        if (elts[i].regex->extra != NULL) {
+            pcre_assign_jit_stack(elts[i].regex->extra, NULL,
+                                  ngx_regex_jit_stack);
+        }
+    }
+    }
+
+#endif
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_regex_process_exit(ngx_cycle_t *cycle)
+{
+    ngx_uint_t         i;
+    ngx_list_part_t   *part;
+    ngx_regex_t       *re;
+    ngx_regex_elt_t   *elts;
+    ngx_regex_conf_t  *rcf;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    if (rcf->pcre_stats && rcf->studies) {
+
+        part = &rcf->studies->part;
+        elts = part->elts;
+
+        for (i = 0 ; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                elts = part->elts;
+                i = 0;
+            }
+
+            re = elts[i].regex;
+
+            if (re->calls == 0) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "regex \"%s\": %ui calls, %ui matches, "
+                          "%ui us total, %ui us max",
+                          re->name, re->calls, re->matches,
+                          re->time, re->max_time);
+        }
+    }
+
+#if (NGX_PCRE2)
+
+    if (ngx_regex_match_data) {
+        pcre2_match_data_free(ngx_regex_match_data);
+        ngx_regex_match_data = NULL;
+        ngx_regex_match_data_size = 0;
+    }
+
+    if (ngx_regex_match_context) {
+        pcre2_match_context_free(ngx_regex_match_context);
+        ngx_regex_match_context = NULL;
+    }
+
+    if (ngx_regex_jit_stack) {
+        pcre2_jit_stack_free(ngx_regex_jit_stack);
+        ngx_regex_jit_stack = NULL;
+    }
+
+#elif (NGX_HAVE_PCRE_JIT)
+
+    if (ngx_regex_jit_stack) {
+        pcre_jit_stack_free(ngx_regex_jit_stack);
+        ngx_regex_jit_stack = NULL;
+    }
+
+#endif
+}
+
+
 static void *
 ngx_regex_create_conf(ngx_cycle_t *cycle)
 {
@@ -411,6 +946,8 @@ ngx_regex_create_conf(ngx_cycle_t *cycle)
     }
 
     rcf->pcre_jit = NGX_CONF_UNSET;
+    rcf->pcre_jit_stack_size = NGX_CONF_UNSET_SIZE;
+    rcf->pcre_stats = NGX_CONF_UNSET;
 
     ngx_pcre_studies = ngx_list_create(cycle->pool, 8, sizeof(ngx_regex_elt_t));
     if (ngx_pcre_studies == NULL) {
@@ -427,6 +964,8 @@ ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_regex_conf_t *rcf = conf;
 
     ngx_conf_init_value(rcf->pcre_jit, 0);
+    ngx_conf_init_size_value(rcf->pcre_jit_stack_size, 0);
+    ngx_conf_init_value(rcf->pcre_stats, 0);
 
     return NGX_CONF_OK;
 }
@@ -446,7 +985,12 @@ ngx_regex_pcre_jit(ngx_conf_t *cf, void *post, void *data)
     int  jit, r;
 
     jit = 0;
+#if (NGX_PCRE2)
+    r = pcre2_config(PCRE2_CONFIG_JIT, &jit);
+    r = (r < 0) ? r : 0;
+#else
     r = pcre_config(PCRE_CONFIG_JIT, &jit);
+#endif
 
     if (r != 0 || jit != 1) {
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
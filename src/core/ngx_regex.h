@@ -12,17 +12,41 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
-#include <pcre.h>
 
+#if (NGX_PCRE2)
+
+#define PCRE2_CODE_UNIT_WIDTH  8
+#include <pcre2.h>
+
+#define NGX_REGEX_NO_MATCHED  PCRE2_ERROR_NOMATCH  /* -1 */
+
+#else
+
+#include <pcre.h>
 
 #define NGX_REGEX_NO_MATCHED  PCRE_ERROR_NOMATCH   /* -1 */
 
-#define NGX_REGEX_CASELESS    PCRE_CASELESS
+#endif
+
+
+#define NGX_REGEX_CASELESS    0x00000001
 
 
 typedef struct {
+#if (NGX_PCRE2)
+    pcre2_code  *code;
+#else
     pcre        *code;
     pcre_extra  *extra;
+#endif
+
+    u_char      *name;
+
+    /* the pcre_stats counters, the times are in microseconds */
+    ngx_uint_t   calls;
+    ngx_uint_t   matches;
+    ngx_uint_t   time;
+    ngx_uint_t   max_time;
 } ngx_regex_t;
 
 
@@ -49,10 +73,14 @@ typedef struct {
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
-#define ngx_regex_exec(re, s, captures, size)                                \
-    pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
-              captures, size)
+ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures,
+    ngx_uint_t size);
+
+#if (NGX_PCRE2)
+#define ngx_regex_exec_n      "pcre2_match()"
+#else
 #define ngx_regex_exec_n      "pcre_exec()"
+#endif
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
@@ -8,10 +8,16 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#include <ngx_event_connect.h>
 
 
 #define NGX_RESOLVER_UDP_SIZE   4096
 
+#define NGX_RESOLVER_TC         0x0200
+
+/* the truncated responses queried again over TCP at once */
+#define NGX_RESOLVER_TCP_MAX    32
+
 
 typedef struct {
     u_char  ident_hi;
@@ -48,6 +54,41 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+typedef struct {
+    ngx_str_node_t          sn;
+    ngx_queue_t             queue;
+    time_t                  valid;
+    u_short                 naddrs;
+    u_short                 naddrs6;
+    u_short                 cnlen;
+    u_char                  data[1];
+} ngx_resolver_shared_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t            rbtree;
+    ngx_rbtree_node_t       sentinel;
+    ngx_queue_t             queue;
+} ngx_resolver_shared_t;
+
+
+typedef struct {
+    ngx_resolver_t         *resolver;
+    ngx_queue_t             queue;
+    ngx_peer_connection_t   peer;
+    ngx_log_t               log;
+
+    u_char                 *query;
+    size_t                  qlen;
+    size_t                  sent;
+
+    u_char                  hdr[2];
+    u_char                 *buf;
+    size_t                  len;
+    size_t                  received;
+} ngx_resolver_tcp_t;
+
+
 ngx_int_t ngx_udp_connect(ngx_udp_connection_t *uc);
 
 
@@ -59,8 +100,12 @@ static void ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree,
     ngx_queue_t *queue);
 static ngx_int_t ngx_resolver_send_query(ngx_resolver_t *r,
     ngx_resolver_node_t *rn);
+static ngx_int_t ngx_resolver_send_udp_query(ngx_resolver_t *r,
+    ngx_udp_connection_t *uc, ngx_resolver_node_t *rn);
 static ngx_int_t ngx_resolver_create_name_query(ngx_resolver_node_t *rn,
     ngx_resolver_ctx_t *ctx);
+static ngx_int_t ngx_resolver_create_srv_query(ngx_resolver_node_t *rn,
+    ngx_resolver_ctx_t *ctx);
 static ngx_int_t ngx_resolver_create_addr_query(ngx_resolver_node_t *rn,
     ngx_resolver_ctx_t *ctx);
 static void ngx_resolver_resend_handler(ngx_event_t *ev);
@@ -68,20 +113,44 @@ static time_t ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree,
     ngx_queue_t *queue);
 static void ngx_resolver_read_response(ngx_event_t *rev);
 static void ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf,
-    size_t n);
+    size_t n, ngx_udp_connection_t *uc);
 static void ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
     ngx_uint_t ident, ngx_uint_t code, ngx_uint_t qtype,
     ngx_uint_t nan, ngx_uint_t ans);
 static void ngx_resolver_process_ptr(ngx_resolver_t *r, u_char *buf, size_t n,
     ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan);
+static void ngx_resolver_process_srv(ngx_resolver_t *r, u_char *buf, size_t n,
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan, ngx_uint_t ans);
+static ngx_int_t ngx_resolver_cmp_srvs(const void *one, const void *two);
+static void ngx_resolver_tcp_query(ngx_resolver_t *r, ngx_udp_connection_t *uc,
+    u_char *buf, size_t n);
+static u_char *ngx_resolver_tcp_pending(ngx_resolver_t *r, ngx_queue_t *queue,
+    u_char *buf, size_t n);
+static ngx_uint_t ngx_resolver_tcp_match(u_char *query, u_char *buf,
+    size_t n);
+static void ngx_resolver_tcp_write_handler(ngx_event_t *wev);
+static void ngx_resolver_tcp_read_handler(ngx_event_t *rev);
+static void ngx_resolver_tcp_close(ngx_resolver_tcp_t *tcp);
+static ngx_int_t ngx_resolver_shared_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_resolver_shared_get(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_shared_set(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
 static ngx_resolver_node_t *ngx_resolver_lookup_name(ngx_resolver_t *r,
     ngx_str_t *name, uint32_t hash);
+static ngx_resolver_node_t *ngx_resolver_lookup_srv(ngx_resolver_t *r,
+    ngx_str_t *name, uint32_t hash);
+static ngx_resolver_node_t *ngx_resolver_lookup_node(ngx_rbtree_t *tree,
+    ngx_str_t *name, uint32_t hash);
 static ngx_resolver_node_t *ngx_resolver_lookup_addr(ngx_resolver_t *r,
     in_addr_t addr);
 static void ngx_resolver_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static ngx_int_t ngx_resolver_copy(ngx_resolver_t *r, ngx_str_t *name,
     u_char *buf, u_char *src, u_char *last);
+static ngx_uint_t ngx_resolver_parallel_wait(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_uint_t qtype, ngx_uint_t code);
 static void ngx_resolver_timeout_handler(ngx_event_t *ev);
 static void ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn);
 static void *ngx_resolver_alloc(ngx_resolver_t *r, size_t size);
@@ -104,7 +173,9 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t              s;
+    u_char                *p;
+    ssize_t                size;
+    ngx_str_t              s, name;
     ngx_url_t              u;
     ngx_uint_t             i, j;
     ngx_resolver_t        *r;
@@ -142,6 +213,14 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     ngx_queue_init(&r->name_expire_queue);
     ngx_queue_init(&r->addr_expire_queue);
 
+    ngx_rbtree_init(&r->srv_rbtree, &r->srv_sentinel,
+                    ngx_resolver_rbtree_insert_value);
+
+    ngx_queue_init(&r->srv_resend_queue);
+    ngx_queue_init(&r->srv_expire_queue);
+
+    ngx_queue_init(&r->tcp_queue);
+
 #if (NGX_HAVE_INET6)
     r->ipv6 = 1;
 
@@ -190,6 +269,65 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+
+            name.data = names[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL || p == name.data) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = names[i].data + names[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &names[i]);
+                return NULL;
+            }
+
+            r->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                                &ngx_core_module);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            r->shm_zone->init = ngx_resolver_shared_init;
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "parallel=", 9) == 0) {
+
+            if (ngx_strcmp(&names[i].data[9], "on") == 0) {
+                r->parallel = 1;
+
+            } else if (ngx_strcmp(&names[i].data[9], "off") == 0) {
+                r->parallel = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv6=", 5) == 0) {
 
@@ -248,6 +386,8 @@ ngx_resolver_cleanup(void *data)
     ngx_resolver_t  *r = data;
 
     ngx_uint_t             i;
+    ngx_queue_t           *q;
+    ngx_resolver_tcp_t    *tcp;
     ngx_udp_connection_t  *uc;
 
     if (r) {
@@ -262,6 +402,15 @@ ngx_resolver_cleanup(void *data)
         ngx_resolver_cleanup_tree(r, &r->addr6_rbtree);
 #endif
 
+        ngx_resolver_cleanup_tree(r, &r->srv_rbtree);
+
+        while (!ngx_queue_empty(&r->tcp_queue)) {
+            q = ngx_queue_head(&r->tcp_queue);
+            tcp = ngx_queue_data(q, ngx_resolver_tcp_t, queue);
+
+            ngx_resolver_tcp_close(tcp);
+        }
+
         if (r->event) {
             ngx_free(r->event);
         }
@@ -625,10 +774,15 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->nsrvs = 0;
 
         ngx_rbtree_insert(&r->name_rbtree, &rn->node);
     }
 
+    if (r->shm_zone && ngx_resolver_shared_get(r, rn) == NGX_OK) {
+        return ngx_resolve_name_locked(r, ctx);
+    }
+
     rc = ngx_resolver_create_name_query(rn, ctx);
 
     if (rc == NGX_ERROR) {
@@ -652,6 +806,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
     rn->naddrs6 = r->ipv6 ? (u_short) -1 : 0;
 #endif
+    rn->failed = 0;
 
     if (ngx_resolver_send_query(r, rn) != NGX_OK) {
         goto failed;
@@ -834,6 +989,7 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->nsrvs = 0;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
@@ -846,6 +1002,7 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
     rn->naddrs6 = (u_short) -1;
 #endif
+    rn->failed = 0;
 
     if (ngx_resolver_send_query(r, rn) != NGX_OK) {
         goto failed;
@@ -1014,964 +1171,2168 @@ done:
 }
 
 
-static void
-ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
+ngx_int_t
+ngx_resolve_srv(ngx_resolver_ctx_t *ctx)
 {
-    time_t                now;
-    ngx_uint_t            i;
-    ngx_queue_t          *q;
+    uint32_t              hash;
+    ngx_int_t             rc;
+    ngx_resolver_t       *r;
     ngx_resolver_node_t  *rn;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver expire");
+    r = ctx->resolver;
 
-    now = ngx_time();
+    if (ctx->name.len > 0 && ctx->name.data[ctx->name.len - 1] == '.') {
+        ctx->name.len--;
+    }
 
-    for (i = 0; i < 2; i++) {
-        if (ngx_queue_empty(queue)) {
-            return;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve srv: \"%V\"", &ctx->name);
 
-        q = ngx_queue_last(queue);
+    ngx_strlow(ctx->name.data, ctx->name.data, ctx->name.len);
 
-        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
+    hash = ngx_crc32_short(ctx->name.data, ctx->name.len);
 
-        if (now <= rn->expire) {
-            return;
-        }
+    /* lock srv mutex */
 
-        ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
-                       "resolver expire \"%*s\"", (size_t) rn->nlen, rn->name);
+    rn = ngx_resolver_lookup_srv(r, &ctx->name, hash);
 
-        ngx_queue_remove(q);
+    if (rn) {
 
-        ngx_rbtree_delete(tree, &rn->node);
+        if (rn->valid >= ngx_time()) {
 
-        ngx_resolver_free_node(r, rn);
-    }
-}
+            ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
+            ngx_queue_remove(&rn->queue);
 
-static ngx_int_t
-ngx_resolver_send_query(ngx_resolver_t *r, ngx_resolver_node_t *rn)
-{
-    ssize_t                n;
-    ngx_udp_connection_t  *uc;
+            rn->expire = ngx_time() + r->expire;
 
-    uc = r->udp_connections.elts;
+            ngx_queue_insert_head(&r->srv_expire_queue, &rn->queue);
 
-    uc = &uc[r->last_connection++];
-    if (r->last_connection == r->udp_connections.nelts) {
-        r->last_connection = 0;
-    }
+            /* unlock srv mutex */
 
-    if (uc->connection == NULL) {
+            ctx->state = NGX_OK;
+            ctx->nsrvs = rn->nsrvs;
+            ctx->srvs = rn->u.srvs;
 
-        uc->log = *r->log;
-        uc->log.handler = ngx_resolver_log_error;
-        uc->log.data = uc;
-        uc->log.action = "resolving";
+            ctx->handler(ctx);
 
-        if (ngx_udp_connect(uc) != NGX_OK) {
-            return NGX_ERROR;
+            return NGX_OK;
         }
 
-        uc->connection->data = r;
-        uc->connection->read->handler = ngx_resolver_read_response;
-        uc->connection->read->resolver = 1;
-    }
+        if (rn->waiting) {
 
-    if (rn->naddrs == (u_short) -1) {
-        n = ngx_send(uc->connection, rn->query, rn->qlen);
+            ctx->next = rn->waiting;
+            rn->waiting = ctx;
+            ctx->state = NGX_AGAIN;
 
-        if (n == -1) {
-            return NGX_ERROR;
-        }
+            /* unlock srv mutex */
 
-        if ((size_t) n != (size_t) rn->qlen) {
-            ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
-            return NGX_ERROR;
+            return NGX_OK;
         }
-    }
 
-#if (NGX_HAVE_INET6)
-    if (rn->query6 && rn->naddrs6 == (u_short) -1) {
-        n = ngx_send(uc->connection, rn->query6, rn->qlen);
+        ngx_queue_remove(&rn->queue);
 
-        if (n == -1) {
-            return NGX_ERROR;
+        /* lock alloc mutex */
+
+        if (rn->query) {
+            ngx_resolver_free_locked(r, rn->query);
+            rn->query = NULL;
+#if (NGX_HAVE_INET6)
+            rn->query6 = NULL;
+#endif
         }
 
-        if ((size_t) n != (size_t) rn->qlen) {
-            ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
-            return NGX_ERROR;
+        if (rn->nsrvs) {
+            while (rn->nsrvs) {
+                ngx_resolver_free_locked(r, rn->u.srvs[--rn->nsrvs].name.data);
+            }
+
+            ngx_resolver_free_locked(r, rn->u.srvs);
         }
-    }
-#endif
 
-    return NGX_OK;
-}
+        /* unlock alloc mutex */
 
+    } else {
 
-static void
-ngx_resolver_resend_handler(ngx_event_t *ev)
-{
-    time_t           timer, atimer, ntimer;
+        rn = ngx_resolver_alloc(r, sizeof(ngx_resolver_node_t));
+        if (rn == NULL) {
+            goto failed;
+        }
+
+        rn->name = ngx_resolver_dup(r, ctx->name.data, ctx->name.len);
+        if (rn->name == NULL) {
+            ngx_resolver_free(r, rn);
+            rn = NULL;
+            goto failed;
+        }
+
+        rn->node.key = hash;
+        rn->nlen = (u_short) ctx->name.len;
+        rn->query = NULL;
 #if (NGX_HAVE_INET6)
-    time_t           a6timer;
+        rn->query6 = NULL;
 #endif
-    ngx_resolver_t  *r;
+        rn->nsrvs = 0;
 
-    r = ev->data;
+        ngx_rbtree_insert(&r->srv_rbtree, &rn->node);
+    }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0,
-                   "resolver resend handler");
+    rc = ngx_resolver_create_srv_query(rn, ctx);
 
-    /* lock name mutex */
+    if (rc == NGX_ERROR) {
+        goto failed;
+    }
 
-    ntimer = ngx_resolver_resend(r, &r->name_rbtree, &r->name_resend_queue);
+    if (rc == NGX_DECLINED) {
+        ngx_rbtree_delete(&r->srv_rbtree, &rn->node);
 
-    /* unlock name mutex */
+        ngx_resolver_free(r, rn->query);
+        ngx_resolver_free(r, rn->name);
+        ngx_resolver_free(r, rn);
 
-    /* lock addr mutex */
+        /* unlock srv mutex */
 
-    atimer = ngx_resolver_resend(r, &r->addr_rbtree, &r->addr_resend_queue);
+        ctx->state = NGX_RESOLVE_NXDOMAIN;
+        ctx->handler(ctx);
 
-    /* unlock addr mutex */
+        return NGX_OK;
+    }
 
+    rn->naddrs = (u_short) -1;
 #if (NGX_HAVE_INET6)
+    rn->naddrs6 = 0;
+#endif
+    rn->failed = 0;
 
-    /* lock addr6 mutex */
-
-    a6timer = ngx_resolver_resend(r, &r->addr6_rbtree, &r->addr6_resend_queue);
-
-    /* unlock addr6 mutex */
+    if (ngx_resolver_send_query(r, rn) != NGX_OK) {
+        goto failed;
+    }
 
-#endif
+    if (ctx->event == NULL) {
+        ctx->event = ngx_resolver_calloc(r, sizeof(ngx_event_t));
+        if (ctx->event == NULL) {
+            goto failed;
+        }
 
-    timer = ntimer;
+        ctx->event->handler = ngx_resolver_timeout_handler;
+        ctx->event->data = rn;
+        ctx->event->log = r->log;
+        ctx->ident = -1;
 
-    if (timer == 0) {
-        timer = atimer;
+        ngx_add_timer(ctx->event, ctx->timeout);
+    }
 
-    } else if (atimer) {
-        timer = ngx_min(timer, atimer);
+    if (ngx_queue_empty(&r->srv_resend_queue)) {
+        ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
     }
 
-#if (NGX_HAVE_INET6)
+    rn->expire = ngx_time() + r->resend_timeout;
 
-    if (timer == 0) {
-        timer = a6timer;
+    ngx_queue_insert_head(&r->srv_resend_queue, &rn->queue);
 
-    } else if (a6timer) {
-        timer = ngx_min(timer, a6timer);
-    }
+    rn->code = 0;
+    rn->cnlen = 0;
+    rn->valid = 0;
+    rn->ttl = NGX_MAX_UINT32_VALUE;
+    rn->waiting = ctx;
 
-#endif
+    /* unlock srv mutex */
 
-    if (timer) {
-        ngx_add_timer(r->event, (ngx_msec_t) (timer * 1000));
-    }
-}
+    ctx->state = NGX_AGAIN;
 
+    return NGX_OK;
 
-static time_t
-ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
-{
-    time_t                now;
-    ngx_queue_t          *q;
-    ngx_resolver_node_t  *rn;
+failed:
 
-    now = ngx_time();
+    if (rn) {
+        ngx_rbtree_delete(&r->srv_rbtree, &rn->node);
 
-    for ( ;; ) {
-        if (ngx_queue_empty(queue)) {
-            return 0;
+        if (rn->query) {
+            ngx_resolver_free(r, rn->query);
         }
 
-        q = ngx_queue_last(queue);
-
-        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
-
-        if (now < rn->expire) {
-            return rn->expire - now;
-        }
+        ngx_resolver_free(r, rn->name);
+        ngx_resolver_free(r, rn);
+    }
 
-        ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
-                       "resolver resend \"%*s\" %p",
-                       (size_t) rn->nlen, rn->name, rn->waiting);
+    /* unlock srv mutex */
 
-        ngx_queue_remove(q);
+    if (ctx->event) {
+        ngx_resolver_free(r, ctx->event);
+    }
 
-        if (rn->waiting) {
+    ngx_resolver_free(r, ctx);
 
-            (void) ngx_resolver_send_query(r, rn);
+    return NGX_ERROR;
+}
 
-            rn->expire = now + r->resend_timeout;
 
-            ngx_queue_insert_head(queue, q);
+void
+ngx_resolve_srv_done(ngx_resolver_ctx_t *ctx)
+{
+    uint32_t              hash;
+    ngx_resolver_t       *r;
+    ngx_resolver_ctx_t   *w, **p;
+    ngx_resolver_node_t  *rn;
 
-            continue;
-        }
+    r = ctx->resolver;
 
-        ngx_rbtree_delete(tree, &rn->node);
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve srv done: %i", ctx->state);
 
-        ngx_resolver_free_node(r, rn);
+    if (ctx->event && ctx->event->timer_set) {
+        ngx_del_timer(ctx->event);
     }
-}
 
+    /* lock srv mutex */
 
-static void
-ngx_resolver_read_response(ngx_event_t *rev)
-{
-    ssize_t            n;
-    ngx_connection_t  *c;
-    u_char             buf[NGX_RESOLVER_UDP_SIZE];
-
-    c = rev->data;
+    if (ctx->state == NGX_AGAIN) {
 
-    do {
-        n = ngx_udp_recv(c, buf, NGX_RESOLVER_UDP_SIZE);
+        hash = ngx_crc32_short(ctx->name.data, ctx->name.len);
 
-        if (n < 0) {
-            return;
-        }
+        rn = ngx_resolver_lookup_srv(r, &ctx->name, hash);
 
-        ngx_resolver_process_response(c->data, buf, n);
+        if (rn) {
+            p = &rn->waiting;
+            w = rn->waiting;
 
-    } while (rev->ready);
-}
+            while (w) {
+                if (w == ctx) {
+                    *p = w->next;
 
+                    goto done;
+                }
 
-static void
-ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf, size_t n)
-{
-    char                 *err;
-    ngx_uint_t            i, times, ident, qident, flags, code, nqs, nan,
-                          qtype, qclass;
-#if (NGX_HAVE_INET6)
-    ngx_uint_t            qident6;
-#endif
-    ngx_queue_t          *q;
-    ngx_resolver_qs_t    *qs;
-    ngx_resolver_hdr_t   *response;
-    ngx_resolver_node_t  *rn;
+                p = &w->next;
+                w = w->next;
+            }
+        }
 
-    if (n < sizeof(ngx_resolver_hdr_t)) {
-        goto short_response;
+        ngx_log_error(NGX_LOG_ALERT, r->log, 0,
+                      "could not cancel %V resolving", &ctx->name);
     }
 
-    response = (ngx_resolver_hdr_t *) buf;
+done:
 
-    ident = (response->ident_hi << 8) + response->ident_lo;
-    flags = (response->flags_hi << 8) + response->flags_lo;
-    nqs = (response->nqs_hi << 8) + response->nqs_lo;
-    nan = (response->nan_hi << 8) + response->nan_lo;
+    ngx_resolver_expire(r, &r->srv_rbtree, &r->srv_expire_queue);
 
-    ngx_log_debug6(NGX_LOG_DEBUG_CORE, r->log, 0,
-                   "resolver DNS response %ui fl:%04Xui %ui/%ui/%ud/%ud",
-                   ident, flags, nqs, nan,
-                   (response->nns_hi << 8) + response->nns_lo,
-                   (response->nar_hi << 8) + response->nar_lo);
+    /* unlock srv mutex */
 
-    /* response to a standard query */
-    if ((flags & 0xf870) != 0x8000) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "invalid DNS response %ui fl:%04Xui", ident, flags);
-        return;
+    /* lock alloc mutex */
+
+    if (ctx->event) {
+        ngx_resolver_free_locked(r, ctx->event);
     }
 
-    code = flags & 0xf;
+    ngx_resolver_free_locked(r, ctx);
 
-    if (code == NGX_RESOLVE_FORMERR) {
+    /* unlock alloc mutex */
+}
 
-        times = 0;
 
-        for (q = ngx_queue_head(&r->name_resend_queue);
-             q != ngx_queue_sentinel(&r->name_resend_queue) || times++ < 100;
-             q = ngx_queue_next(q))
-        {
-            rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
-            qident = (rn->query[0] << 8) + rn->query[1];
+static void
+ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
+{
+    time_t                now;
+    ngx_uint_t            i;
+    ngx_queue_t          *q;
+    ngx_resolver_node_t  *rn;
 
-            if (qident == ident) {
-                goto dns_error_name;
-            }
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver expire");
 
-#if (NGX_HAVE_INET6)
-            if (rn->query6) {
-                qident6 = (rn->query6[0] << 8) + rn->query6[1];
+    now = ngx_time();
 
-                if (qident6 == ident) {
-                    goto dns_error_name;
-                }
-            }
-#endif
+    for (i = 0; i < 2; i++) {
+        if (ngx_queue_empty(queue)) {
+            return;
         }
 
-        goto dns_error;
-    }
-
-    if (code > NGX_RESOLVE_REFUSED) {
-        goto dns_error;
-    }
-
-    if (nqs != 1) {
-        err = "invalid number of questions in DNS response";
-        goto done;
-    }
+        q = ngx_queue_last(queue);
 
-    i = sizeof(ngx_resolver_hdr_t);
+        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
 
-    while (i < (ngx_uint_t) n) {
-        if (buf[i] == '\0') {
-            goto found;
+        if (now <= rn->expire) {
+            return;
         }
 
-        i += 1 + buf[i];
-    }
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver expire \"%*s\"", (size_t) rn->nlen, rn->name);
 
-    goto short_response;
+        ngx_queue_remove(q);
 
-found:
+        ngx_rbtree_delete(tree, &rn->node);
 
-    if (i++ == sizeof(ngx_resolver_hdr_t)) {
-        err = "zero-length domain name in DNS response";
-        goto done;
+        ngx_resolver_free_node(r, rn);
     }
+}
 
-    if (i + sizeof(ngx_resolver_qs_t) + nan * (2 + sizeof(ngx_resolver_an_t))
-        > (ngx_uint_t) n)
-    {
-        goto short_response;
-    }
 
-    qs = (ngx_resolver_qs_t *) &buf[i];
+static ngx_int_t
+ngx_resolver_send_query(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_uint_t             i, sent;
+    ngx_udp_connection_t  *uc;
 
-    qtype = (qs->type_hi << 8) + qs->type_lo;
-    qclass = (qs->class_hi << 8) + qs->class_lo;
+    uc = r->udp_connections.elts;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
-                   "resolver DNS response qt:%ui cl:%ui", qtype, qclass);
+    if (!r->parallel) {
+        i = r->last_connection++;
+        if (r->last_connection == r->udp_connections.nelts) {
+            r->last_connection = 0;
+        }
 
-    if (qclass != 1) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "unknown query class %ui in DNS response", qclass);
-        return;
+        return ngx_resolver_send_udp_query(r, &uc[i], rn);
     }
 
-    switch (qtype) {
+    /*
+     * query all servers at once, the first positive answer wins,
+     * and an error is reported after all servers answered
+     */
 
-    case NGX_RESOLVE_A:
+    sent = 0;
+
+    for (i = 0; i < r->udp_connections.nelts; i++) {
+        if (ngx_resolver_send_udp_query(r, &uc[i], rn) == NGX_OK) {
+            sent++;
+        }
+    }
+
+    rn->pending = (u_short) sent;
 #if (NGX_HAVE_INET6)
-    case NGX_RESOLVE_AAAA:
+    rn->pending6 = (u_short) sent;
 #endif
 
-        ngx_resolver_process_a(r, buf, n, ident, code, qtype, nan,
-                               i + sizeof(ngx_resolver_qs_t));
+    return sent ? NGX_OK : NGX_ERROR;
+}
 
-        break;
 
-    case NGX_RESOLVE_PTR:
+static ngx_int_t
+ngx_resolver_send_udp_query(ngx_resolver_t *r, ngx_udp_connection_t *uc,
+    ngx_resolver_node_t *rn)
+{
+    ssize_t  n;
 
-        ngx_resolver_process_ptr(r, buf, n, ident, code, nan);
+    if (uc->connection == NULL) {
 
-        break;
+        uc->log = *r->log;
+        uc->log.handler = ngx_resolver_log_error;
+        uc->log.data = uc;
+        uc->log.action = "resolving";
 
-    default:
-        ngx_log_error(r->log_level, r->log, 0,
-                      "unknown query type %ui in DNS response", qtype);
-        return;
-    }
+        if (ngx_udp_connect(uc) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-    return;
+        uc->connection->data = r;
+        uc->connection->read->handler = ngx_resolver_read_response;
+        uc->connection->read->resolver = 1;
+    }
 
-short_response:
+    if (rn->naddrs == (u_short) -1) {
+        n = ngx_send(uc->connection, rn->query, rn->qlen);
 
-    err = "short DNS response";
+        if (n == -1) {
+            return NGX_ERROR;
+        }
 
-done:
+        if ((size_t) n != (size_t) rn->qlen) {
+            ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
+            return NGX_ERROR;
+        }
+    }
 
-    ngx_log_error(r->log_level, r->log, 0, err);
+#if (NGX_HAVE_INET6)
+    if (rn->query6 && rn->naddrs6 == (u_short) -1) {
+        n = ngx_send(uc->connection, rn->query6, rn->qlen);
 
-    return;
-
-dns_error_name:
-
-    ngx_log_error(r->log_level, r->log, 0,
-                  "DNS error (%ui: %s), query id:%ui, name:\"%*s\"",
-                  code, ngx_resolver_strerror(code), ident,
-                  rn->nlen, rn->name);
-    return;
+        if (n == -1) {
+            return NGX_ERROR;
+        }
 
-dns_error:
+        if ((size_t) n != (size_t) rn->qlen) {
+            ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
+            return NGX_ERROR;
+        }
+    }
+#endif
 
-    ngx_log_error(r->log_level, r->log, 0,
-                  "DNS error (%ui: %s), query id:%ui",
-                  code, ngx_resolver_strerror(code), ident);
-    return;
+    return NGX_OK;
 }
 
 
 static void
-ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
-    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t qtype,
-    ngx_uint_t nan, ngx_uint_t ans)
+ngx_resolver_resend_handler(ngx_event_t *ev)
 {
-    char                 *err;
-    u_char               *cname;
-    size_t                len;
-    int32_t               ttl;
-    uint32_t              hash;
-    in_addr_t            *addr;
-    ngx_str_t             name;
-    ngx_addr_t           *addrs;
-    ngx_uint_t            type, class, qident, naddrs, a, i, n, start;
+    time_t           timer, atimer, ntimer, stimer;
 #if (NGX_HAVE_INET6)
-    struct in6_addr      *addr6;
+    time_t           a6timer;
 #endif
-    ngx_resolver_an_t    *an;
-    ngx_resolver_ctx_t   *ctx, *next;
-    ngx_resolver_node_t  *rn;
-
-    if (ngx_resolver_copy(r, &name, buf,
-                          buf + sizeof(ngx_resolver_hdr_t), buf + last)
-        != NGX_OK)
-    {
-        return;
-    }
+    ngx_resolver_t  *r;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver qs:%V", &name);
+    r = ev->data;
 
-    hash = ngx_crc32_short(name.data, name.len);
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver resend handler");
 
     /* lock name mutex */
 
-    rn = ngx_resolver_lookup_name(r, &name, hash);
+    ntimer = ngx_resolver_resend(r, &r->name_rbtree, &r->name_resend_queue);
 
-    if (rn == NULL) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "unexpected response for %V", &name);
-        ngx_resolver_free(r, name.data);
-        goto failed;
-    }
+    /* unlock name mutex */
 
-    switch (qtype) {
+    /* lock addr mutex */
+
+    atimer = ngx_resolver_resend(r, &r->addr_rbtree, &r->addr_resend_queue);
+
+    /* unlock addr mutex */
 
 #if (NGX_HAVE_INET6)
-    case NGX_RESOLVE_AAAA:
 
-        if (rn->query6 == NULL || rn->naddrs6 != (u_short) -1) {
-            ngx_log_error(r->log_level, r->log, 0,
-                          "unexpected response for %V", &name);
-            ngx_resolver_free(r, name.data);
-            goto failed;
-        }
+    /* lock addr6 mutex */
 
-        qident = (rn->query6[0] << 8) + rn->query6[1];
+    a6timer = ngx_resolver_resend(r, &r->addr6_rbtree, &r->addr6_resend_queue);
+
+    /* unlock addr6 mutex */
 
-        break;
 #endif
 
-    default: /* NGX_RESOLVE_A */
+    /* lock srv mutex */
 
-        if (rn->query == NULL || rn->naddrs != (u_short) -1) {
-            ngx_log_error(r->log_level, r->log, 0,
-                          "unexpected response for %V", &name);
-            ngx_resolver_free(r, name.data);
-            goto failed;
-        }
+    stimer = ngx_resolver_resend(r, &r->srv_rbtree, &r->srv_resend_queue);
 
-        qident = (rn->query[0] << 8) + rn->query[1];
-    }
+    /* unlock srv mutex */
 
-    if (ident != qident) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "wrong ident %ui response for %V, expect %ui",
-                      ident, &name, qident);
-        ngx_resolver_free(r, name.data);
-        goto failed;
-    }
+    timer = ntimer;
 
-    ngx_resolver_free(r, name.data);
+    if (timer == 0) {
+        timer = atimer;
 
-    if (code == 0 && rn->code) {
-        code = rn->code;
+    } else if (atimer) {
+        timer = ngx_min(timer, atimer);
     }
 
-    if (code == 0 && nan == 0) {
+    if (timer == 0) {
+        timer = stimer;
 
-#if (NGX_HAVE_INET6)
-        switch (qtype) {
+    } else if (stimer) {
+        timer = ngx_min(timer, stimer);
+    }
 
-        case NGX_RESOLVE_AAAA:
+#if (NGX_HAVE_INET6)
 
-            rn->naddrs6 = 0;
+    if (timer == 0) {
+        timer = a6timer;
 
-            if (rn->naddrs == (u_short) -1) {
-                goto next;
-            }
+    } else if (a6timer) {
+        timer = ngx_min(timer, a6timer);
+    }
 
-            if (rn->naddrs) {
-                goto export;
-            }
+#endif
 
-            break;
+    if (timer) {
+        ngx_add_timer(r->event, (ngx_msec_t) (timer * 1000));
+    }
+}
 
-        default: /* NGX_RESOLVE_A */
 
-            rn->naddrs = 0;
+static time_t
+ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
+{
+    time_t                now;
+    ngx_queue_t          *q;
+    ngx_resolver_node_t  *rn;
 
-            if (rn->naddrs6 == (u_short) -1) {
-                goto next;
-            }
+    now = ngx_time();
 
-            if (rn->naddrs6) {
-                goto export;
-            }
+    for ( ;; ) {
+        if (ngx_queue_empty(queue)) {
+            return 0;
         }
-#endif
 
-        code = NGX_RESOLVE_NXDOMAIN;
-    }
+        q = ngx_queue_last(queue);
 
-    if (code) {
+        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
 
-#if (NGX_HAVE_INET6)
-        switch (qtype) {
+        if (now < rn->expire) {
+            return rn->expire - now;
+        }
 
-        case NGX_RESOLVE_AAAA:
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver resend \"%*s\" %p",
+                       (size_t) rn->nlen, rn->name, rn->waiting);
 
-            rn->naddrs6 = 0;
+        ngx_queue_remove(q);
 
-            if (rn->naddrs == (u_short) -1) {
-                rn->code = (u_char) code;
-                goto next;
-            }
+        if (rn->waiting) {
 
-            break;
+            (void) ngx_resolver_send_query(r, rn);
 
-        default: /* NGX_RESOLVE_A */
+            rn->expire = now + r->resend_timeout;
 
-            rn->naddrs = 0;
+            ngx_queue_insert_head(queue, q);
 
-            if (rn->naddrs6 == (u_short) -1) {
-                rn->code = (u_char) code;
-                goto next;
-            }
+            continue;
         }
-#endif
 
-        next = rn->waiting;
-        rn->waiting = NULL;
+        ngx_rbtree_delete(tree, &rn->node);
 
-        ngx_queue_remove(&rn->queue);
+        ngx_resolver_free_node(r, rn);
+    }
+}
 
-        ngx_rbtree_delete(&r->name_rbtree, &rn->node);
 
-        ngx_resolver_free_node(r, rn);
+static void
+ngx_resolver_read_response(ngx_event_t *rev)
+{
+    ssize_t                n;
+    ngx_uint_t             i;
+    ngx_resolver_t        *r;
+    ngx_connection_t      *c;
+    ngx_udp_connection_t  *uc;
+    u_char                 buf[NGX_RESOLVER_UDP_SIZE];
 
-        /* unlock name mutex */
+    c = rev->data;
+    r = c->data;
 
-        while (next) {
-            ctx = next;
-            ctx->state = code;
-            next = ctx->next;
+    uc = r->udp_connections.elts;
 
-            ctx->handler(ctx);
+    for (i = 0; i < r->udp_connections.nelts; i++) {
+        if (uc[i].connection == c) {
+            break;
         }
-
-        return;
     }
 
-    i = ans;
-    naddrs = 0;
-    cname = NULL;
+    do {
+        n = ngx_udp_recv(c, buf, NGX_RESOLVER_UDP_SIZE);
 
-    for (a = 0; a < nan; a++) {
+        if (n < 0) {
+            return;
+        }
 
-        start = i;
+        ngx_resolver_process_response(r, buf, n, &uc[i]);
 
-        while (i < last) {
+    } while (rev->ready);
+}
 
-            if (buf[i] & 0xc0) {
-                i += 2;
-                goto found;
-            }
 
-            if (buf[i] == 0) {
-                i++;
-                goto test_length;
-            }
+static void
+ngx_resolver_tcp_query(ngx_resolver_t *r, ngx_udp_connection_t *uc,
+    u_char *buf, size_t n)
+{
+    u_char              *query;
+    ngx_int_t            rc;
+    ngx_uint_t           ntcp;
+    ngx_queue_t         *q;
+    ngx_connection_t    *c;
+    ngx_resolver_tcp_t  *tcp;
 
-            i += 1 + buf[i];
-        }
+    /*
+     * the truncated response must answer a query being resolved,
+     * with the same ident and question, as a full response would
+     */
 
-        goto short_response;
+    query = ngx_resolver_tcp_pending(r, &r->name_resend_queue, buf, n);
 
-    test_length:
+    if (query == NULL) {
+        query = ngx_resolver_tcp_pending(r, &r->addr_resend_queue, buf, n);
+    }
 
-        if (i - start < 2) {
-            err = "invalid name in DNS response";
-            goto invalid;
-        }
+#if (NGX_HAVE_INET6)
+    if (query == NULL) {
+        query = ngx_resolver_tcp_pending(r, &r->addr6_resend_queue, buf, n);
+    }
+#endif
 
-    found:
+    if (query == NULL) {
+        query = ngx_resolver_tcp_pending(r, &r->srv_resend_queue, buf, n);
+    }
 
-        if (i + sizeof(ngx_resolver_an_t) >= last) {
-            goto short_response;
-        }
+    if (query == NULL) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "unexpected truncated DNS response from %V",
+                      &uc->server);
+        return;
+    }
 
-        an = (ngx_resolver_an_t *) &buf[i];
+    ntcp = 0;
 
-        type = (an->type_hi << 8) + an->type_lo;
-        class = (an->class_hi << 8) + an->class_lo;
-        len = (an->len_hi << 8) + an->len_lo;
-        ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
-            + (an->ttl[2] << 8) + (an->ttl[3]);
+    for (q = ngx_queue_head(&r->tcp_queue);
+         q != ngx_queue_sentinel(&r->tcp_queue);
+         q = ngx_queue_next(q))
+    {
+        tcp = ngx_queue_data(q, ngx_resolver_tcp_t, queue);
 
-        if (class != 1) {
-            ngx_log_error(r->log_level, r->log, 0,
-                          "unexpected RR class %ui", class);
-            goto failed;
-        }
+        if (tcp->qlen == 2 + n && ngx_memcmp(tcp->query + 2, query, n) == 0) {
 
-        if (ttl < 0) {
-            ttl = 0;
+            /* the other servers in parallel mode truncate the same query */
+
+            return;
         }
 
-        rn->ttl = ngx_min(rn->ttl, (uint32_t) ttl);
+        ntcp++;
+    }
 
-        i += sizeof(ngx_resolver_an_t);
+    if (ntcp >= NGX_RESOLVER_TCP_MAX) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "too many DNS queries over TCP, "
+                      "truncated response from %V ignored", &uc->server);
+        return;
+    }
 
-        switch (type) {
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver truncated response, query %V over TCP",
+                   &uc->server);
 
-        case NGX_RESOLVE_A:
+    tcp = ngx_resolver_calloc(r, sizeof(ngx_resolver_tcp_t) + 2 + n);
+    if (tcp == NULL) {
+        return;
+    }
 
-            if (qtype != NGX_RESOLVE_A) {
-                err = "unexpected A record in DNS response";
-                goto invalid;
-            }
+    tcp->resolver = r;
+    tcp->log = uc->log;
 
-            if (len != 4) {
-                err = "invalid A record in DNS response";
-                goto invalid;
-            }
+    /* the query sent over UDP, prefixed with its length */
 
-            if (i + 4 > last) {
-                goto short_response;
-            }
+    tcp->query = (u_char *) tcp + sizeof(ngx_resolver_tcp_t);
+    tcp->qlen = 2 + n;
 
-            naddrs++;
+    tcp->query[0] = (u_char) ((n >> 8) & 0xff);
+    tcp->query[1] = (u_char) (n & 0xff);
 
-            break;
+    ngx_memcpy(tcp->query + 2, query, n);
 
-#if (NGX_HAVE_INET6)
-        case NGX_RESOLVE_AAAA:
+    tcp->peer.sockaddr = uc->sockaddr;
+    tcp->peer.socklen = uc->socklen;
+    tcp->peer.name = &uc->server;
+    tcp->peer.get = ngx_event_get_peer;
+    tcp->peer.log = &tcp->log;
+    tcp->peer.log_error = NGX_ERROR_ERR;
 
-            if (qtype != NGX_RESOLVE_AAAA) {
-                err = "unexpected AAAA record in DNS response";
-                goto invalid;
-            }
+    rc = ngx_event_connect_peer(&tcp->peer);
 
-            if (len != 16) {
-                err = "invalid AAAA record in DNS response";
-                goto invalid;
-            }
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_resolver_free(r, tcp);
+        return;
+    }
 
-            if (i + 16 > last) {
-                goto short_response;
-            }
+    c = tcp->peer.connection;
 
-            naddrs++;
+    c->data = tcp;
+    c->read->handler = ngx_resolver_tcp_read_handler;
+    c->write->handler = ngx_resolver_tcp_write_handler;
+    c->read->resolver = 1;
 
-            break;
-#endif
+    ngx_queue_insert_tail(&r->tcp_queue, &tcp->queue);
 
-        case NGX_RESOLVE_CNAME:
+    ngx_add_timer(c->read, (ngx_msec_t) (r->resend_timeout * 1000));
 
-            cname = &buf[i];
+    if (rc == NGX_OK) {
+        ngx_resolver_tcp_write_handler(c->write);
+    }
+}
 
-            break;
 
-        case NGX_RESOLVE_DNAME:
+static u_char *
+ngx_resolver_tcp_pending(ngx_resolver_t *r, ngx_queue_t *queue, u_char *buf,
+    size_t n)
+{
+    ngx_queue_t          *q;
+    ngx_resolver_node_t  *rn;
 
-            break;
+    for (q = ngx_queue_head(queue);
+         q != ngx_queue_sentinel(queue);
+         q = ngx_queue_next(q))
+    {
+        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
 
-        default:
+        if (rn->qlen != n) {
+            continue;
+        }
 
-            ngx_log_error(r->log_level, r->log, 0,
-                          "unexpected RR type %ui", type);
+        if (rn->query && ngx_resolver_tcp_match(rn->query, buf, n)) {
+            return rn->query;
         }
 
-        i += len;
+#if (NGX_HAVE_INET6)
+        if (rn->query6 && ngx_resolver_tcp_match(rn->query6, buf, n)) {
+            return rn->query6;
+        }
+#endif
     }
 
-    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
-                   "resolver naddrs:%ui cname:%p ttl:%uD",
-                   naddrs, cname, rn->ttl);
+    return NULL;
+}
 
-    if (naddrs) {
 
-        switch (qtype) {
+static ngx_uint_t
+ngx_resolver_tcp_match(u_char *query, u_char *buf, size_t n)
+{
+    size_t  i;
 
-#if (NGX_HAVE_INET6)
-        case NGX_RESOLVE_AAAA:
+    if (query[0] != buf[0] || query[1] != buf[1]) {
+        return 0;
+    }
 
-            if (naddrs == 1) {
-                addr6 = &rn->u6.addr6;
-                rn->naddrs6 = 1;
+    /* the label lengths, type and class are below 'A', only letters fold */
 
-            } else {
-                addr6 = ngx_resolver_alloc(r, naddrs * sizeof(struct in6_addr));
-                if (addr6 == NULL) {
-                    goto failed;
-                }
+    for (i = sizeof(ngx_resolver_hdr_t); i < n; i++) {
+        if (ngx_tolower(query[i]) != ngx_tolower(buf[i])) {
+            return 0;
+        }
+    }
 
-                rn->u6.addrs6 = addr6;
-                rn->naddrs6 = (u_short) naddrs;
-            }
+    return 1;
+}
 
-#if (NGX_SUPPRESS_WARN)
-            addr = NULL;
-#endif
 
-            break;
-#endif
+static void
+ngx_resolver_tcp_write_handler(ngx_event_t *wev)
+{
+    ssize_t              n;
+    ngx_connection_t    *c;
+    ngx_resolver_tcp_t  *tcp;
 
-        default: /* NGX_RESOLVE_A */
+    c = wev->data;
+    tcp = c->data;
 
-            if (naddrs == 1) {
-                addr = &rn->u.addr;
-                rn->naddrs = 1;
+    while (tcp->sent < tcp->qlen) {
 
-            } else {
-                addr = ngx_resolver_alloc(r, naddrs * sizeof(in_addr_t));
-                if (addr == NULL) {
-                    goto failed;
-                }
+        n = c->send(c, tcp->query + tcp->sent, tcp->qlen - tcp->sent);
 
-                rn->u.addrs = addr;
-                rn->naddrs = (u_short) naddrs;
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_resolver_tcp_close(tcp);
             }
 
-#if (NGX_HAVE_INET6 && NGX_SUPPRESS_WARN)
-            addr6 = NULL;
-#endif
+            return;
         }
 
-        n = 0;
-        i = ans;
+        if (n == NGX_ERROR) {
+            ngx_resolver_tcp_close(tcp);
+            return;
+        }
 
-        for (a = 0; a < nan; a++) {
+        tcp->sent += n;
+    }
 
-            for ( ;; ) {
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_resolver_tcp_close(tcp);
+    }
+}
 
-                if (buf[i] & 0xc0) {
-                    i += 2;
-                    break;
-                }
 
-                if (buf[i] == 0) {
-                    i++;
-                    break;
-                }
+static void
+ngx_resolver_tcp_read_handler(ngx_event_t *rev)
+{
+    ssize_t              n;
+    ngx_connection_t    *c;
+    ngx_resolver_tcp_t  *tcp;
 
-                i += 1 + buf[i];
-            }
+    c = rev->data;
+    tcp = c->data;
 
-            an = (ngx_resolver_an_t *) &buf[i];
+    if (rev->timedout) {
+        ngx_log_error(tcp->resolver->log_level, c->log, NGX_ETIMEDOUT,
+                      "DNS server timed out");
+        goto close;
+    }
 
-            type = (an->type_hi << 8) + an->type_lo;
-            len = (an->len_hi << 8) + an->len_lo;
+    for ( ;; ) {
 
-            i += sizeof(ngx_resolver_an_t);
+        if (tcp->buf == NULL) {
+            n = c->recv(c, tcp->hdr + tcp->received, 2 - tcp->received);
 
-            if (type == NGX_RESOLVE_A) {
+        } else {
+            n = c->recv(c, tcp->buf + tcp->received,
+                        tcp->len - tcp->received);
+        }
 
-                addr[n] = htonl((buf[i] << 24) + (buf[i + 1] << 16)
-                                + (buf[i + 2] << 8) + (buf[i + 3]));
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                goto close;
+            }
 
-                if (++n == naddrs) {
+            return;
+        }
 
-#if (NGX_HAVE_INET6)
-                    if (rn->naddrs6 == (u_short) -1) {
-                        goto next;
-                    }
-#endif
+        if (n == 0) {
+            ngx_log_error(tcp->resolver->log_level, c->log, 0,
+                          "DNS server closed connection prematurely");
+            goto close;
+        }
 
-                    break;
-                }
-            }
+        if (n == NGX_ERROR) {
+            goto close;
+        }
 
-#if (NGX_HAVE_INET6)
-            else if (type == NGX_RESOLVE_AAAA) {
+        tcp->received += n;
 
-                ngx_memcpy(addr6[n].s6_addr, &buf[i], 16);
+        if (tcp->buf == NULL) {
 
-                if (++n == naddrs) {
+            if (tcp->received < 2) {
+                continue;
+            }
 
-                    if (rn->naddrs == (u_short) -1) {
-                        goto next;
-                    }
+            tcp->len = (tcp->hdr[0] << 8) + tcp->hdr[1];
 
-                    break;
-                }
+            if (tcp->len == 0) {
+                goto close;
             }
-#endif
 
-            i += len;
+            tcp->buf = ngx_resolver_alloc(tcp->resolver, tcp->len);
+            if (tcp->buf == NULL) {
+                goto close;
+            }
+
+            tcp->received = 0;
+
+            continue;
+        }
+
+        if (tcp->received == tcp->len) {
+            break;
         }
     }
 
-    switch (qtype) {
+    ngx_resolver_process_response(tcp->resolver, tcp->buf, tcp->len, NULL);
+
+close:
+
+    ngx_resolver_tcp_close(tcp);
+}
+
+
+static void
+ngx_resolver_tcp_close(ngx_resolver_tcp_t *tcp)
+{
+    ngx_queue_remove(&tcp->queue);
+
+    ngx_close_connection(tcp->peer.connection);
+
+    if (tcp->buf) {
+        ngx_resolver_free(tcp->resolver, tcp->buf);
+    }
+
+    ngx_resolver_free(tcp->resolver, tcp);
+}
+
 
+static void
+ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf, size_t n,
+    ngx_udp_connection_t *uc)
+{
+    char                 *err;
+    ngx_uint_t            i, times, ident, qident, flags, code, nqs, nan,
+                          qtype, qclass;
 #if (NGX_HAVE_INET6)
-    case NGX_RESOLVE_AAAA:
+    ngx_uint_t            qident6;
+#endif
+    ngx_queue_t          *q;
+    ngx_resolver_qs_t    *qs;
+    ngx_resolver_hdr_t   *response;
+    ngx_resolver_node_t  *rn;
+
+    if (n < sizeof(ngx_resolver_hdr_t)) {
+        goto short_response;
+    }
+
+    response = (ngx_resolver_hdr_t *) buf;
+
+    ident = (response->ident_hi << 8) + response->ident_lo;
+    flags = (response->flags_hi << 8) + response->flags_lo;
+    nqs = (response->nqs_hi << 8) + response->nqs_lo;
+    nan = (response->nan_hi << 8) + response->nan_lo;
+
+    ngx_log_debug6(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver DNS response %ui fl:%04Xui %ui/%ui/%ud/%ud",
+                   ident, flags, nqs, nan,
+                   (response->nns_hi << 8) + response->nns_lo,
+                   (response->nar_hi << 8) + response->nar_lo);
+
+    /* response to a standard query */
+    if ((flags & 0xf870) != 0x8000) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "invalid DNS response %ui fl:%04Xui", ident, flags);
+        return;
+    }
+
+    code = flags & 0xf;
+
+    if (code == NGX_RESOLVE_FORMERR) {
+
+        times = 0;
+
+        for (q = ngx_queue_head(&r->name_resend_queue);
+             q != ngx_queue_sentinel(&r->name_resend_queue) || times++ < 100;
+             q = ngx_queue_next(q))
+        {
+            rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
+            qident = (rn->query[0] << 8) + rn->query[1];
+
+            if (qident == ident) {
+                goto dns_error_name;
+            }
+
+#if (NGX_HAVE_INET6)
+            if (rn->query6) {
+                qident6 = (rn->query6[0] << 8) + rn->query6[1];
+
+                if (qident6 == ident) {
+                    goto dns_error_name;
+                }
+            }
+#endif
+        }
+
+        goto dns_error;
+    }
+
+    if (code > NGX_RESOLVE_REFUSED) {
+        goto dns_error;
+    }
+
+    if (nqs != 1) {
+        err = "invalid number of questions in DNS response";
+        goto done;
+    }
+
+    i = sizeof(ngx_resolver_hdr_t);
+
+    while (i < (ngx_uint_t) n) {
+        if (buf[i] == '\0') {
+            goto found;
+        }
+
+        i += 1 + buf[i];
+    }
+
+    goto short_response;
+
+found:
+
+    if (i++ == sizeof(ngx_resolver_hdr_t)) {
+        err = "zero-length domain name in DNS response";
+        goto done;
+    }
+
+    /* uc is NULL for responses received over TCP */
+
+    if ((flags & NGX_RESOLVER_TC) && uc) {
+
+        if (i + sizeof(ngx_resolver_qs_t) > (ngx_uint_t) n) {
+            goto short_response;
+        }
+
+        ngx_resolver_tcp_query(r, uc, buf, i + sizeof(ngx_resolver_qs_t));
+
+        return;
+    }
+
+    if (i + sizeof(ngx_resolver_qs_t) + nan * (2 + sizeof(ngx_resolver_an_t))
+        > (ngx_uint_t) n)
+    {
+        goto short_response;
+    }
+
+    qs = (ngx_resolver_qs_t *) &buf[i];
+
+    qtype = (qs->type_hi << 8) + qs->type_lo;
+    qclass = (qs->class_hi << 8) + qs->class_lo;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver DNS response qt:%ui cl:%ui", qtype, qclass);
+
+    if (qclass != 1) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "unknown query class %ui in DNS response", qclass);
+        return;
+    }
+
+    switch (qtype) {
+
+    case NGX_RESOLVE_A:
+#if (NGX_HAVE_INET6)
+    case NGX_RESOLVE_AAAA:
+#endif
+
+        ngx_resolver_process_a(r, buf, n, ident, code, qtype, nan,
+                               i + sizeof(ngx_resolver_qs_t));
+
+        break;
+
+    case NGX_RESOLVE_PTR:
+
+        ngx_resolver_process_ptr(r, buf, n, ident, code, nan);
+
+        break;
+
+    case NGX_RESOLVE_SRV:
+
+        ngx_resolver_process_srv(r, buf, n, ident, code, nan,
+                                 i + sizeof(ngx_resolver_qs_t));
+
+        break;
+
+    default:
+        ngx_log_error(r->log_level, r->log, 0,
+                      "unknown query type %ui in DNS response", qtype);
+        return;
+    }
+
+    return;
+
+short_response:
+
+    err = "short DNS response";
+
+done:
+
+    ngx_log_error(r->log_level, r->log, 0, err);
+
+    return;
+
+dns_error_name:
+
+    ngx_log_error(r->log_level, r->log, 0,
+                  "DNS error (%ui: %s), query id:%ui, name:\"%*s\"",
+                  code, ngx_resolver_strerror(code), ident,
+                  rn->nlen, rn->name);
+    return;
+
+dns_error:
+
+    ngx_log_error(r->log_level, r->log, 0,
+                  "DNS error (%ui: %s), query id:%ui",
+                  code, ngx_resolver_strerror(code), ident);
+    return;
+}
+
+
+static void
+ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t qtype,
+    ngx_uint_t nan, ngx_uint_t ans)
+{
+    char                 *err;
+    u_char               *cname;
+    size_t                len;
+    int32_t               ttl;
+    uint32_t              hash;
+    in_addr_t            *addr;
+    ngx_str_t             name;
+    ngx_addr_t           *addrs;
+    ngx_uint_t            type, class, qident, naddrs, a, i, n, start;
+#if (NGX_HAVE_INET6)
+    struct in6_addr      *addr6;
+#endif
+    ngx_resolver_an_t    *an;
+    ngx_resolver_ctx_t   *ctx, *next;
+    ngx_resolver_node_t  *rn;
+
+    if (ngx_resolver_copy(r, &name, buf,
+                          buf + sizeof(ngx_resolver_hdr_t), buf + last)
+        != NGX_OK)
+    {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver qs:%V", &name);
+
+    hash = ngx_crc32_short(name.data, name.len);
+
+    /* lock name mutex */
+
+    rn = ngx_resolver_lookup_name(r, &name, hash);
+
+    if (rn == NULL) {
+        if (!r->parallel) {
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected response for %V", &name);
+        }
+
+        ngx_resolver_free(r, name.data);
+        goto failed;
+    }
+
+    switch (qtype) {
+
+#if (NGX_HAVE_INET6)
+    case NGX_RESOLVE_AAAA:
+
+        if (rn->query6 == NULL || rn->naddrs6 != (u_short) -1) {
+            if (!r->parallel) {
+                ngx_log_error(r->log_level, r->log, 0,
+                              "unexpected response for %V", &name);
+            }
+
+            ngx_resolver_free(r, name.data);
+            goto failed;
+        }
+
+        qident = (rn->query6[0] << 8) + rn->query6[1];
+
+        break;
+#endif
+
+    default: /* NGX_RESOLVE_A */
+
+        if (rn->query == NULL || rn->naddrs != (u_short) -1) {
+            if (!r->parallel) {
+                ngx_log_error(r->log_level, r->log, 0,
+                              "unexpected response for %V", &name);
+            }
+
+            ngx_resolver_free(r, name.data);
+            goto failed;
+        }
+
+        qident = (rn->query[0] << 8) + rn->query[1];
+    }
+
+    if (ident != qident) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "wrong ident %ui response for %V, expect %ui",
+                      ident, &name, qident);
+        ngx_resolver_free(r, name.data);
+        goto failed;
+    }
+
+    ngx_resolver_free(r, name.data);
+
+    if ((code || nan == 0) && ngx_resolver_parallel_wait(r, rn, qtype, code)) {
+        return;
+    }
+
+    if (code == 0 && rn->code) {
+        code = rn->code;
+    }
+
+    if (code == 0 && nan == 0) {
+
+#if (NGX_HAVE_INET6)
+        switch (qtype) {
+
+        case NGX_RESOLVE_AAAA:
+
+            rn->naddrs6 = 0;
+
+            if (rn->naddrs == (u_short) -1) {
+                goto next;
+            }
+
+            if (rn->naddrs) {
+                goto export;
+            }
+
+            break;
+
+        default: /* NGX_RESOLVE_A */
+
+            rn->naddrs = 0;
+
+            if (rn->naddrs6 == (u_short) -1) {
+                goto next;
+            }
+
+            if (rn->naddrs6) {
+                goto export;
+            }
+        }
+#endif
+
+        code = NGX_RESOLVE_NXDOMAIN;
+    }
+
+    if (code) {
+
+#if (NGX_HAVE_INET6)
+        switch (qtype) {
+
+        case NGX_RESOLVE_AAAA:
+
+            rn->naddrs6 = 0;
+
+            if (rn->naddrs == (u_short) -1) {
+                rn->code = (u_char) code;
+                goto next;
+            }
+
+            break;
+
+        default: /* NGX_RESOLVE_A */
+
+            rn->naddrs = 0;
+
+            if (rn->naddrs6 == (u_short) -1) {
+                rn->code = (u_char) code;
+                goto next;
+            }
+        }
+#endif
+
+        next = rn->waiting;
+        rn->waiting = NULL;
+
+        ngx_queue_remove(&rn->queue);
+
+        ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+
+        ngx_resolver_free_node(r, rn);
+
+        /* unlock name mutex */
+
+        while (next) {
+            ctx = next;
+            ctx->state = code;
+            next = ctx->next;
+
+            ctx->handler(ctx);
+        }
+
+        return;
+    }
+
+    i = ans;
+    naddrs = 0;
+    cname = NULL;
+
+    for (a = 0; a < nan; a++) {
+
+        start = i;
+
+        while (i < last) {
+
+            if (buf[i] & 0xc0) {
+                i += 2;
+                goto found;
+            }
+
+            if (buf[i] == 0) {
+                i++;
+                goto test_length;
+            }
+
+            i += 1 + buf[i];
+        }
+
+        goto short_response;
+
+    test_length:
+
+        if (i - start < 2) {
+            err = "invalid name in DNS response";
+            goto invalid;
+        }
+
+    found:
+
+        if (i + sizeof(ngx_resolver_an_t) >= last) {
+            goto short_response;
+        }
+
+        an = (ngx_resolver_an_t *) &buf[i];
+
+        type = (an->type_hi << 8) + an->type_lo;
+        class = (an->class_hi << 8) + an->class_lo;
+        len = (an->len_hi << 8) + an->len_lo;
+        ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
+            + (an->ttl[2] << 8) + (an->ttl[3]);
+
+        if (class != 1) {
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected RR class %ui", class);
+            goto failed;
+        }
+
+        if (ttl < 0) {
+            ttl = 0;
+        }
+
+        rn->ttl = ngx_min(rn->ttl, (uint32_t) ttl);
+
+        i += sizeof(ngx_resolver_an_t);
+
+        switch (type) {
+
+        case NGX_RESOLVE_A:
+
+            if (qtype != NGX_RESOLVE_A) {
+                err = "unexpected A record in DNS response";
+                goto invalid;
+            }
+
+            if (len != 4) {
+                err = "invalid A record in DNS response";
+                goto invalid;
+            }
+
+            if (i + 4 > last) {
+                goto short_response;
+            }
+
+            naddrs++;
+
+            break;
+
+#if (NGX_HAVE_INET6)
+        case NGX_RESOLVE_AAAA:
+
+            if (qtype != NGX_RESOLVE_AAAA) {
+                err = "unexpected AAAA record in DNS response";
+                goto invalid;
+            }
+
+            if (len != 16) {
+                err = "invalid AAAA record in DNS response";
+                goto invalid;
+            }
+
+            if (i + 16 > last) {
+                goto short_response;
+            }
+
+            naddrs++;
+
+            break;
+#endif
+
+        case NGX_RESOLVE_CNAME:
+
+            cname = &buf[i];
+
+            break;
+
+        case NGX_RESOLVE_DNAME:
+
+            break;
+
+        default:
+
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected RR type %ui", type);
+        }
+
+        i += len;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver naddrs:%ui cname:%p ttl:%uD",
+                   naddrs, cname, rn->ttl);
+
+    if (naddrs) {
+
+        switch (qtype) {
+
+#if (NGX_HAVE_INET6)
+        case NGX_RESOLVE_AAAA:
+
+            if (naddrs == 1) {
+                addr6 = &rn->u6.addr6;
+                rn->naddrs6 = 1;
+
+            } else {
+                addr6 = ngx_resolver_alloc(r, naddrs * sizeof(struct in6_addr));
+                if (addr6 == NULL) {
+                    goto failed;
+                }
+
+                rn->u6.addrs6 = addr6;
+                rn->naddrs6 = (u_short) naddrs;
+            }
+
+#if (NGX_SUPPRESS_WARN)
+            addr = NULL;
+#endif
+
+            break;
+#endif
+
+        default: /* NGX_RESOLVE_A */
+
+            if (naddrs == 1) {
+                addr = &rn->u.addr;
+                rn->naddrs = 1;
+
+            } else {
+                addr = ngx_resolver_alloc(r, naddrs * sizeof(in_addr_t));
+                if (addr == NULL) {
+                    goto failed;
+                }
+
+                rn->u.addrs = addr;
+                rn->naddrs = (u_short) naddrs;
+            }
+
+#if (NGX_HAVE_INET6 && NGX_SUPPRESS_WARN)
+            addr6 = NULL;
+#endif
+        }
+
+        n = 0;
+        i = ans;
+
+        for (a = 0; a < nan; a++) {
+
+            for ( ;; ) {
+
+                if (buf[i] & 0xc0) {
+                    i += 2;
+                    break;
+                }
+
+                if (buf[i] == 0) {
+                    i++;
+                    break;
+                }
+
+                i += 1 + buf[i];
+            }
+
+            an = (ngx_resolver_an_t *) &buf[i];
+
+            type = (an->type_hi << 8) + an->type_lo;
+            len = (an->len_hi << 8) + an->len_lo;
+
+            i += sizeof(ngx_resolver_an_t);
+
+            if (type == NGX_RESOLVE_A) {
+
+                addr[n] = htonl((buf[i] << 24) + (buf[i + 1] << 16)
+                                + (buf[i + 2] << 8) + (buf[i + 3]));
+
+                if (++n == naddrs) {
+
+#if (NGX_HAVE_INET6)
+                    if (rn->naddrs6 == (u_short) -1) {
+                        goto next;
+                    }
+#endif
+
+                    break;
+                }
+            }
+
+#if (NGX_HAVE_INET6)
+            else if (type == NGX_RESOLVE_AAAA) {
+
+                ngx_memcpy(addr6[n].s6_addr, &buf[i], 16);
+
+                if (++n == naddrs) {
+
+                    if (rn->naddrs == (u_short) -1) {
+                        goto next;
+                    }
+
+                    break;
+                }
+            }
+#endif
+
+            i += len;
+        }
+    }
+
+    switch (qtype) {
+
+#if (NGX_HAVE_INET6)
+    case NGX_RESOLVE_AAAA:
+
+        if (rn->naddrs6 == (u_short) -1) {
+            rn->naddrs6 = 0;
+        }
+
+        break;
+#endif
+
+    default: /* NGX_RESOLVE_A */
+
+        if (rn->naddrs == (u_short) -1) {
+            rn->naddrs = 0;
+        }
+    }
+
+    if (rn->naddrs != (u_short) -1
+#if (NGX_HAVE_INET6)
+        && rn->naddrs6 != (u_short) -1
+#endif
+        && rn->naddrs
+#if (NGX_HAVE_INET6)
+           + rn->naddrs6
+#endif
+           > 0)
+    {
+
+#if (NGX_HAVE_INET6)
+    export:
+#endif
+
+        naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+        naddrs += rn->naddrs6;
+#endif
+
+        if (naddrs == 1 && rn->naddrs == 1) {
+            addrs = NULL;
+
+        } else {
+            addrs = ngx_resolver_export(r, rn, 0);
+            if (addrs == NULL) {
+                goto failed;
+            }
+        }
+
+        ngx_queue_remove(&rn->queue);
+
+        rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+        if (r->shm_zone) {
+            ngx_resolver_shared_set(r, rn);
+        }
+
+        next = rn->waiting;
+        rn->waiting = NULL;
+
+        /* unlock name mutex */
+
+        while (next) {
+            ctx = next;
+            ctx->state = NGX_OK;
+            ctx->naddrs = naddrs;
+
+            if (addrs == NULL) {
+                ctx->addrs = &ctx->addr;
+                ctx->addr.sockaddr = (struct sockaddr *) &ctx->sin;
+                ctx->addr.socklen = sizeof(struct sockaddr_in);
+                ngx_memzero(&ctx->sin, sizeof(struct sockaddr_in));
+                ctx->sin.sin_family = AF_INET;
+                ctx->sin.sin_addr.s_addr = rn->u.addr;
+
+            } else {
+                ctx->addrs = addrs;
+            }
+
+            next = ctx->next;
+
+            ctx->handler(ctx);
+        }
+
+        if (addrs != NULL) {
+            ngx_resolver_free(r, addrs->sockaddr);
+            ngx_resolver_free(r, addrs);
+        }
+
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+#if (NGX_HAVE_INET6)
+        rn->query6 = NULL;
+#endif
+
+        return;
+    }
+
+    if (cname) {
+
+        /* CNAME only */
+
+        if (rn->naddrs == (u_short) -1
+#if (NGX_HAVE_INET6)
+            || rn->naddrs6 == (u_short) -1
+#endif
+            )
+        {
+            goto next;
+        }
+
+        if (ngx_resolver_copy(r, &name, buf, cname, buf + last) != NGX_OK) {
+            goto failed;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver cname:\"%V\"", &name);
+
+        ngx_queue_remove(&rn->queue);
+
+        rn->cnlen = (u_short) name.len;
+        rn->u.cname = name.data;
+
+        rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+        if (r->shm_zone) {
+            ngx_resolver_shared_set(r, rn);
+        }
+
+        ctx = rn->waiting;
+        rn->waiting = NULL;
+
+        if (ctx) {
+            ctx->name = name;
+
+            (void) ngx_resolve_name_locked(r, ctx);
+        }
+
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+#if (NGX_HAVE_INET6)
+        rn->query6 = NULL;
+#endif
+
+        /* unlock name mutex */
+
+        return;
+    }
+
+    ngx_log_error(r->log_level, r->log, 0,
+                  "no A or CNAME types in DNS response");
+    return;
+
+short_response:
+
+    err = "short DNS response";
+
+invalid:
+
+    /* unlock name mutex */
+
+    ngx_log_error(r->log_level, r->log, 0, err);
+
+    return;
+
+failed:
+
+next:
+
+    /* unlock name mutex */
+
+    return;
+}
+
+
+static void
+ngx_resolver_process_ptr(ngx_resolver_t *r, u_char *buf, size_t n,
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan)
+{
+    char                 *err;
+    size_t                len;
+    u_char                text[NGX_SOCKADDR_STRLEN];
+    in_addr_t             addr;
+    int32_t               ttl;
+    ngx_int_t             octet;
+    ngx_str_t             name;
+    ngx_uint_t            i, mask, qident, class;
+    ngx_queue_t          *expire_queue;
+    ngx_rbtree_t         *tree;
+    ngx_resolver_an_t    *an;
+    ngx_resolver_ctx_t   *ctx, *next;
+    ngx_resolver_node_t  *rn;
+#if (NGX_HAVE_INET6)
+    uint32_t              hash;
+    ngx_int_t             digit;
+    struct in6_addr       addr6;
+#endif
+
+    if (ngx_resolver_copy(r, NULL, buf,
+                          buf + sizeof(ngx_resolver_hdr_t), buf + n)
+        != NGX_OK)
+    {
+        return;
+    }
+
+    /* AF_INET */
+
+    addr = 0;
+    i = sizeof(ngx_resolver_hdr_t);
+
+    for (mask = 0; mask < 32; mask += 8) {
+        len = buf[i++];
+
+        octet = ngx_atoi(&buf[i], len);
+        if (octet == NGX_ERROR || octet > 255) {
+            goto invalid_in_addr_arpa;
+        }
+
+        addr += octet << mask;
+        i += len;
+    }
+
+    if (ngx_strcasecmp(&buf[i], (u_char *) "\7in-addr\4arpa") == 0) {
+        i += sizeof("\7in-addr\4arpa");
+
+        /* lock addr mutex */
+
+        rn = ngx_resolver_lookup_addr(r, addr);
+
+        tree = &r->addr_rbtree;
+        expire_queue = &r->addr_expire_queue;
+
+        addr = htonl(addr);
+        name.len = ngx_inet_ntop(AF_INET, &addr, text, NGX_SOCKADDR_STRLEN);
+        name.data = text;
+
+        goto valid;
+    }
+
+invalid_in_addr_arpa:
+
+#if (NGX_HAVE_INET6)
+
+    i = sizeof(ngx_resolver_hdr_t);
+
+    for (octet = 15; octet >= 0; octet--) {
+        if (buf[i++] != '\1') {
+            goto invalid_ip6_arpa;
+        }
+
+        digit = ngx_hextoi(&buf[i++], 1);
+        if (digit == NGX_ERROR) {
+            goto invalid_ip6_arpa;
+        }
+
+        addr6.s6_addr[octet] = (u_char) digit;
+
+        if (buf[i++] != '\1') {
+            goto invalid_ip6_arpa;
+        }
+
+        digit = ngx_hextoi(&buf[i++], 1);
+        if (digit == NGX_ERROR) {
+            goto invalid_ip6_arpa;
+        }
+
+        addr6.s6_addr[octet] += (u_char) (digit * 16);
+    }
+
+    if (ngx_strcasecmp(&buf[i], (u_char *) "\3ip6\4arpa") == 0) {
+        i += sizeof("\3ip6\4arpa");
+
+        /* lock addr mutex */
+
+        hash = ngx_crc32_short(addr6.s6_addr, 16);
+        rn = ngx_resolver_lookup_addr6(r, &addr6, hash);
+
+        tree = &r->addr6_rbtree;
+        expire_queue = &r->addr6_expire_queue;
+
+        name.len = ngx_inet6_ntop(addr6.s6_addr, text, NGX_SOCKADDR_STRLEN);
+        name.data = text;
+
+        goto valid;
+    }
+
+invalid_ip6_arpa:
+#endif
+
+    ngx_log_error(r->log_level, r->log, 0,
+                  "invalid in-addr.arpa or ip6.arpa name in DNS response");
+    return;
+
+valid:
+
+    if (rn == NULL || rn->query == NULL) {
+        if (!r->parallel) {
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected response for %V", &name);
+        }
+
+        goto failed;
+    }
+
+    qident = (rn->query[0] << 8) + rn->query[1];
+
+    if (ident != qident) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "wrong ident %ui response for %V, expect %ui",
+                      ident, &name, qident);
+        goto failed;
+    }
+
+    if (code == 0 && nan == 0) {
+        code = NGX_RESOLVE_NXDOMAIN;
+    }
+
+    if (code && ngx_resolver_parallel_wait(r, rn, NGX_RESOLVE_PTR, code)) {
+        return;
+    }
+
+    if (code) {
+        next = rn->waiting;
+        rn->waiting = NULL;
+
+        ngx_queue_remove(&rn->queue);
+
+        ngx_rbtree_delete(tree, &rn->node);
+
+        ngx_resolver_free_node(r, rn);
+
+        /* unlock addr mutex */
+
+        while (next) {
+            ctx = next;
+            ctx->state = code;
+            next = ctx->next;
+
+            ctx->handler(ctx);
+        }
+
+        return;
+    }
+
+    i += sizeof(ngx_resolver_qs_t);
+
+    if (i + 2 + sizeof(ngx_resolver_an_t) >= n) {
+        goto short_response;
+    }
+
+    /* compression pointer to *.arpa */
+
+    if (buf[i] != 0xc0 || buf[i + 1] != sizeof(ngx_resolver_hdr_t)) {
+        err = "invalid in-addr.arpa or ip6.arpa name in DNS response";
+        goto invalid;
+    }
+
+    an = (ngx_resolver_an_t *) &buf[i + 2];
+
+    class = (an->class_hi << 8) + an->class_lo;
+    len = (an->len_hi << 8) + an->len_lo;
+    ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
+        + (an->ttl[2] << 8) + (an->ttl[3]);
+
+    if (class != 1) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "unexpected RR class %ui", class);
+        goto failed;
+    }
+
+    if (ttl < 0) {
+        ttl = 0;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                  "resolver qt:%ui cl:%ui len:%uz",
+                  (an->type_hi << 8) + an->type_lo,
+                  class, len);
+
+    i += 2 + sizeof(ngx_resolver_an_t);
+
+    if (i + len > n) {
+        goto short_response;
+    }
+
+    if (ngx_resolver_copy(r, &name, buf, buf + i, buf + n) != NGX_OK) {
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver an:%V", &name);
+
+    if (name.len != (size_t) rn->nlen
+        || ngx_strncmp(name.data, rn->name, name.len) != 0)
+    {
+        if (rn->nlen) {
+            ngx_resolver_free(r, rn->name);
+        }
+
+        rn->nlen = (u_short) name.len;
+        rn->name = name.data;
+
+        name.data = ngx_resolver_dup(r, rn->name, name.len);
+        if (name.data == NULL) {
+            goto failed;
+        }
+    }
+
+    ngx_queue_remove(&rn->queue);
+
+    rn->valid = ngx_time() + (r->valid ? r->valid : ttl);
+    rn->expire = ngx_time() + r->expire;
+
+    ngx_queue_insert_head(expire_queue, &rn->queue);
+
+    next = rn->waiting;
+    rn->waiting = NULL;
+
+    /* unlock addr mutex */
+
+    while (next) {
+        ctx = next;
+        ctx->state = NGX_OK;
+        ctx->name = name;
+        next = ctx->next;
+
+        ctx->handler(ctx);
+    }
+
+    ngx_resolver_free(r, name.data);
+
+    return;
+
+short_response:
+
+    err = "short DNS response";
+
+invalid:
+
+    /* unlock addr mutex */
+
+    ngx_log_error(r->log_level, r->log, 0, err);
+
+    return;
+
+failed:
+
+    /* unlock addr mutex */
+
+    return;
+}
+
+
+static void
+ngx_resolver_process_srv(ngx_resolver_t *r, u_char *buf, size_t last,
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan, ngx_uint_t ans)
+{
+    char                 *err;
+    size_t                len;
+    int32_t               ttl;
+    uint32_t              hash;
+    ngx_str_t             name;
+    ngx_uint_t            type, class, qident, nsrvs, a, i, start;
+    ngx_resolver_an_t    *an;
+    ngx_resolver_srv_t   *srvs;
+    ngx_resolver_ctx_t   *ctx, *next;
+    ngx_resolver_node_t  *rn;
+
+    if (ngx_resolver_copy(r, &name, buf,
+                          buf + sizeof(ngx_resolver_hdr_t), buf + last)
+        != NGX_OK)
+    {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver qs:%V", &name);
+
+    hash = ngx_crc32_short(name.data, name.len);
+
+    /* lock srv mutex */
+
+    rn = ngx_resolver_lookup_srv(r, &name, hash);
+
+    if (rn == NULL || rn->query == NULL || rn->naddrs != (u_short) -1) {
+        if (!r->parallel) {
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected response for %V", &name);
+        }
+
+        ngx_resolver_free(r, name.data);
+        return;
+    }
+
+    qident = (rn->query[0] << 8) + rn->query[1];
+
+    if (ident != qident) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "wrong ident %ui response for %V, expect %ui",
+                      ident, &name, qident);
+        ngx_resolver_free(r, name.data);
+        return;
+    }
+
+    ngx_resolver_free(r, name.data);
+
+    if (code == 0 && nan == 0) {
+        code = NGX_RESOLVE_NXDOMAIN;
+    }
+
+    if (code && ngx_resolver_parallel_wait(r, rn, NGX_RESOLVE_SRV, code)) {
+        return;
+    }
+
+    if (code) {
+        goto dns_error;
+    }
+
+    srvs = ngx_resolver_calloc(r, nan * sizeof(ngx_resolver_srv_t));
+    if (srvs == NULL) {
+        return;
+    }
+
+    i = ans;
+    nsrvs = 0;
+
+    for (a = 0; a < nan; a++) {
+
+        start = i;
+
+        while (i < last) {
+
+            if (buf[i] & 0xc0) {
+                i += 2;
+                goto found;
+            }
+
+            if (buf[i] == 0) {
+                i++;
+                goto test_length;
+            }
+
+            i += 1 + buf[i];
+        }
+
+        goto short_response;
+
+    test_length:
+
+        if (i - start < 2) {
+            err = "invalid name in DNS response";
+            goto invalid;
+        }
+
+    found:
+
+        if (i + sizeof(ngx_resolver_an_t) >= last) {
+            goto short_response;
+        }
+
+        an = (ngx_resolver_an_t *) &buf[i];
+
+        type = (an->type_hi << 8) + an->type_lo;
+        class = (an->class_hi << 8) + an->class_lo;
+        len = (an->len_hi << 8) + an->len_lo;
+        ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
+            + (an->ttl[2] << 8) + (an->ttl[3]);
+
+        if (class != 1) {
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected RR class %ui", class);
+            goto failed;
+        }
 
-        if (rn->naddrs6 == (u_short) -1) {
-            rn->naddrs6 = 0;
+        if (ttl < 0) {
+            ttl = 0;
         }
 
-        break;
-#endif
+        rn->ttl = ngx_min(rn->ttl, (uint32_t) ttl);
 
-    default: /* NGX_RESOLVE_A */
+        i += sizeof(ngx_resolver_an_t);
 
-        if (rn->naddrs == (u_short) -1) {
-            rn->naddrs = 0;
+        if (i + len > last) {
+            goto short_response;
         }
-    }
-
-    if (rn->naddrs != (u_short) -1
-#if (NGX_HAVE_INET6)
-        && rn->naddrs6 != (u_short) -1
-#endif
-        && rn->naddrs
-#if (NGX_HAVE_INET6)
-           + rn->naddrs6
-#endif
-           > 0)
-    {
 
-#if (NGX_HAVE_INET6)
-    export:
-#endif
+        switch (type) {
 
-        naddrs = rn->naddrs;
-#if (NGX_HAVE_INET6)
-        naddrs += rn->naddrs6;
-#endif
+        case NGX_RESOLVE_SRV:
 
-        if (naddrs == 1 && rn->naddrs == 1) {
-            addrs = NULL;
+            if (len < 7) {
+                err = "invalid SRV record in DNS response";
+                goto invalid;
+            }
 
-        } else {
-            addrs = ngx_resolver_export(r, rn, 0);
-            if (addrs == NULL) {
+            if (ngx_resolver_copy(r, &srvs[nsrvs].name, buf, &buf[i + 6],
+                                  buf + last)
+                != NGX_OK)
+            {
                 goto failed;
             }
-        }
 
-        ngx_queue_remove(&rn->queue);
-
-        rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
-        rn->expire = ngx_time() + r->expire;
+            /* the "." target means that the service is not available */
 
-        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+            if (srvs[nsrvs].name.len == 0) {
+                break;
+            }
 
-        next = rn->waiting;
-        rn->waiting = NULL;
+            srvs[nsrvs].priority = (buf[i] << 8) + buf[i + 1];
+            srvs[nsrvs].weight = (buf[i + 2] << 8) + buf[i + 3];
+            srvs[nsrvs].port = (buf[i + 4] << 8) + buf[i + 5];
 
-        /* unlock name mutex */
+            nsrvs++;
 
-        while (next) {
-            ctx = next;
-            ctx->state = NGX_OK;
-            ctx->naddrs = naddrs;
+            break;
 
-            if (addrs == NULL) {
-                ctx->addrs = &ctx->addr;
-                ctx->addr.sockaddr = (struct sockaddr *) &ctx->sin;
-                ctx->addr.socklen = sizeof(struct sockaddr_in);
-                ngx_memzero(&ctx->sin, sizeof(struct sockaddr_in));
-                ctx->sin.sin_family = AF_INET;
-                ctx->sin.sin_addr.s_addr = rn->u.addr;
+        case NGX_RESOLVE_CNAME:
+        case NGX_RESOLVE_DNAME:
 
-            } else {
-                ctx->addrs = addrs;
-            }
+            break;
 
-            next = ctx->next;
+        default:
 
-            ctx->handler(ctx);
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected RR type %ui", type);
         }
 
-        if (addrs != NULL) {
-            ngx_resolver_free(r, addrs->sockaddr);
-            ngx_resolver_free(r, addrs);
-        }
+        i += len;
+    }
 
-        ngx_resolver_free(r, rn->query);
-        rn->query = NULL;
-#if (NGX_HAVE_INET6)
-        rn->query6 = NULL;
-#endif
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver nsrvs:%ui ttl:%uD", nsrvs, rn->ttl);
 
-        return;
+    if (nsrvs == 0) {
+        ngx_resolver_free(r, srvs);
+
+        code = NGX_RESOLVE_NXDOMAIN;
+        goto dns_error;
     }
 
-    if (cname) {
+    ngx_sort(srvs, nsrvs, sizeof(ngx_resolver_srv_t), ngx_resolver_cmp_srvs);
 
-        /* CNAME only */
+    rn->u.srvs = srvs;
+    rn->nsrvs = (u_short) nsrvs;
+    rn->naddrs = 0;
 
-        if (rn->naddrs == (u_short) -1
+    ngx_queue_remove(&rn->queue);
+
+    rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
+    rn->expire = ngx_time() + r->expire;
+
+    ngx_queue_insert_head(&r->srv_expire_queue, &rn->queue);
+
+    ngx_resolver_free(r, rn->query);
+    rn->query = NULL;
 #if (NGX_HAVE_INET6)
-            || rn->naddrs6 == (u_short) -1
+    rn->query6 = NULL;
 #endif
-            )
-        {
-            goto next;
-        }
 
-        if (ngx_resolver_copy(r, &name, buf, cname, buf + last) != NGX_OK) {
-            goto failed;
-        }
+    next = rn->waiting;
+    rn->waiting = NULL;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
-                       "resolver cname:\"%V\"", &name);
+    /* unlock srv mutex */
 
-        ngx_queue_remove(&rn->queue);
+    while (next) {
+        ctx = next;
+        ctx->state = NGX_OK;
+        ctx->nsrvs = nsrvs;
+        ctx->srvs = srvs;
+        next = ctx->next;
 
-        rn->cnlen = (u_short) name.len;
-        rn->u.cname = name.data;
+        ctx->handler(ctx);
+    }
 
-        rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
-        rn->expire = ngx_time() + r->expire;
+    return;
 
-        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+dns_error:
 
-        ctx = rn->waiting;
-        rn->waiting = NULL;
+    next = rn->waiting;
+    rn->waiting = NULL;
 
-        if (ctx) {
-            ctx->name = name;
+    ngx_queue_remove(&rn->queue);
 
-            (void) ngx_resolve_name_locked(r, ctx);
-        }
+    ngx_rbtree_delete(&r->srv_rbtree, &rn->node);
 
-        ngx_resolver_free(r, rn->query);
-        rn->query = NULL;
-#if (NGX_HAVE_INET6)
-        rn->query6 = NULL;
-#endif
+    ngx_resolver_free_node(r, rn);
 
-        /* unlock name mutex */
+    /* unlock srv mutex */
 
-        return;
+    while (next) {
+        ctx = next;
+        ctx->state = code;
+        next = ctx->next;
+
+        ctx->handler(ctx);
     }
 
-    ngx_log_error(r->log_level, r->log, 0,
-                  "no A or CNAME types in DNS response");
     return;
 
 short_response:
@@ -1980,301 +3341,351 @@ short_response:
 
 invalid:
 
-    /* unlock name mutex */
-
     ngx_log_error(r->log_level, r->log, 0, err);
 
-    return;
-
 failed:
 
-next:
+    /* unlock srv mutex */
 
-    /* unlock name mutex */
+    while (nsrvs) {
+        ngx_resolver_free(r, srvs[--nsrvs].name.data);
+    }
+
+    ngx_resolver_free(r, srvs);
 
     return;
 }
 
 
-static void
-ngx_resolver_process_ptr(ngx_resolver_t *r, u_char *buf, size_t n,
-    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan)
+static ngx_int_t
+ngx_resolver_cmp_srvs(const void *one, const void *two)
 {
-    char                 *err;
-    size_t                len;
-    u_char                text[NGX_SOCKADDR_STRLEN];
-    in_addr_t             addr;
-    int32_t               ttl;
-    ngx_int_t             octet;
-    ngx_str_t             name;
-    ngx_uint_t            i, mask, qident, class;
-    ngx_queue_t          *expire_queue;
-    ngx_rbtree_t         *tree;
-    ngx_resolver_an_t    *an;
-    ngx_resolver_ctx_t   *ctx, *next;
-    ngx_resolver_node_t  *rn;
-#if (NGX_HAVE_INET6)
-    uint32_t              hash;
-    ngx_int_t             digit;
-    struct in6_addr       addr6;
-#endif
+    ngx_resolver_srv_t  *first, *second;
 
-    if (ngx_resolver_copy(r, NULL, buf,
-                          buf + sizeof(ngx_resolver_hdr_t), buf + n)
-        != NGX_OK)
-    {
-        return;
-    }
+    first = (ngx_resolver_srv_t *) one;
+    second = (ngx_resolver_srv_t *) two;
 
-    /* AF_INET */
+    return first->priority - second->priority;
+}
 
-    addr = 0;
-    i = sizeof(ngx_resolver_hdr_t);
 
-    for (mask = 0; mask < 32; mask += 8) {
-        len = buf[i++];
+static ngx_int_t
+ngx_resolver_shared_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_shared_t  *osh = data;
 
-        octet = ngx_atoi(&buf[i], len);
-        if (octet == NGX_ERROR || octet > 255) {
-            goto invalid_in_addr_arpa;
-        }
+    size_t                  len;
+    ngx_slab_pool_t        *shpool;
+    ngx_resolver_shared_t  *sh;
 
-        addr += octet << mask;
-        i += len;
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
     }
 
-    if (ngx_strcasecmp(&buf[i], (u_char *) "\7in-addr\4arpa") == 0) {
-        i += sizeof("\7in-addr\4arpa");
-
-        /* lock addr mutex */
-
-        rn = ngx_resolver_lookup_addr(r, addr);
-
-        tree = &r->addr_rbtree;
-        expire_queue = &r->addr_expire_queue;
-
-        addr = htonl(addr);
-        name.len = ngx_inet_ntop(AF_INET, &addr, text, NGX_SOCKADDR_STRLEN);
-        name.data = text;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-        goto valid;
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
     }
 
-invalid_in_addr_arpa:
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_resolver_shared_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
 
-#if (NGX_HAVE_INET6)
+    shpool->data = sh;
+    shm_zone->data = sh;
 
-    i = sizeof(ngx_resolver_hdr_t);
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel, ngx_str_rbtree_insert_value);
 
-    for (octet = 15; octet >= 0; octet--) {
-        if (buf[i++] != '\1') {
-            goto invalid_ip6_arpa;
-        }
+    ngx_queue_init(&sh->queue);
 
-        digit = ngx_hextoi(&buf[i++], 1);
-        if (digit == NGX_ERROR) {
-            goto invalid_ip6_arpa;
-        }
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
 
-        addr6.s6_addr[octet] = (u_char) digit;
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
 
-        if (buf[i++] != '\1') {
-            goto invalid_ip6_arpa;
-        }
+    ngx_sprintf(shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
 
-        digit = ngx_hextoi(&buf[i++], 1);
-        if (digit == NGX_ERROR) {
-            goto invalid_ip6_arpa;
-        }
+    /* the least recently used answers are evicted when the zone is full */
 
-        addr6.s6_addr[octet] += (u_char) (digit * 16);
-    }
+    shpool->log_nomem = 0;
 
-    if (ngx_strcasecmp(&buf[i], (u_char *) "\3ip6\4arpa") == 0) {
-        i += sizeof("\3ip6\4arpa");
+    return NGX_OK;
+}
 
-        /* lock addr mutex */
 
-        hash = ngx_crc32_short(addr6.s6_addr, 16);
-        rn = ngx_resolver_lookup_addr6(r, &addr6, hash);
+static ngx_int_t
+ngx_resolver_shared_get(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                      *p, *cname;
+    time_t                       now, valid;
+    ngx_str_t                    name;
+    ngx_uint_t                   naddrs, cnlen;
+    in_addr_t                   *addrs;
+    ngx_slab_pool_t             *shpool;
+    ngx_resolver_shared_t       *sh;
+    ngx_resolver_shared_node_t  *sn;
+#if (NGX_HAVE_INET6)
+    ngx_uint_t                   naddrs6;
+    struct in6_addr             *addrs6;
+#endif
 
-        tree = &r->addr6_rbtree;
-        expire_queue = &r->addr6_expire_queue;
+    sh = r->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
 
-        name.len = ngx_inet6_ntop(addr6.s6_addr, text, NGX_SOCKADDR_STRLEN);
-        name.data = text;
+    name.len = rn->nlen;
+    name.data = rn->name;
 
-        goto valid;
-    }
+    now = ngx_time();
 
-invalid_ip6_arpa:
+    addrs = NULL;
+    cname = NULL;
+#if (NGX_HAVE_INET6)
+    addrs6 = NULL;
 #endif
 
-    ngx_log_error(r->log_level, r->log, 0,
-                  "invalid in-addr.arpa or ip6.arpa name in DNS response");
-    return;
+    ngx_shmtx_lock(&shpool->mutex);
 
-valid:
+    sn = (ngx_resolver_shared_node_t *)
+             ngx_str_rbtree_lookup(&sh->rbtree, &name, rn->node.key);
 
-    if (rn == NULL || rn->query == NULL) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "unexpected response for %V", &name);
+    if (sn == NULL) {
         goto failed;
     }
 
-    qident = (rn->query[0] << 8) + rn->query[1];
-
-    if (ident != qident) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "wrong ident %ui response for %V, expect %ui",
-                      ident, &name, qident);
+    if (sn->valid < now) {
+        ngx_rbtree_delete(&sh->rbtree, &sn->sn.node);
+        ngx_queue_remove(&sn->queue);
+        ngx_slab_free_locked(shpool, sn);
         goto failed;
     }
 
-    if (code == 0 && nan == 0) {
-        code = NGX_RESOLVE_NXDOMAIN;
-    }
+    naddrs = sn->naddrs;
+    cnlen = sn->cnlen;
+    valid = sn->valid;
 
-    if (code) {
-        next = rn->waiting;
-        rn->waiting = NULL;
+    p = sn->data;
 
-        ngx_queue_remove(&rn->queue);
+    if (naddrs > 1) {
+        addrs = ngx_resolver_alloc(r, naddrs * sizeof(in_addr_t));
+        if (addrs == NULL) {
+            goto failed;
+        }
 
-        ngx_rbtree_delete(tree, &rn->node);
+        ngx_memcpy(addrs, p, naddrs * sizeof(in_addr_t));
 
-        ngx_resolver_free_node(r, rn);
+    } else if (naddrs == 1) {
+        ngx_memcpy(&rn->u.addr, p, sizeof(in_addr_t));
+    }
 
-        /* unlock addr mutex */
+    p += naddrs * sizeof(in_addr_t);
 
-        while (next) {
-            ctx = next;
-            ctx->state = code;
-            next = ctx->next;
+#if (NGX_HAVE_INET6)
+    naddrs6 = sn->naddrs6;
 
-            ctx->handler(ctx);
+    if (naddrs6 > 1) {
+        addrs6 = ngx_resolver_alloc(r, naddrs6 * sizeof(struct in6_addr));
+        if (addrs6 == NULL) {
+            goto failed;
         }
 
-        return;
+        ngx_memcpy(addrs6, p, naddrs6 * sizeof(struct in6_addr));
+
+    } else if (naddrs6 == 1) {
+        ngx_memcpy(&rn->u6.addr6, p, sizeof(struct in6_addr));
     }
+#endif
 
-    i += sizeof(ngx_resolver_qs_t);
+    p += sn->naddrs6 * 16 + sn->sn.str.len;
 
-    if (i + 2 + sizeof(ngx_resolver_an_t) >= n) {
-        goto short_response;
+    if (cnlen) {
+        cname = ngx_resolver_alloc(r, cnlen);
+        if (cname == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(cname, p, cnlen);
     }
 
-    /* compression pointer to *.arpa */
+    ngx_queue_remove(&sn->queue);
+    ngx_queue_insert_head(&sh->queue, &sn->queue);
 
-    if (buf[i] != 0xc0 || buf[i + 1] != sizeof(ngx_resolver_hdr_t)) {
-        err = "invalid in-addr.arpa or ip6.arpa name in DNS response";
-        goto invalid;
-    }
+    ngx_shmtx_unlock(&shpool->mutex);
 
-    an = (ngx_resolver_an_t *) &buf[i + 2];
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve shared \"%V\"", &name);
 
-    class = (an->class_hi << 8) + an->class_lo;
-    len = (an->len_hi << 8) + an->len_lo;
-    ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
-        + (an->ttl[2] << 8) + (an->ttl[3]);
+    rn->naddrs = (u_short) naddrs;
 
-    if (class != 1) {
-        ngx_log_error(r->log_level, r->log, 0,
-                      "unexpected RR class %ui", class);
-        goto failed;
+    if (naddrs > 1) {
+        rn->u.addrs = addrs;
     }
 
-    if (ttl < 0) {
-        ttl = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = (u_short) naddrs6;
+
+    if (naddrs6 > 1) {
+        rn->u6.addrs6 = addrs6;
     }
+#endif
 
-    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
-                  "resolver qt:%ui cl:%ui len:%uz",
-                  (an->type_hi << 8) + an->type_lo,
-                  class, len);
+    rn->cnlen = (u_short) cnlen;
 
-    i += 2 + sizeof(ngx_resolver_an_t);
+    if (cnlen) {
+        rn->u.cname = cname;
+    }
 
-    if (i + len > n) {
-        goto short_response;
+    rn->code = 0;
+    rn->valid = valid;
+    rn->ttl = (uint32_t) (valid - now);
+    rn->expire = now + r->expire;
+    rn->waiting = NULL;
+
+    ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (addrs) {
+        ngx_resolver_free(r, addrs);
     }
 
-    if (ngx_resolver_copy(r, &name, buf, buf + i, buf + n) != NGX_OK) {
-        goto failed;
+#if (NGX_HAVE_INET6)
+    if (addrs6) {
+        ngx_resolver_free(r, addrs6);
     }
+#endif
 
-    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver an:%V", &name);
+    return NGX_DECLINED;
+}
 
-    if (name.len != (size_t) rn->nlen
-        || ngx_strncmp(name.data, rn->name, name.len) != 0)
-    {
-        if (rn->nlen) {
-            ngx_resolver_free(r, rn->name);
-        }
 
-        rn->nlen = (u_short) name.len;
-        rn->name = name.data;
+static void
+ngx_resolver_shared_set(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                      *p;
+    size_t                       size;
+    ngx_str_t                    name;
+    ngx_uint_t                   naddrs, naddrs6;
+    in_addr_t                   *addrs;
+    ngx_queue_t                 *q;
+    ngx_slab_pool_t             *shpool;
+    ngx_resolver_shared_t       *sh;
+    ngx_resolver_shared_node_t  *sn;
+#if (NGX_HAVE_INET6)
+    struct in6_addr             *addrs6;
+#endif
 
-        name.data = ngx_resolver_dup(r, rn->name, name.len);
-        if (name.data == NULL) {
-            goto failed;
-        }
-    }
+    sh = r->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
 
-    ngx_queue_remove(&rn->queue);
+    name.len = rn->nlen;
+    name.data = rn->name;
 
-    rn->valid = ngx_time() + (r->valid ? r->valid : ttl);
-    rn->expire = ngx_time() + r->expire;
+    naddrs = (rn->naddrs == (u_short) -1) ? 0 : rn->naddrs;
+    addrs = (naddrs == 1) ? &rn->u.addr : rn->u.addrs;
 
-    ngx_queue_insert_head(expire_queue, &rn->queue);
+#if (NGX_HAVE_INET6)
+    naddrs6 = (rn->naddrs6 == (u_short) -1) ? 0 : rn->naddrs6;
+    addrs6 = (naddrs6 == 1) ? &rn->u6.addr6 : rn->u6.addrs6;
+#else
+    naddrs6 = 0;
+#endif
 
-    next = rn->waiting;
-    rn->waiting = NULL;
+    size = offsetof(ngx_resolver_shared_node_t, data)
+           + naddrs * sizeof(in_addr_t) + naddrs6 * 16
+           + rn->nlen + rn->cnlen;
 
-    /* unlock addr mutex */
+    ngx_shmtx_lock(&shpool->mutex);
 
-    while (next) {
-        ctx = next;
-        ctx->state = NGX_OK;
-        ctx->name = name;
-        next = ctx->next;
+    sn = (ngx_resolver_shared_node_t *)
+             ngx_str_rbtree_lookup(&sh->rbtree, &name, rn->node.key);
 
-        ctx->handler(ctx);
+    if (sn) {
+        ngx_rbtree_delete(&sh->rbtree, &sn->sn.node);
+        ngx_queue_remove(&sn->queue);
+        ngx_slab_free_locked(shpool, sn);
     }
 
-    ngx_resolver_free(r, name.data);
+    for ( ;; ) {
+        sn = ngx_slab_alloc_locked(shpool, size);
+        if (sn) {
+            break;
+        }
 
-    return;
+        if (ngx_queue_empty(&sh->queue)) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
 
-short_response:
+        q = ngx_queue_last(&sh->queue);
+        ngx_queue_remove(q);
 
-    err = "short DNS response";
+        sn = ngx_queue_data(q, ngx_resolver_shared_node_t, queue);
 
-invalid:
+        ngx_rbtree_delete(&sh->rbtree, &sn->sn.node);
+        ngx_slab_free_locked(shpool, sn);
+    }
 
-    /* unlock addr mutex */
+    sn->sn.node.key = rn->node.key;
+    sn->valid = rn->valid;
+    sn->naddrs = (u_short) naddrs;
+    sn->naddrs6 = (u_short) naddrs6;
+    sn->cnlen = rn->cnlen;
 
-    ngx_log_error(r->log_level, r->log, 0, err);
+    p = ngx_cpymem(sn->data, addrs, naddrs * sizeof(in_addr_t));
+#if (NGX_HAVE_INET6)
+    p = ngx_cpymem(p, addrs6, naddrs6 * sizeof(struct in6_addr));
+#endif
 
-    return;
+    sn->sn.str.len = rn->nlen;
+    sn->sn.str.data = p;
 
-failed:
+    p = ngx_cpymem(p, rn->name, rn->nlen);
 
-    /* unlock addr mutex */
+    if (rn->cnlen) {
+        ngx_memcpy(p, rn->u.cname, rn->cnlen);
+    }
 
-    return;
+    ngx_rbtree_insert(&sh->rbtree, &sn->sn.node);
+    ngx_queue_insert_head(&sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
 }
 
 
 static ngx_resolver_node_t *
 ngx_resolver_lookup_name(ngx_resolver_t *r, ngx_str_t *name, uint32_t hash)
+{
+    return ngx_resolver_lookup_node(&r->name_rbtree, name, hash);
+}
+
+
+static ngx_resolver_node_t *
+ngx_resolver_lookup_srv(ngx_resolver_t *r, ngx_str_t *name, uint32_t hash)
+{
+    return ngx_resolver_lookup_node(&r->srv_rbtree, name, hash);
+}
+
+
+static ngx_resolver_node_t *
+ngx_resolver_lookup_node(ngx_rbtree_t *tree, ngx_str_t *name, uint32_t hash)
 {
     ngx_int_t             rc;
     ngx_rbtree_node_t    *node, *sentinel;
     ngx_resolver_node_t  *rn;
 
-    node = r->name_rbtree.root;
-    sentinel = r->name_rbtree.sentinel;
+    node = tree->root;
+    sentinel = tree->sentinel;
 
     while (node != sentinel) {
 
@@ -2693,6 +4104,93 @@ ngx_resolver_create_addr_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
 }
 
 
+static ngx_int_t
+ngx_resolver_create_srv_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
+{
+    u_char              *p, *s;
+    size_t               len, nlen;
+    ngx_uint_t           ident;
+    ngx_resolver_qs_t   *qs;
+    ngx_resolver_hdr_t  *query;
+
+    nlen = ctx->name.len ? (1 + ctx->name.len + 1) : 1;
+
+    len = sizeof(ngx_resolver_hdr_t) + nlen + sizeof(ngx_resolver_qs_t);
+
+    p = ngx_resolver_alloc(ctx->resolver, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    rn->qlen = (u_short) len;
+    rn->query = p;
+
+    query = (ngx_resolver_hdr_t *) p;
+
+    ident = ngx_random();
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->resolver->log, 0,
+                   "resolve: \"%V\" SRV %i", &ctx->name, ident & 0xffff);
+
+    query->ident_hi = (u_char) ((ident >> 8) & 0xff);
+    query->ident_lo = (u_char) (ident & 0xff);
+
+    /* recursion query */
+    query->flags_hi = 1; query->flags_lo = 0;
+
+    /* one question */
+    query->nqs_hi = 0; query->nqs_lo = 1;
+    query->nan_hi = 0; query->nan_lo = 0;
+    query->nns_hi = 0; query->nns_lo = 0;
+    query->nar_hi = 0; query->nar_lo = 0;
+
+    p += sizeof(ngx_resolver_hdr_t) + nlen;
+
+    qs = (ngx_resolver_qs_t *) p;
+
+    /* query type */
+    qs->type_hi = 0; qs->type_lo = NGX_RESOLVE_SRV;
+
+    /* IN query class */
+    qs->class_hi = 0; qs->class_lo = 1;
+
+    /* convert "_http._tcp.example.com" to "\5_http\4_tcp\7example\3com\0" */
+
+    len = 0;
+    p--;
+    *p-- = '\0';
+
+    if (ctx->name.len == 0)  {
+        return NGX_DECLINED;
+    }
+
+    for (s = ctx->name.data + ctx->name.len - 1; s >= ctx->name.data; s--) {
+        if (*s != '.') {
+            *p = *s;
+            len++;
+
+        } else {
+            if (len == 0 || len > 255) {
+                return NGX_DECLINED;
+            }
+
+            *p = (u_char) len;
+            len = 0;
+        }
+
+        p--;
+    }
+
+    if (len == 0 || len > 255) {
+        return NGX_DECLINED;
+    }
+
+    *p = (u_char) len;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_resolver_copy(ngx_resolver_t *r, ngx_str_t *name, u_char *buf, u_char *src,
     u_char *last)
@@ -2788,6 +4286,39 @@ done:
 }
 
 
+static ngx_uint_t
+ngx_resolver_parallel_wait(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_uint_t qtype, ngx_uint_t code)
+{
+    u_short  *pending;
+
+    if (!r->parallel) {
+        return 0;
+    }
+
+#if (NGX_HAVE_INET6)
+    pending = (qtype == NGX_RESOLVE_AAAA) ? &rn->pending6 : &rn->pending;
+#else
+    pending = &rn->pending;
+#endif
+
+    if (*pending <= 1) {
+        /* the last server has answered */
+        return 0;
+    }
+
+    (*pending)--;
+
+    rn->failed = (u_char) (code ? code : NGX_RESOLVE_NXDOMAIN);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver error %ui for qt:%ui, waiting for %ud servers",
+                   code, qtype, *pending);
+
+    return 1;
+}
+
+
 static void
 ngx_resolver_timeout_handler(ngx_event_t *ev)
 {
@@ -2799,7 +4330,8 @@ ngx_resolver_timeout_handler(ngx_event_t *ev)
     rn->waiting = NULL;
 
     do {
-        ctx->state = NGX_RESOLVE_TIMEDOUT;
+        /* parallel: some servers have answered with an error */
+        ctx->state = rn->failed ? rn->failed : NGX_RESOLVE_TIMEDOUT;
         next = ctx->next;
 
         ctx->handler(ctx);
@@ -2812,6 +4344,8 @@ ngx_resolver_timeout_handler(ngx_event_t *ev)
 static void
 ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
 {
+    ngx_uint_t  i;
+
     /* lock alloc mutex */
 
     if (rn->query) {
@@ -2836,6 +4370,14 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
     }
 #endif
 
+    if (rn->nsrvs) {
+        for (i = 0; i < rn->nsrvs; i++) {
+            ngx_resolver_free_locked(r, rn->u.srvs[i].name.data);
+        }
+
+        ngx_resolver_free_locked(r, rn->u.srvs);
+    }
+
     ngx_resolver_free_locked(r, rn);
 
     /* unlock alloc mutex */
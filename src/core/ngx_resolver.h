@@ -21,6 +21,7 @@
 #if (NGX_HAVE_INET6)
 #define NGX_RESOLVE_AAAA      28
 #endif
+#define NGX_RESOLVE_SRV       33
 #define NGX_RESOLVE_DNAME     39
 
 #define NGX_RESOLVE_FORMERR   1
@@ -50,6 +51,14 @@ typedef struct ngx_resolver_ctx_s  ngx_resolver_ctx_t;
 typedef void (*ngx_resolver_handler_pt)(ngx_resolver_ctx_t *ctx);
 
 
+typedef struct {
+    ngx_str_t                 name;
+    u_short                   priority;
+    u_short                   weight;
+    u_short                   port;
+} ngx_resolver_srv_t;
+
+
 typedef struct {
     ngx_rbtree_node_t         node;
     ngx_queue_t               queue;
@@ -74,11 +83,15 @@ typedef struct {
         in_addr_t             addr;
         in_addr_t            *addrs;
         u_char               *cname;
+        ngx_resolver_srv_t   *srvs;
     } u;
 
     u_char                    code;
+    /* parallel: the error of the servers which answered so far */
+    u_char                    failed;
     u_short                   naddrs;
     u_short                   cnlen;
+    u_short                   nsrvs;
 
 #if (NGX_HAVE_INET6)
     union {
@@ -89,6 +102,13 @@ typedef struct {
     u_short                   naddrs6;
 #endif
 
+    /* parallel: the servers yet to answer the A, PTR, or SRV query */
+    u_short                   pending;
+#if (NGX_HAVE_INET6)
+    /* parallel: the servers yet to answer the AAAA query */
+    u_short                   pending6;
+#endif
+
     time_t                    expire;
     time_t                    valid;
     uint32_t                  ttl;
@@ -122,6 +142,17 @@ typedef struct {
     ngx_queue_t               name_expire_queue;
     ngx_queue_t               addr_expire_queue;
 
+    ngx_rbtree_t              srv_rbtree;
+    ngx_rbtree_node_t         srv_sentinel;
+    ngx_queue_t               srv_resend_queue;
+    ngx_queue_t               srv_expire_queue;
+
+    /* truncated responses being queried again over TCP */
+    ngx_queue_t               tcp_queue;
+
+    /* A, AAAA and CNAME answers shared between worker processes */
+    ngx_shm_zone_t           *shm_zone;
+
 #if (NGX_HAVE_INET6)
     ngx_uint_t                ipv6;                 /* unsigned  ipv6:1; */
     ngx_rbtree_t              addr6_rbtree;
@@ -135,6 +166,7 @@ typedef struct {
     time_t                    valid;
 
     ngx_uint_t                log_level;
+    ngx_uint_t                parallel;         /* unsigned  parallel:1; */
 } ngx_resolver_t;
 
 
@@ -154,6 +186,10 @@ struct ngx_resolver_ctx_s {
     ngx_addr_t                addr;
     struct sockaddr_in        sin;
 
+    /* valid only while the handler is called */
+    ngx_uint_t                nsrvs;
+    ngx_resolver_srv_t       *srvs;
+
     ngx_resolver_handler_pt   handler;
     void                     *data;
     ngx_msec_t                timeout;
@@ -172,6 +208,8 @@ ngx_int_t ngx_resolve_name(ngx_resolver_ctx_t *ctx);
 void ngx_resolve_name_done(ngx_resolver_ctx_t *ctx);
 ngx_int_t ngx_resolve_addr(ngx_resolver_ctx_t *ctx);
 void ngx_resolve_addr_done(ngx_resolver_ctx_t *ctx);
+ngx_int_t ngx_resolve_srv(ngx_resolver_ctx_t *ctx);
+void ngx_resolve_srv_done(ngx_resolver_ctx_t *ctx);
 char *ngx_resolver_strerror(ngx_int_t err);
 
 
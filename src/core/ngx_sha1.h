@@ -14,6 +14,7 @@
 
 
 #if (NGX_HAVE_OPENSSL_SHA1_H)
+#define OPENSSL_SUPPRESS_DEPRECATED
 #include <openssl/sha.h>
 #else
 #include <sha.h>
@@ -135,6 +135,56 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 }
 
 
+ngx_slab_pool_t *
+ngx_slab_sub_pool(ngx_slab_pool_t *pool, size_t size)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    ngx_slab_pool_t  *sp;
+
+    /*
+     * a sub-pool is carved out of the pool's pages and has its own mutex,
+     * so the lock contention may be split between several sub-pools
+     */
+
+    size = ngx_align(size, ngx_pagesize);
+
+    if (size < 8 * ngx_pagesize) {
+        return NULL;
+    }
+
+    sp = ngx_slab_alloc(pool, size);
+    if (sp == NULL) {
+        return NULL;
+    }
+
+    /* the pages may be reused, the mutex must start unlocked */
+
+    ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+    sp->end = (u_char *) sp + size;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        ngx_slab_free(pool, sp);
+        return NULL;
+    }
+
+    ngx_slab_init(sp);
+
+    return sp;
+
+#else
+
+    /* the file locks are per zone */
+
+    return NULL;
+
+#endif
+}
+
+
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size) /*共享内存，加锁同步*/
 {
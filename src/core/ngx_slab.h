@@ -47,6 +47,7 @@ typedef struct {
 
 
 void ngx_slab_init(ngx_slab_pool_t *pool);
+ngx_slab_pool_t *ngx_slab_sub_pool(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
@@ -0,0 +1,686 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/* the number of messages sent with one sendmmsg() or writev() call */
+#define NGX_SYSLOG_BATCH  64
+
+
+static char *ngx_syslog_parse_args(ngx_conf_t *cf, ngx_syslog_peer_t *peer);
+static size_t ngx_syslog_send_stream(ngx_syslog_peer_t *peer, u_char *buf,
+    size_t len);
+static ngx_int_t ngx_syslog_keep(ngx_syslog_peer_t *peer, struct iovec *iov,
+    size_t sent);
+static ngx_int_t ngx_syslog_connect(ngx_syslog_peer_t *peer);
+static void ngx_syslog_close(ngx_syslog_peer_t *peer, ngx_err_t err,
+    const char *text);
+static void ngx_syslog_cleanup(void *data);
+
+
+static char  *facilities[] = {
+    "kern", "user", "mail", "daemon", "auth", "intern", "lpr", "news", "uucp",
+    "clock", "authpriv", "ftp", "ntp", "audit", "alert", "cron", "local0",
+    "local1", "local2", "local3", "local4", "local5", "local6", "local7",
+    NULL
+};
+
+/* note 'error/warn' like in nginx.conf, not 'err/warning' */
+static char  *severities[] = {
+    "emerg", "alert", "crit", "error", "warn", "notice", "info", "debug", NULL
+};
+
+
+char *
+ngx_syslog_process_conf(ngx_conf_t *cf, ngx_syslog_peer_t *peer)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    peer->facility = NGX_CONF_UNSET_UINT;
+    peer->severity = NGX_CONF_UNSET_UINT;
+
+    if (ngx_syslog_parse_args(cf, peer) != NGX_CONF_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (peer->server.sockaddr == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no syslog server specified");
+        return NGX_CONF_ERROR;
+    }
+
+    if (peer->facility == NGX_CONF_UNSET_UINT) {
+        peer->facility = 23; /* local7 */
+    }
+
+    if (peer->severity == NGX_CONF_UNSET_UINT) {
+        peer->severity = 6; /* info */
+    }
+
+    if (peer->tag.data == NULL) {
+        ngx_str_set(&peer->tag, "nginx");
+    }
+
+    peer->fd = (ngx_socket_t) -1;
+    peer->type = SOCK_DGRAM;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_syslog_cleanup;
+    cln->data = peer;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_syslog_parse_args(ngx_conf_t *cf, ngx_syslog_peer_t *peer)
+{
+    u_char      *p, *comma, c;
+    size_t       len;
+    ngx_str_t   *value;
+    ngx_url_t    u;
+    ngx_uint_t   i;
+
+    value = cf->args->elts;
+
+    p = value[1].data + sizeof("syslog:") - 1;
+
+    for ( ;; ) {
+        comma = (u_char *) ngx_strchr(p, ',');
+
+        if (comma != NULL) {
+            len = comma - p;
+            *comma = '\0';
+
+        } else {
+            len = value[1].data + value[1].len - p;
+        }
+
+        if (ngx_strncmp(p, "server=", 7) == 0) {
+
+            if (peer->server.sockaddr != NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"server\"");
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&u, sizeof(ngx_url_t));
+
+            u.url.data = p + 7;
+            u.url.len = len - 7;
+            u.default_port = 514;
+
+            if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+                if (u.err) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "%s in syslog server \"%V\"",
+                                       u.err, &u.url);
+                }
+
+                return NGX_CONF_ERROR;
+            }
+
+            peer->server = u.addrs[0];
+
+        } else if (ngx_strncmp(p, "facility=", 9) == 0) {
+
+            if (peer->facility != NGX_CONF_UNSET_UINT) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"facility\"");
+                return NGX_CONF_ERROR;
+            }
+
+            for (i = 0; facilities[i] != NULL; i++) {
+
+                if (ngx_strcmp(p + 9, facilities[i]) == 0) {
+                    peer->facility = i;
+                    goto next;
+                }
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown syslog facility \"%s\"", p + 9);
+            return NGX_CONF_ERROR;
+
+        } else if (ngx_strncmp(p, "severity=", 9) == 0) {
+
+            if (peer->severity != NGX_CONF_UNSET_UINT) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"severity\"");
+                return NGX_CONF_ERROR;
+            }
+
+            for (i = 0; severities[i] != NULL; i++) {
+
+                if (ngx_strcmp(p + 9, severities[i]) == 0) {
+                    peer->severity = i;
+                    goto next;
+                }
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown syslog severity \"%s\"", p + 9);
+            return NGX_CONF_ERROR;
+
+        } else if (ngx_strncmp(p, "tag=", 4) == 0) {
+
+            if (peer->tag.data != NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"tag\"");
+                return NGX_CONF_ERROR;
+            }
+
+            /*
+             * RFC 3164: the TAG is a string of ABNF alphanumeric characters
+             * that MUST NOT exceed 32 characters.
+             */
+
+            if (len - 4 > NGX_SYSLOG_MAX_TAG) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "syslog tag length exceeds 32");
+                return NGX_CONF_ERROR;
+            }
+
+            for (i = 4; i < len; i++) {
+                c = ngx_tolower(p[i]);
+
+                if (c < '0' || (c > '9' && c < 'a' && c != '_') || c > 'z') {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "syslog \"tag\" only allows "
+                                       "alphanumeric characters "
+                                       "and underscore");
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            peer->tag.data = p + 4;
+            peer->tag.len = len - 4;
+
+        } else if (len == 10 && ngx_strncmp(p, "nohostname", 10) == 0) {
+            peer->nohostname = 1;
+
+        } else {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown syslog parameter \"%s\"", p);
+            return NGX_CONF_ERROR;
+        }
+
+    next:
+
+        if (comma == NULL) {
+            break;
+        }
+
+        p = comma + 1;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+u_char *
+ngx_syslog_add_header(ngx_syslog_peer_t *peer, u_char *buf)
+{
+    ngx_uint_t  pri;
+
+    pri = peer->facility * 8 + peer->severity;
+
+    if (peer->nohostname || ngx_cycle->hostname.len == 0) {
+        return ngx_sprintf(buf, "<%ui>%V %V: ", pri, &ngx_cached_syslog_time,
+                           &peer->tag);
+    }
+
+    return ngx_sprintf(buf, "<%ui>%V %V %V: ", pri, &ngx_cached_syslog_time,
+                       &ngx_cycle->hostname, &peer->tag);
+}
+
+
+void
+ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
+    size_t len)
+{
+    u_char             *p, msg[NGX_SYSLOG_MAX_STR];
+    size_t              n;
+    ngx_syslog_peer_t  *peer;
+
+    peer = log->wdata;
+
+    if (peer->busy) {
+        /* an error while sending the message is logged to the same log */
+        return;
+    }
+
+    peer->busy = 1;
+    peer->severity = level - 1;
+
+    p = ngx_syslog_add_header(peer, msg);
+
+    if (len > (size_t) (msg + NGX_SYSLOG_MAX_STR - p)) {
+        len = msg + NGX_SYSLOG_MAX_STR - p;
+    }
+
+    p = ngx_cpymem(p, buf, len);
+    *(p - 1) = LF;
+
+    n = ngx_syslog_send_lines(peer, msg, p - msg);
+
+    if (n != (size_t) (p - msg)) {
+        peer->dropped++;
+    }
+
+    peer->busy = 0;
+}
+
+
+/*
+ * Sends the LF terminated messages from the buffer and returns the number
+ * of bytes consumed.  The messages are sent without the LF to a datagram
+ * socket, one message per datagram, and to a stream socket using the octet
+ * counting framing of RFC 6587.  The unsent rest is kept by a caller
+ * and is sent later, so a busy receiver pushes back instead of losing lines.
+ */
+
+size_t
+ngx_syslog_send_lines(ngx_syslog_peer_t *peer, u_char *buf, size_t len)
+{
+    u_char     *p, *q, *last;
+    ssize_t     n;
+    ngx_err_t   err;
+#if (NGX_HAVE_SENDMMSG)
+    int         rc;
+    ngx_uint_t  i, nmsgs;
+    struct iovec    iov[NGX_SYSLOG_BATCH];
+    struct mmsghdr  msgs[NGX_SYSLOG_BATCH];
+#endif
+
+    if (peer->fd == (ngx_socket_t) -1 && ngx_syslog_connect(peer) != NGX_OK) {
+        return 0;
+    }
+
+    if (peer->type == SOCK_STREAM) {
+        return ngx_syslog_send_stream(peer, buf, len);
+    }
+
+    p = buf;
+    last = buf + len;
+
+#if (NGX_HAVE_SENDMMSG)
+
+    ngx_memzero(msgs, sizeof(msgs));
+
+    while (p < last) {
+
+        q = p;
+
+        for (nmsgs = 0; nmsgs < NGX_SYSLOG_BATCH && q < last; nmsgs++) {
+            iov[nmsgs].iov_base = q;
+
+            q = ngx_strlchr(q, last, LF);
+            if (q == NULL) {
+                q = last;
+            }
+
+            iov[nmsgs].iov_len = q - (u_char *) iov[nmsgs].iov_base;
+
+            msgs[nmsgs].msg_hdr.msg_iov = &iov[nmsgs];
+            msgs[nmsgs].msg_hdr.msg_iovlen = 1;
+
+            q++;
+        }
+
+        rc = sendmmsg(peer->fd, msgs, nmsgs, 0);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "sendmmsg: %d of %ui", rc, nmsgs);
+
+        if (rc == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EMSGSIZE) {
+                /* the datagram is too long for the peer, skip it */
+                p += iov[0].iov_len + 1;
+                peer->dropped++;
+                continue;
+            }
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR && err != NGX_ENOBUFS) {
+                ngx_syslog_close(peer, err, "sendmmsg() failed to");
+            }
+
+            break;
+        }
+
+        for (i = 0; i < (ngx_uint_t) rc; i++) {
+            p += iov[i].iov_len + 1;
+        }
+    }
+
+#else
+
+    while (p < last) {
+
+        q = ngx_strlchr(p, last, LF);
+        if (q == NULL) {
+            q = last;
+        }
+
+        n = send(peer->fd, p, q - p, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EMSGSIZE) {
+                p = q + 1;
+                peer->dropped++;
+                continue;
+            }
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR && err != NGX_ENOBUFS) {
+                ngx_syslog_close(peer, err, "send() failed to");
+            }
+
+            break;
+        }
+
+        p = q + 1;
+    }
+
+#endif
+
+    if (p > last) {
+        /* the last message was not terminated by LF */
+        p = last;
+    }
+
+    return p - buf;
+}
+
+
+/*
+ * A frame is the decimal length of the message, a space, and the message.
+ * A frame is never sent in part: the rest of a frame accepted in part
+ * is kept by the peer and is sent before anything else, so the messages
+ * of a caller that drops its unsent lines do not break the framing.
+ */
+
+static size_t
+ngx_syslog_send_stream(ngx_syslog_peer_t *peer, u_char *buf, size_t len)
+{
+    u_char        *p, *q, *last;
+    size_t         size, sent;
+    ssize_t        n;
+    ngx_err_t      err;
+    ngx_uint_t     i, nmsgs;
+    struct iovec   iov[NGX_SYSLOG_BATCH * 2];
+    u_char         counts[NGX_SYSLOG_BATCH][NGX_SIZE_T_LEN + 1];
+
+    if (peer->pending_len) {
+        n = send(peer->fd, peer->pending, peer->pending_len, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_syslog_close(peer, err, "send() failed to");
+            }
+
+            return 0;
+        }
+
+        peer->pending_len -= n;
+
+        if (peer->pending_len) {
+            ngx_memmove(peer->pending, peer->pending + n, peer->pending_len);
+            return 0;
+        }
+    }
+
+    p = buf;
+    last = buf + len;
+
+    while (p < last) {
+
+        q = p;
+
+        for (nmsgs = 0; nmsgs < NGX_SYSLOG_BATCH && q < last; nmsgs++) {
+            iov[nmsgs * 2 + 1].iov_base = q;
+
+            q = ngx_strlchr(q, last, LF);
+            if (q == NULL) {
+                q = last;
+            }
+
+            size = q - (u_char *) iov[nmsgs * 2 + 1].iov_base;
+
+            iov[nmsgs * 2 + 1].iov_len = size;
+
+            iov[nmsgs * 2].iov_base = counts[nmsgs];
+            iov[nmsgs * 2].iov_len = ngx_sprintf(counts[nmsgs], "%uz ", size)
+                                     - counts[nmsgs];
+
+            q++;
+        }
+
+        n = writev(peer->fd, iov, nmsgs * 2);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "syslog writev: %z of %ui messages, fd:%d",
+                       n, nmsgs, peer->fd);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_syslog_close(peer, err, "writev() failed to");
+            }
+
+            break;
+        }
+
+        sent = n;
+
+        for (i = 0; i < nmsgs; i++) {
+            size = iov[i * 2].iov_len + iov[i * 2 + 1].iov_len;
+
+            if (sent < size) {
+                break;
+            }
+
+            sent -= size;
+            p += iov[i * 2 + 1].iov_len + 1;
+        }
+
+        if (i == nmsgs) {
+            continue;
+        }
+
+        if (sent && ngx_syslog_keep(peer, &iov[i * 2], sent) == NGX_OK) {
+            p += iov[i * 2 + 1].iov_len + 1;
+        }
+
+        break;
+    }
+
+    if (p > last) {
+        /* the last message was not terminated by LF */
+        p = last;
+    }
+
+    return p - buf;
+}
+
+
+static ngx_int_t
+ngx_syslog_keep(ngx_syslog_peer_t *peer, struct iovec *iov, size_t sent)
+{
+    u_char  *p;
+    size_t   size;
+
+    size = iov[0].iov_len + iov[1].iov_len - sent;
+
+    if (size > peer->pending_size) {
+
+        if (peer->pending) {
+            ngx_free(peer->pending);
+        }
+
+        peer->pending_size = 0;
+
+        peer->pending = ngx_alloc(size, ngx_cycle->log);
+
+        if (peer->pending == NULL) {
+            /* the rest of the frame cannot be sent on this connection */
+            ngx_syslog_close(peer, 0, "incomplete message was sent to");
+            return NGX_ERROR;
+        }
+
+        peer->pending_size = size;
+    }
+
+    p = peer->pending;
+
+    if (sent < iov[0].iov_len) {
+        p = ngx_cpymem(p, (u_char *) iov[0].iov_base + sent,
+                       iov[0].iov_len - sent);
+        sent = 0;
+
+    } else {
+        sent -= iov[0].iov_len;
+    }
+
+    p = ngx_cpymem(p, (u_char *) iov[1].iov_base + sent,
+                   iov[1].iov_len - sent);
+
+    peer->pending_len = p - peer->pending;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_syslog_connect(ngx_syslog_peer_t *peer)
+{
+    time_t        now;
+    ngx_err_t     err;
+    ngx_socket_t  fd;
+
+    now = ngx_time();
+
+    /* do not try to connect more often than once per second */
+
+    if (peer->connect_time == now) {
+        return NGX_DECLINED;
+    }
+
+    peer->connect_time = now;
+
+    for ( ;; ) {
+        fd = ngx_socket(peer->server.sockaddr->sa_family, peer->type, 0);
+
+        if (fd == (ngx_socket_t) -1) {
+            ngx_syslog_close(peer, ngx_socket_errno,
+                             ngx_socket_n " failed for");
+            return NGX_ERROR;
+        }
+
+        if (ngx_nonblocking(fd) == -1) {
+            err = ngx_socket_errno;
+            (void) ngx_close_socket(fd);
+            ngx_syslog_close(peer, err, ngx_nonblocking_n " failed for");
+            return NGX_ERROR;
+        }
+
+        if (connect(fd, peer->server.sockaddr, peer->server.socklen) != -1) {
+            break;
+        }
+
+        err = ngx_socket_errno;
+
+        (void) ngx_close_socket(fd);
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+        /* the local syslog daemon may listen on a stream socket */
+
+        if (err == NGX_EPROTOTYPE
+            && peer->type == SOCK_DGRAM
+            && peer->server.sockaddr->sa_family == AF_UNIX)
+        {
+            peer->type = SOCK_STREAM;
+            continue;
+        }
+
+#endif
+
+        ngx_syslog_close(peer, err, "connect() failed to");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "syslog connected to %V, fd:%d", &peer->server.name, fd);
+
+    peer->fd = fd;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_syslog_close(ngx_syslog_peer_t *peer, ngx_err_t err, const char *text)
+{
+    time_t  now;
+
+    if (peer->fd != (ngx_socket_t) -1) {
+        if (ngx_close_socket(peer->fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        peer->fd = (ngx_socket_t) -1;
+    }
+
+    if (peer->pending_len) {
+        /* the receiver discards the frame cut by the close */
+        peer->pending_len = 0;
+        peer->dropped++;
+    }
+
+    now = ngx_time();
+
+    if (now - peer->error_log_time > 59) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                      "%s syslog server %V", text, &peer->server.name);
+
+        peer->error_log_time = now;
+    }
+}
+
+
+static void
+ngx_syslog_cleanup(void *data)
+{
+    ngx_syslog_peer_t  *peer = data;
+
+    if (peer->pending) {
+        ngx_free(peer->pending);
+        peer->pending = NULL;
+    }
+
+    if (peer->fd == (ngx_socket_t) -1) {
+        return;
+    }
+
+    if (ngx_close_socket(peer->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+}
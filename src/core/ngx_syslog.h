@@ -0,0 +1,64 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SYSLOG_H_INCLUDED_
+#define _NGX_SYSLOG_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_SYSLOG_MAX_TAG  32
+
+#define NGX_SYSLOG_MAX_HEADER                                                 \
+    (sizeof("<191>Sep 28 12:00:00 ") - 1 + NGX_MAXHOSTNAMELEN                 \
+     + NGX_SYSLOG_MAX_TAG + sizeof(": ") - 1)
+
+#define NGX_SYSLOG_MAX_STR  (NGX_SYSLOG_MAX_HEADER + NGX_MAX_ERROR_STR)
+
+
+typedef struct {
+    ngx_uint_t        facility;
+    ngx_uint_t        severity;
+    ngx_str_t         tag;
+
+    ngx_addr_t        server;
+    ngx_socket_t      fd;
+    int               type;          /* SOCK_DGRAM or SOCK_STREAM */
+
+    /* the unsent rest of a partially sent stream frame */
+    u_char           *pending;
+    size_t            pending_len;
+    size_t            pending_size;
+
+    time_t            connect_time;
+    time_t            error_log_time;
+
+    ngx_uint_t        dropped;
+    time_t            drop_log_time;
+
+    unsigned          busy:1;
+    unsigned          nohostname:1;
+} ngx_syslog_peer_t;
+
+
+/* the upper bound of the ngx_syslog_add_header() output */
+
+#define ngx_syslog_header_len(peer)                                           \
+    (sizeof("<191>Sep 28 12:00:00 ") - 1 + ngx_cycle->hostname.len + 1        \
+     + (peer)->tag.len + sizeof(": ") - 1)
+
+
+char *ngx_syslog_process_conf(ngx_conf_t *cf, ngx_syslog_peer_t *peer);
+u_char *ngx_syslog_add_header(ngx_syslog_peer_t *peer, u_char *buf);
+void ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
+    size_t len);
+size_t ngx_syslog_send_lines(ngx_syslog_peer_t *peer, u_char *buf,
+    size_t len);
+
+
+#endif /* _NGX_SYSLOG_H_INCLUDED_ */
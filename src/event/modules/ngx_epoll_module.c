@@ -580,6 +580,8 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
 
     err = (events == -1) ? ngx_errno : 0;
 
+    ngx_event_loop_wakeup(events);
+
     if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
         ngx_time_update(); /*更新时间缓存*/
     }
@@ -688,7 +690,7 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_locked_post_event(rev, queue);              /*事件缓存*/
 
             } else {                                                /*调用事件回调函数*/
-                rev->handler(rev);                                 /*读事件的回调函数, handler->filter*/
+                ngx_event_call_handler(rev);                       /*读事件的回调函数, handler->filter*/
             }
         }
 
@@ -719,7 +721,7 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_locked_post_event(wev, &ngx_posted_events);           /*事件缓存*/
 
             } else {                                                          /*直接处理,调用事件回调函数*/
-                wev->handler(wev);                                           /*写事件的回调函数, handler->filter*/
+                ngx_event_call_handler(wev);                                 /*写事件的回调函数, handler->filter*/
             }
         }
     }
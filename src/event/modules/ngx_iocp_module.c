@@ -341,7 +341,7 @@ ngx_int_t ngx_iocp_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "iocp event handler: %p", ev->handler);
 
-    ev->handler(ev);
+    ngx_event_call_handler(ev);
 
     return NGX_OK;
 }
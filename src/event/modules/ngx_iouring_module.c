@@ -0,0 +1,675 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a level-triggered readiness interface:
+ * every active event has a single one-shot IORING_OP_POLL_ADD request
+ * in flight, and the request is armed again after the event is reported
+ * while the event is still active.  Additions, removals, and rearms are
+ * queued in the submission ring and are passed to the kernel together
+ * with waiting for completions in a single io_uring_enter() call per
+ * event loop iteration, so there are no per-event syscalls at all.
+ *
+ * Only the readiness is taken from the ring: accept(), recv(), send(),
+ * sendfile(), and open() are still called by ngx_os_io and the open file
+ * cache once an event is reported, as with the other methods, since
+ * completion-based I/O would change the ready and NGX_AGAIN contract the
+ * upper layers rely on.  Compared to epoll, a connection saves the
+ * epoll_ctl() call, and a read saves the recv() which returns EAGAIN, as
+ * a level-triggered method does not require reading until EAGAIN.
+ *
+ * The poll request generation is kept in ev->index and in the upper bits
+ * of the request user data, it allows to detect stale completions of the
+ * removed requests.  A removed request completes with -ECANCELED, such
+ * completions are dropped without touching the event, which may be freed
+ * already.  A request which fired before its removal was processed is
+ * dropped as ev->index is reset on removal, and if the event was added
+ * again, e.g. for a new connection reusing the descriptor, the request
+ * has a different generation.  The completions of inactive events are
+ * never reported to the handlers either.
+ */
+
+
+#define NGX_IOURING_GEN_SHIFT  48
+#define NGX_IOURING_GEN_MASK   0xffff
+
+
+typedef struct {
+    ngx_uint_t  entries;
+} ngx_iouring_conf_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static ngx_int_t ngx_iouring_poll_add(ngx_event_t *ev);
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_log_t *log);
+static int ngx_iouring_enter(u_int min_complete, ngx_msec_t timer);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                    ring = -1;
+
+static u_char                *sq_ring;
+static size_t                 sq_ring_size;
+static u_char                *cq_ring;
+static size_t                 cq_ring_size;
+static struct io_uring_sqe   *sqes;
+static size_t                 sqes_size;
+
+static uint32_t volatile     *sq_head;
+static uint32_t volatile     *sq_tail;
+static uint32_t               sq_mask;
+static uint32_t               sq_entries;
+static uint32_t               sq_local_tail;
+static uint32_t               sq_pending;
+
+static uint32_t volatile     *cq_head;
+static uint32_t volatile     *cq_tail;
+static uint32_t               cq_mask;
+static struct io_uring_cqe   *cqes;
+
+static ngx_event_t          **rearm;
+static ngx_uint_t             nrearm;
+static ngx_uint_t             rearm_size;
+
+static ngx_uint_t             generation;
+
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        NULL,                            /* add an connection */
+        NULL,                            /* delete an connection */
+        NULL,                            /* process the changes */
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    uint32_t                *array, i;
+    ngx_iouring_conf_t      *iocf;
+    struct io_uring_params   p;
+
+    iocf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring == -1) {
+
+        ngx_memzero(&p, sizeof(struct io_uring_params));
+
+        /* every connection may have both read and write requests in flight */
+
+        p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+        p.cq_entries = ngx_max(2 * cycle->connection_n, 2 * iocf->entries);
+
+        ring = syscall(__NR_io_uring_setup, iocf->entries, &p);
+
+        if (ring == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "io_uring_setup() failed");
+            return NGX_ERROR;
+        }
+
+        if (!(p.features & IORING_FEAT_EXT_ARG)
+            || !(p.features & IORING_FEAT_NODROP))
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "io_uring is not supported by the kernel, "
+                          "Linux 5.11 or newer is required");
+            goto failed;
+        }
+
+        sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_ring_size = p.cq_off.cqes
+                       + p.cq_entries * sizeof(struct io_uring_cqe);
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size = ngx_max(sq_ring_size, cq_ring_size);
+        }
+
+        sq_ring = mmap(NULL, sq_ring_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+        if (sq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_SQ_RING) failed");
+            sq_ring = NULL;
+            goto failed;
+        }
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring = sq_ring;
+            cq_ring_size = 0;
+
+        } else {
+            cq_ring = mmap(NULL, cq_ring_size, PROT_READ|PROT_WRITE,
+                           MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+            if (cq_ring == MAP_FAILED) {
+                ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                              "mmap(IORING_OFF_CQ_RING) failed");
+                cq_ring = NULL;
+                goto failed;
+            }
+        }
+
+        sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+        sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE,
+                    MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+        if (sqes == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_SQES) failed");
+            sqes = NULL;
+            goto failed;
+        }
+
+        sq_head = (uint32_t *) (sq_ring + p.sq_off.head);
+        sq_tail = (uint32_t *) (sq_ring + p.sq_off.tail);
+        sq_mask = *(uint32_t *) (sq_ring + p.sq_off.ring_mask);
+        sq_entries = p.sq_entries;
+        sq_local_tail = *sq_tail;
+        sq_pending = 0;
+
+        /* the submission queue entries are always used in order */
+
+        array = (uint32_t *) (sq_ring + p.sq_off.array);
+
+        for (i = 0; i < sq_entries; i++) {
+            array[i] = i;
+        }
+
+        cq_head = (uint32_t *) (cq_ring + p.cq_off.head);
+        cq_tail = (uint32_t *) (cq_ring + p.cq_off.tail);
+        cq_mask = *(uint32_t *) (cq_ring + p.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *) (cq_ring + p.cq_off.cqes);
+
+        rearm = ngx_alloc(p.cq_entries * sizeof(ngx_event_t *), cycle->log);
+        if (rearm == NULL) {
+            goto failed;
+        }
+
+        rearm_size = p.cq_entries;
+        nrearm = 0;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d sq:%uD cq:%uD",
+                       ring, p.sq_entries, p.cq_entries);
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_LEVEL_EVENT;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_iouring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    if (sqes && munmap(sqes, sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (cq_ring && cq_ring_size && munmap(cq_ring, cq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_CQ_RING) failed");
+    }
+
+    if (sq_ring && munmap(sq_ring, sq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    if (ring != -1 && close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    sqes = NULL;
+    sq_ring = NULL;
+    cq_ring = NULL;
+
+    if (rearm) {
+        ngx_free(rearm);
+    }
+
+    rearm = NULL;
+    rearm_size = 0;
+    nrearm = 0;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ev->active = 1;
+
+    if (ev->index != NGX_INVALID_INDEX) {
+        /* the poll request is already in flight */
+        return NGX_OK;
+    }
+
+    if (ngx_iouring_poll_add(ev) != NGX_OK) {
+        ev->active = 0;
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    struct io_uring_sqe  *sqe;
+
+    ev->active = 0;
+
+    if (ev->index == NGX_INVALID_INDEX) {
+        return NGX_OK;
+    }
+
+    /*
+     * unlike epoll, a poll request is not cancelled when the descriptor
+     * is closed, so it is removed even for NGX_CLOSE_EVENT
+     */
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: %p g:%ui", ev, ev->index);
+
+    sqe = ngx_iouring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ((uint64_t) ev->index << NGX_IOURING_GEN_SHIFT)
+                | (uintptr_t) ev;
+    sqe->user_data = 0;
+
+    ev->index = NGX_INVALID_INDEX;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_add(ngx_event_t *ev)
+{
+    ngx_connection_t     *c;
+    struct io_uring_sqe  *sqe;
+
+    c = ev->data;
+
+    sqe = ngx_iouring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    generation = (generation + 1) & NGX_IOURING_GEN_MASK;
+
+    if (generation == 0) {
+        generation = 1;
+    }
+
+    ev->index = generation;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->poll32_events = ev->write ? POLLOUT : POLLIN;
+    sqe->user_data = ((uint64_t) generation << NGX_IOURING_GEN_SHIFT)
+                     | (uintptr_t) ev;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d w:%d %p g:%ui",
+                   c->fd, ev->write, ev, generation);
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (sq_local_tail - *sq_head >= sq_entries) {
+
+        /* the submission queue is full, pass it to the kernel */
+
+        if (ngx_iouring_enter(0, 0) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "io_uring_enter() failed");
+            return NULL;
+        }
+
+        if (sq_local_tail - *sq_head >= sq_entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    sqe = &sqes[sq_local_tail & sq_mask];
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq_local_tail++;
+    sq_pending++;
+
+    return sqe;
+}
+
+
+static int
+ngx_iouring_enter(u_int min_complete, ngx_msec_t timer)
+{
+    int                              n;
+    u_int                            flags;
+    struct __kernel_timespec         ts;
+    struct io_uring_getevents_arg    arg;
+
+    ngx_memory_barrier();
+
+    *sq_tail = sq_local_tail;
+
+    flags = IORING_ENTER_EXT_ARG;
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (min_complete) {
+        flags |= IORING_ENTER_GETEVENTS;
+
+        if (timer != NGX_TIMER_INFINITE) {
+            ts.tv_sec = timer / 1000;
+            ts.tv_nsec = (timer % 1000) * 1000000;
+            arg.ts = (uintptr_t) &ts;
+        }
+    }
+
+    n = syscall(__NR_io_uring_enter, ring, sq_pending, min_complete, flags,
+                &arg, sizeof(struct io_uring_getevents_arg));
+
+    if (n > 0) {
+        sq_pending -= ngx_min((uint32_t) n, sq_pending);
+    }
+
+    return n;
+}
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                   n;
+    uint32_t              head, tail, revents;
+    uint64_t              data;
+    ngx_int_t             res;
+    ngx_err_t             err;
+    ngx_uint_t            i, level, gen;
+    ngx_event_t          *ev, **queue;
+    struct io_uring_cqe  *cqe;
+
+    /* arm again the events reported by the previous iteration */
+
+    for (i = 0; i < nrearm; i++) {
+        ev = rearm[i];
+
+        if (ev->active && ev->index == NGX_INVALID_INDEX) {
+            if (ngx_iouring_poll_add(ev) != NGX_OK) {
+                ev->active = 0;
+            }
+        }
+    }
+
+    nrearm = 0;
+
+    head = *cq_head;
+    tail = *cq_tail;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit:%uD, ready:%uD",
+                   timer, sq_pending, tail - head);
+
+    if (head == tail || sq_pending) {
+
+        /* do not wait if there are already completions to process */
+
+        n = ngx_iouring_enter(head == tail ? 1 : 0, timer);
+
+        err = (n == -1) ? ngx_errno : 0;
+
+    } else {
+        err = 0;
+    }
+
+    ngx_event_loop_wakeup((ngx_int_t) (*cq_tail - head));
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err && err != ETIME) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *cq_head;
+    tail = *cq_tail;
+
+    ngx_memory_barrier();
+
+    if (head == tail) {
+        if (timer != NGX_TIMER_INFINITE) {
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "io_uring_enter() returned no events without timeout");
+        return NGX_ERROR;
+    }
+
+    ngx_mutex_lock(ngx_posted_events_mutex);
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &cqes[head & cq_mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+
+        if (data == 0) {
+            /* IORING_OP_POLL_REMOVE completion */
+            continue;
+        }
+
+        if (res == -NGX_ECANCELED) {
+            /* the request was removed by ngx_iouring_del_event() */
+            continue;
+        }
+
+        ev = (ngx_event_t *) (uintptr_t)
+                 (data & (((uint64_t) 1 << NGX_IOURING_GEN_SHIFT) - 1));
+        gen = (ngx_uint_t) (data >> NGX_IOURING_GEN_SHIFT);
+
+        if (ev->index != gen) {
+
+            /*
+             * the stale completion of a request that was removed
+             * or of a descriptor that was just closed
+             */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p g:%ui", ev, gen);
+            continue;
+        }
+
+        ev->index = NGX_INVALID_INDEX;
+
+        if (!ev->active) {
+            continue;
+        }
+
+        if (res < 0) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, -res,
+                           "io_uring poll error %p g:%ui", ev, gen);
+
+            revents = POLLERR;
+
+        } else {
+            revents = (uint32_t) res;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: %p w:%d ev:%04XD",
+                       ev, ev->write, revents);
+
+        /* the errors are reported to the handler as readiness */
+
+        if (nrearm < rearm_size) {
+            rearm[nrearm++] = ev;
+
+        } else if (ngx_iouring_poll_add(ev) != NGX_OK) {
+            ev->active = 0;
+            continue;
+        }
+
+        if ((flags & NGX_POST_THREAD_EVENTS) && !ev->accept) {
+            ev->posted_ready = 1;
+
+        } else {
+            ev->ready = 1;
+        }
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = (ngx_event_t **) (ev->accept ?
+                           &ngx_posted_accept_events : &ngx_posted_events);
+
+            ngx_locked_post_event(ev, queue);
+
+        } else {
+            ngx_event_call_handler(ev);
+        }
+    }
+
+    ngx_memory_barrier();
+
+    *cq_head = head;
+
+    ngx_mutex_unlock(ngx_posted_events_mutex);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iocf;
+
+    iocf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iocf == NULL) {
+        return NULL;
+    }
+
+    iocf->entries = NGX_CONF_UNSET;
+
+    return iocf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iocf = conf;
+
+    ngx_conf_init_uint_value(iocf->entries, 512);
+
+    return NGX_CONF_OK;
+}
@@ -410,7 +410,7 @@ ngx_rtsig_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_locked_post_event(rev, queue);
 
             } else {
-                rev->handler(rev);
+                ngx_event_call_handler(rev);
             }
         }
 
@@ -424,7 +424,7 @@ ngx_rtsig_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_locked_post_event(wev, &ngx_posted_events);
 
             } else {
-                wev->handler(wev);
+                ngx_event_call_handler(wev);
             }
         }
 
@@ -587,7 +587,7 @@ ngx_rtsig_process_overflow(ngx_cycle_t *cycle, ngx_msec_t timer,
                     ngx_locked_post_event(rev, queue);
 
                 } else {
-                    rev->handler(rev);
+                    ngx_event_call_handler(rev);
                 }
             }
 
@@ -612,7 +612,7 @@ ngx_rtsig_process_overflow(ngx_cycle_t *cycle, ngx_msec_t timer,
                     ngx_locked_post_event(wev, &ngx_posted_events);
 
                 } else {
-                    wev->handler(wev);
+                    ngx_event_call_handler(wev);
                 }
             }
         }
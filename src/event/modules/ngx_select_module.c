@@ -263,6 +263,8 @@ ngx_select_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
 
     err = (ready == -1) ? ngx_errno : 0;
 
+    ngx_event_loop_wakeup(ready);
+
     if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
         ngx_time_update();
     }
@@ -35,6 +35,15 @@ static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
 static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
 static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
 
+#if (NGX_EVENT_TSC)
+static void ngx_event_tsc_calibrate(ngx_cycle_t *cycle);
+#endif
+static void ngx_event_log_slow_handler(ngx_event_handler_pt handler,
+    char *action, uint64_t usec);
+#if (NGX_STAT_STUB)
+static void ngx_event_loop_account(void);
+#endif
+
 
 static ngx_uint_t     ngx_timer_resolution;
 sig_atomic_t          ngx_event_timer_alarm;
@@ -57,6 +66,14 @@ ngx_uint_t            ngx_accept_mutex_held;
 ngx_msec_t            ngx_accept_mutex_delay;
 ngx_int_t             ngx_accept_disabled;
 
+ngx_uint_t            ngx_event_batch;
+ngx_msec_t            ngx_event_spin;
+ngx_int_t             ngx_event_loop_events;
+ngx_msec_t            ngx_event_handler_threshold;
+ngx_uint_t            ngx_event_tsc_khz;
+
+static ngx_msec_t     ngx_event_loop_busy;
+
 
 #if (NGX_STAT_STUB)
 
@@ -74,6 +91,26 @@ ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
 ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t  *ngx_stat_waiting = &ngx_stat_waiting0;
+ngx_atomic_t   ngx_stat_event_loop0[NGX_EVENT_LOOP_BUCKETS];
+ngx_atomic_t  *ngx_stat_event_loop = ngx_stat_event_loop0;
+
+#if (NGX_SSL)
+ngx_atomic_t   ngx_stat_ssl_records_small0;
+ngx_atomic_t  *ngx_stat_ssl_records_small = &ngx_stat_ssl_records_small0;
+ngx_atomic_t   ngx_stat_ssl_records_medium0;
+ngx_atomic_t  *ngx_stat_ssl_records_medium = &ngx_stat_ssl_records_medium0;
+ngx_atomic_t   ngx_stat_ssl_records_large0;
+ngx_atomic_t  *ngx_stat_ssl_records_large = &ngx_stat_ssl_records_large0;
+ngx_atomic_t   ngx_stat_ssl_handshakes0[NGX_SSL_HANDSHAKE_BUCKETS];
+ngx_atomic_t  *ngx_stat_ssl_handshakes = ngx_stat_ssl_handshakes0;
+#endif
+
+ngx_uint_t     ngx_event_loop_timing;
+uint64_t       ngx_event_loop_start;
+
+static uint64_t  ngx_event_loop_bounds[NGX_EVENT_LOOP_BUCKETS - 1] = {
+    10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
 
 #endif
 
@@ -161,6 +198,38 @@ static ngx_command_t  ngx_event_core_commands[] = {
       0,
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
+
+    { ngx_string("event_batch"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_event_conf_t, batch),
+      NULL },
+
+    { ngx_string("event_spin"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, spin),
+      NULL },
+
+    { ngx_string("event_handler_threshold"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, handler_threshold),
+      NULL },
+
+#if (NGX_STAT_STUB)
+
+    { ngx_string("event_loop_timing"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, loop_timing),
+      NULL },
+
+#endif
       /*需要对来自指定IP的TCP连接打印debug级别的调试日志*/
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
@@ -221,6 +290,14 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)   /* 等待事件发生的函
 #endif
     }
 
+    if (ngx_posted_delayed_events
+        || (ngx_event_spin
+            && ngx_current_msec - ngx_event_loop_busy < ngx_event_spin))
+    {
+        /* the rest of the previous batch is pending, or the loop spins */
+        timer = 0;
+    }
+
     if (ngx_use_accept_mutex) {             /*检查accept_mutex锁是否打开*/
         if (ngx_accept_disabled > 0) {      /*通过检验ngx_accept_disabled是否大于0来判断当前进程是否过载*/
             ngx_accept_disabled--;          /*当前进程连接数超过阀值*/
@@ -243,12 +320,20 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)   /* 等待事件发生的函
         }
     }
 
+    if (ngx_event_batch) {
+        flags |= NGX_POST_EVENTS;
+    }
+
     delta = ngx_current_msec;
 
     (void) ngx_process_events(cycle, timer, flags);     /*调用各种事件驱动机制下的事件处理函数，实际进入ngx_epoll_module模块*/
 
     delta = ngx_current_msec - delta;                     /*delta是ngx_process_events执行时候消耗的毫秒数,会影响到下面触发定时器的执行*/
 
+    if (ngx_event_loop_events > 0) {
+        ngx_event_loop_busy = ngx_current_msec;
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "timer delta: %M", delta);
 
@@ -267,16 +352,246 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)   /* 等待事件发生的函
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "posted events %p", ngx_posted_events);
 
-    if (ngx_posted_events) {/*非网络请求事件,这些事件来自与事件驱动模块本身，都调用每个事件自己的处理方法进行处理*/
+    if (ngx_posted_events || ngx_posted_delayed_events) {/*非网络请求事件,这些事件来自与事件驱动模块本身，都调用每个事件自己的处理方法进行处理*/
         if (ngx_threaded) {
             ngx_wakeup_worker_thread(cycle);
 
+        } else if (ngx_event_batch) {
+            ngx_event_process_posted_batch(cycle, ngx_event_batch);
+
         } else {
             ngx_event_process_posted(cycle, &ngx_posted_events);  /*处理缓存事件*/
         }
     }
+
+#if (NGX_STAT_STUB)
+
+    if (ngx_event_loop_start) {
+
+        /* empty non-blocking polls of a spinning loop are not accounted */
+
+        if (ngx_event_loop_events || timer) {
+            ngx_event_loop_account();
+        }
+
+        ngx_event_loop_start = 0;
+    }
+
+#endif
+}
+
+
+uint64_t
+ngx_event_monotonic(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+#else
+
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+#endif
+}
+
+
+#if (NGX_EVENT_TSC)
+
+/* the TSC is used only if it is invariant, the monotonic clock otherwise */
+
+static void
+ngx_event_tsc_calibrate(ngx_cycle_t *cycle)
+{
+    uint64_t  tsc, usec, now;
+
+    ngx_event_tsc_khz = 0;
+
+    if (!ngx_cpu_invariant_tsc) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "event loop clock: monotonic, TSC is not invariant");
+        return;
+    }
+
+    usec = ngx_event_monotonic();
+    tsc = ngx_event_rdtsc();
+
+    do {
+        now = ngx_event_monotonic();
+    } while (now - usec < 2000);
+
+    ngx_event_tsc_khz = (ngx_uint_t)
+                            ((ngx_event_rdtsc() - tsc) * 1000 / (now - usec));
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "event loop clock: TSC at %ui kHz", ngx_event_tsc_khz);
 }
 
+#endif
+
+
+void
+ngx_event_timed_handler(ngx_event_t *ev)
+{
+    char                  *action;
+    uint64_t               start, usec;
+    ngx_event_handler_pt   handler;
+
+    /* the event and its log may be freed by the handler */
+
+    handler = ev->handler;
+    action = ev->log ? ev->log->action : NULL;
+
+    start = ngx_event_loop_clock();
+
+    handler(ev);
+
+    usec = ngx_event_loop_usec(ngx_event_loop_clock() - start);
+
+    if (usec >= (uint64_t) ngx_event_handler_threshold * 1000) {
+        ngx_event_log_slow_handler(handler, action, usec);
+    }
+}
+
+
+static void
+ngx_event_log_slow_handler(ngx_event_handler_pt handler, char *action,
+    uint64_t usec)
+{
+    u_char      *p, buf[NGX_MAX_ERROR_STR / 2];
+#if (NGX_HAVE_DLADDR)
+    const char  *name;
+    Dl_info      info, self;
+#endif
+
+    p = buf;
+
+#if (NGX_HAVE_DLADDR)
+
+    /*
+     * the object and the offset in it can be passed to addr2line(1),
+     * a symbol name is only known for the exported functions
+     */
+
+    if (dladdr((void *) handler, &info) && info.dli_fname) {
+
+        name = info.dli_fname;
+
+        /* argv[0] of the executable is overwritten by the process title */
+
+        if (dladdr((void *) ngx_event_timed_handler, &self)
+            && self.dli_fbase == info.dli_fbase)
+        {
+            name = ngx_argv[0];
+        }
+
+        p = ngx_snprintf(buf, sizeof(buf), " (%s+0x%xL%s%s)", name,
+                         (uint64_t) ((u_char *) handler
+                                     - (u_char *) info.dli_fbase),
+                         info.dli_sname ? ", " : "",
+                         info.dli_sname ? info.dli_sname : "");
+    }
+
+#endif
+
+    ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                  "event handler %p%*s blocked event loop for %uLus%s%s",
+                  (void *) handler, (size_t) (p - buf), buf, usec,
+                  action ? " while " : "", action ? action : "");
+}
+
+
+#if (NGX_STAT_STUB)
+
+static void
+ngx_event_loop_account(void)
+{
+    uint64_t    usec;
+    ngx_uint_t  i;
+
+    usec = ngx_event_loop_usec(ngx_event_loop_clock() - ngx_event_loop_start);
+
+    for (i = 0; i < NGX_EVENT_LOOP_BUCKETS - 1; i++) {
+        if (usec <= ngx_event_loop_bounds[i]) {
+            break;
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(&ngx_stat_event_loop[i], 1);
+}
+
+
+u_char *
+ngx_event_loop_histogram(u_char *buf)
+{
+    u_char      *p;
+    ngx_uint_t   i;
+
+    p = buf;
+
+    for (i = 0; i < NGX_EVENT_LOOP_BUCKETS; i++) {
+
+        if (i) {
+            *p++ = ' ';
+        }
+
+        if (i < NGX_EVENT_LOOP_BUCKETS - 1) {
+            p = ngx_sprintf(p, "%uL:", ngx_event_loop_bounds[i]);
+
+        } else {
+            p = ngx_cpymem(p, "inf:", sizeof("inf:") - 1);
+        }
+
+        p = ngx_sprintf(p, "%uA", ngx_stat_event_loop[i]);
+    }
+
+    return p;
+}
+
+
+/* the upper bound of the bucket holding the given percentile, in us */
+
+u_char *
+ngx_event_loop_percentile(u_char *buf, ngx_uint_t percent)
+{
+    ngx_uint_t         i;
+    ngx_atomic_uint_t  n[NGX_EVENT_LOOP_BUCKETS], total, sum;
+
+    total = 0;
+
+    for (i = 0; i < NGX_EVENT_LOOP_BUCKETS; i++) {
+        n[i] = ngx_stat_event_loop[i];
+        total += n[i];
+    }
+
+    if (total == 0) {
+        *buf = '0';
+        return buf + 1;
+    }
+
+    sum = 0;
+
+    for (i = 0; i < NGX_EVENT_LOOP_BUCKETS - 1; i++) {
+        sum += n[i];
+
+        if (sum * 100 >= total * percent) {
+            return ngx_sprintf(buf, "%uL", ngx_event_loop_bounds[i]);
+        }
+    }
+
+    return ngx_cpymem(buf, "inf", sizeof("inf") - 1);
+}
+
+#endif
+
 /**/
 ngx_int_t
 ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags) /*将事件添加到事件驱动模块中，一旦出现了可读事件，就会调用对应的handler方法*/
@@ -513,7 +828,17 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + cl;         /* ngx_stat_event_loop[], 11 counters */
+
+#if (NGX_SSL)
+
+    size += cl           /* ngx_stat_ssl_records_small */
+           + cl          /* ngx_stat_ssl_records_medium */
+           + cl          /* ngx_stat_ssl_records_large */
+           + cl;         /* ngx_stat_ssl_handshakes[], 11 counters */
+
+#endif
 
 #endif
 
@@ -561,6 +886,14 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_event_loop = (ngx_atomic_t *) (shared + 10 * cl);
+
+#if (NGX_SSL)
+    ngx_stat_ssl_records_small = (ngx_atomic_t *) (shared + 11 * cl);
+    ngx_stat_ssl_records_medium = (ngx_atomic_t *) (shared + 12 * cl);
+    ngx_stat_ssl_records_large = (ngx_atomic_t *) (shared + 13 * cl);
+    ngx_stat_ssl_handshakes = (ngx_atomic_t *) (shared + 14 * cl);
+#endif
 
 #endif
 
@@ -606,6 +939,27 @@ ngx_event_process_init(ngx_cycle_t *cycle)          /**/
         ngx_use_accept_mutex = 0;
     }
 
+    ngx_event_batch = ecf->batch;
+    ngx_event_spin = ecf->spin;
+    ngx_event_handler_threshold = ecf->handler_threshold;
+
+#if (NGX_STAT_STUB)
+    ngx_event_loop_timing = ecf->loop_timing;
+#endif
+
+#if (NGX_EVENT_TSC)
+
+    if (ngx_event_handler_threshold
+#if (NGX_STAT_STUB)
+        || ngx_event_loop_timing
+#endif
+       )
+    {
+        ngx_event_tsc_calibrate(cycle);
+    }
+
+#endif
+
 #if (NGX_WIN32)
 
     /*
@@ -1193,6 +1547,12 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)  /*创建本模块关注的配置
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->batch = NGX_CONF_UNSET_UINT;
+    ecf->spin = NGX_CONF_UNSET_MSEC;
+    ecf->handler_threshold = NGX_CONF_UNSET_MSEC;
+#if (NGX_STAT_STUB)
+    ecf->loop_timing = NGX_CONF_UNSET;
+#endif
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1308,6 +1668,12 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)  /*初始化 ngx_event_
     ngx_conf_init_value(ecf->multi_accept, 0);                                        /*todo*/
     ngx_conf_init_value(ecf->accept_mutex, 1);                                        /*todo*/
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);                          /*todo*/
+    ngx_conf_init_uint_value(ecf->batch, 0);
+    ngx_conf_init_msec_value(ecf->spin, 0);
+    ngx_conf_init_msec_value(ecf->handler_threshold, 0);
+#if (NGX_STAT_STUB)
+    ngx_conf_init_value(ecf->loop_timing, 0);
+#endif
 
 
 #if (NGX_HAVE_RTSIG)
@@ -135,6 +135,9 @@ struct ngx_event_s {  /*代表一个事件*/
     unsigned         channel:1;
     unsigned         resolver:1;
 
+    /* the timer does not delay the worker exit */
+    unsigned         cancelable:1;
+
 #if (NGX_THREADS)
 
     unsigned         locked:1;
@@ -475,6 +478,13 @@ typedef struct {
 
     ngx_msec_t    accept_mutex_delay;           /*todo*/
 
+    ngx_uint_t    batch;
+    ngx_msec_t    spin;
+    ngx_msec_t    handler_threshold;
+#if (NGX_STAT_STUB)
+    ngx_flag_t    loop_timing;
+#endif
+
     u_char       *name;                           /*todo*/
 
 #if (NGX_DEBUG)
@@ -503,6 +513,10 @@ extern ngx_uint_t             ngx_accept_mutex_held;
 extern ngx_msec_t             ngx_accept_mutex_delay;
 extern ngx_int_t              ngx_accept_disabled;
 
+extern ngx_uint_t             ngx_event_batch;
+extern ngx_msec_t             ngx_event_spin;
+extern ngx_int_t              ngx_event_loop_events;
+
 
 #if (NGX_STAT_STUB)
 
@@ -513,10 +527,95 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
+extern ngx_atomic_t  *ngx_stat_event_loop;
+
+#if (NGX_SSL)
+extern ngx_atomic_t  *ngx_stat_ssl_records_small;
+extern ngx_atomic_t  *ngx_stat_ssl_records_medium;
+extern ngx_atomic_t  *ngx_stat_ssl_records_large;
+extern ngx_atomic_t  *ngx_stat_ssl_handshakes;
+#endif
+
+/* the event loop iteration time histogram: 10, 20, 50, ..., 10000 us, more */
+
+#define NGX_EVENT_LOOP_BUCKETS  11
+
+#define NGX_EVENT_LOOP_HISTOGRAM_LEN                                          \
+    (NGX_EVENT_LOOP_BUCKETS * (sizeof("10000: ") - 1 + NGX_ATOMIC_T_LEN))
+
+extern ngx_uint_t     ngx_event_loop_timing;
+extern uint64_t       ngx_event_loop_start;
+
+
+/*
+ * called by an event module right after it has returned from waiting,
+ * n is the number of the reported events or -1 on error
+ */
+
+#define ngx_event_loop_wakeup(n)                                              \
+    ngx_event_loop_events = n;                                                \
+                                                                              \
+    if (ngx_event_loop_timing) {                                              \
+        ngx_event_loop_start = ngx_event_loop_clock();                        \
+    }
+
+#else
+
+#define ngx_event_loop_wakeup(n)                                              \
+    ngx_event_loop_events = n;
+
+#endif
+
+
+/*
+ * the event loop clock ticks are TSC cycles if the TSC has been calibrated,
+ * or microseconds of the monotonic clock otherwise
+ */
+
+extern ngx_uint_t     ngx_event_tsc_khz;
+
+#if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
+
+#define NGX_EVENT_TSC  1
+
+static ngx_inline uint64_t
+ngx_event_rdtsc(void)
+{
+    uint32_t  lo, hi;
+
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+
+    return ((uint64_t) hi << 32) | lo;
+}
+
+#define ngx_event_loop_clock()                                                \
+    (ngx_event_tsc_khz ? ngx_event_rdtsc() : ngx_event_monotonic())
+
+#define ngx_event_loop_usec(ticks)                                            \
+    (ngx_event_tsc_khz ? (ticks) * 1000 / ngx_event_tsc_khz : (ticks))
+
+#else
+
+#define ngx_event_loop_clock()      ngx_event_monotonic()
+#define ngx_event_loop_usec(ticks)  (ticks)
 
 #endif
 
 
+extern ngx_msec_t     ngx_event_handler_threshold;
+
+
+#define ngx_event_call_handler(ev)                                            \
+    do {                                                                      \
+        if (ngx_event_handler_threshold) {                                    \
+            ngx_event_timed_handler(ev);                                      \
+                                                                              \
+        } else {                                                              \
+            (ev)->handler(ev);                                                \
+        }                                                                     \
+    } while (0)
+
+
 #define NGX_UPDATE_TIME         1
 #define NGX_POST_EVENTS         2
 #define NGX_POST_THREAD_EVENTS  4
@@ -539,6 +638,12 @@ u_char *ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len);
 
 
 void ngx_process_events_and_timers(ngx_cycle_t *cycle);
+uint64_t ngx_event_monotonic(void);
+void ngx_event_timed_handler(ngx_event_t *ev);
+#if (NGX_STAT_STUB)
+u_char *ngx_event_loop_histogram(u_char *buf);
+u_char *ngx_event_loop_percentile(u_char *buf, ngx_uint_t percent);
+#endif
 ngx_int_t ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags);
 ngx_int_t ngx_handle_write_event(ngx_event_t *wev, size_t lowat);
 
@@ -10,15 +10,34 @@
 #include <ngx_event.h>
 
 
-typedef struct {
-    ngx_uint_t  engine;   /* unsigned  engine:1; */
-} ngx_openssl_conf_t;
+#define NGX_SSL_TICKET_KEYS_CHECK  60
 
 
 static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+static void ngx_ssl_handshake_done(ngx_connection_t *c);
+#ifdef SSL_ERROR_WANT_ASYNC
+static ngx_int_t ngx_ssl_async_wait(ngx_connection_t *c);
+static void ngx_ssl_async_handler(ngx_event_t *ev);
+static void ngx_ssl_async_release(ngx_connection_t *c);
+#endif
+#if (NGX_SSL_ASYNC_OFFLOAD)
+static int ngx_ssl_offload_priv_enc(int flen, const u_char *from, u_char *to,
+    RSA *rsa, int padding);
+static int ngx_ssl_offload_priv_dec(int flen, const u_char *from, u_char *to,
+    RSA *rsa, int padding);
+static int ngx_ssl_offload(ngx_uint_t decrypt, int flen, const u_char *from,
+    u_char *to, RSA *rsa, int padding);
+static void ngx_ssl_offload_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+    OSSL_ASYNC_FD fd, void *data);
+static void *ngx_ssl_offload_thread(void *data);
+static ngx_int_t ngx_ssl_offload_start(ngx_cycle_t *cycle,
+    ngx_openssl_conf_t *oscf);
+static void ngx_ssl_offload_key(ngx_cycle_t *cycle, SSL_CTX *ctx);
+static void ngx_ssl_offload_stop(void);
+#endif
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
@@ -26,6 +45,12 @@ static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
     ngx_err_t err, char *text);
 static void ngx_ssl_clear_error(ngx_log_t *log);
+static size_t ngx_ssl_dyn_rec_size(ngx_ssl_connection_t *sc);
+static void ngx_ssl_dyn_rec_sent(ngx_ssl_connection_t *sc, ssize_t n);
+#ifdef BIO_get_ktls_send
+static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
+#endif
 
 static ngx_int_t ngx_ssl_session_id_context(ngx_ssl_t *ssl,
     ngx_str_t *sess_ctx);
@@ -33,21 +58,34 @@ ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
 static int ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn,
     ngx_ssl_session_t *sess);
 static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
+#if OPENSSL_VERSION_NUMBER >= 0x10100003L
+    const
+#endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
+    ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+static ngx_int_t ngx_ssl_read_session_ticket_key(ngx_str_t *name,
+    ngx_ssl_session_ticket_key_t *key, time_t *mtime, ngx_uint_t level,
+    ngx_log_t *log);
+static ngx_int_t ngx_ssl_update_session_ticket_keys(
+    ngx_ssl_session_ticket_keys_t *tk, SSL_CTX *ssl_ctx, ngx_log_t *log);
+static void ngx_ssl_reload_session_ticket_keys(
+    ngx_ssl_session_ticket_keys_t *tk, ngx_log_t *log);
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
 #endif
 
 static void *ngx_openssl_create_conf(ngx_cycle_t *cycle);
+static char *ngx_openssl_init_conf(ngx_cycle_t *cycle, void *conf);
 static char *ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_openssl_init_process(ngx_cycle_t *cycle);
+static void ngx_openssl_exit_process(ngx_cycle_t *cycle);
 static void ngx_openssl_exit(ngx_cycle_t *cycle);
 
 
@@ -60,6 +98,13 @@ static ngx_command_t  ngx_openssl_commands[] = {
       0,
       NULL },
 
+    { ngx_string("ssl_async_threads"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_openssl_conf_t, async_threads),
+      NULL },
+
       ngx_null_command
 };
 
@@ -67,7 +112,7 @@ static ngx_command_t  ngx_openssl_commands[] = {
 static ngx_core_module_t  ngx_openssl_module_ctx = {
     ngx_string("openssl"),
     ngx_openssl_create_conf,
-    NULL
+    ngx_openssl_init_conf
 };
 
 
@@ -78,10 +123,10 @@ ngx_module_t  ngx_openssl_module = {
     NGX_CORE_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_openssl_init_process,              /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_openssl_exit_process,              /* exit process */
     ngx_openssl_exit,                      /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -241,6 +286,10 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
     SSL_CTX_set_options(ssl->ctx, SSL_OP_NO_COMPRESSION);
 #endif
 
+#ifdef SSL_OP_NO_RENEGOTIATION
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_NO_RENEGOTIATION);
+#endif
+
 #ifdef SSL_MODE_RELEASE_BUFFERS
     SSL_CTX_set_mode(ssl->ctx, SSL_MODE_RELEASE_BUFFERS);
 #endif
@@ -543,6 +592,13 @@ ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where, int ret)
     BIO               *rbio, *wbio;
     ngx_connection_t  *c;
 
+#ifndef SSL_OP_NO_RENEGOTIATION
+
+    /*
+     * with SSL_OP_NO_RENEGOTIATION the library refuses renegotiation
+     * itself, while TLSv1.3 post-handshake messages also start a handshake
+     */
+
     if (where & SSL_CB_HANDSHAKE_START) {
         c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
 
@@ -552,6 +608,8 @@ ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where, int ret)
         }
     }
 
+#endif
+
     if ((where & SSL_CB_ACCEPT_LOOP) == SSL_CB_ACCEPT_LOOP) {
         c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
 
@@ -598,8 +656,9 @@ ngx_ssl_rsa512_key_callback(ngx_ssl_conn_t *ssl_conn, int is_export,
 ngx_int_t
 ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
 {
-    DH   *dh;
-    BIO  *bio;
+    DH      *dh;
+    BIO     *bio;
+    BIGNUM  *p, *g;
 
     /*
      * -----BEGIN DH PARAMETERS-----
@@ -628,21 +687,48 @@ ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
 
     if (file->len == 0) {
 
+#ifdef SSL_CTX_set_dh_auto
+
+        /* the 1024-bit group is below the default security level */
+
+        SSL_CTX_set_dh_auto(ssl->ctx, 1);
+
+        return NGX_OK;
+
+#endif
+
         dh = DH_new();
         if (dh == NULL) {
             ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "DH_new() failed");
             return NGX_ERROR;
         }
 
-        dh->p = BN_bin2bn(dh1024_p, sizeof(dh1024_p), NULL);
-        dh->g = BN_bin2bn(dh1024_g, sizeof(dh1024_g), NULL);
+        p = BN_bin2bn(dh1024_p, sizeof(dh1024_p), NULL);
+        g = BN_bin2bn(dh1024_g, sizeof(dh1024_g), NULL);
 
-        if (dh->p == NULL || dh->g == NULL) {
+        if (p == NULL || g == NULL) {
             ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "BN_bin2bn() failed");
+            BN_free(p);
+            BN_free(g);
+            DH_free(dh);
+            return NGX_ERROR;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+        if (DH_set0_pqg(dh, p, NULL, g) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "DH_set0_pqg() failed");
+            BN_free(p);
+            BN_free(g);
             DH_free(dh);
             return NGX_ERROR;
         }
 
+#else
+        dh->p = p;
+        dh->g = g;
+#endif
+
         SSL_CTX_set_tmp_dh(ssl->ctx, dh);
 
         DH_free(dh);
@@ -719,6 +805,30 @@ ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name)
 }
 
 
+ngx_int_t
+ngx_ssl_async_offload(ngx_conf_t *cf, ngx_ssl_t *ssl)
+{
+#if (NGX_SSL_ASYNC_OFFLOAD)
+
+    SSL_CTX             **ctx;
+    ngx_openssl_conf_t   *oscf;
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    ctx = ngx_array_push(&oscf->async_ctxs);
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    *ctx = ssl->ctx;
+
+#endif
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 {
@@ -731,6 +841,8 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 
     sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
     sc->buffer_size = ssl->buffer_size;
+    sc->dyn_rec = ssl->dyn_rec;
+    sc->handshake_start = ngx_current_msec;
 
     sc->connection = SSL_new(ssl->ctx);
 
@@ -744,6 +856,12 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
         return NGX_ERROR;
     }
 
+#ifdef SSL_MODE_ASYNC
+    if (ssl->async) {
+        SSL_set_mode(sc->connection, SSL_MODE_ASYNC);
+    }
+#endif
+
     if (flags & NGX_SSL_CLIENT) {
         SSL_set_connect_state(sc->connection);
 
@@ -847,16 +965,35 @@ ngx_ssl_handshake(ngx_connection_t *c)
 
         c->ssl->handshaked = 1;
 
+        ngx_ssl_handshake_done(c);
+
+#ifdef BIO_get_ktls_send
+
+        /* the kernel encrypts the records, so files may be sent directly */
+
+        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "SSL kernel TLS send enabled");
+
+            c->ssl->sendfile = 1;
+        }
+
+#endif
+
         c->recv = ngx_ssl_recv;
         c->send = ngx_ssl_write;
         c->recv_chain = ngx_ssl_recv_chain;
         c->send_chain = ngx_ssl_send_chain;
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
         /* initial handshake done, disable renegotiation (CVE-2009-3555) */
         if (c->ssl->connection->s3) {
             c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
         }
 
+#endif
+
         return NGX_OK;
     }
 
@@ -896,6 +1033,30 @@ ngx_ssl_handshake(ngx_connection_t *c)
         return NGX_AGAIN;
     }
 
+#ifdef SSL_ERROR_WANT_ASYNC
+
+    if (sslerr == SSL_ERROR_WANT_ASYNC) {
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_ssl_async_wait(c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_ASYNC_JOB) {
+
+        /* no async jobs are available, complete the handshake inline */
+
+        SSL_clear_mode(c->ssl->connection, SSL_MODE_ASYNC);
+
+        return ngx_ssl_handshake(c);
+    }
+
+#endif
+
     err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
 
     c->ssl->no_wait_shutdown = 1;
@@ -940,193 +1101,863 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
 }
 
 
-ssize_t
-ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl)
-{
-    u_char     *last;
-    ssize_t     n, bytes;
-    ngx_buf_t  *b;
-
-    bytes = 0;
+#if (NGX_STAT_STUB)
 
-    b = cl->buf;
-    last = b->last;
+static ngx_msec_t  ngx_ssl_handshake_bounds[NGX_SSL_HANDSHAKE_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
 
-    for ( ;; ) {
+#endif
 
-        n = ngx_ssl_recv(c, last, b->end - last);
 
-        if (n > 0) {
-            last += n;
-            bytes += n;
+static void
+ngx_ssl_handshake_done(ngx_connection_t *c)
+{
+#if (NGX_STAT_STUB)
+    ngx_uint_t  i;
+#endif
 
-            if (last == b->end) {
-                cl = cl->next;
+    c->ssl->handshake_time = ngx_current_msec - c->ssl->handshake_start;
 
-                if (cl == NULL) {
-                    return bytes;
-                }
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake time: %M", c->ssl->handshake_time);
 
-                b = cl->buf;
-                last = b->last;
-            }
+#if (NGX_STAT_STUB)
 
-            continue;
+    for (i = 0; i < NGX_SSL_HANDSHAKE_BUCKETS - 1; i++) {
+        if (c->ssl->handshake_time <= ngx_ssl_handshake_bounds[i]) {
+            break;
         }
+    }
 
-        if (bytes) {
+    (void) ngx_atomic_fetch_add(&ngx_stat_ssl_handshakes[i], 1);
 
-            if (n == 0 || n == NGX_ERROR) {
-                c->read->ready = 1;
-            }
+#endif
 
-            return bytes;
-        }
+#ifdef SSL_ERROR_WANT_ASYNC
 
-        return n;
+    if (SSL_get_mode(c->ssl->connection) & SSL_MODE_ASYNC) {
+        ngx_ssl_async_release(c);
+
+        /* only the handshake private key operations are offloaded */
+
+        SSL_clear_mode(c->ssl->connection, SSL_MODE_ASYNC);
     }
+
+#endif
 }
 
 
-ssize_t
-ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
+#if (NGX_STAT_STUB)
+
+u_char *
+ngx_ssl_handshake_histogram(u_char *buf)
 {
-    int  n, bytes;
+    u_char      *p;
+    ngx_uint_t   i;
 
-    if (c->ssl->last == NGX_ERROR) {
-        c->read->error = 1;
-        return NGX_ERROR;
-    }
+    p = buf;
 
-    if (c->ssl->last == NGX_DONE) {
-        c->read->ready = 0;
-        c->read->eof = 1;
-        return 0;
+    for (i = 0; i < NGX_SSL_HANDSHAKE_BUCKETS; i++) {
+
+        if (i) {
+            *p++ = ' ';
+        }
+
+        if (i < NGX_SSL_HANDSHAKE_BUCKETS - 1) {
+            p = ngx_sprintf(p, "%M:", ngx_ssl_handshake_bounds[i]);
+
+        } else {
+            p = ngx_cpymem(p, "inf:", sizeof("inf:") - 1);
+        }
+
+        p = ngx_sprintf(p, "%uA", ngx_stat_ssl_handshakes[i]);
     }
 
-    bytes = 0;
+    return p;
+}
 
-    ngx_ssl_clear_error(c->log);
+#endif
 
-    /*
-     * SSL_read() may return data in parts, so try to read
-     * until SSL_read() would return no data
-     */
 
-    for ( ;; ) {
+#ifdef SSL_ERROR_WANT_ASYNC
 
-        n = SSL_read(c->ssl->connection, buf, size);
+/*
+ * With SSL_MODE_ASYNC and an async capable engine loaded by "ssl_engine",
+ * the private key operations run as OpenSSL async jobs; the paused job
+ * signals its completion via a file descriptor, which is added to the
+ * event loop to resume the handshake.
+ */
 
-        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_read: %d", n);
+static ngx_int_t
+ngx_ssl_async_wait(ngx_connection_t *c)
+{
+    size_t             n;
+    OSSL_ASYNC_FD      fd;
+    ngx_connection_t  *ac;
 
-        if (n > 0) {
-            bytes += n;
-        }
+    n = 0;
 
-        c->ssl->last = ngx_ssl_handle_recv(c, n);
+    if (SSL_get_all_async_fds(c->ssl->connection, NULL, &n) == 0) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_get_all_async_fds() failed");
+        return NGX_ERROR;
+    }
 
-        if (c->ssl->last == NGX_OK) {
+    if (n == 0) {
 
-            size -= n;
+        /* the engine provides no wait fd, retry on the next iteration */
 
-            if (size == 0) {
-                c->read->ready = 1;
-                return bytes;
-            }
+        ngx_post_event(c->read, &ngx_posted_events);
+        return NGX_OK;
+    }
 
-            buf += n;
+    /* engines use a single wait fd per connection */
 
-            continue;
-        }
+    n = 1;
 
-        if (bytes) {
-            if (c->ssl->last != NGX_AGAIN) {
-                c->read->ready = 1;
-            }
+    if (SSL_get_all_async_fds(c->ssl->connection, &fd, &n) == 0) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_get_all_async_fds() failed");
+        return NGX_ERROR;
+    }
 
-            return bytes;
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL async fd: %d", fd);
+
+    ac = c->ssl->async;
+
+    if (ac) {
+        if (ac->fd == fd) {
+            return NGX_OK;
         }
 
-        switch (c->ssl->last) {
+        ngx_ssl_async_release(c);
+    }
 
-        case NGX_DONE:
-            c->read->ready = 0;
-            c->read->eof = 1;
-            return 0;
+    ac = ngx_get_connection(fd, c->log);
+    if (ac == NULL) {
+        return NGX_ERROR;
+    }
 
-        case NGX_ERROR:
-            c->read->error = 1;
+    ac->data = c;
+    ac->log = c->log;
+    ac->read->log = c->log;
+    ac->write->log = c->log;
+    ac->read->handler = ngx_ssl_async_handler;
 
-            /* fall through */
+    c->ssl->async = ac;
 
-        case NGX_AGAIN:
-            return c->ssl->last;
-        }
+    if (ngx_handle_read_event(ac->read, 0) != NGX_OK) {
+        ngx_ssl_async_release(c);
+        return NGX_ERROR;
     }
+
+    return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_ssl_handle_recv(ngx_connection_t *c, int n)
+static void
+ngx_ssl_async_handler(ngx_event_t *ev)
 {
-    int        sslerr;
-    ngx_err_t  err;
+    ngx_connection_t  *ac, *c;
 
-    if (c->ssl->renegotiation) {
-        /*
-         * disable renegotiation (CVE-2009-3555):
-         * OpenSSL (at least up to 0.9.8l) does not handle disabled
-         * renegotiation gracefully, so drop connection here
-         */
+    ac = ev->data;
+    c = ac->data;
 
-        ngx_log_error(NGX_LOG_NOTICE, c->log, 0, "SSL renegotiation disabled");
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL async handler");
 
-        while (ERR_peek_error()) {
-            ngx_ssl_error(NGX_LOG_DEBUG, c->log, 0,
-                          "ignoring stale global SSL error");
-        }
+    c->read->handler(c->read);
+}
 
-        ERR_clear_error();
 
-        c->ssl->no_wait_shutdown = 1;
-        c->ssl->no_send_shutdown = 1;
+static void
+ngx_ssl_async_release(ngx_connection_t *c)
+{
+    ngx_connection_t  *ac;
 
-        return NGX_ERROR;
-    }
+    ac = c->ssl->async;
 
-    if (n > 0) {
+    if (ac == NULL) {
+        return;
+    }
 
-        if (c->ssl->saved_write_handler) {
+    c->ssl->async = NULL;
 
-            c->write->handler = c->ssl->saved_write_handler;
-            c->ssl->saved_write_handler = NULL;
-            c->write->ready = 1;
+    /* the fd is owned by the engine and is not closed */
 
-            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-                return NGX_ERROR;
-            }
+    if (ngx_del_conn) {
+        ngx_del_conn(ac, 0);
 
-            ngx_post_event(c->write, &ngx_posted_events);
-        }
+    } else if (ac->read->active || ac->read->disabled) {
+        ngx_del_event(ac->read, NGX_READ_EVENT, 0);
+    }
 
-        return NGX_OK;
+    if (ac->read->prev) {
+        ngx_delete_posted_event(ac->read);
     }
 
-    sslerr = SSL_get_error(c->ssl->connection, n);
+    ac->read->closed = 1;
+    ac->write->closed = 1;
 
-    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+    ngx_free_connection(ac);
 
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+    ac->fd = (ngx_socket_t) -1;
+}
 
-    if (sslerr == SSL_ERROR_WANT_READ) {
-        c->read->ready = 0;
-        return NGX_AGAIN;
-    }
+#endif
 
-    if (sslerr == SSL_ERROR_WANT_WRITE) {
 
-        ngx_log_error(NGX_LOG_INFO, c->log, 0,
-                      "peer started SSL renegotiation");
+#if (NGX_SSL_ASYNC_OFFLOAD)
+
+/*
+ * Without an async engine, the RSA private key operations of the contexts
+ * with "ssl_async" are run by a pool of "ssl_async_threads" threads.  The
+ * key gets an RSA method which, inside an async job, queues the operation
+ * and pauses the job; the thread signals the job's wait fd when done.
+ * Outside of a job the operation is done in place.  The threads only call
+ * the default RSA implementation, which is thread safe.
+ */
+
+typedef struct ngx_ssl_offload_task_s  ngx_ssl_offload_task_t;
+
+typedef struct {
+    OSSL_ASYNC_FD               fd[2];
+    ngx_ssl_offload_task_t     *task;
+
+    /* the wait context was freed while the task was in the thread */
+    ngx_uint_t                  orphan;
+} ngx_ssl_offload_wait_t;
+
+
+struct ngx_ssl_offload_task_s {
+    ngx_ssl_offload_task_t     *next;
+    ngx_ssl_offload_wait_t     *wait;
+
+    RSA                        *rsa;
+    ngx_uint_t                  decrypt;
+    int                         padding;
+    int                         flen;
+    int                         ret;
+    ngx_uint_t                  done;
+
+    /* the copies, the caller's buffers are not touched by the thread */
+    u_char                     *from;
+    u_char                     *to;
+};
+
+
+typedef struct {
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;
+
+    ngx_ssl_offload_task_t     *head;
+    ngx_ssl_offload_task_t    **last;
+
+    pthread_t                  *tids;
+    ngx_uint_t                  nthreads;
+    ngx_uint_t                  exiting;
+} ngx_ssl_offload_pool_t;
+
+
+static ngx_ssl_offload_pool_t  ngx_ssl_offload_pool;
+static RSA_METHOD             *ngx_ssl_offload_method;
+static int                     ngx_ssl_offload_wait_key;
+
+
+static int
+ngx_ssl_offload_priv_enc(int flen, const u_char *from, u_char *to, RSA *rsa,
+    int padding)
+{
+    return ngx_ssl_offload(0, flen, from, to, rsa, padding);
+}
+
+
+static int
+ngx_ssl_offload_priv_dec(int flen, const u_char *from, u_char *to, RSA *rsa,
+    int padding)
+{
+    return ngx_ssl_offload(1, flen, from, to, rsa, padding);
+}
+
+
+static int
+ngx_ssl_offload(ngx_uint_t decrypt, int flen, const u_char *from, u_char *to,
+    RSA *rsa, int padding)
+{
+    int                      ret;
+    u_char                   buf[8];
+    ASYNC_JOB               *job;
+    ngx_uint_t               done;
+    OSSL_ASYNC_FD            fd;
+    ASYNC_WAIT_CTX          *ctx;
+    const RSA_METHOD        *meth;
+    ngx_ssl_offload_task_t  *task;
+    ngx_ssl_offload_wait_t  *wait;
+
+    job = ASYNC_get_current_job();
+
+    if (job == NULL || ngx_ssl_offload_pool.nthreads == 0) {
+        meth = RSA_PKCS1_OpenSSL();
+
+        return decrypt ? RSA_meth_get_priv_dec(meth)(flen, from, to, rsa,
+                                                     padding)
+                       : RSA_meth_get_priv_enc(meth)(flen, from, to, rsa,
+                                                     padding);
+    }
+
+    ctx = ASYNC_get_wait_ctx(job);
+
+    if (ASYNC_WAIT_CTX_get_fd(ctx, &ngx_ssl_offload_wait_key, &fd,
+                              (void **) &wait)
+        == 0)
+    {
+        wait = ngx_alloc(sizeof(ngx_ssl_offload_wait_t), ngx_cycle->log);
+        if (wait == NULL) {
+            return -1;
+        }
+
+        if (pipe(wait->fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          "pipe() failed");
+            ngx_free(wait);
+            return -1;
+        }
+
+        if (ngx_nonblocking(wait->fd[0]) == -1
+            || ngx_nonblocking(wait->fd[1]) == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_nonblocking_n " failed");
+            ngx_ssl_offload_cleanup(NULL, NULL, 0, wait);
+            return -1;
+        }
+
+        wait->task = NULL;
+        wait->orphan = 0;
+
+        if (ASYNC_WAIT_CTX_set_wait_fd(ctx, &ngx_ssl_offload_wait_key,
+                                       wait->fd[0], wait,
+                                       ngx_ssl_offload_cleanup)
+            == 0)
+        {
+            ngx_ssl_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "ASYNC_WAIT_CTX_set_wait_fd() failed");
+            ngx_ssl_offload_cleanup(NULL, NULL, 0, wait);
+            return -1;
+        }
+    }
+
+    task = ngx_alloc(sizeof(ngx_ssl_offload_task_t) + flen + RSA_size(rsa),
+                     ngx_cycle->log);
+    if (task == NULL) {
+        return -1;
+    }
+
+    task->next = NULL;
+    task->wait = wait;
+    task->rsa = rsa;
+    task->decrypt = decrypt;
+    task->padding = padding;
+    task->flen = flen;
+    task->ret = -1;
+    task->done = 0;
+    task->from = (u_char *) task + sizeof(ngx_ssl_offload_task_t);
+    task->to = task->from + flen;
+
+    ngx_memcpy(task->from, from, flen);
+
+    RSA_up_ref(rsa);
+
+    (void) pthread_mutex_lock(&ngx_ssl_offload_pool.mutex);
+
+    wait->task = task;
+
+    *ngx_ssl_offload_pool.last = task;
+    ngx_ssl_offload_pool.last = &task->next;
+
+    (void) pthread_cond_signal(&ngx_ssl_offload_pool.cond);
+    (void) pthread_mutex_unlock(&ngx_ssl_offload_pool.mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "SSL offload %s: %d", decrypt ? "decrypt" : "sign", flen);
+
+    do {
+        if (ASYNC_pause_job() == 0) {
+            ngx_ssl_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "ASYNC_pause_job() failed");
+        }
+
+        /* the job is also resumed by the other events of the connection */
+
+        (void) pthread_mutex_lock(&ngx_ssl_offload_pool.mutex);
+        done = task->done;
+        (void) pthread_mutex_unlock(&ngx_ssl_offload_pool.mutex);
+
+    } while (!done);
+
+    while (read(wait->fd[0], buf, sizeof(buf)) > 0) { /* void */ }
+
+    ret = task->ret;
+
+    if (ret > 0) {
+        ngx_memcpy(to, task->to, ret);
+    }
+
+    (void) pthread_mutex_lock(&ngx_ssl_offload_pool.mutex);
+    wait->task = NULL;
+    (void) pthread_mutex_unlock(&ngx_ssl_offload_pool.mutex);
+
+    ngx_free(task);
+
+    return ret;
+}
+
+
+static void
+ngx_ssl_offload_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+    OSSL_ASYNC_FD fd, void *data)
+{
+    ngx_ssl_offload_wait_t  *wait = data;
+
+    if (ctx) {
+        (void) pthread_mutex_lock(&ngx_ssl_offload_pool.mutex);
+
+        if (wait->task) {
+
+            /* the connection is closed, the thread frees the wait */
+
+            wait->orphan = 1;
+
+            (void) pthread_mutex_unlock(&ngx_ssl_offload_pool.mutex);
+            return;
+        }
+
+        (void) pthread_mutex_unlock(&ngx_ssl_offload_pool.mutex);
+    }
+
+    (void) close(wait->fd[0]);
+    (void) close(wait->fd[1]);
+
+    ngx_free(wait);
+}
+
+
+static void *
+ngx_ssl_offload_thread(void *data)
+{
+    ngx_ssl_offload_pool_t  *pool = data;
+
+    int                      ret;
+    const RSA_METHOD        *meth;
+    ngx_ssl_offload_task_t  *task;
+    ngx_ssl_offload_wait_t  *wait;
+
+    meth = RSA_PKCS1_OpenSSL();
+
+    for ( ;; ) {
+        (void) pthread_mutex_lock(&pool->mutex);
+
+        while (pool->head == NULL && !pool->exiting) {
+            (void) pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+
+        task = pool->head;
+
+        if (task == NULL) {
+            (void) pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+
+        pool->head = task->next;
+
+        if (pool->head == NULL) {
+            pool->last = &pool->head;
+        }
+
+        (void) pthread_mutex_unlock(&pool->mutex);
+
+        if (task->decrypt) {
+            ret = RSA_meth_get_priv_dec(meth)(task->flen, task->from,
+                                              task->to, task->rsa,
+                                              task->padding);
+        } else {
+            ret = RSA_meth_get_priv_enc(meth)(task->flen, task->from,
+                                              task->to, task->rsa,
+                                              task->padding);
+        }
+
+        RSA_free(task->rsa);
+
+        /* the errors of the thread are not seen by the worker */
+
+        ERR_clear_error();
+
+        wait = task->wait;
+
+        (void) pthread_mutex_lock(&pool->mutex);
+
+        if (wait->orphan) {
+            (void) pthread_mutex_unlock(&pool->mutex);
+
+            ngx_free(task);
+            ngx_ssl_offload_cleanup(NULL, NULL, 0, wait);
+            continue;
+        }
+
+        task->ret = ret;
+        task->done = 1;
+
+        (void) write(wait->fd[1], "", 1);
+
+        (void) pthread_mutex_unlock(&pool->mutex);
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_ssl_offload_start(ngx_cycle_t *cycle, ngx_openssl_conf_t *oscf)
+{
+    ngx_err_t                err;
+    sigset_t                 set, old;
+    ngx_uint_t               i;
+    ngx_ssl_offload_pool_t  *pool;
+
+    pool = &ngx_ssl_offload_pool;
+
+    pool->tids = ngx_alloc(oscf->async_threads * sizeof(pthread_t),
+                           cycle->log);
+    if (pool->tids == NULL) {
+        return NGX_ERROR;
+    }
+
+    pool->head = NULL;
+    pool->last = &pool->head;
+
+    err = pthread_mutex_init(&pool->mutex, NULL);
+
+    if (err == 0) {
+        err = pthread_cond_init(&pool->cond, NULL);
+    }
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                      "pthread_mutex_init() failed");
+        return NGX_ERROR;
+    }
+
+    /* the threads do not handle signals */
+
+    sigfillset(&set);
+
+    if (pthread_sigmask(SIG_SETMASK, &set, &old) != 0) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "pthread_sigmask() failed");
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < (ngx_uint_t) oscf->async_threads; i++) {
+        err = pthread_create(&pool->tids[i], NULL, ngx_ssl_offload_thread,
+                             pool);
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                          "pthread_create() failed");
+            break;
+        }
+
+        pool->nthreads++;
+    }
+
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (pool->nthreads == 0) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "SSL offload threads: %ui", pool->nthreads);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_offload_key(ngx_cycle_t *cycle, SSL_CTX *ctx)
+{
+    RSA       *rsa, *dup;
+    EVP_PKEY  *pkey;
+
+    pkey = SSL_CTX_get0_privatekey(ctx);
+
+    if (pkey == NULL || EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "only RSA private keys are offloaded to threads");
+        return;
+    }
+
+    rsa = EVP_PKEY_get1_RSA(pkey);
+    if (rsa == NULL) {
+        ngx_ssl_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "EVP_PKEY_get1_RSA() failed");
+        return;
+    }
+
+    if (RSA_get_method(rsa) == ngx_ssl_offload_method) {
+
+        /* the context is shared by several servers */
+
+        RSA_free(rsa);
+        return;
+    }
+
+    dup = RSAPrivateKey_dup(rsa);
+
+    RSA_free(rsa);
+
+    if (dup == NULL) {
+        ngx_ssl_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "RSAPrivateKey_dup() failed");
+        return;
+    }
+
+    /* the key with a non-default method stays out of the providers */
+
+    RSA_set_method(dup, ngx_ssl_offload_method);
+
+    pkey = EVP_PKEY_new();
+
+    if (pkey == NULL || EVP_PKEY_assign_RSA(pkey, dup) == 0) {
+        ngx_ssl_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "EVP_PKEY_assign_RSA() failed");
+        EVP_PKEY_free(pkey);
+        RSA_free(dup);
+        return;
+    }
+
+    if (SSL_CTX_use_PrivateKey(ctx, pkey) == 0) {
+        ngx_ssl_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "SSL_CTX_use_PrivateKey() failed");
+    }
+
+    EVP_PKEY_free(pkey);
+}
+
+
+static void
+ngx_ssl_offload_stop(void)
+{
+    ngx_uint_t               i;
+    ngx_ssl_offload_pool_t  *pool;
+
+    pool = &ngx_ssl_offload_pool;
+
+    if (pool->nthreads == 0) {
+        return;
+    }
+
+    (void) pthread_mutex_lock(&pool->mutex);
+    pool->exiting = 1;
+    (void) pthread_cond_broadcast(&pool->cond);
+    (void) pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->nthreads; i++) {
+        (void) pthread_join(pool->tids[i], NULL);
+    }
+
+    pool->nthreads = 0;
+}
+
+#endif
+
+
+ssize_t
+ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl)
+{
+    u_char     *last;
+    ssize_t     n, bytes;
+    ngx_buf_t  *b;
+
+    bytes = 0;
+
+    b = cl->buf;
+    last = b->last;
+
+    for ( ;; ) {
+
+        n = ngx_ssl_recv(c, last, b->end - last);
+
+        if (n > 0) {
+            last += n;
+            bytes += n;
+
+            if (last == b->end) {
+                cl = cl->next;
+
+                if (cl == NULL) {
+                    return bytes;
+                }
+
+                b = cl->buf;
+                last = b->last;
+            }
+
+            continue;
+        }
+
+        if (bytes) {
+
+            if (n == 0 || n == NGX_ERROR) {
+                c->read->ready = 1;
+            }
+
+            return bytes;
+        }
+
+        return n;
+    }
+}
+
+
+ssize_t
+ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    int  n, bytes;
+
+    if (c->ssl->last == NGX_ERROR) {
+        c->read->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (c->ssl->last == NGX_DONE) {
+        c->read->ready = 0;
+        c->read->eof = 1;
+        return 0;
+    }
+
+    bytes = 0;
+
+    ngx_ssl_clear_error(c->log);
+
+    /*
+     * SSL_read() may return data in parts, so try to read
+     * until SSL_read() would return no data
+     */
+
+    for ( ;; ) {
+
+        n = SSL_read(c->ssl->connection, buf, size);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_read: %d", n);
+
+        if (n > 0) {
+            bytes += n;
+        }
+
+        c->ssl->last = ngx_ssl_handle_recv(c, n);
+
+        if (c->ssl->last == NGX_OK) {
+
+            size -= n;
+
+            if (size == 0) {
+                c->read->ready = 1;
+                return bytes;
+            }
+
+            buf += n;
+
+            continue;
+        }
+
+        if (bytes) {
+            if (c->ssl->last != NGX_AGAIN) {
+                c->read->ready = 1;
+            }
+
+            return bytes;
+        }
+
+        switch (c->ssl->last) {
+
+        case NGX_DONE:
+            c->read->ready = 0;
+            c->read->eof = 1;
+            return 0;
+
+        case NGX_ERROR:
+            c->read->error = 1;
+
+            /* fall through */
+
+        case NGX_AGAIN:
+            return c->ssl->last;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_ssl_handle_recv(ngx_connection_t *c, int n)
+{
+    int        sslerr;
+    ngx_err_t  err;
+
+    if (c->ssl->renegotiation) {
+        /*
+         * disable renegotiation (CVE-2009-3555):
+         * OpenSSL (at least up to 0.9.8l) does not handle disabled
+         * renegotiation gracefully, so drop connection here
+         */
+
+        ngx_log_error(NGX_LOG_NOTICE, c->log, 0, "SSL renegotiation disabled");
+
+        while (ERR_peek_error()) {
+            ngx_ssl_error(NGX_LOG_DEBUG, c->log, 0,
+                          "ignoring stale global SSL error");
+        }
+
+        ERR_clear_error();
+
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        return NGX_ERROR;
+    }
+
+    if (n > 0) {
+
+        if (c->ssl->saved_write_handler) {
+
+            c->write->handler = c->ssl->saved_write_handler;
+            c->ssl->saved_write_handler = NULL;
+            c->write->ready = 1;
+
+            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_post_event(c->write, &ngx_posted_events);
+        }
+
+        return NGX_OK;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_READ) {
+        c->read->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "peer started SSL renegotiation");
 
         c->write->ready = 0;
 
@@ -1184,6 +2015,7 @@ ngx_chain_t *
 ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
     int          n;
+    u_char      *end;
     ngx_uint_t   flush;
     ssize_t      send, size;
     ngx_buf_t   *buf;
@@ -1196,7 +2028,40 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
-            n = ngx_ssl_write(c, in->buf->pos, in->buf->last - in->buf->pos);
+#ifdef BIO_get_ktls_send
+
+            if (c->ssl->sendfile && !ngx_buf_in_memory(in->buf)) {
+
+                n = ngx_ssl_sendfile(c, in->buf, (size_t) NGX_MAX_INT32_VALUE);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    return in;
+                }
+
+                in->buf->file_pos += n;
+                c->sent += n;
+
+                if (in->buf->file_pos == in->buf->file_last) {
+                    in = in->next;
+                    continue;
+                }
+
+                return in;
+            }
+
+#endif
+
+            size = in->buf->last - in->buf->pos;
+
+            if (c->ssl->dyn_rec.enable) {
+                size = ngx_min((size_t) size, ngx_ssl_dyn_rec_size(c->ssl));
+            }
+
+            n = ngx_ssl_write(c, in->buf->pos, size);
 
             if (n == NGX_ERROR) {
                 return NGX_CHAIN_ERROR;
@@ -1209,6 +2074,8 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             in->buf->pos += n;
             c->sent += n;
 
+            ngx_ssl_dyn_rec_sent(c->ssl, n);
+
             if (in->buf->pos == in->buf->last) {
                 in = in->next;
             }
@@ -1251,7 +2118,21 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     for ( ;; ) {
 
-        while (in && buf->last < buf->end && send < limit) {
+        end = buf->end;
+
+        if (c->ssl->dyn_rec.enable) {
+            end = buf->start + ngx_ssl_dyn_rec_size(c->ssl);
+
+            if (end > buf->end) {
+                end = buf->end;
+            }
+
+            if (end < buf->last) {
+                end = buf->last;
+            }
+        }
+
+        while (in && buf->last < end && send < limit) {
             if (in->buf->last_buf || in->buf->flush) {
                 flush = 1;
             }
@@ -1261,10 +2142,46 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+#ifdef BIO_get_ktls_send
+
+            if (c->ssl->sendfile && !ngx_buf_in_memory(in->buf)) {
+
+                if (buf->last > buf->pos) {
+                    /* send the buffered data first */
+                    flush = 1;
+                    break;
+                }
+
+                n = ngx_ssl_sendfile(c, in->buf, (size_t) (limit - send));
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    break;
+                }
+
+                in->buf->file_pos += n;
+                send += n;
+                c->sent += n;
+
+                if (in->buf->file_pos == in->buf->file_last) {
+                    in = in->next;
+                    continue;
+                }
+
+                /* the socket buffer is full */
+
+                break;
+            }
+
+#endif
+
             size = in->buf->last - in->buf->pos;
 
-            if (size > buf->end - buf->last) {
-                size = buf->end - buf->last;
+            if (size > end - buf->last) {
+                size = end - buf->last;
             }
 
             if (send + size > limit) {
@@ -1285,7 +2202,7 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             }
         }
 
-        if (!flush && send < limit && buf->last < buf->end) {
+        if (!flush && send < limit && buf->last < end) {
             break;
         }
 
@@ -1310,6 +2227,8 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         buf->pos += n;
         c->sent += n;
 
+        ngx_ssl_dyn_rec_sent(c->ssl, n);
+
         if (n < size) {
             break;
         }
@@ -1337,6 +2256,108 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 }
 
 
+#ifdef BIO_get_ktls_send
+
+static ssize_t
+ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+    int         sslerr;
+    ssize_t     n;
+    ngx_err_t   err;
+
+    if ((off_t) size > file->file_last - file->file_pos) {
+        size = (size_t) (file->file_last - file->file_pos);
+    }
+
+    ngx_ssl_clear_error(c->log);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_sendfile: @%O %uz", file->file_pos, size);
+
+    n = SSL_sendfile(c->ssl->connection, file->file->fd, file->file_pos,
+                     size, 0);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_sendfile: %z", n);
+
+    if (n > 0) {
+
+        if ((size_t) n < size) {
+            c->write->ready = 0;
+        }
+
+        return n;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->write->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_sendfile() failed");
+
+    return NGX_ERROR;
+}
+
+#endif
+
+
+static size_t
+ngx_ssl_dyn_rec_size(ngx_ssl_connection_t *sc)
+{
+    if (ngx_current_msec - sc->dyn_rec_last_write > sc->dyn_rec.timeout) {
+        sc->dyn_rec_sent = 0;
+        return sc->dyn_rec.size_lo;
+    }
+
+    if (sc->dyn_rec_sent >= 2 * sc->dyn_rec.threshold) {
+        return sc->buffer_size;
+    }
+
+    if (sc->dyn_rec_sent >= sc->dyn_rec.threshold) {
+        return sc->dyn_rec.size_hi;
+    }
+
+    return sc->dyn_rec.size_lo;
+}
+
+
+static void
+ngx_ssl_dyn_rec_sent(ngx_ssl_connection_t *sc, ssize_t n)
+{
+    if (sc->dyn_rec_sent < 2 * sc->dyn_rec.threshold) {
+        sc->dyn_rec_sent += n;
+    }
+
+    sc->dyn_rec_last_write = ngx_current_msec;
+
+#if (NGX_STAT_STUB)
+
+    if ((size_t) n <= sc->dyn_rec.size_lo) {
+        (void) ngx_atomic_fetch_add(ngx_stat_ssl_records_small, 1);
+
+    } else if ((size_t) n <= sc->dyn_rec.size_hi) {
+        (void) ngx_atomic_fetch_add(ngx_stat_ssl_records_medium, 1);
+
+    } else {
+        (void) ngx_atomic_fetch_add(ngx_stat_ssl_records_large,
+                                    (n + NGX_SSL_BUFSIZE - 1)
+                                    / NGX_SSL_BUFSIZE);
+    }
+
+#endif
+}
+
+
 ssize_t
 ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 {
@@ -1442,6 +2463,10 @@ ngx_ssl_shutdown(ngx_connection_t *c)
     int        n, sslerr, mode;
     ngx_err_t  err;
 
+#ifdef SSL_ERROR_WANT_ASYNC
+    ngx_ssl_async_release(c);
+#endif
+
     if (c->timedout) {
         mode = SSL_RECEIVED_SHUTDOWN|SSL_SENT_SHUTDOWN;
         SSL_set_quiet_shutdown(c->ssl->connection, 1);
@@ -1589,7 +2614,9 @@ ngx_ssl_connection_error(ngx_connection_t *c, int sslerr, ngx_err_t err,
             || n == SSL_R_ERROR_IN_RECEIVED_CIPHER_LIST              /*  151 */
             || n == SSL_R_EXCESSIVE_MESSAGE_SIZE                     /*  152 */
             || n == SSL_R_LENGTH_MISMATCH                            /*  159 */
+#ifdef SSL_R_NO_CIPHERS_PASSED
             || n == SSL_R_NO_CIPHERS_PASSED                          /*  182 */
+#endif
             || n == SSL_R_NO_CIPHERS_SPECIFIED                       /*  183 */
             || n == SSL_R_NO_COMPRESSION_SPECIFIED                   /*  187 */
             || n == SSL_R_NO_SHARED_CIPHER                           /*  193 */
@@ -1802,7 +2829,7 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
     int                   n, i;
     X509                 *cert;
     X509_NAME            *name;
-    EVP_MD_CTX            md;
+    EVP_MD_CTX           *md;
     unsigned int          len;
     STACK_OF(X509_NAME)  *list;
     u_char                buf[EVP_MAX_MD_SIZE];
@@ -1812,15 +2839,20 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
      * the server certificate, and the client CA list.
      */
 
-    EVP_MD_CTX_init(&md);
+    md = EVP_MD_CTX_create();
+    if (md == NULL) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "EVP_MD_CTX_create() failed");
+        return NGX_ERROR;
+    }
 
-    if (EVP_DigestInit_ex(&md, EVP_sha1(), NULL) == 0) {
+    if (EVP_DigestInit_ex(md, EVP_sha1(), NULL) == 0) {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                       "EVP_DigestInit_ex() failed");
         goto failed;
     }
 
-    if (EVP_DigestUpdate(&md, sess_ctx->data, sess_ctx->len) == 0) {
+    if (EVP_DigestUpdate(md, sess_ctx->data, sess_ctx->len) == 0) {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                       "EVP_DigestUpdate() failed");
         goto failed;
@@ -1834,7 +2866,7 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
         goto failed;
     }
 
-    if (EVP_DigestUpdate(&md, buf, len) == 0) {
+    if (EVP_DigestUpdate(md, buf, len) == 0) {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                       "EVP_DigestUpdate() failed");
         goto failed;
@@ -1854,7 +2886,7 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
                 goto failed;
             }
 
-            if (EVP_DigestUpdate(&md, buf, len) == 0) {
+            if (EVP_DigestUpdate(md, buf, len) == 0) {
                 ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                               "EVP_DigestUpdate() failed");
                 goto failed;
@@ -1862,13 +2894,13 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
         }
     }
 
-    if (EVP_DigestFinal_ex(&md, buf, &len) == 0) {
+    if (EVP_DigestFinal_ex(md, buf, &len) == 0) {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                       "EVP_DigestUpdate() failed");
         goto failed;
     }
 
-    EVP_MD_CTX_cleanup(&md);
+    EVP_MD_CTX_destroy(md);
 
     if (SSL_CTX_set_session_id_context(ssl->ctx, buf, len) == 0) {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
@@ -1880,7 +2912,7 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
 
 failed:
 
-    EVP_MD_CTX_cleanup(&md);
+    EVP_MD_CTX_destroy(md);
 
     return NGX_ERROR;
 }
@@ -1889,8 +2921,10 @@ failed:
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
+    size_t                    len, size;
+    ngx_uint_t                i, n;
+    ngx_slab_pool_t          *shpool, *sp;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
     if (data) {
@@ -1905,30 +2939,81 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    /*
+     * the sessions are spread over several shards by the session id hash,
+     * each shard has its own slab pool and mutex to lessen lock contention
+     */
+
+    n = ngx_min((ngx_uint_t) ngx_ncpu, NGX_SSL_MAX_SESSION_SHARDS);
+    n = ngx_min(n, shm_zone->shm.size / NGX_SSL_MIN_SESSION_SHARD);
+
+    if (n == 0) {
+        n = 1;
+    }
+
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t)
+                                   + (n - 1) * sizeof(ngx_ssl_session_shard_t));
     if (cache == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = cache;
-    shm_zone->data = cache;
+    shpool->data = cache;
+    shm_zone->data = cache;
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    ngx_memzero(cache->ticket_keys, sizeof(cache->ticket_keys));
+#endif
+
+    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    if (n == 1) {
+        cache->shards[0].shpool = shpool;
+
+    } else {
+        size = (shpool->end - shpool->start) / n;
+        size = (size - ngx_pagesize) & ~(ngx_pagesize - 1);
+
+        for (i = 0; i < n; i++) {
+
+            sp = ngx_slab_sub_pool(shpool, size);
+            if (sp == NULL) {
+                break;
+            }
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+            sp->log_ctx = shpool->log_ctx;
+            sp->log_nomem = 0;
 
-    ngx_queue_init(&cache->expire_queue);
+            cache->shards[i].shpool = sp;
+        }
 
-    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
+        if (i == 0) {
+            cache->shards[0].shpool = shpool;
+            i = 1;
+        }
 
-    shpool->log_ctx = ngx_slab_alloc(shpool, len);
-    if (shpool->log_ctx == NULL) {
-        return NGX_ERROR;
+        n = i;
     }
 
-    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
-                &shm_zone->shm.name);
+    cache->nshards = n;
 
-    shpool->log_nomem = 0;
+    for (i = 0; i < n; i++) {
+        shard = &cache->shards[i];
+
+        ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
+
+        ngx_queue_init(&shard->expire_queue);
+    }
 
     return NGX_OK;
 }
@@ -1958,10 +3043,13 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     u_char                   *p, *id, *cached_sess;
     uint32_t                  hash;
     SSL_CTX                  *ssl_ctx;
+    unsigned int              sess_id_len;
+    const u_char             *sess_id_data;
     ngx_shm_zone_t           *shm_zone;
     ngx_connection_t         *c;
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
@@ -1981,13 +3069,18 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ssl_ctx = SSL_get_SSL_CTX(ssl_conn);
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
+    sess_id_data = SSL_SESSION_get_id(sess, &sess_id_len);
+
+    hash = ngx_crc32_short((u_char *) sess_id_data, sess_id_len);
+
     cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -1995,7 +3088,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2011,7 +3104,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -2026,15 +3119,15 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
 #else
 
-    id = ngx_slab_alloc_locked(shpool, sess->session_id_length);
+    id = ngx_slab_alloc_locked(shpool, sess_id_len);
 
     if (id == NULL) {
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
-        id = ngx_slab_alloc_locked(shpool, sess->session_id_length);
+        id = ngx_slab_alloc_locked(shpool, sess_id_len);
 
         if (id == NULL) {
             goto failed;
@@ -2045,25 +3138,23 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(cached_sess, buf, len);
 
-    ngx_memcpy(id, sess->session_id, sess->session_id_length);
-
-    hash = ngx_crc32_short(sess->session_id, sess->session_id_length);
+    ngx_memcpy(id, sess_id_data, sess_id_len);
 
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%d:%d",
-                   hash, sess->session_id_length, len);
+                   hash, sess_id_len, len);
 
     sess_id->node.key = hash;
-    sess_id->node.data = (u_char) sess->session_id_length;
+    sess_id->node.data = (u_char) sess_id_len;
     sess_id->id = id;
     sess_id->len = len;
     sess_id->session = cached_sess;
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -2089,8 +3180,11 @@ failed:
 
 
 static ngx_ssl_session_t *
-ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
-    int *copy)
+ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
+#if OPENSSL_VERSION_NUMBER >= 0x10100003L
+    const
+#endif
+    u_char *id, int len, int *copy)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x0090707fL
     const
@@ -2103,13 +3197,14 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 #if (NGX_DEBUG)
     ngx_connection_t         *c;
 #endif
 
-    hash = ngx_crc32_short(id, (size_t) len);
+    hash = ngx_crc32_short((u_char *) id, (size_t) len);
     *copy = 0;
 
 #if (NGX_DEBUG)
@@ -2123,15 +3218,16 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
                                    ngx_ssl_session_cache_index);
 
     cache = shm_zone->data;
+    shard = &cache->shards[hash % cache->nshards];
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2149,7 +3245,8 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
 
         sess_id = (ngx_ssl_sess_id_t *) node;
 
-        rc = ngx_memn2cmp(id, sess_id->id, (size_t) len, (size_t) node->data);
+        rc = ngx_memn2cmp((u_char *) id, sess_id->id, (size_t) len,
+                          (size_t) node->data);
 
         if (rc == 0) {
 
@@ -2166,7 +3263,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2202,14 +3299,15 @@ ngx_ssl_remove_cached_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 static void
 ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 {
-    size_t                    len;
     u_char                   *id;
     uint32_t                  hash;
     ngx_int_t                 rc;
+    unsigned int              len;
     ngx_shm_zone_t           *shm_zone;
     ngx_slab_pool_t          *shpool;
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
@@ -2220,20 +3318,20 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
     cache = shm_zone->data;
 
-    id = sess->session_id;
-    len = (size_t) sess->session_id_length;
+    id = (u_char *) SSL_SESSION_get_id(sess, &len);
 
     hash = ngx_crc32_short(id, len);
 
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%uz", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2257,7 +3355,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2278,22 +3376,23 @@ done:
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
+    ngx_slab_pool_t    *shpool;
     ngx_ssl_sess_id_t  *sess_id;
 
     now = ngx_time();
+    shpool = shard->shpool;
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -2306,7 +3405,7 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
         ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2364,86 +3463,96 @@ ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 ngx_int_t
 ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
 {
-    u_char                         buf[48];
-    ssize_t                        n;
-    ngx_str_t                     *path;
-    ngx_file_t                     file;
-    ngx_uint_t                     i;
-    ngx_array_t                   *keys;
-    ngx_file_info_t                fi;
-    ngx_ssl_session_ticket_key_t  *key;
+    time_t                          mtime;
+    ngx_str_t                      *path;
+    ngx_uint_t                      i;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_ssl_session_ticket_key_t   *key;
+    ngx_ssl_session_ticket_keys_t  *tk;
+
+    shm_zone = NULL;
 
     if (paths == NULL) {
-        return NGX_OK;
+
+        /*
+         * without the keys files the keys are rotated in the shared
+         * session cache, so the tickets are valid in all workers and
+         * survive reconfiguration
+         */
+
+        shm_zone = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_session_cache_index);
+
+        if (shm_zone == NULL) {
+            return NGX_OK;
+        }
+
+#ifdef SSL_OP_NO_TICKET
+        if (SSL_CTX_get_options(ssl->ctx) & SSL_OP_NO_TICKET) {
+            return NGX_OK;
+        }
+#endif
     }
 
-    keys = ngx_array_create(cf->pool, paths->nelts,
-                            sizeof(ngx_ssl_session_ticket_key_t));
-    if (keys == NULL) {
+    tk = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_ticket_keys_t));
+    if (tk == NULL) {
         return NGX_ERROR;
     }
 
-    path = paths->elts;
-    for (i = 0; i < paths->nelts; i++) {
-
-        if (ngx_conf_full_name(cf->cycle, &path[i], 1) != NGX_OK) {
+    if (shm_zone) {
+        tk->keys = ngx_array_create(cf->pool, 3,
+                                    sizeof(ngx_ssl_session_ticket_key_t));
+        if (tk->keys == NULL) {
             return NGX_ERROR;
         }
 
-        ngx_memzero(&file, sizeof(ngx_file_t));
-        file.name = path[i];
-        file.log = cf->log;
-
-        file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, 0, 0);
-        if (file.fd == NGX_INVALID_FILE) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
-                               ngx_open_file_n " \"%V\" failed", &file.name);
+        key = ngx_array_push_n(tk->keys, 3);
+        if (key == NULL) {
             return NGX_ERROR;
         }
 
-        if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
-            ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
-                               ngx_fd_info_n " \"%V\" failed", &file.name);
-            goto failed;
-        }
+        /* the keys are copied from the shared zone on the first use */
 
-        if (ngx_file_size(&fi) != 48) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "\"%V\" must be 48 bytes", &file.name);
-            goto failed;
-        }
+        ngx_memzero(key, 3 * sizeof(ngx_ssl_session_ticket_key_t));
 
-        n = ngx_read_file(&file, buf, 48, 0);
+        tk->shm_zone = shm_zone;
 
-        if (n == NGX_ERROR) {
-            ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
-                               ngx_read_file_n " \"%V\" failed", &file.name);
-            goto failed;
-        }
+        goto done;
+    }
 
-        if (n != 48) {
-            ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
-                               ngx_read_file_n " \"%V\" returned only "
-                               "%z bytes instead of 48", &file.name, n);
-            goto failed;
+    tk->keys = ngx_array_create(cf->pool, paths->nelts,
+                                sizeof(ngx_ssl_session_ticket_key_t));
+    if (tk->keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    path = paths->elts;
+    for (i = 0; i < paths->nelts; i++) {
+
+        if (ngx_conf_full_name(cf->cycle, &path[i], 1) != NGX_OK) {
+            return NGX_ERROR;
         }
 
-        key = ngx_array_push(keys);
+        key = ngx_array_push(tk->keys);
         if (key == NULL) {
-            goto failed;
+            return NGX_ERROR;
         }
 
-        ngx_memcpy(key->name, buf, 16);
-        ngx_memcpy(key->aes_key, buf + 16, 16);
-        ngx_memcpy(key->hmac_key, buf + 32, 16);
-
-        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                          ngx_close_file_n " \"%V\" failed", &file.name);
+        if (ngx_ssl_read_session_ticket_key(&path[i], key, &mtime,
+                                            NGX_LOG_EMERG, cf->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
         }
+
+        tk->mtime = ngx_max(tk->mtime, mtime);
     }
 
-    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
+    tk->paths = paths;
+    tk->check = ngx_time() + NGX_SSL_TICKET_KEYS_CHECK;
+
+done:
+
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, tk)
         == 0)
     {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
@@ -2463,15 +3572,217 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     }
 
     return NGX_OK;
+}
 
-failed:
+
+static ngx_int_t
+ngx_ssl_read_session_ticket_key(ngx_str_t *name,
+    ngx_ssl_session_ticket_key_t *key, time_t *mtime, ngx_uint_t level,
+    ngx_log_t *log)
+{
+    u_char           buf[48];
+    ssize_t          n;
+    ngx_int_t        rc;
+    ngx_file_t       file;
+    ngx_file_info_t  fi;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = *name;
+    file.log = log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, 0, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(level, log, ngx_errno,
+                      ngx_open_file_n " \"%V\" failed", &file.name);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%V\" failed", &file.name);
+        goto done;
+    }
+
+    if (ngx_file_size(&fi) != 48) {
+        ngx_log_error(level, log, 0, "\"%V\" must be 48 bytes", &file.name);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, buf, 48, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_file_n " \"%V\" failed", &file.name);
+        goto done;
+    }
+
+    if (n != 48) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_read_file_n " \"%V\" returned only "
+                      "%z bytes instead of 48", &file.name, n);
+        goto done;
+    }
+
+    ngx_memcpy(key->name, buf, 16);
+    ngx_memcpy(key->aes_key, buf + 16, 16);
+    ngx_memcpy(key->hmac_key, buf + 32, 16);
+    key->expire = 0;
+
+    *mtime = ngx_file_mtime(&fi);
+
+    rc = NGX_OK;
+
+done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
                       ngx_close_file_n " \"%V\" failed", &file.name);
     }
 
-    return NGX_ERROR;
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_ssl_update_session_ticket_keys(ngx_ssl_session_ticket_keys_t *tk,
+    SSL_CTX *ssl_ctx, ngx_log_t *log)
+{
+    time_t                         now, timeout;
+    ngx_slab_pool_t               *shpool;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key, next;
+
+    now = ngx_time();
+
+    if (now < tk->check) {
+        return NGX_OK;
+    }
+
+    if (tk->shm_zone == NULL) {
+        tk->check = now + NGX_SSL_TICKET_KEYS_CHECK;
+        ngx_ssl_reload_session_ticket_keys(tk, log);
+        return NGX_OK;
+    }
+
+    /*
+     * the current key encrypts tickets for the session timeout, then
+     * it becomes the previous one and is used for decryption only;
+     * the next key is known in advance to workers which have not yet
+     * noticed the rotation
+     */
+
+    cache = tk->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) tk->shm_zone->shm.addr;
+    key = cache->ticket_keys;
+
+    timeout = SSL_CTX_get_timeout(ssl_ctx);
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (key[0].expire <= now) {
+
+        if (key[0].expire == 0) {
+            if (RAND_bytes(key[0].name, 48) != 1
+                || RAND_bytes(key[1].name, 48) != 1)
+            {
+                goto failed;
+            }
+
+            key[2] = key[0];
+
+        } else {
+            if (RAND_bytes(next.name, 48) != 1) {
+                goto failed;
+            }
+
+            key[2] = key[0];
+            key[0] = key[1];
+            key[1] = next;
+        }
+
+        key[0].expire = now + timeout;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "ssl session ticket keys rotated for %T", timeout);
+    }
+
+    ngx_memcpy(tk->keys->elts, key, 3 * sizeof(ngx_ssl_session_ticket_key_t));
+
+    tk->check = key[0].expire;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+
+    key = tk->keys->elts;
+
+    return key[0].expire ? NGX_OK : NGX_ERROR;
+}
+
+
+static void
+ngx_ssl_reload_session_ticket_keys(ngx_ssl_session_ticket_keys_t *tk,
+    ngx_log_t *log)
+{
+    time_t                         mtime, t;
+    ngx_str_t                     *path;
+    ngx_uint_t                     i;
+    ngx_file_info_t                fi;
+    ngx_ssl_session_ticket_key_t  *keys;
+
+    mtime = 0;
+    path = tk->paths->elts;
+
+    for (i = 0; i < tk->paths->nelts; i++) {
+
+        if (ngx_file_info(path[i].data, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                          ngx_file_info_n " \"%V\" failed", &path[i]);
+            return;
+        }
+
+        mtime = ngx_max(mtime, ngx_file_mtime(&fi));
+    }
+
+    if (mtime == tk->mtime) {
+        return;
+    }
+
+    /* the old keys are kept unless all files are read successfully */
+
+    keys = ngx_alloc(tk->keys->nelts * sizeof(ngx_ssl_session_ticket_key_t),
+                     log);
+    if (keys == NULL) {
+        return;
+    }
+
+    for (i = 0; i < tk->paths->nelts; i++) {
+        if (ngx_ssl_read_session_ticket_key(&path[i], &keys[i], &t,
+                                            NGX_LOG_ERR, log)
+            != NGX_OK)
+        {
+            goto done;
+        }
+    }
+
+    ngx_memcpy(tk->keys->elts, keys,
+               tk->keys->nelts * sizeof(ngx_ssl_session_ticket_key_t));
+
+    tk->mtime = mtime;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0, "ssl session ticket keys reloaded");
+
+done:
+
+    ngx_free(keys);
 }
 
 
@@ -2487,27 +3798,31 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc)
 {
-    SSL_CTX                       *ssl_ctx;
-    ngx_uint_t                     i;
-    ngx_array_t                   *keys;
-    ngx_ssl_session_ticket_key_t  *key;
+    SSL_CTX                        *ssl_ctx;
+    ngx_uint_t                      i;
+    ngx_array_t                    *keys;
+    ngx_connection_t               *c;
+    ngx_ssl_session_ticket_key_t   *key;
+    ngx_ssl_session_ticket_keys_t  *tk;
 #if (NGX_DEBUG)
-    u_char                         buf[32];
-    ngx_connection_t              *c;
+    u_char                          buf[32];
 #endif
 
     ssl_ctx = SSL_get_SSL_CTX(ssl_conn);
 
-    keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
-    if (keys == NULL) {
+    tk = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
+    if (tk == NULL) {
         return -1;
     }
 
-    key = keys->elts;
-
-#if (NGX_DEBUG)
     c = ngx_ssl_get_connection(ssl_conn);
-#endif
+
+    if (ngx_ssl_update_session_ticket_keys(tk, ssl_ctx, c->log) != NGX_OK) {
+        return -1;
+    }
+
+    keys = tk->keys;
+    key = keys->elts;
 
     if (enc == 1) {
         /* encrypt session ticket */
@@ -2523,7 +3838,7 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
                      ngx_ssl_session_ticket_md(), NULL);
         memcpy(name, key[0].name, 16);
 
-        return 0;
+        return 1;
 
     } else {
         /* decrypt session ticket */
@@ -2599,9 +3914,9 @@ ngx_ssl_get_cipher_name(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 ngx_int_t
 ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 {
-    int           len;
-    u_char       *buf;
-    SSL_SESSION  *sess;
+    u_char        *buf;
+    SSL_SESSION   *sess;
+    unsigned int   len;
 
     sess = SSL_get0_session(c->ssl->connection);
     if (sess == NULL) {
@@ -2609,8 +3924,7 @@ ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
         return NGX_OK;
     }
 
-    buf = sess->session_id;
-    len = sess->session_id_length;
+    buf = (u_char *) SSL_SESSION_get_id(sess, &len);
 
     s->len = 2 * len;
     s->data = ngx_pnalloc(pool, 2 * len);
@@ -2638,6 +3952,30 @@ ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 }
 
 
+ngx_int_t
+ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    u_char  *p;
+
+    if (!c->ssl->handshaked) {
+        s->len = 0;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(pool, NGX_TIME_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(p, "%T.%03M", (time_t) c->ssl->handshake_time / 1000,
+                         c->ssl->handshake_time % 1000)
+             - p;
+    s->data = p;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_get_raw_certificate(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 {
@@ -2896,10 +4234,41 @@ ngx_openssl_create_conf(ngx_cycle_t *cycle)
      *     oscf->engine = 0;
      */
 
+    ngx_queue_init(&oscf->staplings);
+
+    oscf->async_threads = NGX_CONF_UNSET;
+
+    if (ngx_array_init(&oscf->async_ctxs, cycle->pool, 4, sizeof(SSL_CTX *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     return oscf;
 }
 
 
+static char *
+ngx_openssl_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_openssl_conf_t *oscf = conf;
+
+    ngx_conf_init_value(oscf->async_threads, 0);
+
+#if !(NGX_SSL_ASYNC_OFFLOAD)
+
+    if (oscf->async_threads) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"ssl_async_threads\" ignored, not supported");
+        oscf->async_threads = 0;
+    }
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -2940,6 +4309,68 @@ ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static ngx_int_t
+ngx_openssl_init_process(ngx_cycle_t *cycle)
+{
+#if (NGX_SSL_ASYNC_OFFLOAD)
+
+    ngx_uint_t           i;
+    SSL_CTX            **ctx;
+    ngx_openssl_conf_t  *oscf;
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    if (oscf->async_threads
+        && oscf->async_ctxs.nelts
+        && (ngx_process == NGX_PROCESS_WORKER
+            || ngx_process == NGX_PROCESS_SINGLE))
+    {
+        if (ngx_ssl_offload_method == NULL) {
+            ngx_ssl_offload_method = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+
+            if (ngx_ssl_offload_method == NULL) {
+                ngx_ssl_error(NGX_LOG_ALERT, cycle->log, 0,
+                              "RSA_meth_dup() failed");
+                return NGX_ERROR;
+            }
+
+            RSA_meth_set1_name(ngx_ssl_offload_method, "nginx offload");
+            RSA_meth_set_priv_enc(ngx_ssl_offload_method,
+                                  ngx_ssl_offload_priv_enc);
+            RSA_meth_set_priv_dec(ngx_ssl_offload_method,
+                                  ngx_ssl_offload_priv_dec);
+        }
+
+        if (ngx_ssl_offload_start(cycle, oscf) == NGX_OK) {
+            ctx = oscf->async_ctxs.elts;
+
+            for (i = 0; i < oscf->async_ctxs.nelts; i++) {
+                ngx_ssl_offload_key(cycle, ctx[i]);
+            }
+
+        } else {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                          "failed to start SSL offload threads, "
+                          "private key operations are done synchronously");
+        }
+    }
+
+#endif
+
+    return ngx_ssl_stapling_init_process(cycle);
+}
+
+
+static void
+ngx_openssl_exit_process(ngx_cycle_t *cycle)
+{
+#if (NGX_SSL_ASYNC_OFFLOAD)
+    ngx_ssl_offload_stop();
+#endif
+}
+
+
 static void
 ngx_openssl_exit(ngx_cycle_t *cycle)
 {
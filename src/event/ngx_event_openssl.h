@@ -12,6 +12,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+/* the low level APIs deprecated by OpenSSL 3.0 are still used */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/conf.h>
@@ -22,14 +25,37 @@
 #define NGX_SSL_NAME     "OpenSSL"
 
 
+#if (defined SSL_ERROR_WANT_ASYNC && NGX_HAVE_PTHREAD)
+#define NGX_SSL_ASYNC_OFFLOAD  1
+#endif
+
+
 #define ngx_ssl_session_t       SSL_SESSION
 #define ngx_ssl_conn_t          SSL
 
 
+/*
+ * dynamic record sizing: the records are small at the connection start
+ * and after an idle period, so the first bytes can be decrypted without
+ * waiting for a whole 16K record, and grow after the threshold bytes
+ */
+
+typedef struct {
+    ngx_flag_t                  enable;
+    ngx_msec_t                  timeout;
+    size_t                      size_lo;
+    size_t                      size_hi;
+    /* the bytes sent in small records, and then in medium records */
+    size_t                      threshold;
+} ngx_ssl_dyn_rec_t;
+
+
 typedef struct {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
     size_t                      buffer_size;
+    ngx_ssl_dyn_rec_t           dyn_rec;
+    ngx_flag_t                  async;
 } ngx_ssl_t;
 
 
@@ -40,6 +66,16 @@ typedef struct {
     ngx_buf_t                  *buf;
     size_t                      buffer_size;
 
+    ngx_ssl_dyn_rec_t           dyn_rec;
+    ngx_msec_t                  dyn_rec_last_write;
+    size_t                      dyn_rec_sent;
+
+    ngx_msec_t                  handshake_start;
+    ngx_msec_t                  handshake_time;
+
+    /* the OpenSSL async job wait fd */
+    ngx_connection_t           *async;
+
     ngx_connection_handler_pt   handler;
 
     ngx_event_handler_pt        saved_read_handler;
@@ -51,6 +87,7 @@ typedef struct {
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    handshake_buffer_set:1;
+    unsigned                    sendfile:1;
 } ngx_ssl_connection_t;
 
 
@@ -78,23 +115,53 @@ struct ngx_ssl_sess_id_s {
 };
 
 
-typedef struct {
-    ngx_rbtree_t                session_rbtree;
-    ngx_rbtree_node_t           sentinel;
-    ngx_queue_t                 expire_queue;
-} ngx_ssl_session_cache_t;
-
-
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 typedef struct {
     u_char                      name[16];
     u_char                      aes_key[16];
     u_char                      hmac_key[16];
+    time_t                      expire;
 } ngx_ssl_session_ticket_key_t;
 
+
+typedef struct {
+    ngx_array_t                *keys;
+
+    /* the keys loaded from files are reloaded when the files change */
+    ngx_array_t                *paths;
+    time_t                      mtime;
+
+    /* or else the keys are rotated in the shared session cache */
+    ngx_shm_zone_t             *shm_zone;
+
+    time_t                      check;
+} ngx_ssl_session_ticket_keys_t;
+
+#endif
+
+
+#define NGX_SSL_MAX_SESSION_SHARDS  16
+#define NGX_SSL_MIN_SESSION_SHARD   (512 * 1024)
+
+typedef struct {
+    ngx_rbtree_t                session_rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 expire_queue;
+    ngx_slab_pool_t            *shpool;
+} ngx_ssl_session_shard_t;
+
+
+typedef struct {
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    /* the current, the next, and the previous keys */
+    ngx_ssl_session_ticket_key_t  ticket_keys[3];
 #endif
 
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_shard_t     shards[1];
+} ngx_ssl_session_cache_t;
+
 
 #define NGX_SSL_SSLv2    0x0002
 #define NGX_SSL_SSLv3    0x0004
@@ -109,6 +176,23 @@ typedef struct {
 #define NGX_SSL_BUFSIZE  16384
 
 
+typedef struct {
+    ngx_uint_t                  engine;   /* unsigned  engine:1; */
+
+    /* the staples of the configuration to prefetch */
+    ngx_queue_t                 staplings;
+
+    /* the private key operations thread pool */
+    ngx_int_t                   async_threads;
+    ngx_array_t                 async_ctxs;       /* SSL_CTX * */
+} ngx_openssl_conf_t;
+
+
+/* the handshake time histogram: 1, 2, 5, ..., 1000 ms, and more */
+
+#define NGX_SSL_HANDSHAKE_BUCKETS  11
+
+
 ngx_int_t ngx_ssl_init(ngx_log_t *log);
 ngx_int_t ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -122,6 +206,10 @@ ngx_int_t ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *file, ngx_str_t *responder, ngx_uint_t verify);
 ngx_int_t ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_resolver_t *resolver, ngx_msec_t resolver_timeout);
+ngx_int_t ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone, ngx_str_t *path);
+ngx_int_t ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_int_t ngx_ssl_stapling_init_process(ngx_cycle_t *cycle);
 RSA *ngx_ssl_rsa512_key_callback(ngx_ssl_conn_t *ssl_conn, int is_export,
     int key_length);
 ngx_int_t ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file);
@@ -131,6 +219,7 @@ ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *paths);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_int_t ngx_ssl_async_offload(ngx_conf_t *cf, ngx_ssl_t *ssl);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
@@ -159,6 +248,8 @@ ngx_int_t ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
 ngx_int_t ngx_ssl_get_raw_certificate(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_certificate(ngx_connection_t *c, ngx_pool_t *pool,
@@ -185,6 +276,15 @@ void ngx_cdecl ngx_ssl_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
     char *fmt, ...);
 void ngx_ssl_cleanup_ctx(void *data);
 
+#if (NGX_STAT_STUB)
+
+#define NGX_SSL_HANDSHAKE_HISTOGRAM_LEN                                       \
+    (NGX_SSL_HANDSHAKE_BUCKETS * (sizeof("1000: ") - 1 + NGX_ATOMIC_T_LEN))
+
+u_char *ngx_ssl_handshake_histogram(u_char *buf);
+
+#endif
+
 
 extern int  ngx_ssl_connection_index;
 extern int  ngx_ssl_server_conf_index;
@@ -193,5 +293,7 @@ extern int  ngx_ssl_session_ticket_keys_index;
 extern int  ngx_ssl_certificate_index;
 extern int  ngx_ssl_stapling_index;
 
+extern ngx_module_t  ngx_openssl_module;
+
 
 #endif /* _NGX_EVENT_OPENSSL_H_INCLUDED_ */
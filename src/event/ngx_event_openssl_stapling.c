@@ -14,6 +14,30 @@
 #ifdef SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB
 
 
+#define NGX_SSL_STAPLING_ID_LEN  20    /* SHA-1 of the certificate */
+
+
+typedef struct {
+    ngx_rbtree_node_t            node;
+    u_char                       id[NGX_SSL_STAPLING_ID_LEN];
+
+    time_t                       valid;
+    time_t                       expire;
+    time_t                       loading;
+
+    ngx_uint_t                   version;
+
+    size_t                       len;
+    u_char                      *data;
+} ngx_ssl_stapling_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+} ngx_ssl_stapling_cache_t;
+
+
 typedef struct {
     ngx_str_t                    staple;
     ngx_msec_t                   timeout;
@@ -32,6 +56,17 @@ typedef struct {
     X509                        *issuer;
 
     time_t                       valid;
+    time_t                       expire;
+
+    ngx_shm_zone_t              *shm_zone;
+    ngx_ssl_stapling_node_t     *node;
+    ngx_uint_t                   version;
+    u_char                       id[NGX_SSL_STAPLING_ID_LEN];
+
+    ngx_str_t                    path;
+
+    ngx_event_t                  event;
+    ngx_queue_t                  queue;
 
     unsigned                     verify:1;
     unsigned                     loading:1;
@@ -92,6 +127,22 @@ static int ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn,
     void *data);
 static void ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple);
 static void ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx);
+static ngx_int_t ngx_ssl_stapling_check(ngx_ssl_stapling_t *staple,
+    u_char *data, size_t len, time_t *expire, ngx_log_t *log);
+static time_t ngx_ssl_stapling_refresh(time_t expire);
+static void ngx_ssl_stapling_prefetch_handler(ngx_event_t *ev);
+
+static void ngx_ssl_stapling_load(ngx_ssl_stapling_t *staple, ngx_log_t *log);
+static void ngx_ssl_stapling_save(ngx_ssl_stapling_t *staple, ngx_log_t *log);
+
+static ngx_ssl_stapling_node_t *ngx_ssl_stapling_node(
+    ngx_ssl_stapling_t *staple, ngx_slab_pool_t *shpool);
+static ngx_int_t ngx_ssl_stapling_lock(ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_publish(ngx_ssl_stapling_t *staple,
+    ngx_uint_t response, ngx_log_t *log);
+static void ngx_ssl_stapling_sync(ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 static void ngx_ssl_stapling_cleanup(void *data);
 
@@ -120,6 +171,7 @@ ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
 {
     ngx_int_t                  rc;
     ngx_pool_cleanup_t        *cln;
+    ngx_openssl_conf_t        *oscf;
     ngx_ssl_stapling_t        *staple;
 
     staple = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_stapling_t));
@@ -177,6 +229,11 @@ ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
         return NGX_ERROR;
     }
 
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    ngx_queue_insert_tail(&oscf->staplings, &staple->queue);
+
 done:
 
     SSL_CTX_set_tlsext_status_cb(ssl->ctx, ngx_ssl_certificate_status_callback);
@@ -281,7 +338,11 @@ ngx_ssl_stapling_issuer(ngx_conf_t *cf, ngx_ssl_t *ssl)
     for (i = 0; i < n; i++) {
         issuer = sk_X509_value(chain, i);
         if (X509_check_issued(issuer, cert) == X509_V_OK) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100001L
+            X509_up_ref(issuer);
+#else
             CRYPTO_add(&issuer->references, 1, CRYPTO_LOCK_X509);
+#endif
 
             ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ssl->log, 0,
                            "SSL get issuer: found %p in extra certs", issuer);
@@ -445,6 +506,136 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone, ngx_str_t *path)
+{
+    u_char              *p;
+    unsigned int         len;
+    ngx_ssl_stapling_t  *staple;
+
+    staple = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_stapling_index);
+
+    if (staple->host.len == 0 || (shm_zone == NULL && path->len == 0)) {
+        /* a response from ssl_stapling_file or no responder */
+        return NGX_OK;
+    }
+
+    if (X509_digest(staple->cert, EVP_sha1(), staple->id, &len) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "X509_digest() failed");
+        return NGX_ERROR;
+    }
+
+    staple->shm_zone = shm_zone;
+
+    if (path->len == 0) {
+        return NGX_OK;
+    }
+
+    staple->path.len = path->len + 1 + 2 * NGX_SSL_STAPLING_ID_LEN
+                       + sizeof(".der") - 1;
+
+    staple->path.data = ngx_pnalloc(cf->pool, staple->path.len + 1);
+    if (staple->path.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(staple->path.data, path->data, path->len);
+    *p++ = '/';
+    p = ngx_hex_dump(p, staple->id, NGX_SSL_STAPLING_ID_LEN);
+    ngx_memcpy(p, ".der", sizeof(".der"));
+
+    /* a response saved by the previous run is stapled right away */
+
+    ngx_ssl_stapling_load(staple, cf->log);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                     len;
+    ngx_slab_pool_t           *shpool;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (data) {
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_stapling_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache;
+    shm_zone->data = cache;
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_ssl_stapling_rbtree_insert_value);
+
+    len = sizeof(" in OCSP cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in OCSP cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_init_process(ngx_cycle_t *cycle)
+{
+    ngx_queue_t         *q;
+    ngx_openssl_conf_t  *oscf;
+    ngx_ssl_stapling_t  *staple;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    /*
+     * the responses are refreshed before they expire rather than
+     * on a handshake, the shared cache lock lets one worker fetch them
+     */
+
+    for (q = ngx_queue_head(&oscf->staplings);
+         q != ngx_queue_sentinel(&oscf->staplings);
+         q = ngx_queue_next(q))
+    {
+        staple = ngx_queue_data(q, ngx_ssl_stapling_t, queue);
+
+        staple->event.handler = ngx_ssl_stapling_prefetch_handler;
+        staple->event.data = staple;
+        staple->event.log = cycle->log;
+        staple->event.cancelable = 1;
+
+        ngx_add_timer(&staple->event, 1);
+    }
+
+    return NGX_OK;
+}
+
+
 static int
 ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
 {
@@ -461,7 +652,15 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
     staple = data;
     rc = SSL_TLSEXT_ERR_NOACK;
 
-    if (staple->staple.len) {
+    ngx_ssl_stapling_update(staple);
+
+    if (staple->shm_zone) {
+        ngx_ssl_stapling_sync(staple);
+    }
+
+    if (staple->staple.len
+        && (staple->expire == 0 || staple->expire > ngx_time()))
+    {
         /* we have to copy ocsp response as OpenSSL will free it by itself */
 
         p = OPENSSL_malloc(staple->staple.len);
@@ -477,8 +676,6 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
         rc = SSL_TLSEXT_ERR_OK;
     }
 
-    ngx_ssl_stapling_update(staple);
-
     return rc;
 }
 
@@ -494,6 +691,10 @@ ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
         return;
     }
 
+    if (staple->shm_zone && ngx_ssl_stapling_lock(staple) != NGX_OK) {
+        return;
+    }
+
     staple->loading = 1;
 
     ctx = ngx_ssl_ocsp_start();
@@ -524,64 +725,130 @@ ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 
 static void
 ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
+{
+    size_t               len;
+    time_t               expire;
+    ngx_str_t            response;
+    ngx_ssl_stapling_t  *staple;
+
+    staple = ctx->data;
+
+    if (ctx->code != 200) {
+        goto error;
+    }
+
+    /* check the response */
+
+    len = ctx->response->last - ctx->response->pos;
+
+    if (ngx_ssl_stapling_check(staple, ctx->response->pos, len, &expire,
+                               ctx->log)
+        != NGX_OK)
+    {
+        goto error;
+    }
+
+    /* copy the response to memory not in ctx->pool */
+
+    response.len = len;
+    response.data = ngx_alloc(response.len, ctx->log);
+
+    if (response.data == NULL) {
+        goto done;
+    }
+
+    ngx_memcpy(response.data, ctx->response->pos, response.len);
+
+    if (staple->staple.data) {
+        ngx_free(staple->staple.data);
+    }
+
+    staple->staple = response;
+    staple->expire = expire;
+
+    if (staple->path.len) {
+        ngx_ssl_stapling_save(staple, ctx->log);
+    }
+
+done:
+
+    staple->loading = 0;
+    staple->valid = ngx_ssl_stapling_refresh(expire);
+
+    if (staple->shm_zone) {
+        ngx_ssl_stapling_publish(staple, response.data != NULL, ctx->log);
+    }
+
+    ngx_ssl_ocsp_done(ctx);
+    return;
+
+error:
+
+    staple->loading = 0;
+    staple->valid = ngx_time() + 300; /* ssl_stapling_err_valid */
+
+    if (staple->shm_zone) {
+        ngx_ssl_stapling_publish(staple, 0, ctx->log);
+    }
+
+    ngx_ssl_ocsp_done(ctx);
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_check(ngx_ssl_stapling_t *staple, u_char *data, size_t len,
+    time_t *expire, ngx_log_t *log)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x0090707fL
     const
 #endif
     u_char                *p;
     int                    n;
-    size_t                 len;
-    ngx_str_t              response;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    int                    days, secs;
+#endif
+    ngx_int_t              rc;
     X509_STORE            *store;
     STACK_OF(X509)        *chain;
     OCSP_CERTID           *id;
     OCSP_RESPONSE         *ocsp;
     OCSP_BASICRESP        *basic;
-    ngx_ssl_stapling_t    *staple;
     ASN1_GENERALIZEDTIME  *thisupdate, *nextupdate;
 
-    staple = ctx->data;
-    ocsp = NULL;
+    rc = NGX_ERROR;
     basic = NULL;
     id = NULL;
 
-    if (ctx->code != 200) {
-        goto error;
-    }
-
-    /* check the response */
-
-    len = ctx->response->last - ctx->response->pos;
-    p = ctx->response->pos;
+    p = data;
 
     ocsp = d2i_OCSP_RESPONSE(NULL, &p, len);
     if (ocsp == NULL) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "d2i_OCSP_RESPONSE() failed");
-        goto error;
+        goto failed;
     }
 
     n = OCSP_response_status(ocsp);
 
     if (n != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_log_error(NGX_LOG_ERR, log, 0,
                       "OCSP response not successful (%d: %s)",
                       n, OCSP_response_status_str(n));
-        goto error;
+        goto failed;
     }
 
     basic = OCSP_response_get1_basic(ocsp);
     if (basic == NULL) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "OCSP_response_get1_basic() failed");
-        goto error;
+        goto failed;
     }
 
     store = SSL_CTX_get_cert_store(staple->ssl_ctx);
     if (store == NULL) {
-        ngx_ssl_error(NGX_LOG_CRIT, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_CRIT, log, 0,
                       "SSL_CTX_get_cert_store() failed");
-        goto error;
+        goto failed;
     }
 
 #if OPENSSL_VERSION_NUMBER >= 0x10001000L
@@ -594,91 +861,529 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
                           staple->verify ? OCSP_TRUSTOTHER : OCSP_NOVERIFY)
         != 1)
     {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "OCSP_basic_verify() failed");
-        goto error;
+        goto failed;
     }
 
-    id = OCSP_cert_to_id(NULL, ctx->cert, ctx->issuer);
+    id = OCSP_cert_to_id(NULL, staple->cert, staple->issuer);
     if (id == NULL) {
-        ngx_ssl_error(NGX_LOG_CRIT, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_CRIT, log, 0,
                       "OCSP_cert_to_id() failed");
-        goto error;
+        goto failed;
     }
 
     if (OCSP_resp_find_status(basic, id, &n, NULL, NULL,
                               &thisupdate, &nextupdate)
         != 1)
     {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_log_error(NGX_LOG_ERR, log, 0,
                       "certificate status not found in the OCSP response");
-        goto error;
+        goto failed;
     }
 
     if (n != V_OCSP_CERTSTATUS_GOOD) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_log_error(NGX_LOG_ERR, log, 0,
                       "certificate status \"%s\" in the OCSP response",
                       OCSP_cert_status_str(n));
-        goto error;
+        goto failed;
     }
 
     if (OCSP_check_validity(thisupdate, nextupdate, 300, -1) != 1) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "OCSP_check_validity() failed");
-        goto error;
+        goto failed;
     }
 
-    OCSP_CERTID_free(id);
-    OCSP_BASICRESP_free(basic);
-    OCSP_RESPONSE_free(ocsp);
+    *expire = 0;
 
-    /* copy the response to memory not in ctx->pool */
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    if (nextupdate && ASN1_TIME_diff(&days, &secs, NULL, nextupdate) == 1) {
+        *expire = ngx_time() + (time_t) days * 86400 + secs;
+    }
+#endif
 
-    response.len = len;
-    response.data = ngx_alloc(response.len, ctx->log);
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ssl ocsp response, %s, %uz, expires %T",
+                   OCSP_cert_status_str(n), len, *expire);
 
-    if (response.data == NULL) {
-        goto done;
+    rc = NGX_OK;
+
+failed:
+
+    if (id) {
+        OCSP_CERTID_free(id);
     }
 
-    ngx_memcpy(response.data, ctx->response->pos, response.len);
+    if (basic) {
+        OCSP_BASICRESP_free(basic);
+    }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ctx->log, 0,
-                   "ssl ocsp response, %s, %uz",
-                   OCSP_cert_status_str(n), response.len);
+    if (ocsp) {
+        OCSP_RESPONSE_free(ocsp);
+    }
 
-    if (staple->staple.data) {
-        ngx_free(staple->staple.data);
+    return rc;
+}
+
+
+static time_t
+ngx_ssl_stapling_refresh(time_t expire)
+{
+    time_t  now, valid;
+
+    now = ngx_time();
+    valid = now + 3600; /* ssl_stapling_valid */
+
+    /* a short-lived response is refreshed halfway to its expiration */
+
+    if (expire && now + (expire - now) / 2 < valid) {
+        valid = ngx_max(now + (expire - now) / 2, now + 60);
     }
 
-    staple->staple = response;
+    return valid;
+}
 
-done:
 
-    staple->loading = 0;
-    staple->valid = ngx_time() + 3600; /* ssl_stapling_valid */
+static void
+ngx_ssl_stapling_prefetch_handler(ngx_event_t *ev)
+{
+    time_t               delay;
+    ngx_ssl_stapling_t  *staple;
+
+    staple = ev->data;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    ngx_ssl_stapling_update(staple);
+
+    if (staple->shm_zone) {
+        ngx_ssl_stapling_sync(staple);
+    }
+
+    delay = staple->valid - ngx_time();
+
+    if (delay < 1) {
+        /* the response is being loaded */
+        delay = 1;
+    }
+
+    ngx_add_timer(ev, (ngx_msec_t) ngx_min(delay, 3600) * 1000);
+}
+
+
+static void
+ngx_ssl_stapling_load(ngx_ssl_stapling_t *staple, ngx_log_t *log)
+{
+    u_char           *buf;
+    off_t             size;
+    time_t            expire;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_file_info_t   fi;
+
+    fd = ngx_open_file(staple->path.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed",
+                          staple->path.data);
+        }
+
+        return;
+    }
+
+    buf = NULL;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", staple->path.data);
+        goto failed;
+    }
+
+    size = ngx_file_size(&fi);
+
+    if (size == 0 || size > 65536) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "invalid OCSP response size in \"%s\"",
+                      staple->path.data);
+        goto failed;
+    }
+
+    buf = ngx_alloc((size_t) size, log);
+    if (buf == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_fd(fd, buf, (size_t) size);
+
+    if (n != size) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" failed", staple->path.data);
+        goto failed;
+    }
+
+    if (ngx_ssl_stapling_check(staple, buf, (size_t) size, &expire, log)
+        != NGX_OK)
+    {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "OCSP response in \"%s\" ignored", staple->path.data);
+        goto failed;
+    }
+
+    staple->staple.data = buf;
+    staple->staple.len = (size_t) size;
+    staple->expire = expire;
+    staple->valid = ngx_ssl_stapling_refresh(expire);
+
+    buf = NULL;
+
+failed:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", staple->path.data);
+    }
+}
+
+
+static void
+ngx_ssl_stapling_save(ngx_ssl_stapling_t *staple, ngx_log_t *log)
+{
+    u_char    *temp;
+    ssize_t    n;
+    ngx_fd_t   fd;
+
+    temp = ngx_alloc(staple->path.len + 1 + NGX_INT64_LEN + 1, log);
+    if (temp == NULL) {
+        return;
+    }
+
+    ngx_sprintf(temp, "%V.%P%Z", &staple->path, ngx_pid);
+
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        ngx_free(temp);
+        return;
+    }
+
+    n = ngx_write_fd(fd, staple->staple.data, staple->staple.len);
+
+    if (n != (ssize_t) staple->staple.len) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", temp);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+    if (n != (ssize_t) staple->staple.len) {
+        goto failed;
+    }
+
+    if (ngx_rename_file(temp, staple->path.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp, staple->path.data);
+        goto failed;
+    }
+
+    ngx_free(temp);
 
-    ngx_ssl_ocsp_done(ctx);
     return;
 
-error:
+failed:
 
-    staple->loading = 0;
-    staple->valid = ngx_time() + 300; /* ssl_stapling_err_valid */
+    if (ngx_delete_file(temp) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp);
+    }
 
-    if (id) {
-        OCSP_CERTID_free(id);
+    ngx_free(temp);
+}
+
+
+static ngx_ssl_stapling_node_t *
+ngx_ssl_stapling_node(ngx_ssl_stapling_t *staple, ngx_slab_pool_t *shpool)
+{
+    u_char                    *p;
+    uint32_t                   hash;
+    ngx_int_t                  rc;
+    ngx_rbtree_node_t         *node, *sentinel;
+    ngx_ssl_stapling_node_t   *sn;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (staple->node) {
+        return staple->node;
     }
 
-    if (basic) {
-        OCSP_BASICRESP_free(basic);
+    cache = staple->shm_zone->data;
+
+    hash = ngx_crc32_short(staple->id, NGX_SSL_STAPLING_ID_LEN);
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_ssl_stapling_node_t *) node;
+
+        rc = ngx_memcmp(staple->id, sn->id, NGX_SSL_STAPLING_ID_LEN);
+
+        if (rc == 0) {
+            staple->node = sn;
+            goto found;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
     }
 
-    if (ocsp) {
-        OCSP_RESPONSE_free(ocsp);
+    sn = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_stapling_node_t));
+    if (sn == NULL) {
+        return NULL;
     }
 
-    ngx_ssl_ocsp_done(ctx);
+    ngx_memzero(sn, sizeof(ngx_ssl_stapling_node_t));
+
+    sn->node.key = hash;
+    ngx_memcpy(sn->id, staple->id, NGX_SSL_STAPLING_ID_LEN);
+
+    ngx_rbtree_insert(&cache->rbtree, &sn->node);
+
+    staple->node = sn;
+
+found:
+
+    if (sn->len == 0 && staple->staple.len) {
+
+        /* share the response loaded from the disk */
+
+        p = ngx_slab_alloc_locked(shpool, staple->staple.len);
+
+        if (p) {
+            ngx_memcpy(p, staple->staple.data, staple->staple.len);
+
+            sn->data = p;
+            sn->len = staple->staple.len;
+            sn->expire = staple->expire;
+            sn->valid = staple->valid;
+            sn->version++;
+
+            staple->version = sn->version;
+        }
+    }
+
+    return sn;
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_lock(ngx_ssl_stapling_t *staple)
+{
+    time_t                    now;
+    ngx_int_t                 rc;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *sn;
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    now = ngx_time();
+    rc = NGX_OK;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_ssl_stapling_node(staple, shpool);
+
+    if (sn == NULL) {
+        /* no memory in the zone, every worker loads the response itself */
+        goto done;
+    }
+
+    if (sn->valid >= now) {
+        /* the response was loaded by another worker */
+        staple->valid = sn->valid;
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    if (sn->loading > now) {
+        /* the response is being loaded by another worker */
+        staple->valid = now;
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    sn->loading = now + (staple->timeout + staple->resolver_timeout) / 1000
+                  + 1;
+
+done:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_ssl_stapling_publish(ngx_ssl_stapling_t *staple, ngx_uint_t response,
+    ngx_log_t *log)
+{
+    u_char                   *p;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *sn;
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    p = NULL;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_ssl_stapling_node(staple, shpool);
+
+    if (sn == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        goto failed;
+    }
+
+    sn->valid = staple->valid;
+    sn->loading = 0;
+
+    if (!response) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return;
+    }
+
+    p = ngx_slab_alloc_locked(shpool, staple->staple.len);
+
+    if (p) {
+        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+
+        if (sn->data) {
+            ngx_slab_free_locked(shpool, sn->data);
+        }
+
+        sn->data = p;
+        sn->len = staple->staple.len;
+        sn->expire = staple->expire;
+        sn->version++;
+
+        staple->version = sn->version;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (p) {
+        return;
+    }
+
+failed:
+
+    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                  "could not allocate OCSP response in cache \"%V\"",
+                  &staple->shm_zone->shm.name);
+}
+
+
+static void
+ngx_ssl_stapling_sync(ngx_ssl_stapling_t *staple)
+{
+    u_char                   *p;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *sn;
+
+    sn = staple->node;
+
+    if (sn == NULL || sn->version == staple->version) {
+        return;
+    }
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    p = ngx_alloc(sn->len, ngx_cycle->log);
+
+    if (p) {
+        ngx_memcpy(p, sn->data, sn->len);
+
+        if (staple->staple.data) {
+            ngx_free(staple->staple.data);
+        }
+
+        staple->staple.data = p;
+        staple->staple.len = sn->len;
+        staple->expire = sn->expire;
+        staple->valid = sn->valid;
+        staple->version = sn->version;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static void
+ngx_ssl_stapling_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t        **p;
+    ngx_ssl_stapling_node_t   *sn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_ssl_stapling_node_t *) node;
+            snt = (ngx_ssl_stapling_node_t *) temp;
+
+            p = (ngx_memcmp(sn->id, snt->id, NGX_SSL_STAPLING_ID_LEN) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
 }
 
 
@@ -687,6 +1392,14 @@ ngx_ssl_stapling_cleanup(void *data)
 {
     ngx_ssl_stapling_t  *staple = data;
 
+    if (staple->queue.next) {
+        ngx_queue_remove(&staple->queue);
+    }
+
+    if (staple->event.timer_set) {
+        ngx_del_timer(&staple->event);
+    }
+
     if (staple->issuer) {
         X509_free(staple->issuer);
     }
@@ -1757,4 +2470,26 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_init_process(ngx_cycle_t *cycle)
+{
+    return NGX_OK;
+}
+
+
 #endif
@@ -12,12 +12,17 @@
 
 ngx_thread_volatile ngx_event_t  *ngx_posted_accept_events;
 ngx_thread_volatile ngx_event_t  *ngx_posted_events;
+ngx_thread_volatile ngx_event_t  *ngx_posted_delayed_events;
 
 #if (NGX_THREADS)
 ngx_mutex_t                      *ngx_posted_events_mutex;
 #endif
 
 
+static ngx_uint_t ngx_event_process_posted_n(ngx_cycle_t *cycle,
+    ngx_thread_volatile ngx_event_t **posted, ngx_uint_t n);
+
+
 void
 ngx_event_process_posted(ngx_cycle_t *cycle,
     ngx_thread_volatile ngx_event_t **posted)       /*处理缓存队列的事件*/
@@ -37,8 +42,74 @@ ngx_event_process_posted(ngx_cycle_t *cycle,
 
         ngx_delete_posted_event(ev);                  /*将事件从缓存队列中删除*/
 
-        ev->handler(ev);                                /*回调函数*/
+        ngx_event_call_handler(ev);                     /*回调函数*/
+    }
+}
+
+
+/*
+ * The posted events are handled at most "batch" per a loop iteration.
+ * With "event_batch" the event methods post all the events reported,
+ * as with NGX_POST_EVENTS, so the limit covers them too.  The events
+ * left from the previous iteration are kept in the delayed queue and
+ * go first, so the new events, which are added to the head of the
+ * posted queue, cannot starve them.  The delayed queue holds only the
+ * posted events: the accept events and the timers are still handled
+ * all at once.
+ */
+
+void
+ngx_event_process_posted_batch(ngx_cycle_t *cycle, ngx_uint_t batch)
+{
+    ngx_event_t  *ev;
+
+    batch -= ngx_event_process_posted_n(cycle, &ngx_posted_delayed_events,
+                                        batch);
+
+    if (batch) {
+        (void) ngx_event_process_posted_n(cycle, &ngx_posted_events, batch);
+    }
+
+    if (ngx_posted_delayed_events || ngx_posted_events == NULL) {
+        return;
+    }
+
+    ev = (ngx_event_t *) ngx_posted_events;
+
+    ngx_posted_delayed_events = ev;
+    ev->prev = (ngx_event_t **) &ngx_posted_delayed_events;
+
+    ngx_posted_events = NULL;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "posted events delayed %p", ev);
+}
+
+
+static ngx_uint_t
+ngx_event_process_posted_n(ngx_cycle_t *cycle,
+    ngx_thread_volatile ngx_event_t **posted, ngx_uint_t n)
+{
+    ngx_uint_t    i;
+    ngx_event_t  *ev;
+
+    for (i = 0; i < n; i++) {
+
+        ev = (ngx_event_t *) *posted;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                      "posted event %p", ev);
+
+        if (ev == NULL) {
+            break;
+        }
+
+        ngx_delete_posted_event(ev);
+
+        ngx_event_call_handler(ev);
     }
+
+    return i;
 }
 
 
@@ -143,7 +214,7 @@ ngx_event_thread_process_posted(ngx_cycle_t *cycle)
 
             ngx_mutex_unlock(ngx_posted_events_mutex);
 
-            ev->handler(ev);
+            ngx_event_call_handler(ev);
 
             ngx_mutex_lock(ngx_posted_events_mutex);
 
@@ -61,6 +61,7 @@ extern ngx_mutex_t  *ngx_posted_events_mutex;
 
 void ngx_event_process_posted(ngx_cycle_t *cycle,
     ngx_thread_volatile ngx_event_t **posted);
+void ngx_event_process_posted_batch(ngx_cycle_t *cycle, ngx_uint_t batch);
 void ngx_wakeup_worker_thread(ngx_cycle_t *cycle);
 
 #if (NGX_THREADS)
@@ -70,6 +71,7 @@ ngx_int_t ngx_event_thread_process_posted(ngx_cycle_t *cycle);
 
 extern ngx_thread_volatile ngx_event_t  *ngx_posted_accept_events;
 extern ngx_thread_volatile ngx_event_t  *ngx_posted_events;
+extern ngx_thread_volatile ngx_event_t  *ngx_posted_delayed_events;
 
 
 #endif /* _NGX_EVENT_POSTED_H_INCLUDED_ */
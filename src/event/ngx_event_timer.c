@@ -18,6 +18,10 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;       /*全局变量, 定时器红黑树*/
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;      /*全局变量, 哨兵*/
 
+
+static ngx_int_t ngx_event_timers_cancelable(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -146,7 +150,7 @@ ngx_event_expire_timers(void)                       /*超时检测函数, 主要
 
             ev->timedout = 1;       /*设置超时标记*/
 
-            ev->handler(ev);        /*执行定时器事件的回调函数*/
+            ngx_event_call_handler(ev);     /*执行定时器事件的回调函数*/
 
             continue;
         }
@@ -156,3 +160,47 @@ ngx_event_expire_timers(void)                       /*超时检测函数, 主要
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    ngx_rbtree_node_t  *root, *sentinel;
+
+    root = ngx_event_timer_rbtree.root;
+    sentinel = ngx_event_timer_rbtree.sentinel;
+
+    if (root == sentinel) {
+        return NGX_OK;
+    }
+
+    return ngx_event_timers_cancelable(root, sentinel);
+}
+
+
+static ngx_int_t
+ngx_event_timers_cancelable(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    ngx_event_t  *ev;
+
+    ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+    if (!ev->cancelable) {
+        return NGX_AGAIN;
+    }
+
+    if (node->left != sentinel
+        && ngx_event_timers_cancelable(node->left, sentinel) != NGX_OK)
+    {
+        return NGX_AGAIN;
+    }
+
+    if (node->right != sentinel
+        && ngx_event_timers_cancelable(node->right, sentinel) != NGX_OK)
+    {
+        return NGX_AGAIN;
+    }
+
+    return NGX_OK;
+}
@@ -11,6 +11,10 @@
 
 #include <zlib.h>
 
+#if (NGX_HAVE_LIBDEFLATE)
+#include <libdeflate.h>
+#endif
+
 
 typedef struct {
     ngx_flag_t           enable;
@@ -26,10 +30,38 @@ typedef struct {
     size_t               memlevel;
     ssize_t              min_length;
 
+    ngx_shm_zone_t      *cache;
+
     ngx_array_t         *types_keys;
 } ngx_http_gzip_conf_t;
 
 
+typedef struct {
+    u_char               color;
+    u_char               dummy;
+    u_short              len;
+    ngx_queue_t          queue;
+    size_t               zin;
+    size_t               size;
+    /* the key followed by the gzipped response */
+    u_char               data[1];
+} ngx_http_gzip_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t         rbtree;
+    ngx_rbtree_node_t    sentinel;
+    ngx_queue_t          queue;
+} ngx_http_gzip_cache_shctx_t;
+
+
+typedef struct {
+    ngx_http_gzip_cache_shctx_t  *sh;
+    ngx_slab_pool_t              *shpool;
+    size_t                        max_size;
+} ngx_http_gzip_cache_ctx_t;
+
+
 typedef struct {
     ngx_chain_t         *in;
     ngx_chain_t         *free;
@@ -44,6 +76,13 @@ typedef struct {
     ngx_buf_t           *out_buf;
     ngx_int_t            bufs;
 
+    ngx_str_t            key;
+    uint32_t             hash;
+    ngx_buf_t           *hit;
+    ngx_chain_t         *cached;
+    ngx_chain_t        **last_cached;
+    size_t               cached_size;
+
     void                *preallocated;
     char                *free_mem;
     ngx_uint_t           allocated;
@@ -57,6 +96,7 @@ typedef struct {
     unsigned             nomem:1;
     unsigned             gzheader:1;
     unsigned             buffering:1;
+    unsigned             caching:1;
 
     size_t               zin;
     size_t               zout;
@@ -90,6 +130,10 @@ static ngx_int_t ngx_http_gzip_filter_buffer(ngx_http_gzip_ctx_t *ctx,
     ngx_chain_t *in);
 static ngx_int_t ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
+#if (NGX_HAVE_LIBDEFLATE)
+static ngx_int_t ngx_http_gzip_filter_deflate_whole(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+#endif
 static ngx_int_t ngx_http_gzip_filter_gzheader(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 static ngx_int_t ngx_http_gzip_filter_add_data(ngx_http_request_t *r,
@@ -107,6 +151,23 @@ static void ngx_http_gzip_filter_free(void *opaque, void *address);
 static void ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 
+static ngx_int_t ngx_http_gzip_cache_lookup(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static ngx_http_gzip_cache_node_t *ngx_http_gzip_cache_find(
+    ngx_http_gzip_cache_ctx_t *cache, uint32_t hash, ngx_str_t *key);
+static ngx_int_t ngx_http_gzip_cache_send(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_gzip_cache_collect(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_cache_store(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_cache_free(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_gzip_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static ngx_int_t ngx_http_gzip_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -117,6 +178,10 @@ static char *ngx_http_gzip_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static char *ngx_http_gzip_window(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_gzip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_num_bounds_t  ngx_http_gzip_comp_level_bounds = {
@@ -193,6 +258,20 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, min_length),
       NULL },
 
+    { ngx_string("gzip_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_gzip_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("gzip_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gzip_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -233,6 +312,30 @@ static ngx_str_t  ngx_http_gzip_ratio = ngx_string("gzip_ratio");
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
+#if (NGX_HAVE_LIBDEFLATE)
+/* the compressors are allocated once per worker process and level */
+static struct libdeflate_compressor  *ngx_http_gzip_compressors[9];
+#endif
+
+
+static ngx_int_t
+ngx_http_gzip_filter_test(ngx_http_request_t *r)
+{
+    ngx_http_gzip_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    if (!conf->enable
+        || (r->headers_out.content_length_n != -1
+            && r->headers_out.content_length_n < conf->min_length)
+        || ngx_http_test_content_type(r, &conf->types) == NULL)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
 
 static ngx_int_t
 ngx_http_gzip_header_filter(ngx_http_request_t *r)
@@ -243,16 +346,13 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
 
-    if (!conf->enable
-        || (r->headers_out.status != NGX_HTTP_OK
-            && r->headers_out.status != NGX_HTTP_FORBIDDEN
-            && r->headers_out.status != NGX_HTTP_NOT_FOUND)
+    if ((r->headers_out.status != NGX_HTTP_OK
+         && r->headers_out.status != NGX_HTTP_FORBIDDEN
+         && r->headers_out.status != NGX_HTTP_NOT_FOUND)
         || (r->headers_out.content_encoding
             && r->headers_out.content_encoding->value.len)
-        || (r->headers_out.content_length_n != -1
-            && r->headers_out.content_length_n < conf->min_length)
-        || ngx_http_test_content_type(r, &conf->types) == NULL
-        || r->header_only)
+        || r->header_only
+        || ngx_http_gzip_filter_test(r) != NGX_OK)
     {
         return ngx_http_next_header_filter(r);
     }
@@ -292,6 +392,12 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
 
     ngx_http_gzip_filter_memory(r, ctx);
 
+    if (conf->cache) {
+        if (ngx_http_gzip_cache_lookup(r, ctx) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     h = ngx_list_push(&r->headers_out.headers);
     if (h == NULL) {
         return NGX_ERROR;
@@ -302,12 +408,17 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     ngx_str_set(&h->value, "gzip");
     r->headers_out.content_encoding = h;
 
-    r->main_filter_need_in_memory = 1;
-
     ngx_http_clear_content_length(r);
     ngx_http_clear_accept_ranges(r);
     ngx_http_clear_etag(r);
 
+    if (ctx->hit) {
+        r->headers_out.content_length_n = ctx->hit->last - ctx->hit->pos;
+
+    } else {
+        r->main_filter_need_in_memory = 1;
+    }
+
     return ngx_http_next_header_filter(r);
 }
 
@@ -328,6 +439,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http gzip filter");
 
+    if (ctx->hit) {
+        return ngx_http_gzip_cache_send(r, ctx, in);
+    }
+
     if (ctx->buffering) {
 
         /*
@@ -358,18 +473,31 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
     }
 
-    if (ctx->preallocated == NULL) {
-        if (ngx_http_gzip_filter_deflate_start(r, ctx) != NGX_OK) {
+    if (in) {
+        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
             goto failed;
         }
+
+        r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
     }
 
-    if (in) {
-        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+    if (ctx->preallocated == NULL) {
+
+#if (NGX_HAVE_LIBDEFLATE)
+        rc = ngx_http_gzip_filter_deflate_whole(r, ctx);
+#else
+        rc = NGX_DECLINED;
+#endif
+
+        if (rc == NGX_ERROR) {
             goto failed;
         }
 
-        r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
+        if (rc == NGX_DECLINED
+            && ngx_http_gzip_filter_deflate_start(r, ctx) != NGX_OK)
+        {
+            goto failed;
+        }
     }
 
     if (ctx->nomem || in == NULL) {
@@ -444,6 +572,16 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             }
         }
 
+        if (ctx->caching) {
+            if (ngx_http_gzip_cache_collect(r, ctx) != NGX_OK) {
+                goto failed;
+            }
+
+            if (ctx->done) {
+                ngx_http_gzip_cache_store(r, ctx);
+            }
+        }
+
         rc = ngx_http_next_body_filter(r, ctx->out);
 
         if (rc == NGX_ERROR) {
@@ -477,6 +615,10 @@ failed:
 
     ngx_http_gzip_filter_free_copy_buf(r, ctx);
 
+    if (ctx->caching) {
+        ngx_http_gzip_cache_free(r, ctx);
+    }
+
     return NGX_ERROR;
 }
 
@@ -630,6 +772,142 @@ ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_LIBDEFLATE)
+
+static ngx_int_t
+ngx_http_gzip_filter_deflate_whole(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx)
+{
+    u_char                        *p, *data;
+    size_t                         size, len;
+    ngx_buf_t                     *b;
+    ngx_uint_t                     last, n;
+    ngx_chain_t                   *cl;
+    ngx_http_gzip_conf_t          *conf;
+    struct libdeflate_compressor  *c;
+
+    /*
+     * a response which is already buffered completely in memory
+     * is compressed in one call, libdeflate is considerably faster
+     * than zlib in this case
+     */
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    size = 0;
+    last = 0;
+    n = 0;
+    data = NULL;
+
+    for (cl = ctx->in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (b->flush || !(ngx_buf_in_memory(b) || ngx_buf_special(b))) {
+            return NGX_DECLINED;
+        }
+
+        if (ngx_buf_in_memory(b) && b->last != b->pos) {
+            size += b->last - b->pos;
+            data = b->pos;
+            n++;
+        }
+
+        if (b->last_buf) {
+            last = 1;
+        }
+    }
+
+    if (!last || size > conf->bufs.num * conf->bufs.size) {
+        return NGX_DECLINED;
+    }
+
+    c = ngx_http_gzip_compressors[conf->level - 1];
+
+    if (c == NULL) {
+        c = libdeflate_alloc_compressor((int) conf->level);
+        if (c == NULL) {
+            return NGX_DECLINED;
+        }
+
+        ngx_http_gzip_compressors[conf->level - 1] = c;
+    }
+
+    if (n > 1) {
+        data = ngx_pnalloc(r->pool, size);
+        if (data == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = data;
+
+        for (cl = ctx->in; cl; cl = cl->next) {
+            if (ngx_buf_in_memory(cl->buf)) {
+                p = ngx_cpymem(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+            }
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool,
+                            libdeflate_gzip_compress_bound(c, size));
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = libdeflate_gzip_compress(c, data, size, b->pos, b->end - b->pos);
+
+    if (len == 0) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "libdeflate_gzip_compress() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip whole: %uz -> %uz", size, len);
+
+    if (n > 1) {
+        ngx_pfree(r->pool, data);
+    }
+
+    for (cl = ctx->in; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->last;
+
+        if (cl->buf->tag == (ngx_buf_tag_t) &ngx_http_gzip_filter_module) {
+            ngx_pfree(r->pool, cl->buf->start);
+        }
+    }
+
+    ctx->in = NULL;
+
+    b->last += len;
+    b->last_buf = 1;
+    b->tag = (ngx_buf_tag_t) &ngx_http_gzip_filter_module;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+    ctx->out = cl;
+    ctx->last_out = &cl->next;
+
+    ctx->zin = size;
+    ctx->zout = len;
+
+    /* libdeflate writes the gzip header and trailer itself */
+
+    ctx->gzheader = 1;
+    ctx->done = 1;
+
+    r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_gzip_filter_gzheader(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 {
@@ -1045,6 +1323,452 @@ ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_gzip_cache_lookup(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    u_char                      *p;
+    size_t                       len;
+    ngx_buf_t                   *b;
+    ngx_str_t                   *etag;
+    ngx_http_gzip_conf_t        *conf;
+    ngx_http_gzip_cache_ctx_t   *cache;
+    ngx_http_gzip_cache_node_t  *gn;
+
+    if (r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.etag == NULL)
+    {
+        return NGX_DECLINED;
+    }
+
+    etag = &r->headers_out.etag->value;
+
+    /* a weak entity tag does not promise a byte-identical response */
+
+    if (etag->len < 2 || etag->data[0] != '"') {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    len = r->headers_in.server.len + 1 + r->unparsed_uri.len + 1 + etag->len
+          + 1 + NGX_INT_T_LEN;
+
+    if (len > 65535) {
+        return NGX_DECLINED;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->key.data = p;
+    ctx->key.len = ngx_sprintf(p, "%V %V %V %i", &r->headers_in.server,
+                               &r->unparsed_uri, etag, conf->level)
+                   - p;
+
+    ctx->hash = ngx_crc32_short(ctx->key.data, ctx->key.len);
+
+    cache = conf->cache->data;
+    b = NULL;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    gn = ngx_http_gzip_cache_find(cache, ctx->hash, &ctx->key);
+
+    if (gn) {
+        ngx_queue_remove(&gn->queue);
+        ngx_queue_insert_head(&cache->sh->queue, &gn->queue);
+
+        b = ngx_create_temp_buf(r->pool, gn->size);
+
+        if (b) {
+            b->last = ngx_cpymem(b->pos, gn->data + gn->len, gn->size);
+            ctx->zin = gn->zin;
+            ctx->zout = gn->size;
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip cache \"%V\": %s", &ctx->key, gn ? "hit" : "miss");
+
+    if (gn == NULL) {
+        ctx->caching = 1;
+        ctx->last_cached = &ctx->cached;
+
+        return NGX_OK;
+    }
+
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->hit = b;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_gzip_cache_node_t *
+ngx_http_gzip_cache_find(ngx_http_gzip_cache_ctx_t *cache, uint32_t hash,
+    ngx_str_t *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_gzip_cache_node_t  *gn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        gn = (ngx_http_gzip_cache_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, gn->data, key->len, (size_t) gn->len);
+
+        if (rc == 0) {
+            return gn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_send(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    ngx_buf_t    *b;
+    ngx_uint_t    last;
+    ngx_chain_t  *cl, *out, **ll;
+
+    /* the response is already known, the body is only drained */
+
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        b->pos = b->last;
+
+        if (b->in_file) {
+            b->file_pos = b->file_last;
+        }
+
+        if (b->last_buf) {
+            last = 1;
+        }
+    }
+
+    out = NULL;
+    ll = &out;
+
+    if (!ctx->gzheader) {
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ctx->hit;
+        cl->next = NULL;
+        *ll = cl;
+        ll = &cl->next;
+
+        ctx->gzheader = 1;
+
+        if (last) {
+            ctx->hit->last_buf = 1;
+            last = 0;
+        }
+    }
+
+    if (last) {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->last_buf = 1;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ll = cl;
+    }
+
+    if (ctx->hit->last_buf || last) {
+        ctx->done = 1;
+    }
+
+    if (out == NULL && in) {
+        return NGX_OK;
+    }
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_collect(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    size_t                      size;
+    ngx_buf_t                  *b;
+    ngx_chain_t                *cl, *ln;
+    ngx_http_gzip_conf_t       *conf;
+    ngx_http_gzip_cache_ctx_t  *cache;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+    cache = conf->cache->data;
+
+    for (cl = ctx->out; cl; cl = cl->next) {
+        size = cl->buf->last - cl->buf->pos;
+
+        if (size == 0) {
+            continue;
+        }
+
+        ctx->cached_size += size;
+
+        if (ctx->cached_size > cache->max_size) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "gzip cache \"%V\": response is too big",
+                           &ctx->key);
+
+            ngx_http_gzip_cache_free(r, ctx);
+            return NGX_OK;
+        }
+
+        b = ngx_create_temp_buf(r->pool, size);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->pos, cl->buf->pos, size);
+
+        ln = ngx_alloc_chain_link(r->pool);
+        if (ln == NULL) {
+            return NGX_ERROR;
+        }
+
+        ln->buf = b;
+        ln->next = NULL;
+        *ctx->last_cached = ln;
+        ctx->last_cached = &ln->next;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gzip_cache_store(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    u_char                      *p;
+    size_t                       size;
+    ngx_queue_t                 *q;
+    ngx_chain_t                 *cl;
+    ngx_rbtree_node_t           *node;
+    ngx_http_gzip_conf_t        *conf;
+    ngx_http_gzip_cache_ctx_t   *cache;
+    ngx_http_gzip_cache_node_t  *gn;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+    cache = conf->cache->data;
+
+    size = offsetof(ngx_rbtree_node_t, color)
+           + offsetof(ngx_http_gzip_cache_node_t, data)
+           + ctx->key.len + ctx->cached_size;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (ngx_http_gzip_cache_find(cache, ctx->hash, &ctx->key)) {
+        goto done;
+    }
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (node) {
+            break;
+        }
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "could not allocate node%s",
+                          cache->shpool->log_ctx);
+            goto done;
+        }
+
+        /* evict the least recently used response */
+
+        q = ngx_queue_last(&cache->sh->queue);
+        ngx_queue_remove(q);
+
+        gn = ngx_queue_data(q, ngx_http_gzip_cache_node_t, queue);
+
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) gn - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_rbtree_delete(&cache->sh->rbtree, node);
+
+        ngx_slab_free_locked(cache->shpool, node);
+    }
+
+    node->key = ctx->hash;
+
+    gn = (ngx_http_gzip_cache_node_t *) &node->color;
+
+    gn->len = (u_short) ctx->key.len;
+    gn->zin = ctx->zin;
+    gn->size = ctx->cached_size;
+
+    p = ngx_cpymem(gn->data, ctx->key.data, ctx->key.len);
+
+    for (cl = ctx->cached; cl; cl = cl->next) {
+        p = ngx_cpymem(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+    }
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &gn->queue);
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_gzip_cache_free(r, ctx);
+}
+
+
+static void
+ngx_http_gzip_cache_free(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    ngx_chain_t  *cl;
+
+    for (cl = ctx->cached; cl; cl = cl->next) {
+        ngx_pfree(r->pool, cl->buf->start);
+    }
+
+    ctx->cached = NULL;
+    ctx->caching = 0;
+}
+
+
+static void
+ngx_http_gzip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_http_gzip_cache_node_t   *gn, *gnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            gn = (ngx_http_gzip_cache_node_t *) &node->color;
+            gnt = (ngx_http_gzip_cache_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(gn->data, gnt->data, gn->len, gnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_gzip_cache_ctx_t  *octx = data;
+
+    size_t                      len;
+    ngx_http_gzip_cache_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_gzip_cache_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_http_gzip_cache_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    len = sizeof(" in gzip_cache_zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in gzip_cache_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_gzip_add_variables(ngx_conf_t *cf)
 {
@@ -1131,6 +1855,7 @@ ngx_http_gzip_create_conf(ngx_conf_t *cf)
     conf->wbits = NGX_CONF_UNSET_SIZE;
     conf->memlevel = NGX_CONF_UNSET_SIZE;
     conf->min_length = NGX_CONF_UNSET;
+    conf->cache = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -1155,6 +1880,7 @@ ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->memlevel, prev->memlevel,
                               MAX_MEM_LEVEL - 1);
     ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
 
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
@@ -1177,6 +1903,11 @@ ngx_http_gzip_filter_init(ngx_conf_t *cf)
     ngx_http_next_body_filter = ngx_http_top_body_filter;/*指向链接头指向的模块,作为next*/
     ngx_http_top_body_filter = ngx_http_gzip_body_filter;/*链接头指向自身*/
 
+#if (NGX_HTTP_ENCODING)
+    ngx_http_encoding_filters[NGX_HTTP_ENCODING_GZIP].test =
+                                                     ngx_http_gzip_filter_test;
+#endif
+
     return NGX_OK;
 }
 
@@ -1227,3 +1958,152 @@ ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data)
 
     return "must be 512, 1k, 2k, 4k, 8k, 16k, 32k, 64k, or 128k";
 }
+
+
+static char *
+ngx_http_gzip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                     *p;
+    ssize_t                     size, max_size;
+    ngx_str_t                  *value, name, s;
+    ngx_uint_t                  i;
+    ngx_shm_zone_t             *shm_zone;
+    ngx_http_gzip_cache_ctx_t  *ctx;
+
+    value = cf->args->elts;
+
+    size = 0;
+    max_size = NGX_CONF_UNSET;
+    name.len = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_size(&s);
+
+            if (max_size == NGX_ERROR || max_size == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (max_size == NGX_CONF_UNSET) {
+        max_size = ngx_min(1024 * 1024, size / 8);
+
+    } else if (max_size > size / 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "max_size must be less than half of zone size");
+        return NGX_CONF_ERROR;
+    }
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_cache_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->max_size = max_size;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_gzip_filter_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_gzip_cache_init_zone;
+    shm_zone->data = ctx;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ngx_str_t  *value;
+
+    if (gcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        gcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    gcf->cache = ngx_shared_memory_add(cf, &value[1], 0,
+                                       &ngx_http_gzip_filter_module);
+    if (gcf->cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (gcf->cache->data == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "unknown gzip_cache_zone \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
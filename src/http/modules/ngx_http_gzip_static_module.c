@@ -9,21 +9,146 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#include <zlib.h>
 
-#define NGX_HTTP_GZIP_STATIC_OFF     0
-#define NGX_HTTP_GZIP_STATIC_ON      1
-#define NGX_HTTP_GZIP_STATIC_ALWAYS  2
+#if (NGX_HTTP_BROTLI)
+#include <brotli/encode.h>
+#endif
+
+
+#define NGX_HTTP_GZIP_STATIC_OFF       0
+#define NGX_HTTP_GZIP_STATIC_ON        1
+#define NGX_HTTP_GZIP_STATIC_ALWAYS    2
+#define NGX_HTTP_GZIP_STATIC_GENERATE  3
+
+
+#define NGX_HTTP_GZIP_STATIC_TEMP_PATH  "gzip_static_temp"
+
+#define NGX_HTTP_GZIP_STATIC_CHUNK      65536
+#define NGX_HTTP_GZIP_STATIC_BUDGET     1000
+
+/* the gzip extra subfield and the brotli metadata of the generated files */
+#define NGX_HTTP_GZIP_STATIC_GZIP_MARKER    "NG\0\0"
+#define NGX_HTTP_GZIP_STATIC_BROTLI_MARKER  "nginx gzip_static"
+
+
+typedef struct {
+    u_char                          color;
+    u_char                          dummy;
+    u_short                         len;
+    ngx_queue_t                     queue;
+    /* the file is not queued again until this time */
+    time_t                          expire;
+    u_char                          data[1];
+} ngx_http_gzip_static_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    /* the files waiting to be compressed */
+    ngx_queue_t                     queue;
+    /* the files being compressed or failed to be compressed */
+    ngx_queue_t                     done;
+} ngx_http_gzip_static_shctx_t;
+
+
+/* the file being compressed, it may take several cache manager calls */
+
+typedef struct {
+    ngx_pool_t                     *pool;
+    u_char                         *name;
+    size_t                          len;
+    time_t                          mtime;
+    u_char                         *data;
+    size_t                          size;
+    /* the source bytes passed to the current encoder */
+    size_t                          pos;
+    u_char                         *out;
+    size_t                          out_size;
+    size_t                          out_len;
+    z_stream                        zstream;
+    gz_header                       header;
+#if (NGX_HTTP_BROTLI)
+    BrotliEncoderState             *brotli;
+#endif
+    unsigned                        gz:1;
+    unsigned                        br:1;
+    unsigned                        deflate:1;
+} ngx_http_gzip_static_job_t;
+
+
+typedef struct {
+    ngx_http_gzip_static_shctx_t   *sh;
+    ngx_slab_pool_t                *shpool;
+    ngx_path_t                     *temp_path;
+    off_t                           max_size;
+    ngx_int_t                       gzip_level;
+    ngx_int_t                       brotli_level;
+    /* the cache manager process data */
+    ngx_http_gzip_static_job_t     *job;
+#if (NGX_HTTP_BROTLI)
+    ngx_str_t                       brotli_marker;
+#endif
+} ngx_http_gzip_static_generator_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                 *generator;
+} ngx_http_gzip_static_main_conf_t;
 
 
 typedef struct {
-    ngx_uint_t  enable;
+    ngx_uint_t                      enable;
 } ngx_http_gzip_static_conf_t;
 
 
 static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path,
+    ngx_open_file_info_t *of);
+#if (NGX_HTTP_BROTLI)
+static ngx_uint_t ngx_http_gzip_static_brotli_ok(ngx_http_request_t *r);
+#endif
+static void ngx_http_gzip_static_enqueue(ngx_http_request_t *r,
+    u_char *name, size_t len, off_t size);
+
+static time_t ngx_http_gzip_static_manager(void *data);
+static ngx_int_t ngx_http_gzip_static_start(
+    ngx_http_gzip_static_generator_t *gen, u_char *name, size_t len);
+static ngx_int_t ngx_http_gzip_static_compress(
+    ngx_http_gzip_static_generator_t *gen, ngx_msec_t start);
+static ngx_int_t ngx_http_gzip_static_deflate(
+    ngx_http_gzip_static_generator_t *gen, ngx_http_gzip_static_job_t *job);
+#if (NGX_HTTP_BROTLI)
+static ngx_int_t ngx_http_gzip_static_brotli(
+    ngx_http_gzip_static_generator_t *gen, ngx_http_gzip_static_job_t *job);
+static BrotliEncoderState *ngx_http_gzip_static_brotli_create(
+    ngx_http_gzip_static_generator_t *gen, u_char **out, size_t *avail_out);
+static ngx_int_t ngx_http_gzip_static_brotli_marker(
+    ngx_http_gzip_static_generator_t *gen);
+#endif
+static ngx_int_t ngx_http_gzip_static_test(
+    ngx_http_gzip_static_generator_t *gen, ngx_http_gzip_static_job_t *job,
+    char *suffix);
+static void ngx_http_gzip_static_forget(
+    ngx_http_gzip_static_generator_t *gen, u_char *name, size_t len);
+static void ngx_http_gzip_static_finish(
+    ngx_http_gzip_static_generator_t *gen);
+static ngx_int_t ngx_http_gzip_static_write(
+    ngx_http_gzip_static_generator_t *gen, ngx_http_gzip_static_job_t *job,
+    char *suffix);
+static void ngx_http_gzip_static_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_gzip_static_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+static void *ngx_http_gzip_static_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
+static char *ngx_http_gzip_static_generator(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_gzip_static_init(ngx_conf_t *cf);
 
 
@@ -31,6 +156,7 @@ static ngx_conf_enum_t  ngx_http_gzip_static[] = {
     { ngx_string("off"), NGX_HTTP_GZIP_STATIC_OFF },
     { ngx_string("on"), NGX_HTTP_GZIP_STATIC_ON },
     { ngx_string("always"), NGX_HTTP_GZIP_STATIC_ALWAYS },
+    { ngx_string("always_generate"), NGX_HTTP_GZIP_STATIC_GENERATE },
     { ngx_null_string, 0 }
 };
 
@@ -44,6 +170,13 @@ static ngx_command_t  ngx_http_gzip_static_commands[] = {
       offsetof(ngx_http_gzip_static_conf_t, enable),
       &ngx_http_gzip_static },
 
+    { ngx_string("gzip_static_generator"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_static_generator,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -52,7 +185,7 @@ ngx_http_module_t  ngx_http_gzip_static_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_gzip_static_init,             /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_gzip_static_create_main_conf, /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -82,16 +215,16 @@ ngx_module_t  ngx_http_gzip_static_module = {
 static ngx_int_t
 ngx_http_gzip_static_handler(ngx_http_request_t *r)
 {
-    u_char                       *p;
+    u_char                       *p, *last;
     size_t                        root;
     ngx_str_t                     path;
-    ngx_int_t                     rc;
-    ngx_uint_t                    level;
+    ngx_int_t                     rc, found;
+    ngx_uint_t                    br, queued;
     ngx_log_t                    *log;
     ngx_buf_t                    *b;
     ngx_chain_t                   out;
     ngx_table_elt_t              *h;
-    ngx_open_file_info_t          of;
+    ngx_open_file_info_t          of, sof;
     ngx_http_core_loc_conf_t     *clcf;
     ngx_http_gzip_static_conf_t  *gzcf;
 
@@ -109,13 +242,20 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        rc = ngx_http_gzip_ok(r);
+    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ALWAYS) {
+        rc = NGX_OK;
 
     } else {
-        /* always */
-        rc = NGX_OK;
+        rc = ngx_http_gzip_ok(r);
+    }
+
+    br = 0;
+
+#if (NGX_HTTP_BROTLI)
+    if (rc == NGX_OK && gzcf->enable == NGX_HTTP_GZIP_STATIC_GENERATE) {
+        br = ngx_http_gzip_static_brotli_ok(r);
     }
+#endif
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
@@ -125,70 +265,98 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     log = r->connection->log;
 
-    p = ngx_http_map_uri_to_path(r, &path, &root, sizeof(".gz") - 1);
-    if (p == NULL) {
+    last = ngx_http_map_uri_to_path(r, &path, &root, sizeof(".gz") - 1);
+    if (last == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    *p++ = '.';
-    *p++ = 'g';
-    *p++ = 'z';
-    *p = '\0';
+    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_GENERATE) {
 
-    path.len = p - path.data;
+        /*
+         * the compressed files are generated with the modification time
+         * of the source file, so a changed source is detected by stat();
+         * the files supplied later than the source are used as is
+         */
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
-                   "http filename: \"%s\"", path.data);
+        path.len = last - path.data;
 
-    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+        ngx_memzero(&sof, sizeof(ngx_open_file_info_t));
 
-    of.read_ahead = clcf->read_ahead;
-    of.directio = clcf->directio;
-    of.valid = clcf->open_file_cache_valid;
-    of.min_uses = clcf->open_file_cache_min_uses;
-    of.errors = clcf->open_file_cache_errors;
-    of.events = clcf->open_file_cache_events;
+        sof.test_only = 1;
+        sof.valid = clcf->open_file_cache_valid;
+        sof.min_uses = clcf->open_file_cache_min_uses;
+        sof.errors = clcf->open_file_cache_errors;
+        sof.events = clcf->open_file_cache_events;
 
-    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        if (ngx_http_set_disable_symlinks(r, clcf, &path, &sof) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (ngx_open_cached_file(clcf->open_file_cache, &path, &sof, r->pool)
+            != NGX_OK
+            || !sof.is_file)
+        {
+            /* the static module will report the error */
+            return NGX_DECLINED;
+        }
     }
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-        != NGX_OK)
-    {
-        switch (of.err) {
+    queued = 0;
 
-        case 0:
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    for ( ;; ) {
 
-        case NGX_ENOENT:
-        case NGX_ENOTDIR:
-        case NGX_ENAMETOOLONG:
+        p = last;
 
-            return NGX_DECLINED;
+        *p++ = '.';
 
-        case NGX_EACCES:
-#if (NGX_HAVE_OPENAT)
-        case NGX_EMLINK:
-        case NGX_ELOOP:
-#endif
+        if (br) {
+            *p++ = 'b';
+            *p++ = 'r';
 
-            level = NGX_LOG_ERR;
-            break;
+        } else {
+            *p++ = 'g';
+            *p++ = 'z';
+        }
+
+        *p = '\0';
+
+        path.len = p - path.data;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "http filename: \"%s\"", path.data);
+
+        found = ngx_http_gzip_static_open(r, clcf, &path, &of);
 
-        default:
+        if (found == NGX_HTTP_INTERNAL_SERVER_ERROR) {
+            return found;
+        }
+
+        if (gzcf->enable != NGX_HTTP_GZIP_STATIC_GENERATE) {
+            if (found != NGX_OK) {
+                return NGX_DECLINED;
+            }
+
+            break;
+        }
 
-            level = NGX_LOG_CRIT;
+        if (found == NGX_OK && of.mtime >= sof.mtime) {
             break;
         }
 
-        ngx_log_error(level, log, of.err,
-                      "%s \"%s\" failed", of.failed, path.data);
+        if (!queued) {
+            ngx_http_gzip_static_enqueue(r, path.data, last - path.data,
+                                         sof.size);
+            queued = 1;
+        }
 
-        return NGX_DECLINED;
+        if (!br) {
+            return NGX_DECLINED;
+        }
+
+        br = 0;
     }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
+    if (gzcf->enable != NGX_HTTP_GZIP_STATIC_ALWAYS) {
         r->gzip_vary = 1;
 
         if (rc != NGX_OK) {
@@ -243,7 +411,14 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     h->hash = 1;
     ngx_str_set(&h->key, "Content-Encoding");
-    ngx_str_set(&h->value, "gzip");
+
+    if (br) {
+        ngx_str_set(&h->value, "br");
+
+    } else {
+        ngx_str_set(&h->value, "gzip");
+    }
+
     r->headers_out.content_encoding = h;
 
     r->ignore_content_encoding = 1;
@@ -285,30 +460,1310 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 }
 
 
-static void *
-ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
+static ngx_int_t
+ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of)
 {
-    ngx_http_gzip_static_conf_t  *conf;
+    ngx_uint_t  level;
 
-    conf = ngx_palloc(cf->pool, sizeof(ngx_http_gzip_static_conf_t));
-    if (conf == NULL) {
-        return NULL;
+    ngx_memzero(of, sizeof(ngx_open_file_info_t));
+
+    of->read_ahead = clcf->read_ahead;
+    of->directio = clcf->directio;
+    of->valid = clcf->open_file_cache_valid;
+    of->min_uses = clcf->open_file_cache_min_uses;
+    of->errors = clcf->open_file_cache_errors;
+    of->events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, path, of) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    conf->enable = NGX_CONF_UNSET_UINT;
+    if (ngx_open_cached_file(clcf->open_file_cache, path, of, r->pool)
+        == NGX_OK)
+    {
+        return NGX_OK;
+    }
 
-    return conf;
+    switch (of->err) {
+
+    case 0:
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+    case NGX_ENOENT:
+    case NGX_ENOTDIR:
+    case NGX_ENAMETOOLONG:
+
+        return NGX_DECLINED;
+
+    case NGX_EACCES:
+#if (NGX_HAVE_OPENAT)
+    case NGX_EMLINK:
+    case NGX_ELOOP:
+#endif
+
+        level = NGX_LOG_ERR;
+        break;
+
+    default:
+
+        level = NGX_LOG_CRIT;
+        break;
+    }
+
+    ngx_log_error(level, r->connection->log, of->err,
+                  "%s \"%s\" failed", of->failed, path->data);
+
+    return NGX_DECLINED;
 }
 
 
-static char *
-ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+#if (NGX_HTTP_BROTLI)
+
+static ngx_uint_t
+ngx_http_gzip_static_brotli_ok(ngx_http_request_t *r)
 {
-    ngx_http_gzip_static_conf_t *prev = parent;
-    ngx_http_gzip_static_conf_t *conf = child;
+    ngx_int_t         q;
+    ngx_table_elt_t  *ae;
 
-    ngx_conf_merge_uint_value(conf->enable, prev->enable,
-                              NGX_HTTP_GZIP_STATIC_OFF);
+    ae = r->headers_in.accept_encoding;
+    if (ae == NULL) {
+        return 0;
+    }
+
+    q = ngx_http_encoding_quality(&ae->value, NGX_HTTP_ENCODING_BROTLI);
+
+    return q > 0
+           && q >= ngx_http_encoding_quality(&ae->value,
+                                             NGX_HTTP_ENCODING_GZIP);
+}
+
+#endif
+
+
+static void
+ngx_http_gzip_static_enqueue(ngx_http_request_t *r, u_char *name, size_t len,
+    off_t size)
+{
+    size_t                             n;
+    uint32_t                           hash;
+    ngx_int_t                          rc;
+    ngx_rbtree_node_t                 *node, *sentinel;
+    ngx_http_gzip_static_node_t       *gn;
+    ngx_http_gzip_static_generator_t  *gen;
+    ngx_http_gzip_static_main_conf_t  *gmcf;
+
+    gmcf = ngx_http_get_module_main_conf(r, ngx_http_gzip_static_module);
+    gen = gmcf->generator->data;
+
+    if (size > gen->max_size || len > 65535) {
+        return;
+    }
+
+    hash = ngx_crc32_short(name, len);
+
+    ngx_shmtx_lock(&gen->shpool->mutex);
+
+    node = gen->sh->rbtree.root;
+    sentinel = gen->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        gn = (ngx_http_gzip_static_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(name, gn->data, len, (size_t) gn->len);
+
+        if (rc == 0) {
+            /* already queued */
+            goto done;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    n = offsetof(ngx_rbtree_node_t, color)
+        + offsetof(ngx_http_gzip_static_node_t, data)
+        + len + 1;
+
+    node = ngx_slab_alloc_locked(gen->shpool, n);
+
+    if (node == NULL) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "could not queue \"%*s\" for compression%s",
+                      len, name, gen->shpool->log_ctx);
+        goto done;
+    }
+
+    node->key = hash;
+
+    gn = (ngx_http_gzip_static_node_t *) &node->color;
+
+    gn->len = (u_short) len;
+    gn->expire = 0;
+    ngx_memcpy(gn->data, name, len);
+    gn->data[len] = '\0';
+
+    ngx_rbtree_insert(&gen->sh->rbtree, node);
+
+    ngx_queue_insert_tail(&gen->sh->queue, &gn->queue);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip static queued \"%*s\"", len, name);
+
+done:
+
+    ngx_shmtx_unlock(&gen->shpool->mutex);
+}
+
+
+static time_t
+ngx_http_gzip_static_manager(void *data)
+{
+    ngx_http_gzip_static_generator_t *gen = data;
+
+    u_char                       *name;
+    size_t                        len;
+    time_t                        now;
+    ngx_int_t                     rc;
+    ngx_msec_t                    start;
+    ngx_queue_t                  *q;
+    ngx_rbtree_node_t            *node;
+    ngx_http_gzip_static_node_t  *gn;
+
+    start = ngx_current_msec;
+
+    for ( ;; ) {
+
+        if (ngx_terminate || ngx_quit) {
+            break;
+        }
+
+        if (gen->job) {
+
+            /* the current file may be left from the previous call */
+
+            rc = ngx_http_gzip_static_compress(gen, start);
+
+            if (rc == NGX_AGAIN) {
+                break;
+            }
+
+            if (rc == NGX_OK) {
+                ngx_http_gzip_static_forget(gen, gen->job->name,
+                                            gen->job->len);
+            }
+
+            ngx_http_gzip_static_finish(gen);
+
+            continue;
+        }
+
+        ngx_time_update();
+
+        /* do not hold other cache managers for too long */
+
+        if (ngx_current_msec - start >= NGX_HTTP_GZIP_STATIC_BUDGET) {
+            break;
+        }
+
+        now = ngx_time();
+
+        ngx_shmtx_lock(&gen->shpool->mutex);
+
+        /* forget the files which failed some time ago */
+
+        while (!ngx_queue_empty(&gen->sh->done)) {
+            q = ngx_queue_last(&gen->sh->done);
+            gn = ngx_queue_data(q, ngx_http_gzip_static_node_t, queue);
+
+            if (gn->expire > now) {
+                break;
+            }
+
+            ngx_queue_remove(q);
+
+            node = (ngx_rbtree_node_t *)
+                       ((u_char *) gn - offsetof(ngx_rbtree_node_t, color));
+
+            ngx_rbtree_delete(&gen->sh->rbtree, node);
+
+            ngx_slab_free_locked(gen->shpool, node);
+        }
+
+        if (ngx_queue_empty(&gen->sh->queue)) {
+            ngx_shmtx_unlock(&gen->shpool->mutex);
+            break;
+        }
+
+        /*
+         * the file stays in the tree while it is compressed, so it is not
+         * queued again; should the process die, the entry expires anyway
+         */
+
+        q = ngx_queue_head(&gen->sh->queue);
+        ngx_queue_remove(q);
+
+        gn = ngx_queue_data(q, ngx_http_gzip_static_node_t, queue);
+        gn->expire = now + 60;
+
+        ngx_queue_insert_head(&gen->sh->done, q);
+
+        len = gn->len;
+
+        name = ngx_alloc(len + 1, ngx_cycle->log);
+        if (name) {
+            ngx_memcpy(name, gn->data, len + 1);
+        }
+
+        ngx_shmtx_unlock(&gen->shpool->mutex);
+
+        if (name == NULL) {
+            break;
+        }
+
+        rc = ngx_http_gzip_static_start(gen, name, len);
+
+        if (rc == NGX_DONE) {
+            ngx_http_gzip_static_forget(gen, name, len);
+        }
+
+        ngx_free(name);
+    }
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_start(ngx_http_gzip_static_generator_t *gen,
+    u_char *name, size_t len)
+{
+    ssize_t                      n;
+    ngx_fd_t                     fd;
+    ngx_int_t                    rc, gz, br;
+    ngx_log_t                   *log;
+    ngx_file_t                   file;
+    ngx_pool_t                  *pool;
+    ngx_file_info_t              fi;
+    ngx_http_gzip_static_job_t  *job;
+
+    log = ngx_cycle->log;
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        goto done;
+    }
+
+    job = ngx_pcalloc(pool, sizeof(ngx_http_gzip_static_job_t));
+    if (job == NULL) {
+        goto done;
+    }
+
+    job->pool = pool;
+    job->len = len;
+
+    job->name = ngx_pnalloc(pool, len + 1);
+    if (job->name == NULL) {
+        goto done;
+    }
+
+    ngx_memcpy(job->name, name, len + 1);
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto done;
+    }
+
+    if (!ngx_is_file(&fi) || ngx_file_size(&fi) > gen->max_size) {
+        rc = NGX_DONE;
+        goto done;
+    }
+
+    job->size = (size_t) ngx_file_size(&fi);
+    job->mtime = ngx_file_mtime(&fi);
+
+    gz = ngx_http_gzip_static_test(gen, job, "gz");
+    br = NGX_OK;
+
+#if (NGX_HTTP_BROTLI)
+    br = ngx_http_gzip_static_test(gen, job, "br");
+#endif
+
+    if (gz == NGX_ERROR || br == NGX_ERROR) {
+        goto done;
+    }
+
+    job->gz = (gz == NGX_DECLINED);
+    job->br = (br == NGX_DECLINED);
+
+    if (!job->gz && !job->br) {
+
+        /* the files not created here are not checked again for a while */
+
+        rc = (gz == NGX_ABORT || br == NGX_ABORT) ? NGX_DECLINED : NGX_DONE;
+        goto done;
+    }
+
+    job->data = ngx_palloc(pool, job->size + 1);
+    if (job->data == NULL) {
+        goto done;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = fd;
+    file.name.len = len;
+    file.name.data = name;
+    file.log = log;
+
+    n = ngx_read_file(&file, job->data, job->size, 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) n != job->size) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_read_file_n " read only %z of %uz from \"%s\"",
+                      n, job->size, name);
+        goto done;
+    }
+
+    gen->job = job;
+    pool = NULL;
+
+    rc = NGX_OK;
+
+done:
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_compress(ngx_http_gzip_static_generator_t *gen,
+    ngx_msec_t start)
+{
+    ngx_int_t                    rc;
+    ngx_http_gzip_static_job_t  *job;
+
+    job = gen->job;
+
+    for ( ;; ) {
+
+        if (job->gz) {
+            rc = ngx_http_gzip_static_deflate(gen, job);
+
+            if (rc == NGX_OK) {
+                job->gz = 0;
+                rc = ngx_http_gzip_static_write(gen, job, "gz");
+            }
+
+#if (NGX_HTTP_BROTLI)
+
+        } else if (job->br) {
+            rc = ngx_http_gzip_static_brotli(gen, job);
+
+            if (rc == NGX_OK) {
+                job->br = 0;
+                rc = ngx_http_gzip_static_write(gen, job, "br");
+            }
+
+#endif
+
+        } else {
+            return NGX_OK;
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        /* the files are compressed by chunks to check the time budget */
+
+        ngx_time_update();
+
+        if (ngx_current_msec - start >= NGX_HTTP_GZIP_STATIC_BUDGET) {
+            return (job->gz || job->br) ? NGX_AGAIN : NGX_OK;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_deflate(ngx_http_gzip_static_generator_t *gen,
+    ngx_http_gzip_static_job_t *job)
+{
+    int        rc, flush;
+    size_t     n;
+    ngx_log_t  *log;
+
+    log = ngx_cycle->log;
+
+    if (!job->deflate) {
+        rc = deflateInit2(&job->zstream, (int) gen->gzip_level, Z_DEFLATED,
+                          MAX_WBITS + 16, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+
+        if (rc != Z_OK) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "deflateInit2() failed: %d", rc);
+            return NGX_ERROR;
+        }
+
+        job->deflate = 1;
+
+        /* the extra field marks the files created by the module */
+
+        job->header.extra = (Bytef *) NGX_HTTP_GZIP_STATIC_GZIP_MARKER;
+        job->header.extra_len = sizeof(NGX_HTTP_GZIP_STATIC_GZIP_MARKER) - 1;
+        job->header.os = 3;
+
+        rc = deflateSetHeader(&job->zstream, &job->header);
+
+        if (rc != Z_OK) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "deflateSetHeader() failed: %d", rc);
+            return NGX_ERROR;
+        }
+
+        n = deflateBound(&job->zstream, job->size);
+
+        job->out = ngx_palloc(job->pool, n);
+        if (job->out == NULL) {
+            return NGX_ERROR;
+        }
+
+        job->zstream.next_out = job->out;
+        job->zstream.avail_out = n;
+
+        job->pos = 0;
+    }
+
+    n = ngx_min(job->size - job->pos, NGX_HTTP_GZIP_STATIC_CHUNK);
+
+    job->zstream.next_in = job->data + job->pos;
+    job->zstream.avail_in = n;
+
+    job->pos += n;
+
+    flush = (job->pos == job->size) ? Z_FINISH : Z_NO_FLUSH;
+
+    rc = deflate(&job->zstream, flush);
+
+    if (rc != (flush == Z_FINISH ? Z_STREAM_END : Z_OK)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "deflate() failed: %d, %d", flush, rc);
+        return NGX_ERROR;
+    }
+
+    if (flush != Z_FINISH) {
+        return NGX_AGAIN;
+    }
+
+    job->out_len = job->zstream.total_out;
+
+    deflateEnd(&job->zstream);
+    job->deflate = 0;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HTTP_BROTLI)
+
+static ngx_int_t
+ngx_http_gzip_static_brotli(ngx_http_gzip_static_generator_t *gen,
+    ngx_http_gzip_static_job_t *job)
+{
+    u_char                  *p;
+    size_t                   n, avail_in, avail_out;
+    const uint8_t           *next_in;
+    BrotliEncoderOperation   op;
+
+    if (job->brotli == NULL) {
+        job->out_size = BrotliEncoderMaxCompressedSize(job->size);
+
+        if (job->out_size == 0) {
+            job->out_size = job->size;
+        }
+
+        job->out_size += 1024;
+
+        job->out = ngx_palloc(job->pool, job->out_size);
+        if (job->out == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = job->out;
+        avail_out = job->out_size;
+
+        job->brotli = ngx_http_gzip_static_brotli_create(gen, &p, &avail_out);
+        if (job->brotli == NULL) {
+            return NGX_ERROR;
+        }
+
+        job->out_len = p - job->out;
+        job->pos = 0;
+    }
+
+    n = ngx_min(job->size - job->pos, NGX_HTTP_GZIP_STATIC_CHUNK);
+
+    next_in = job->data + job->pos;
+    avail_in = n;
+
+    job->pos += n;
+
+    op = (job->pos == job->size) ? BROTLI_OPERATION_FINISH
+                                 : BROTLI_OPERATION_PROCESS;
+
+    for ( ;; ) {
+
+        if (job->out_len == job->out_size) {
+            p = ngx_palloc(job->pool, 2 * job->out_size);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(p, job->out, job->out_len);
+
+            job->out = p;
+            job->out_size *= 2;
+        }
+
+        p = job->out + job->out_len;
+        avail_out = job->out_size - job->out_len;
+
+        if (!BrotliEncoderCompressStream(job->brotli, op, &avail_in, &next_in,
+                                         &avail_out, &p, NULL))
+        {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "BrotliEncoderCompressStream() failed");
+            return NGX_ERROR;
+        }
+
+        job->out_len = p - job->out;
+
+        if (avail_in == 0 && !BrotliEncoderHasMoreOutput(job->brotli)) {
+            break;
+        }
+    }
+
+    if (op != BROTLI_OPERATION_FINISH) {
+        return NGX_AGAIN;
+    }
+
+    if (!BrotliEncoderIsFinished(job->brotli)) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "brotli stream is not finished");
+        return NGX_ERROR;
+    }
+
+    BrotliEncoderDestroyInstance(job->brotli);
+    job->brotli = NULL;
+
+    return NGX_OK;
+}
+
+
+static BrotliEncoderState *
+ngx_http_gzip_static_brotli_create(ngx_http_gzip_static_generator_t *gen,
+    u_char **out, size_t *avail_out)
+{
+    size_t               avail_in;
+    const uint8_t       *next_in;
+    BrotliEncoderState  *state;
+
+    state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+
+    if (state == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "BrotliEncoderCreateInstance() failed");
+        return NULL;
+    }
+
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY,
+                              (uint32_t) gen->brotli_level);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN,
+                              BROTLI_DEFAULT_WINDOW);
+
+    /*
+     * the metadata block marks the files created by the module,
+     * the stream starts with the same bytes as long as the window is fixed
+     */
+
+    next_in = (const uint8_t *) NGX_HTTP_GZIP_STATIC_BROTLI_MARKER;
+    avail_in = sizeof(NGX_HTTP_GZIP_STATIC_BROTLI_MARKER) - 1;
+
+    do {
+        if (*avail_out == 0
+            || !BrotliEncoderCompressStream(state,
+                                            BROTLI_OPERATION_EMIT_METADATA,
+                                            &avail_in, &next_in,
+                                            avail_out, out, NULL))
+        {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "BrotliEncoderCompressStream() failed");
+            BrotliEncoderDestroyInstance(state);
+            return NULL;
+        }
+
+    } while (avail_in || BrotliEncoderHasMoreOutput(state));
+
+    return state;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_gzip_static_test(ngx_http_gzip_static_generator_t *gen,
+    ngx_http_gzip_static_job_t *job, char *suffix)
+{
+    u_char           *name, buf[64];
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_int_t         rc;
+    ngx_uint_t        own;
+    ngx_file_info_t   fi;
+
+    name = ngx_pnalloc(job->pool, job->len + sizeof(".gz"));
+    if (name == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_sprintf(name, "%*s.%s%Z", job->len, job->name, suffix);
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        return NGX_DECLINED;
+    }
+
+    rc = NGX_DECLINED;
+    n = NGX_ERROR;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        rc = NGX_ERROR;
+
+    } else if (ngx_file_mtime(&fi) >= job->mtime) {
+        /* generated from this source or supplied later */
+        rc = NGX_OK;
+
+    } else {
+        n = ngx_read_fd(fd, buf, sizeof(buf));
+
+        if (n == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_read_fd_n " \"%s\" failed", name);
+            rc = NGX_ERROR;
+        }
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+    /* only the outdated files created by the module are replaced */
+
+    own = 0;
+
+    if (suffix[0] == 'g') {
+        own = (n >= 14
+               && buf[0] == 0x1f && buf[1] == 0x8b && (buf[3] & 0x04)
+               && ngx_memcmp(&buf[12], NGX_HTTP_GZIP_STATIC_GZIP_MARKER, 2)
+                  == 0);
+
+#if (NGX_HTTP_BROTLI)
+
+    } else {
+        if (gen->brotli_marker.data == NULL
+            && ngx_http_gzip_static_brotli_marker(gen) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        own = ((size_t) n >= gen->brotli_marker.len
+               && ngx_memcmp(buf, gen->brotli_marker.data,
+                             gen->brotli_marker.len)
+                  == 0);
+
+#endif
+    }
+
+    if (own) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "\"%s\" is older than the source file, but it was not "
+                  "created by gzip_static, so it is not replaced", name);
+
+    return NGX_ABORT;
+}
+
+
+#if (NGX_HTTP_BROTLI)
+
+static ngx_int_t
+ngx_http_gzip_static_brotli_marker(ngx_http_gzip_static_generator_t *gen)
+{
+    u_char              *p;
+    size_t               avail_out;
+    BrotliEncoderState  *state;
+
+    p = ngx_pnalloc(ngx_cycle->pool, 64);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    gen->brotli_marker.data = p;
+    avail_out = 64;
+
+    state = ngx_http_gzip_static_brotli_create(gen, &p, &avail_out);
+    if (state == NULL) {
+        gen->brotli_marker.data = NULL;
+        return NGX_ERROR;
+    }
+
+    BrotliEncoderDestroyInstance(state);
+
+    gen->brotli_marker.len = p - gen->brotli_marker.data;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static void
+ngx_http_gzip_static_forget(ngx_http_gzip_static_generator_t *gen,
+    u_char *name, size_t len)
+{
+    uint32_t                      hash;
+    ngx_int_t                     rc;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_http_gzip_static_node_t  *gn;
+
+    hash = ngx_crc32_short(name, len);
+
+    ngx_shmtx_lock(&gen->shpool->mutex);
+
+    node = gen->sh->rbtree.root;
+    sentinel = gen->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        gn = (ngx_http_gzip_static_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(name, gn->data, len, (size_t) gn->len);
+
+        if (rc == 0) {
+            ngx_queue_remove(&gn->queue);
+            ngx_rbtree_delete(&gen->sh->rbtree, node);
+            ngx_slab_free_locked(gen->shpool, node);
+            break;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    ngx_shmtx_unlock(&gen->shpool->mutex);
+}
+
+
+static void
+ngx_http_gzip_static_finish(ngx_http_gzip_static_generator_t *gen)
+{
+    ngx_http_gzip_static_job_t  *job;
+
+    job = gen->job;
+
+    if (job->deflate) {
+        deflateEnd(&job->zstream);
+    }
+
+#if (NGX_HTTP_BROTLI)
+    if (job->brotli) {
+        BrotliEncoderDestroyInstance(job->brotli);
+    }
+#endif
+
+    ngx_destroy_pool(job->pool);
+
+    gen->job = NULL;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_write(ngx_http_gzip_static_generator_t *gen,
+    ngx_http_gzip_static_job_t *job, char *suffix)
+{
+    ngx_str_t              to;
+    ngx_file_t             file;
+    ngx_pool_t            *pool;
+    ngx_ext_rename_file_t  ext;
+
+    /* a file might be supplied while this one was compressed */
+
+    if (ngx_http_gzip_static_test(gen, job, suffix) != NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    pool = job->pool;
+
+    /*
+     * the file is written to the temporary path and then renamed,
+     * so a worker never sends a partially written file
+     */
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = NGX_INVALID_FILE;
+    file.log = pool->log;
+
+    if (ngx_create_temp_file(&file, gen->temp_path, pool, 1, 0,
+                             NGX_FILE_DEFAULT_ACCESS)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_write_file(&file, job->out, job->out_len, 0)
+        != (ssize_t) job->out_len)
+    {
+
+        if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, pool->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed",
+                          file.name.data);
+        }
+
+        return NGX_ERROR;
+    }
+
+    to.len = job->len + sizeof(".gz") - 1;
+
+    to.data = ngx_pnalloc(pool, to.len + 1);
+    if (to.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_sprintf(to.data, "%*s.%s%Z", job->len, job->name, suffix);
+
+    ext.access = NGX_FILE_DEFAULT_ACCESS;
+    ext.path_access = 0;
+    ext.time = job->mtime;
+    ext.fd = file.fd;
+    ext.create_path = 0;
+    ext.delete_file = 1;
+    ext.log = pool->log;
+
+    if (ngx_ext_rename_file(&file.name, &to, &ext) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pool->log, 0,
+                   "gzip static generated \"%V\", %uz bytes",
+                   &to, job->out_len);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gzip_static_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t            **p;
+    ngx_http_gzip_static_node_t   *gn, *gnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            gn = (ngx_http_gzip_static_node_t *) &node->color;
+            gnt = (ngx_http_gzip_static_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(gn->data, gnt->data, gn->len, gnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_gzip_static_generator_t  *ogen = data;
+
+    size_t                             len;
+    ngx_http_gzip_static_generator_t  *gen;
+
+    gen = shm_zone->data;
+
+    if (ogen) {
+        gen->sh = ogen->sh;
+        gen->shpool = ogen->shpool;
+
+        return NGX_OK;
+    }
+
+    gen->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        gen->sh = gen->shpool->data;
+
+        return NGX_OK;
+    }
+
+    gen->sh = ngx_slab_alloc(gen->shpool,
+                             sizeof(ngx_http_gzip_static_shctx_t));
+    if (gen->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    gen->shpool->data = gen->sh;
+
+    ngx_rbtree_init(&gen->sh->rbtree, &gen->sh->sentinel,
+                    ngx_http_gzip_static_rbtree_insert_value);
+
+    ngx_queue_init(&gen->sh->queue);
+    ngx_queue_init(&gen->sh->done);
+
+    len = sizeof(" in gzip_static_generator zone \"\"")
+          + shm_zone->shm.name.len;
+
+    gen->shpool->log_ctx = ngx_slab_alloc(gen->shpool, len);
+    if (gen->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(gen->shpool->log_ctx, " in gzip_static_generator zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    gen->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_gzip_static_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_static_main_conf_t  *gmcf;
+
+    gmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_static_main_conf_t));
+    if (gmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     gmcf->generator = NULL;
+     */
+
+    return gmcf;
+}
+
+
+static void *
+ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_static_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_gzip_static_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->enable = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_gzip_static_conf_t *prev = parent;
+    ngx_http_gzip_static_conf_t *conf = child;
+
+    ngx_http_gzip_static_main_conf_t  *gmcf;
+
+    ngx_conf_merge_uint_value(conf->enable, prev->enable,
+                              NGX_HTTP_GZIP_STATIC_OFF);
+
+    if (conf->enable == NGX_HTTP_GZIP_STATIC_GENERATE) {
+        gmcf = ngx_http_conf_get_module_main_conf(cf,
+                                                  ngx_http_gzip_static_module);
+
+        if (gmcf->generator == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"gzip_static always_generate\" requires "
+                               "\"gzip_static_generator\"");
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_static_generator(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_static_main_conf_t *gmcf = conf;
+
+    u_char                            *p;
+    off_t                              max_size;
+    ssize_t                            size;
+    ngx_int_t                          gzip_level, brotli_level;
+    ngx_str_t                         *value, name, s, temp;
+    ngx_uint_t                         i;
+    ngx_path_t                        *path;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_gzip_static_generator_t  *gen;
+
+    if (gmcf->generator) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    size = 0;
+    max_size = 1024 * 1024;
+    gzip_level = 6;
+    brotli_level = 6;
+    name.len = 0;
+    ngx_str_set(&temp, NGX_HTTP_GZIP_STATIC_TEMP_PATH);
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "temp_path=", 10) == 0) {
+
+            temp.len = value[i].len - 10;
+            temp.data = value[i].data + 10;
+
+            if (temp.len > 1 && temp.data[temp.len - 1] == '/') {
+                temp.len--;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_offset(&s);
+
+            if (max_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "gzip_level=", 11) == 0) {
+
+            gzip_level = ngx_atoi(value[i].data + 11, value[i].len - 11);
+
+            if (gzip_level < 1 || gzip_level > 9) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid gzip_level \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "brotli_level=", 13) == 0) {
+
+            brotli_level = ngx_atoi(value[i].data + 13, value[i].len - 13);
+
+            if (brotli_level < 0 || brotli_level > 11) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid brotli_level \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    gen = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_static_generator_t));
+    if (gen == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    gen->max_size = max_size;
+    gen->gzip_level = gzip_level;
+    gen->brotli_level = brotli_level;
+
+    /*
+     * the files are compressed by the cache manager process,
+     * it runs the manager of the temporary path
+     */
+
+    path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+    if (path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    path->name = temp;
+
+    if (ngx_conf_full_name(cf->cycle, &path->name, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    path->manager = ngx_http_gzip_static_manager;
+    path->data = gen;
+    path->conf_file = cf->conf_file->file.name.data;
+    path->line = cf->conf_file->line;
+
+    if (ngx_add_path(cf, &path) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    gen->temp_path = path;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_gzip_static_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_gzip_static_init_zone;
+    shm_zone->data = gen;
+
+    gmcf->generator = shm_zone;
 
     return NGX_CONF_OK;
 }
@@ -8,16 +8,58 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_http_limit_sync_module.h>
+
+
+/*
+ * the counts are reported to the peers when they change and every
+ * 10 seconds, the counts of a peer not reported for 30 seconds are forgotten
+ */
+
+#define NGX_HTTP_LIMIT_CONN_SYNC_REFRESH  10
+#define NGX_HTTP_LIMIT_CONN_SYNC_TIMEOUT  30
+
+#define NGX_HTTP_LIMIT_CONN_SYNC_FREE     32
 
 
 typedef struct {
     u_char              color;
     u_char              len;
     u_short             conn;
+    /* the sum of the connections of the peers */
+    u_short             remote;
+    /* conn is not yet reported to the peers */
+    u_char              changed;
     u_char              data[1];
 } ngx_http_limit_conn_node_t;
 
 
+/* the connections of a key reported by a peer */
+
+typedef struct {
+    u_char              color;
+    u_char              len;
+    u_short             conn;
+    uint32_t            peer;
+    /* the time of the report by the clock of the peer, in milliseconds */
+    uint64_t            time;
+    /* the time the report was received, in seconds */
+    time_t              updated;
+    u_char              data[1];
+} ngx_http_limit_conn_remote_t;
+
+
+typedef struct {
+    ngx_rbtree_t        rbtree;
+    ngx_rbtree_node_t   sentinel;
+    ngx_rbtree_t        remote;
+    ngx_rbtree_node_t   remote_sentinel;
+    /* the number of nodes with a change to report */
+    ngx_uint_t          pending;
+    time_t              refresh;
+} ngx_http_limit_conn_shctx_t;
+
+
 typedef struct {
     ngx_shm_zone_t     *shm_zone;
     ngx_rbtree_node_t  *node;
@@ -25,12 +67,22 @@ typedef struct {
 
 
 typedef struct {
-    ngx_rbtree_t       *rbtree;
-    ngx_int_t           index;
-    ngx_str_t           var;
+    ngx_http_limit_conn_shctx_t  *sh;
+    ngx_rbtree_t                 *rbtree;
+    ngx_int_t                     index;
+    ngx_str_t                     var;
+    ngx_uint_t                    sync;     /* unsigned  sync:1 */
 } ngx_http_limit_conn_ctx_t;
 
 
+typedef struct {
+    ngx_buf_t                    *buf;
+    time_t                        expire;
+    ngx_uint_t                    nfree;
+    ngx_rbtree_node_t            *free[NGX_HTTP_LIMIT_CONN_SYNC_FREE];
+} ngx_http_limit_conn_sync_t;
+
+
 typedef struct {
     ngx_shm_zone_t     *shm_zone;
     ngx_uint_t          conn;
@@ -48,6 +100,24 @@ static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_http_variable_value_t *vv, uint32_t hash);
 static void ngx_http_limit_conn_cleanup(void *data);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
+static ngx_int_t ngx_http_limit_conn_sync_collect(ngx_shm_zone_t *shm_zone,
+    ngx_buf_t *b);
+static ngx_int_t ngx_http_limit_conn_sync_walk(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel,
+    ngx_http_limit_conn_sync_t *ls);
+static void ngx_http_limit_conn_sync_refresh(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_http_limit_conn_sync_expire(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_slab_pool_t *shpool, time_t now);
+static void ngx_http_limit_conn_sync_stale(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, ngx_http_limit_conn_sync_t *ls);
+static void ngx_http_limit_conn_sync_merge(ngx_shm_zone_t *shm_zone,
+    u_char *data, size_t len, ngx_uint_t value, uint32_t peer, uint64_t time);
+static ngx_rbtree_node_t *ngx_http_limit_conn_remote_lookup(
+    ngx_rbtree_t *rbtree, u_char *data, size_t len, uint32_t hash,
+    uint32_t peer);
+static void ngx_http_limit_conn_remote_add(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_slab_pool_t *shpool, u_char *data, size_t len, ngx_int_t n);
 
 static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_conn_merge_conf(ngx_conf_t *cf, void *parent,
@@ -83,7 +153,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -152,6 +222,19 @@ ngx_module_t  ngx_http_limit_conn_module = {
 };
 
 
+static ngx_inline void
+ngx_http_limit_conn_sync_change(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_http_limit_conn_node_t *lc)
+{
+    if (!ctx->sync || lc->changed) {
+        return;
+    }
+
+    lc->changed = 1;
+    ctx->sh->pending++;
+}
+
+
 static ngx_int_t
 ngx_http_limit_conn_handler(ngx_http_request_t *r)
 {
@@ -227,15 +310,19 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             node->key = hash;
             lc->len = (u_char) len;
             lc->conn = 1;
+            lc->remote = 0;
+            lc->changed = 0;
             ngx_memcpy(lc->data, vv->data, len);
 
             ngx_rbtree_insert(ctx->rbtree, node);
 
+            ngx_http_limit_conn_sync_change(ctx, lc);
+
         } else {
 
             lc = (ngx_http_limit_conn_node_t *) &node->color;
 
-            if ((ngx_uint_t) lc->conn >= limits[i].conn) {
+            if ((ngx_uint_t) lc->conn + lc->remote >= limits[i].conn) {
 
                 ngx_shmtx_unlock(&shpool->mutex);
 
@@ -248,6 +335,8 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             }
 
             lc->conn++;
+
+            ngx_http_limit_conn_sync_change(ctx, lc);
         }
 
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -375,7 +464,11 @@ ngx_http_limit_conn_cleanup(void *data)
 
     lc->conn--;
 
-    if (lc->conn == 0) {
+    ngx_http_limit_conn_sync_change(ctx, lc);
+
+    /* a node with a change to report is freed when it is reported */
+
+    if (lc->conn == 0 && lc->remote == 0 && !lc->changed) {
         ngx_rbtree_delete(ctx->rbtree, node);
         ngx_slab_free_locked(shpool, node);
     }
@@ -400,6 +493,414 @@ ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool)
 }
 
 
+static ngx_int_t
+ngx_http_limit_conn_sync_collect(ngx_shm_zone_t *shm_zone, ngx_buf_t *b)
+{
+    time_t                       now;
+    ngx_int_t                    rc;
+    ngx_uint_t                   i;
+    ngx_slab_pool_t             *shpool;
+    ngx_http_limit_conn_ctx_t   *ctx;
+    ngx_http_limit_conn_sync_t   ls;
+
+    ctx = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    now = ngx_time();
+
+    if (ctx->sh->pending == 0 && now < ctx->sh->refresh) {
+        return NGX_OK;
+    }
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    /*
+     * all counts are reported from time to time, so the peers recover
+     * from a lost datagram and do not forget the counts
+     */
+
+    if (now >= ctx->sh->refresh) {
+        ctx->sh->refresh = now + NGX_HTTP_LIMIT_CONN_SYNC_REFRESH;
+
+        ngx_http_limit_conn_sync_refresh(ctx, ctx->rbtree->root,
+                                         ctx->rbtree->sentinel);
+
+        ngx_http_limit_conn_sync_expire(ctx, shpool, now);
+    }
+
+    ls.buf = b;
+    ls.nfree = 0;
+
+    rc = ngx_http_limit_conn_sync_walk(ctx, ctx->rbtree->root,
+                                       ctx->rbtree->sentinel, &ls);
+
+    for (i = 0; i < ls.nfree; i++) {
+        ngx_rbtree_delete(ctx->rbtree, ls.free[i]);
+        ngx_slab_free_locked(shpool, ls.free[i]);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_limit_conn_sync_walk(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel,
+    ngx_http_limit_conn_sync_t *ls)
+{
+    ngx_buf_t                   *b;
+    ngx_http_limit_conn_node_t  *lc;
+
+    if (node == sentinel || ctx->sh->pending == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_limit_conn_sync_walk(ctx, node->left, sentinel, ls)
+        != NGX_OK)
+    {
+        return NGX_AGAIN;
+    }
+
+    lc = (ngx_http_limit_conn_node_t *) &node->color;
+
+    if (lc->changed) {
+        b = ls->buf;
+
+        if (ls->nfree == NGX_HTTP_LIMIT_CONN_SYNC_FREE
+            || (size_t) (b->end - b->last)
+               < NGX_HTTP_LIMIT_SYNC_RECORD_LEN(lc->len))
+        {
+            return NGX_AGAIN;
+        }
+
+        b->last = ngx_http_limit_sync_write(b->last, lc->data, lc->len,
+                                            lc->conn);
+
+        lc->changed = 0;
+        ctx->sh->pending--;
+
+        if (lc->conn == 0 && lc->remote == 0) {
+            ls->free[ls->nfree++] = node;
+        }
+    }
+
+    return ngx_http_limit_conn_sync_walk(ctx, node->right, sentinel, ls);
+}
+
+
+static void
+ngx_http_limit_conn_sync_refresh(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_http_limit_conn_node_t  *lc;
+
+    if (node == sentinel) {
+        return;
+    }
+
+    ngx_http_limit_conn_sync_refresh(ctx, node->left, sentinel);
+
+    lc = (ngx_http_limit_conn_node_t *) &node->color;
+
+    if (lc->conn) {
+        ngx_http_limit_conn_sync_change(ctx, lc);
+    }
+
+    ngx_http_limit_conn_sync_refresh(ctx, node->right, sentinel);
+}
+
+
+static void
+ngx_http_limit_conn_sync_expire(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_slab_pool_t *shpool, time_t now)
+{
+    ngx_uint_t                     i;
+    ngx_http_limit_conn_sync_t     ls;
+    ngx_http_limit_conn_remote_t  *lr;
+
+    ls.expire = now - NGX_HTTP_LIMIT_CONN_SYNC_TIMEOUT;
+
+    do {
+        ls.nfree = 0;
+
+        ngx_http_limit_conn_sync_stale(ctx->sh->remote.root,
+                                       ctx->sh->remote.sentinel, &ls);
+
+        for (i = 0; i < ls.nfree; i++) {
+            lr = (ngx_http_limit_conn_remote_t *) &ls.free[i]->color;
+
+            ngx_http_limit_conn_remote_add(ctx, shpool, lr->data, lr->len,
+                                           -(ngx_int_t) lr->conn);
+
+            ngx_rbtree_delete(&ctx->sh->remote, ls.free[i]);
+            ngx_slab_free_locked(shpool, ls.free[i]);
+        }
+
+    } while (ls.nfree == NGX_HTTP_LIMIT_CONN_SYNC_FREE);
+}
+
+
+static void
+ngx_http_limit_conn_sync_stale(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, ngx_http_limit_conn_sync_t *ls)
+{
+    ngx_http_limit_conn_remote_t  *lr;
+
+    if (node == sentinel || ls->nfree == NGX_HTTP_LIMIT_CONN_SYNC_FREE) {
+        return;
+    }
+
+    ngx_http_limit_conn_sync_stale(node->left, sentinel, ls);
+
+    lr = (ngx_http_limit_conn_remote_t *) &node->color;
+
+    if (lr->updated < ls->expire
+        && ls->nfree < NGX_HTTP_LIMIT_CONN_SYNC_FREE)
+    {
+        ls->free[ls->nfree++] = node;
+    }
+
+    ngx_http_limit_conn_sync_stale(node->right, sentinel, ls);
+}
+
+
+static void
+ngx_http_limit_conn_sync_merge(ngx_shm_zone_t *shm_zone, u_char *data,
+    size_t len, ngx_uint_t value, uint32_t peer, uint64_t time)
+{
+    size_t                          n;
+    uint32_t                        hash;
+    ngx_int_t                       prev;
+    ngx_slab_pool_t                *shpool;
+    ngx_rbtree_node_t              *node;
+    ngx_http_limit_conn_ctx_t      *ctx;
+    ngx_http_limit_conn_remote_t   *lr;
+
+    ctx = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    hash = ngx_crc32_short(data, len) ^ peer;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    node = ngx_http_limit_conn_remote_lookup(&ctx->sh->remote, data, len,
+                                             hash, peer);
+
+    if (node) {
+        lr = (ngx_http_limit_conn_remote_t *) &node->color;
+
+        /* a report older than the one already applied */
+
+        if (time < lr->time) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+
+        prev = lr->conn;
+
+    } else {
+
+        if (value == 0) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+
+        n = offsetof(ngx_rbtree_node_t, color)
+            + offsetof(ngx_http_limit_conn_remote_t, data)
+            + len;
+
+        node = ngx_slab_alloc_locked(shpool, n);
+
+        if (node == NULL) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+
+        lr = (ngx_http_limit_conn_remote_t *) &node->color;
+
+        node->key = hash;
+        lr->len = (u_char) len;
+        lr->peer = peer;
+        ngx_memcpy(lr->data, data, len);
+
+        ngx_rbtree_insert(&ctx->sh->remote, node);
+
+        prev = 0;
+    }
+
+    lr->conn = (u_short) value;
+    lr->time = time;
+    lr->updated = ngx_time();
+
+    ngx_http_limit_conn_remote_add(ctx, shpool, data, len,
+                                   (ngx_int_t) value - prev);
+
+    if (value == 0) {
+        ngx_rbtree_delete(&ctx->sh->remote, node);
+        ngx_slab_free_locked(shpool, node);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static void
+ngx_http_limit_conn_remote_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t             **p;
+    ngx_http_limit_conn_remote_t   *lrn, *lrnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            lrn = (ngx_http_limit_conn_remote_t *) &node->color;
+            lrnt = (ngx_http_limit_conn_remote_t *) &temp->color;
+
+            if (lrn->peer != lrnt->peer) {
+                p = (lrn->peer < lrnt->peer) ? &temp->left : &temp->right;
+
+            } else {
+                p = (ngx_memn2cmp(lrn->data, lrnt->data, lrn->len, lrnt->len)
+                     < 0)
+                    ? &temp->left : &temp->right;
+            }
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_limit_conn_remote_lookup(ngx_rbtree_t *rbtree, u_char *data,
+    size_t len, uint32_t hash, uint32_t peer)
+{
+    ngx_int_t                      rc;
+    ngx_rbtree_node_t             *node, *sentinel;
+    ngx_http_limit_conn_remote_t  *lr;
+
+    node = rbtree->root;
+    sentinel = rbtree->sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        lr = (ngx_http_limit_conn_remote_t *) &node->color;
+
+        if (peer != lr->peer) {
+            node = (peer < lr->peer) ? node->left : node->right;
+            continue;
+        }
+
+        rc = ngx_memn2cmp(data, lr->data, len, (size_t) lr->len);
+        if (rc == 0) {
+            return node;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_limit_conn_remote_add(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_slab_pool_t *shpool, u_char *data, size_t len, ngx_int_t n)
+{
+    size_t                       size;
+    uint32_t                     hash;
+    ngx_int_t                    remote;
+    ngx_rbtree_node_t           *node;
+    ngx_http_limit_conn_node_t  *lc;
+    ngx_http_variable_value_t    vv;
+
+    if (n == 0) {
+        return;
+    }
+
+    vv.len = len;
+    vv.data = data;
+
+    hash = ngx_crc32_short(data, len);
+
+    node = ngx_http_limit_conn_lookup(ctx->rbtree, &vv, hash);
+
+    if (node == NULL) {
+
+        if (n < 0) {
+            return;
+        }
+
+        size = offsetof(ngx_rbtree_node_t, color)
+               + offsetof(ngx_http_limit_conn_node_t, data)
+               + len;
+
+        node = ngx_slab_alloc_locked(shpool, size);
+
+        if (node == NULL) {
+            return;
+        }
+
+        lc = (ngx_http_limit_conn_node_t *) &node->color;
+
+        node->key = hash;
+        lc->len = (u_char) len;
+        lc->conn = 0;
+        lc->remote = 0;
+        lc->changed = 0;
+        ngx_memcpy(lc->data, data, len);
+
+        ngx_rbtree_insert(ctx->rbtree, node);
+
+    } else {
+        lc = (ngx_http_limit_conn_node_t *) &node->color;
+    }
+
+    remote = lc->remote + n;
+
+    lc->remote = (u_short) ngx_max(ngx_min(remote, 65535), 0);
+
+    if (lc->conn == 0 && lc->remote == 0 && !lc->changed) {
+        ngx_rbtree_delete(ctx->rbtree, node);
+        ngx_slab_free_locked(shpool, node);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -407,7 +908,6 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     size_t                      len;
     ngx_slab_pool_t            *shpool;
-    ngx_rbtree_node_t          *sentinel;
     ngx_http_limit_conn_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -421,6 +921,7 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        ctx->sh = octx->sh;
         ctx->rbtree = octx->rbtree;
 
         return NGX_OK;
@@ -429,26 +930,30 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->rbtree = shpool->data;
+        ctx->sh = shpool->data;
+        ctx->rbtree = &ctx->sh->rbtree;
 
         return NGX_OK;
     }
 
-    ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
-    if (ctx->rbtree == NULL) {
+    ctx->sh = ngx_slab_alloc(shpool, sizeof(ngx_http_limit_conn_shctx_t));
+    if (ctx->sh == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = ctx->rbtree;
+    shpool->data = ctx->sh;
 
-    sentinel = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_node_t));
-    if (sentinel == NULL) {
-        return NGX_ERROR;
-    }
+    ctx->rbtree = &ctx->sh->rbtree;
 
-    ngx_rbtree_init(ctx->rbtree, sentinel,
+    ngx_rbtree_init(ctx->rbtree, &ctx->sh->sentinel,
                     ngx_http_limit_conn_rbtree_insert_value);
 
+    ngx_rbtree_init(&ctx->sh->remote, &ctx->sh->remote_sentinel,
+                    ngx_http_limit_conn_remote_insert_value);
+
+    ctx->sh->pending = 0;
+    ctx->sh->refresh = 0;
+
     len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
 
     shpool->log_ctx = ngx_slab_alloc(shpool, len);
@@ -510,7 +1015,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                     *p;
     ssize_t                     size;
     ngx_str_t                  *value, name, s;
-    ngx_uint_t                  i;
+    ngx_uint_t                  i, sync;
     ngx_shm_zone_t             *shm_zone;
     ngx_http_limit_conn_ctx_t  *ctx;
 
@@ -518,6 +1023,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx = NULL;
     size = 0;
+    sync = 0;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -556,6 +1062,11 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "sync") == 0) {
+            sync = 1;
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -613,6 +1124,18 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     shm_zone->init = ngx_http_limit_conn_init_zone;
     shm_zone->data = ctx;
 
+    if (sync) {
+        ctx->sync = 1;
+
+        if (ngx_http_limit_sync_add_zone(cf, shm_zone,
+                                         ngx_http_limit_conn_sync_collect,
+                                         ngx_http_limit_conn_sync_merge)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -8,11 +8,30 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_http_limit_sync_module.h>
+
+
+#define NGX_HTTP_LIMIT_REQ_MAX_SHARDS  16
+#define NGX_HTTP_LIMIT_REQ_MIN_SHARD   (256 * 1024)
+
+#define NGX_HTTP_LIMIT_REQ_LOCAL_SIZE  64
+#define NGX_HTTP_LIMIT_REQ_LOCAL_KEY   64
+
+#define NGX_HTTP_LIMIT_REQ_LEAKY       0
+#define NGX_HTTP_LIMIT_REQ_GCRA        1
+#define NGX_HTTP_LIMIT_REQ_WINDOW      2
+
+#define NGX_HTTP_LIMIT_REQ_PASSED            1
+#define NGX_HTTP_LIMIT_REQ_DELAYED           2
+#define NGX_HTTP_LIMIT_REQ_REJECTED          3
+#define NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN   4
+#define NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN  5
 
 
 typedef struct {
     u_char                       color;
-    u_char                       dummy;
+    /* the requests not yet reported to the peers */
+    u_char                       sync;
     u_short                      len;
     ngx_queue_t                  queue;
     ngx_msec_t                   last;
@@ -23,13 +42,61 @@ typedef struct {
 } ngx_http_limit_req_node_t;
 
 
+/*
+ * the compact node of the GCRA and sliding window algorithms,
+ * the time is the lower 32 bits of milliseconds and is only compared
+ * by signed differences, see ngx_http_limit_req_tat()
+ */
+
+typedef struct {
+    u_char                       color;
+    u_char                       sync;
+    u_short                      len;
+    /* GCRA: theoretical arrival time, window: start of the current window */
+    uint32_t                     time;
+    ngx_queue_t                  queue;
+    /*
+     * window: the requests in the previous and in the current windows,
+     * GCRA: the microseconds part of the theoretical arrival time
+     */
+    u_short                      prev;
+    u_short                      count;
+    /* the requests between the lookup and the account stages */
+    u_short                      ref;
+    u_char                       data[1];
+} ngx_http_limit_req_cnode_t;
+
+
 typedef struct {
+    ngx_slab_pool_t              *shpool;
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
+    /* the number of nodes with requests to report to the peers */
+    ngx_uint_t                    pending;
+} ngx_http_limit_req_shard_t;
+
+
+typedef struct {
+    /* the requests which would have been delayed or rejected if not dry run */
+    ngx_atomic_t                  dry_run_delayed;
+    ngx_atomic_t                  dry_run_rejected;
+    ngx_uint_t                    nshards;
+    ngx_http_limit_req_shard_t    shards[1];
 } ngx_http_limit_req_shctx_t;
 
 
+/* the tokens taken in advance by a worker process for a key */
+
+typedef struct {
+    uint32_t                     hash;
+    u_short                      len;
+    u_short                      tokens;
+    ngx_msec_t                   expire;
+    u_char                       data[NGX_HTTP_LIMIT_REQ_LOCAL_KEY];
+} ngx_http_limit_req_local_t;
+
+
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
     ngx_slab_pool_t             *shpool;
@@ -37,7 +104,28 @@ typedef struct {
     ngx_uint_t                   rate;
     ngx_int_t                    index;
     ngx_str_t                    var;
+    ngx_uint_t                   algorithm;
+    /* window length in milliseconds */
+    ngx_msec_t                   window;
+    /* window: the requests per window, 1 corresponds to 0.001 request */
+    ngx_uint_t                   window_limit;
+    /* GCRA: the emission interval in microseconds */
+    uint64_t                     interval;
+    /*
+     * GCRA: the farthest the theoretical arrival time may be ahead of now,
+     * in milliseconds; a node beyond it is older than the 32-bit time wrap
+     */
+    ngx_msec_int_t               horizon;
+    ngx_uint_t                   shards;
+    ngx_uint_t                   local;
+    ngx_uint_t                   sync;     /* unsigned  sync:1 */
+    ngx_http_limit_req_local_t  *cache;
+    /* returns the expired tokens of the cache */
+    ngx_event_t                  event;
+    ngx_http_limit_req_shard_t  *shard;
     ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_cnode_t  *cnode;
+    ngx_http_limit_req_local_t  *lc;
 } ngx_http_limit_req_ctx_t;
 
 
@@ -54,17 +142,45 @@ typedef struct {
     ngx_uint_t                   limit_log_level;
     ngx_uint_t                   delay_log_level;
     ngx_uint_t                   status_code;
+    ngx_flag_t                   dry_run;
 } ngx_http_limit_req_conf_t;
 
 
 static void ngx_http_limit_req_delay(ngx_http_request_t *r);
 static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account);
+static ngx_int_t ngx_http_limit_req_lookup_compact(
+    ngx_http_limit_req_limit_t *limit, ngx_http_limit_req_shard_t *shard,
     ngx_uint_t hash, u_char *data, size_t len, ngx_uint_t *ep,
     ngx_uint_t account);
+static ngx_int_t ngx_http_limit_req_compact_check(
+    ngx_http_limit_req_limit_t *limit, ngx_http_limit_req_cnode_t *cn,
+    uint32_t now, ngx_uint_t *ep);
+static ngx_uint_t ngx_http_limit_req_compact_update(
+    ngx_http_limit_req_limit_t *limit, ngx_http_limit_req_shard_t *shard,
+    ngx_http_limit_req_cnode_t *cn, uint32_t now);
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n);
+static ngx_uint_t ngx_http_limit_req_local(ngx_http_limit_req_ctx_t *ctx,
+    ngx_uint_t hash, u_char *data, size_t len);
+static ngx_uint_t ngx_http_limit_req_reserve(
+    ngx_http_limit_req_limit_t *limit, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t avail);
+static void ngx_http_limit_req_release(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_local_t *lc);
+static void ngx_http_limit_req_local_expire(ngx_event_t *ev);
+static void ngx_http_limit_req_exit_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_limit_req_sync_collect(ngx_shm_zone_t *shm_zone,
+    ngx_buf_t *b);
+static void ngx_http_limit_req_sync_merge(ngx_shm_zone_t *shm_zone,
+    u_char *data, size_t len, ngx_uint_t delta, uint32_t peer, uint64_t time);
+static ngx_int_t ngx_http_limit_req_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_limit_req_dry_run_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
@@ -73,6 +189,7 @@ static char *ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_limit_req_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_limit_req_init(ngx_conf_t *cf);
 
 
@@ -93,7 +210,8 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4|NGX_CONF_TAKE5
+                        |NGX_CONF_TAKE6|NGX_CONF_TAKE7,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -120,12 +238,19 @@ static ngx_command_t  ngx_http_limit_req_commands[] = {
       offsetof(ngx_http_limit_req_conf_t, status_code),
       &ngx_http_limit_req_status_bounds },
 
+    { ngx_string("limit_req_dry_run"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_limit_req_conf_t, dry_run),
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_limit_req_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_limit_req_add_variables,      /* preconfiguration */
     ngx_http_limit_req_init,               /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -149,12 +274,56 @@ ngx_module_t  ngx_http_limit_req_module = {
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_http_limit_req_exit_process,       /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 
+static ngx_http_variable_t  ngx_http_limit_req_vars[] = {
+
+    { ngx_string("limit_req_status"), NULL,
+      ngx_http_limit_req_status_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("limit_req_dry_run_delayed"), NULL,
+      ngx_http_limit_req_dry_run_variable,
+      offsetof(ngx_http_limit_req_shctx_t, dry_run_delayed),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("limit_req_dry_run_rejected"), NULL,
+      ngx_http_limit_req_dry_run_variable,
+      offsetof(ngx_http_limit_req_shctx_t, dry_run_rejected),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_str_t  ngx_http_limit_req_status[] = {
+    ngx_string("PASSED"),
+    ngx_string("DELAYED"),
+    ngx_string("REJECTED"),
+    ngx_string("DELAYED_DRY_RUN"),
+    ngx_string("REJECTED_DRY_RUN")
+};
+
+
+static ngx_inline void
+ngx_http_limit_req_sync_add(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, u_char *sync, ngx_uint_t n)
+{
+    if (!ctx->sync) {
+        return;
+    }
+
+    if (*sync == 0) {
+        shard->pending++;
+    }
+
+    *sync = (u_char) ngx_min(*sync + n, 255);
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_handler(ngx_http_request_t *r)
 {
@@ -166,6 +335,7 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     ngx_http_variable_value_t   *vv;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_shard_t  *shard;
     ngx_http_limit_req_limit_t  *limit, *limits;
 
     if (r->main->limit_req_set) {
@@ -188,6 +358,7 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
         limit = &limits[n];
 
         ctx = limit->shm_zone->data;
+        ctx->lc = NULL;
 
         vv = ngx_http_get_indexed_variable(r, ctx->index);
 
@@ -211,12 +382,30 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        if (ctx->cache && limit->nodelay
+            && ngx_http_limit_req_local(ctx, hash, vv->data, len))
+        {
+            rc = (n == lrcf->limits.nelts - 1) ? NGX_OK : NGX_AGAIN;
+            excess = 0;
+
+        } else {
+            shard = &ctx->sh->shards[hash % ctx->sh->nshards];
+
+            ngx_shmtx_lock(&shard->shpool->mutex);
 
-        rc = ngx_http_limit_req_lookup(limit, hash, vv->data, len, &excess,
-                                       (n == lrcf->limits.nelts - 1));
+            if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+                rc = ngx_http_limit_req_lookup(limit, shard, hash, vv->data,
+                                               len, &excess,
+                                               (n == lrcf->limits.nelts - 1));
+
+            } else {
+                rc = ngx_http_limit_req_lookup_compact(limit, shard, hash,
+                                               vv->data, len, &excess,
+                                               (n == lrcf->limits.nelts - 1));
+            }
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+        }
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -237,7 +426,9 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         if (rc == NGX_BUSY) {
             ngx_log_error(lrcf->limit_log_level, r->connection->log, 0,
-                          "limiting requests, excess: %ui.%03ui by zone \"%V\"",
+                          "limiting requests%s, excess: %ui.%03ui "
+                          "by zone \"%V\"",
+                          lrcf->dry_run ? ", dry run" : "",
                           excess / 1000, excess % 1000,
                           &limit->shm_zone->shm.name);
         }
@@ -245,19 +436,43 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
         while (n--) {
             ctx = limits[n].shm_zone->data;
 
-            if (ctx->node == NULL) {
+            if (ctx->lc) {
+                /* the local token is not spent */
+                ctx->lc->tokens++;
+                ctx->lc = NULL;
+                continue;
+            }
+
+            if (ctx->node == NULL && ctx->cnode == NULL) {
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
-            ctx->node->count--;
+            if (ctx->node) {
+                ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            } else {
+                /* the compact state is only changed by the account stage */
+                ctx->cnode->ref--;
+            }
+
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
             ctx->node = NULL;
+            ctx->cnode = NULL;
+        }
+
+        if (lrcf->dry_run) {
+            ctx = limit->shm_zone->data;
+            (void) ngx_atomic_fetch_add(&ctx->sh->dry_run_rejected, 1);
+
+            r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN;
+            return NGX_DECLINED;
         }
 
+        r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_REJECTED;
+
         return lrcf->status_code;
     }
 
@@ -270,13 +485,25 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     delay = ngx_http_limit_req_account(limits, n, &excess, &limit);
 
     if (!delay) {
+        r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_PASSED;
         return NGX_DECLINED;
     }
 
     ngx_log_error(lrcf->delay_log_level, r->connection->log, 0,
-                  "delaying request, excess: %ui.%03ui, by zone \"%V\"",
+                  "delaying request%s, excess: %ui.%03ui, by zone \"%V\"",
+                  lrcf->dry_run ? ", dry run" : "",
                   excess / 1000, excess % 1000, &limit->shm_zone->shm.name);
 
+    if (lrcf->dry_run) {
+        ctx = limit->shm_zone->data;
+        (void) ngx_atomic_fetch_add(&ctx->sh->dry_run_delayed, 1);
+
+        r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN;
+        return NGX_DECLINED;
+    }
+
+    r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_DELAYED;
+
     if (ngx_handle_read_event(r->connection->read, 0) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
@@ -363,12 +590,55 @@ ngx_http_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
 }
 
 
+static void
+ngx_http_limit_req_rbtree_insert_cvalue(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_http_limit_req_cnode_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_limit_req_cnode_t *) &node->color;
+            cnt = (ngx_http_limit_req_cnode_t *) &temp->color;
+
+            p = (ngx_memn2cmp(cn->data, cnt->data, cn->len, cnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
 static ngx_int_t
-ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
-    u_char *data, size_t len, ngx_uint_t *ep, ngx_uint_t account)
+ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account)
 {
     size_t                      size;
     ngx_int_t                   rc, excess;
+    ngx_uint_t                  tokens;
     ngx_time_t                 *tp;
     ngx_msec_t                  now;
     ngx_msec_int_t              ms;
@@ -381,8 +651,8 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ctx = limit->shm_zone->data;
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -404,7 +674,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&shard->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -421,13 +691,19 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
             }
 
             if (account) {
-                lr->excess = excess;
+                tokens = ngx_http_limit_req_reserve(limit, hash, data, len,
+                                               (limit->burst - excess) / 1000);
+
+                ngx_http_limit_req_sync_add(ctx, shard, &lr->sync, 1 + tokens);
+
+                lr->excess = excess + tokens * 1000;
                 lr->last = now;
                 return NGX_OK;
             }
 
             lr->count++;
 
+            ctx->shard = shard;
             ctx->node = lr;
 
             return NGX_AGAIN;
@@ -442,17 +718,17 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
            + offsetof(ngx_http_limit_req_node_t, data)
            + len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, shard, 1);
 
-    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    node = ngx_slab_alloc_locked(shard->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, shard, 0);
 
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        node = ngx_slab_alloc_locked(shard->shpool, size);
         if (node == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", ctx->shpool->log_ctx);
+                          "could not allocate node%s", shard->shpool->log_ctx);
             return NGX_ERROR;
         }
     }
@@ -463,14 +739,22 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     lr->len = (u_char) len;
     lr->excess = 0;
+    lr->sync = 0;
 
     ngx_memcpy(lr->data, data, len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&shard->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&shard->queue, &lr->queue);
 
     if (account) {
+        tokens = ngx_http_limit_req_reserve(limit, hash, data, len,
+                                            limit->burst / 1000);
+
+        ngx_http_limit_req_sync_add(ctx, shard, &lr->sync, 1 + tokens);
+
+        lr->excess = tokens * 1000;
+
         lr->last = now;
         lr->count = 0;
         return NGX_OK;
@@ -479,194 +763,1092 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     lr->last = 0;
     lr->count = 1;
 
+    ctx->shard = shard;
     ctx->node = lr;
 
     return NGX_AGAIN;
 }
 
 
-static ngx_msec_t
-ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
-    ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit)
+static ngx_int_t
+ngx_http_limit_req_lookup_compact(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account)
 {
-    ngx_int_t                   excess;
-    ngx_time_t                 *tp;
-    ngx_msec_t                  now, delay, max_delay;
-    ngx_msec_int_t              ms;
-    ngx_http_limit_req_ctx_t   *ctx;
-    ngx_http_limit_req_node_t  *lr;
+    size_t                       size;
+    uint32_t                     now;
+    ngx_int_t                    rc;
+    ngx_time_t                  *tp;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_cnode_t  *cn;
 
-    excess = *ep;
+    tp = ngx_timeofday();
+    now = (uint32_t) (tp->sec * 1000 + tp->msec);
 
-    if (excess == 0 || (*limit)->nodelay) {
-        max_delay = 0;
+    ctx = limit->shm_zone->data;
 
-    } else {
-        ctx = (*limit)->shm_zone->data;
-        max_delay = excess * 1000 / ctx->rate;
-    }
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
 
-    while (n--) {
-        ctx = limits[n].shm_zone->data;
-        lr = ctx->node;
+    cn = NULL;
 
-        if (lr == NULL) {
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
-
-        tp = ngx_timeofday();
-
-        now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
-        ms = (ngx_msec_int_t) (now - lr->last);
-
-        excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
-
-        if (excess < 0) {
-            excess = 0;
+        if (hash > node->key) {
+            node = node->right;
+            continue;
         }
 
-        lr->last = now;
-        lr->excess = excess;
-        lr->count--;
+        /* hash == node->key */
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        cn = (ngx_http_limit_req_cnode_t *) &node->color;
 
-        ctx->node = NULL;
+        rc = ngx_memn2cmp(data, cn->data, len, (size_t) cn->len);
 
-        if (limits[n].nodelay) {
-            continue;
+        if (rc == 0) {
+            ngx_queue_remove(&cn->queue);
+            ngx_queue_insert_head(&shard->queue, &cn->queue);
+            break;
         }
 
-        delay = excess * 1000 / ctx->rate;
+        cn = NULL;
 
-        if (delay > max_delay) {
-            max_delay = delay;
-            *ep = excess;
-            *limit = &limits[n];
-        }
+        node = (rc < 0) ? node->left : node->right;
     }
 
-    return max_delay;
-}
+    if (cn == NULL) {
+        size = offsetof(ngx_rbtree_node_t, color)
+               + offsetof(ngx_http_limit_req_cnode_t, data)
+               + len;
 
+        ngx_http_limit_req_expire(ctx, shard, 1);
 
-static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
-{
-    ngx_int_t                   excess;
-    ngx_time_t                 *tp;
-    ngx_msec_t                  now;
-    ngx_queue_t                *q;
-    ngx_msec_int_t              ms;
-    ngx_rbtree_node_t          *node;
-    ngx_http_limit_req_node_t  *lr;
+        node = ngx_slab_alloc_locked(shard->shpool, size);
 
-    tp = ngx_timeofday();
+        if (node == NULL) {
+            ngx_http_limit_req_expire(ctx, shard, 0);
+
+            node = ngx_slab_alloc_locked(shard->shpool, size);
+            if (node == NULL) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                              "could not allocate node%s",
+                              shard->shpool->log_ctx);
+                return NGX_ERROR;
+            }
+        }
 
-    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+        node->key = hash;
 
-    /*
-     * n == 1 deletes one or two zero rate entries
-     * n == 0 deletes oldest entry by force
-     *        and one or two zero rate entries
-     */
+        cn = (ngx_http_limit_req_cnode_t *) &node->color;
 
-    while (n < 3) {
+        cn->len = (u_short) len;
+        cn->sync = 0;
+        cn->time = now;
+        cn->prev = 0;
+        cn->count = 0;
+        cn->ref = 0;
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
-            return;
-        }
+        ngx_memcpy(cn->data, data, len);
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        ngx_rbtree_insert(&shard->rbtree, node);
 
-        lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+        ngx_queue_insert_head(&shard->queue, &cn->queue);
+    }
 
-        if (lr->count) {
+    if (ngx_http_limit_req_compact_check(limit, cn, now, ep) == NGX_BUSY) {
+        return NGX_BUSY;
+    }
 
-            /*
-             * There is not much sense in looking further,
-             * because we bump nodes on the lookup stage.
-             */
+    if (account) {
+        (void) ngx_http_limit_req_compact_update(limit, shard, cn, now);
+        return NGX_OK;
+    }
 
-            return;
-        }
+    /*
+     * the state is changed by ngx_http_limit_req_account() only after
+     * the other limits have passed, until then the node is kept
+     */
 
-        if (n++ != 0) {
+    cn->ref++;
 
-            ms = (ngx_msec_int_t) (now - lr->last);
-            ms = ngx_abs(ms);
+    ctx->shard = shard;
+    ctx->cnode = cn;
 
-            if (ms < 60000) {
-                return;
-            }
+    return NGX_AGAIN;
+}
 
-            excess = lr->excess - ctx->rate * ms / 1000;
 
-            if (excess > 0) {
-                return;
-            }
-        }
+static ngx_inline uint64_t
+ngx_http_limit_req_tat(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_cnode_t *cn, uint32_t now)
+{
+    int32_t  ahead;
 
-        ngx_queue_remove(q);
+    /* the theoretical arrival time relative to now, in microseconds */
 
-        node = (ngx_rbtree_node_t *)
-                   ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+    ahead = (int32_t) (cn->time - now);
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+    if (ahead < 0 || ahead > ctx->horizon) {
 
-        ngx_slab_free_locked(ctx->shpool, node);
+        /* in the past, or left from before the time wrapped around */
+
+        return 0;
     }
+
+    return (uint64_t) ahead * 1000 + cn->count;
 }
 
 
 static ngx_int_t
-ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+ngx_http_limit_req_compact_check(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_cnode_t *cn, uint32_t now, ngx_uint_t *ep)
 {
-    ngx_http_limit_req_ctx_t  *octx = data;
-
-    size_t                     len;
+    uint32_t                   start;
+    uint64_t                   tat, estimate, limit_count;
+    ngx_uint_t                 prev, count;
     ngx_http_limit_req_ctx_t  *ctx;
 
-    ctx = shm_zone->data;
+    ctx = limit->shm_zone->data;
 
-    if (octx) {
-        if (ngx_strcmp(ctx->var.data, octx->var.data) != 0) {
-            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
-                          "limit_req \"%V\" uses the \"%V\" variable "
-                          "while previously it used the \"%V\" variable",
-                          &shm_zone->shm.name, &ctx->var, &octx->var);
-            return NGX_ERROR;
-        }
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_GCRA) {
 
-        ctx->sh = octx->sh;
-        ctx->shpool = octx->shpool;
+        tat = ngx_http_limit_req_tat(ctx, cn, now);
+
+        *ep = (ngx_uint_t) (tat * ctx->rate / 1000000);
+
+        if (tat > (uint64_t) limit->burst * ctx->interval / 1000) {
+            return NGX_BUSY;
+        }
 
         return NGX_OK;
     }
 
-    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    /* NGX_HTTP_LIMIT_REQ_WINDOW */
 
-    if (shm_zone->shm.exists) {
-        ctx->sh = ctx->shpool->data;
+    start = now - now % (uint32_t) ctx->window;
 
-        return NGX_OK;
-    }
+    if (cn->time == start) {
+        prev = cn->prev;
+        count = cn->count;
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
-    if (ctx->sh == NULL) {
-        return NGX_ERROR;
+    } else {
+        prev = (start - cn->time == ctx->window) ? cn->count : 0;
+        count = 0;
     }
 
-    ctx->shpool->data = ctx->sh;
+    /* the counts are scaled by 1000 like the rate and the burst */
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
-                    ngx_http_limit_req_rbtree_insert_value);
+    estimate = (uint64_t) prev * (ctx->window - (now - start)) * 1000
+               / ctx->window
+               + (uint64_t) count * 1000;
 
-    ngx_queue_init(&ctx->sh->queue);
+    limit_count = ctx->window_limit + limit->burst;
 
-    len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
+    if (estimate + 1000 > limit_count) {
+        *ep = (ngx_uint_t) (estimate + 1000 - limit_count);
+        return NGX_BUSY;
+    }
+
+    *ep = 0;
+
+    return NGX_OK;
+}
+
+
+/* accounts a request, returns the GCRA excess for the delay */
+
+static ngx_uint_t
+ngx_http_limit_req_compact_update(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_http_limit_req_cnode_t *cn,
+    uint32_t now)
+{
+    uint32_t                   start;
+    uint64_t                   tat, burst, estimate, limit_count;
+    ngx_uint_t                 excess, tokens;
+    ngx_rbtree_node_t         *node;
+    ngx_http_limit_req_ctx_t  *ctx;
+
+    ctx = limit->shm_zone->data;
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+    tokens = 0;
+
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_GCRA) {
+
+        tat = ngx_http_limit_req_tat(ctx, cn, now);
+
+        excess = (ngx_uint_t) (tat * ctx->rate / 1000000);
+
+        tat += ctx->interval;
+
+        /* the local tokens are the requests which would still pass */
+
+        burst = (uint64_t) limit->burst * ctx->interval / 1000;
+
+        if (tat <= burst) {
+            tokens = ngx_http_limit_req_reserve(limit, node->key, cn->data,
+                                  cn->len,
+                                  (ngx_uint_t) ((burst - tat) / ctx->interval)
+                                  + 1);
+            tat += tokens * ctx->interval;
+        }
+
+        cn->time = now + (uint32_t) (tat / 1000);
+        cn->count = (u_short) (tat % 1000);
+
+        ngx_http_limit_req_sync_add(ctx, shard, &cn->sync, 1 + tokens);
+
+        return excess;
+    }
+
+    /* NGX_HTTP_LIMIT_REQ_WINDOW, the sliding window never delays requests */
+
+    start = now - now % (uint32_t) ctx->window;
+
+    if (cn->time != start) {
+        cn->prev = (start - cn->time == ctx->window) ? cn->count : 0;
+        cn->count = 0;
+        cn->time = start;
+    }
+
+    if (cn->count != 0xffff) {
+        cn->count++;
+    }
+
+    estimate = (uint64_t) cn->prev * (ctx->window - (now - start)) * 1000
+               / ctx->window
+               + (uint64_t) cn->count * 1000;
+
+    limit_count = ctx->window_limit + limit->burst;
+
+    if (estimate <= limit_count) {
+        tokens = ngx_http_limit_req_reserve(limit, node->key, cn->data,
+                                            cn->len,
+                                            (ngx_uint_t) ((limit_count
+                                                           - estimate)
+                                                          / 1000));
+        cn->count = (u_short) ngx_min(cn->count + tokens, 0xffff);
+    }
+
+    ngx_http_limit_req_sync_add(ctx, shard, &cn->sync, 1 + tokens);
+
+    return 0;
+}
+
+
+static ngx_msec_t
+ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
+    ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit)
+{
+    ngx_int_t                   excess;
+    ngx_uint_t                  tokens;
+    ngx_time_t                 *tp;
+    ngx_msec_t                  now, delay, max_delay;
+    ngx_msec_int_t              ms;
+    ngx_rbtree_node_t          *node;
+    ngx_http_limit_req_ctx_t   *ctx;
+    ngx_http_limit_req_node_t  *lr;
+
+    excess = *ep;
+
+    if (excess == 0 || (*limit)->nodelay) {
+        max_delay = 0;
+
+    } else {
+        ctx = (*limit)->shm_zone->data;
+        max_delay = excess * 1000 / ctx->rate;
+    }
+
+    while (n--) {
+        ctx = limits[n].shm_zone->data;
+        lr = ctx->node;
+
+        if (lr == NULL) {
+
+            if (ctx->cnode == NULL) {
+                continue;
+            }
+
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
+
+            tp = ngx_timeofday();
+            now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+            excess = ngx_http_limit_req_compact_update(&limits[n],
+                                                       ctx->shard, ctx->cnode,
+                                                       (uint32_t) now);
+            ctx->cnode->ref--;
+
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
+
+            ctx->cnode = NULL;
+
+            goto accounted;
+        }
+
+        ngx_shmtx_lock(&ctx->shard->shpool->mutex);
+
+        tp = ngx_timeofday();
+
+        now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+        ms = (ngx_msec_int_t) (now - lr->last);
+
+        excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+
+        if (excess < 0) {
+            excess = 0;
+        }
+
+        tokens = 0;
+
+        if ((ngx_uint_t) excess <= limits[n].burst) {
+            node = (ngx_rbtree_node_t *)
+                       ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+
+            tokens = ngx_http_limit_req_reserve(&limits[n], node->key,
+                                       lr->data, lr->len,
+                                       (limits[n].burst - excess) / 1000);
+        }
+
+        lr->last = now;
+        lr->excess = excess + tokens * 1000;
+        lr->count--;
+
+        ngx_http_limit_req_sync_add(ctx, ctx->shard, &lr->sync, 1 + tokens);
+
+        ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
+
+        ctx->node = NULL;
+
+    accounted:
+
+        if (limits[n].nodelay) {
+            continue;
+        }
+
+        delay = excess * 1000 / ctx->rate;
+
+        if (delay > max_delay) {
+            max_delay = delay;
+            *ep = excess;
+            *limit = &limits[n];
+        }
+    }
+
+    return max_delay;
+}
+
+
+static void
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n)
+{
+    ngx_int_t                    excess;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_queue_t                 *q;
+    ngx_msec_int_t               ms;
+    ngx_rbtree_node_t           *node;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_cnode_t  *cn;
+
+    tp = ngx_timeofday();
+
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    /*
+     * n == 1 deletes one or two zero rate entries
+     * n == 0 deletes oldest entry by force
+     *        and one or two zero rate entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&shard->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&shard->queue);
+
+        if (ctx->algorithm != NGX_HTTP_LIMIT_REQ_LEAKY) {
+
+            cn = ngx_queue_data(q, ngx_http_limit_req_cnode_t, queue);
+
+            if (cn->ref) {
+                return;
+            }
+
+            /*
+             * an entry is of no use after its theoretical arrival time
+             * or after two windows; a time ahead of the horizon is left
+             * from before the 32-bit time wrapped around
+             */
+
+            if (n++ != 0) {
+                ms = (int32_t) ((uint32_t) now - cn->time);
+
+                if (ms >= -ctx->horizon
+                    && (ms < 60000 || ms < (ngx_msec_int_t) (2 * ctx->window)))
+                {
+                    return;
+                }
+            }
+
+            if (cn->sync) {
+                shard->pending--;
+            }
+
+            ngx_queue_remove(q);
+
+            node = (ngx_rbtree_node_t *)
+                       ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+            ngx_rbtree_delete(&shard->rbtree, node);
+
+            ngx_slab_free_locked(shard->shpool, node);
+
+            continue;
+        }
+
+        lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+
+        if (lr->count) {
+
+            /*
+             * There is not much sense in looking further,
+             * because we bump nodes on the lookup stage.
+             */
+
+            return;
+        }
+
+        if (n++ != 0) {
+
+            ms = (ngx_msec_int_t) (now - lr->last);
+            ms = ngx_abs(ms);
+
+            if (ms < 60000) {
+                return;
+            }
+
+            excess = lr->excess - ctx->rate * ms / 1000;
+
+            if (excess > 0) {
+                return;
+            }
+        }
+
+        if (lr->sync) {
+            shard->pending--;
+        }
+
+        ngx_queue_remove(q);
+
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_rbtree_delete(&shard->rbtree, node);
+
+        ngx_slab_free_locked(shard->shpool, node);
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_limit_req_local(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t hash,
+    u_char *data, size_t len)
+{
+    ngx_http_limit_req_local_t  *lc;
+
+    lc = &ctx->cache[hash % NGX_HTTP_LIMIT_REQ_LOCAL_SIZE];
+
+    if (lc->tokens == 0) {
+        return 0;
+    }
+
+    if (lc->hash != (uint32_t) hash
+        || ngx_memn2cmp(data, lc->data, len, lc->len) != 0
+        || (ngx_msec_int_t) (lc->expire - ngx_current_msec) < 0)
+    {
+        /* the slot is needed for another key, or the tokens expired */
+
+        ngx_http_limit_req_release(ctx, lc);
+        return 0;
+    }
+
+    lc->tokens--;
+
+    ctx->lc = lc;
+
+    return 1;
+}
+
+
+static ngx_uint_t
+ngx_http_limit_req_reserve(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
+    u_char *data, size_t len, ngx_uint_t avail)
+{
+    ngx_uint_t                   tokens;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_local_t  *lc;
+
+    /*
+     * a worker process takes up to "local" tokens at once from the requests
+     * the limit would still pass and spends them without locking the zone;
+     * the tokens not spent in a second are returned
+     */
+
+    ctx = limit->shm_zone->data;
+
+    if (ctx->cache == NULL || !limit->nodelay
+        || len > NGX_HTTP_LIMIT_REQ_LOCAL_KEY)
+    {
+        return 0;
+    }
+
+    lc = &ctx->cache[hash % NGX_HTTP_LIMIT_REQ_LOCAL_SIZE];
+
+    /* a busy slot is released by ngx_http_limit_req_local() before */
+
+    if (lc->tokens) {
+        return 0;
+    }
+
+    tokens = ngx_min(ctx->local - 1, avail);
+
+    if (tokens == 0) {
+        return 0;
+    }
+
+    lc->hash = (uint32_t) hash;
+    lc->len = (u_short) len;
+    lc->tokens = (u_short) tokens;
+    lc->expire = ngx_current_msec + 1000;
+
+    ngx_memcpy(lc->data, data, len);
+
+    if (!ctx->event.timer_set) {
+        ngx_add_timer(&ctx->event, 1000);
+    }
+
+    return tokens;
+}
+
+
+static void
+ngx_http_limit_req_release(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_local_t *lc)
+{
+    uint32_t                     now, start;
+    uint64_t                     tat;
+    ngx_int_t                    rc;
+    ngx_uint_t                   tokens;
+    ngx_time_t                  *tp;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_cnode_t  *cn;
+    ngx_http_limit_req_shard_t  *shard;
+
+    tokens = lc->tokens;
+    lc->tokens = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "limit_req return %ui tokens of \"%*s\"",
+                   tokens, (size_t) lc->len, lc->data);
+
+    shard = &ctx->sh->shards[lc->hash % ctx->sh->nshards];
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
+
+    lr = NULL;
+    cn = NULL;
+
+    while (node != sentinel) {
+
+        if (lc->hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (lc->hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* lc->hash == node->key */
+
+        if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+            lr = (ngx_http_limit_req_node_t *) &node->color;
+            rc = ngx_memn2cmp(lc->data, lr->data, lc->len, (size_t) lr->len);
+
+        } else {
+            cn = (ngx_http_limit_req_cnode_t *) &node->color;
+            rc = ngx_memn2cmp(lc->data, cn->data, lc->len, (size_t) cn->len);
+        }
+
+        if (rc == 0) {
+            break;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    if (node == sentinel) {
+        /* the node has been expired already */
+        goto done;
+    }
+
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+        lr->excess -= ngx_min(lr->excess, tokens * 1000);
+        goto done;
+    }
+
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_GCRA) {
+        tp = ngx_timeofday();
+        now = (uint32_t) (tp->sec * 1000 + tp->msec);
+
+        tat = ngx_http_limit_req_tat(ctx, cn, now);
+        tat -= ngx_min(tat, tokens * ctx->interval);
+
+        cn->time = now + (uint32_t) (tat / 1000);
+        cn->count = (u_short) (tat % 1000);
+
+        goto done;
+    }
+
+    /* NGX_HTTP_LIMIT_REQ_WINDOW, the tokens were taken a second ago */
+
+    start = (uint32_t) (lc->expire - 1000);
+    start -= start % (uint32_t) ctx->window;
+
+    if (cn->time == start) {
+        cn->count -= (u_short) ngx_min(cn->count, tokens);
+
+    } else if (cn->time - start == ctx->window) {
+        cn->prev -= (u_short) ngx_min(cn->prev, tokens);
+    }
+
+done:
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+static void
+ngx_http_limit_req_local_expire(ngx_event_t *ev)
+{
+    ngx_uint_t                   i;
+    ngx_msec_t                   timer;
+    ngx_msec_int_t               left;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_local_t  *lc;
+
+    ctx = ev->data;
+
+    timer = 0;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_LOCAL_SIZE; i++) {
+        lc = &ctx->cache[i];
+
+        if (lc->tokens == 0) {
+            continue;
+        }
+
+        left = (ngx_msec_int_t) (lc->expire - ngx_current_msec);
+
+        if (left < 0) {
+            ngx_http_limit_req_release(ctx, lc);
+            continue;
+        }
+
+        if (timer == 0 || (ngx_msec_t) left + 1 < timer) {
+            timer = (ngx_msec_t) left + 1;
+        }
+    }
+
+    if (timer) {
+        ngx_add_timer(ev, timer);
+    }
+}
+
+
+static void
+ngx_http_limit_req_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i, n;
+    ngx_list_part_t           *part;
+    ngx_shm_zone_t            *shm_zone;
+    ngx_http_limit_req_ctx_t  *ctx;
+
+    /* the tokens taken in advance are not lost for the other workers */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].tag != &ngx_http_limit_req_module) {
+            continue;
+        }
+
+        ctx = shm_zone[i].data;
+
+        if (ctx == NULL || ctx->cache == NULL || ctx->sh == NULL) {
+            continue;
+        }
+
+        if (ctx->event.timer_set) {
+            ngx_del_timer(&ctx->event);
+        }
+
+        for (n = 0; n < NGX_HTTP_LIMIT_REQ_LOCAL_SIZE; n++) {
+            if (ctx->cache[n].tokens) {
+                ngx_http_limit_req_release(ctx, &ctx->cache[n]);
+            }
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_sync_collect(ngx_shm_zone_t *shm_zone, ngx_buf_t *b)
+{
+    u_char                      *sync, *data;
+    size_t                       len;
+    ngx_uint_t                   i;
+    ngx_queue_t                 *q;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_cnode_t  *cn;
+    ngx_http_limit_req_shard_t  *shard;
+
+    ctx = shm_zone->data;
+
+    for (i = 0; i < ctx->sh->nshards; i++) {
+        shard = &ctx->sh->shards[i];
+
+        if (shard->pending == 0) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        /*
+         * the nodes used since the last flush are at the head of the queue,
+         * so the walk stops as soon as all pending nodes are seen
+         */
+
+        for (q = ngx_queue_head(&shard->queue);
+             shard->pending && q != ngx_queue_sentinel(&shard->queue);
+             q = ngx_queue_next(q))
+        {
+            if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+                lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+                sync = &lr->sync;
+                data = lr->data;
+                len = lr->len;
+
+            } else {
+                cn = ngx_queue_data(q, ngx_http_limit_req_cnode_t, queue);
+                sync = &cn->sync;
+                data = cn->data;
+                len = cn->len;
+            }
+
+            if (*sync == 0) {
+                continue;
+            }
+
+            if (len <= 255) {
+                if ((size_t) (b->end - b->last)
+                    < NGX_HTTP_LIMIT_SYNC_RECORD_LEN(len))
+                {
+                    ngx_shmtx_unlock(&shard->shpool->mutex);
+                    return NGX_AGAIN;
+                }
+
+                b->last = ngx_http_limit_sync_write(b->last, data, len, *sync);
+            }
+
+            *sync = 0;
+            shard->pending--;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_req_sync_merge(ngx_shm_zone_t *shm_zone, u_char *data,
+    size_t len, ngx_uint_t delta, uint32_t peer, uint64_t time)
+{
+    size_t                       size;
+    uint32_t                     hash, start;
+    uint64_t                     usec;
+    ngx_int_t                    rc, excess;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_msec_int_t               ms;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_cnode_t  *cn;
+    ngx_http_limit_req_shard_t  *shard;
+
+    /* the requests passed by the peers are accounted as if passed here */
+
+    if (delta == 0) {
+        return;
+    }
+
+    ctx = shm_zone->data;
+
+    hash = ngx_crc32_short(data, len);
+
+    shard = &ctx->sh->shards[hash % ctx->sh->nshards];
+
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    lr = NULL;
+    cn = NULL;
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+            lr = (ngx_http_limit_req_node_t *) &node->color;
+            rc = ngx_memn2cmp(data, lr->data, len, (size_t) lr->len);
+
+        } else {
+            cn = (ngx_http_limit_req_cnode_t *) &node->color;
+            rc = ngx_memn2cmp(data, cn->data, len, (size_t) cn->len);
+        }
+
+        if (rc == 0) {
+            break;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    if (node == sentinel) {
+
+        ngx_http_limit_req_expire(ctx, shard, 1);
+
+        if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+            size = offsetof(ngx_rbtree_node_t, color)
+                   + offsetof(ngx_http_limit_req_node_t, data)
+                   + len;
+
+        } else {
+            size = offsetof(ngx_rbtree_node_t, color)
+                   + offsetof(ngx_http_limit_req_cnode_t, data)
+                   + len;
+        }
+
+        /* the keys of the peers never evict the local ones */
+
+        node = ngx_slab_alloc_locked(shard->shpool, size);
+        if (node == NULL) {
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+            return;
+        }
+
+        node->key = hash;
+
+        if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+            lr = (ngx_http_limit_req_node_t *) &node->color;
+
+            lr->sync = 0;
+            lr->len = (u_short) len;
+            lr->last = now;
+            lr->excess = 0;
+            lr->count = 0;
+
+            ngx_memcpy(lr->data, data, len);
+
+            ngx_queue_insert_head(&shard->queue, &lr->queue);
+
+        } else {
+            cn = (ngx_http_limit_req_cnode_t *) &node->color;
+
+            cn->sync = 0;
+            cn->len = (u_short) len;
+            cn->time = (uint32_t) now;
+            cn->prev = 0;
+            cn->count = 0;
+            cn->ref = 0;
+
+            ngx_memcpy(cn->data, data, len);
+
+            ngx_queue_insert_head(&shard->queue, &cn->queue);
+        }
+
+        ngx_rbtree_insert(&shard->rbtree, node);
+    }
+
+    switch (ctx->algorithm) {
+
+    case NGX_HTTP_LIMIT_REQ_LEAKY:
+
+        /* the excess leaks up to now before the requests are added */
+
+        ms = (ngx_msec_int_t) (now - lr->last);
+
+        excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000;
+
+        if (excess < 0) {
+            excess = 0;
+        }
+
+        lr->excess = excess + (ngx_int_t) delta * 1000;
+        lr->last = now;
+
+        break;
+
+    case NGX_HTTP_LIMIT_REQ_GCRA:
+
+        usec = ngx_http_limit_req_tat(ctx, cn, (uint32_t) now)
+               + (uint64_t) delta * ctx->interval;
+
+        cn->time = (uint32_t) now + (uint32_t) (usec / 1000);
+        cn->count = (u_short) (usec % 1000);
+
+        break;
+
+    default: /* NGX_HTTP_LIMIT_REQ_WINDOW */
+
+        start = (uint32_t) now - (uint32_t) now % (uint32_t) ctx->window;
+
+        if (cn->time != start) {
+            cn->prev = (start - cn->time == ctx->window) ? cn->count : 0;
+            cn->count = 0;
+            cn->time = start;
+        }
+
+        cn->count = (u_short) ngx_min(cn->count + delta, 0xffff);
+
+        break;
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_limit_req_ctx_t  *octx = data;
+
+    size_t                       len, size;
+    ngx_uint_t                   i, n;
+    ngx_slab_pool_t             *sp;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_shard_t  *shard;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        if (ngx_strcmp(ctx->var.data, octx->var.data) != 0) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses the \"%V\" variable "
+                          "while previously it used the \"%V\" variable",
+                          &shm_zone->shm.name, &ctx->var, &octx->var);
+            return NGX_ERROR;
+        }
+
+        if (ctx->algorithm != octx->algorithm) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses another algorithm "
+                          "than previously", &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    /*
+     * the states are spread over several shards by the key hash,
+     * each shard has its own slab pool and mutex to lessen lock contention
+     */
+
+    if (ctx->shards) {
+        n = ctx->shards;
+
+    } else {
+        n = ngx_min((ngx_uint_t) ngx_ncpu, NGX_HTTP_LIMIT_REQ_MAX_SHARDS);
+        n = ngx_min(n, shm_zone->shm.size / NGX_HTTP_LIMIT_REQ_MIN_SHARD);
+
+        if (n == 0) {
+            n = 1;
+        }
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool,
+                             sizeof(ngx_http_limit_req_shctx_t)
+                             + (n - 1) * sizeof(ngx_http_limit_req_shard_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ctx->sh->dry_run_delayed = 0;
+    ctx->sh->dry_run_rejected = 0;
+
+    len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
     ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
     if (ctx->shpool->log_ctx == NULL) {
@@ -678,6 +1860,53 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ctx->shpool->log_nomem = 0;
 
+    if (n == 1) {
+        ctx->sh->shards[0].shpool = ctx->shpool;
+
+    } else {
+        size = (ctx->shpool->end - ctx->shpool->start) / n;
+        size = (size - ngx_pagesize) & ~(ngx_pagesize - 1);
+
+        for (i = 0; i < n; i++) {
+
+            sp = ngx_slab_sub_pool(ctx->shpool, size);
+            if (sp == NULL) {
+                break;
+            }
+
+            sp->log_ctx = ctx->shpool->log_ctx;
+            sp->log_nomem = 0;
+
+            ctx->sh->shards[i].shpool = sp;
+        }
+
+        if (i == 0) {
+            ctx->sh->shards[0].shpool = ctx->shpool;
+            i = 1;
+        }
+
+        n = i;
+    }
+
+    ctx->sh->nshards = n;
+
+    for (i = 0; i < n; i++) {
+        shard = &ctx->sh->shards[i];
+
+        if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY) {
+            ngx_rbtree_init(&shard->rbtree, &shard->sentinel,
+                            ngx_http_limit_req_rbtree_insert_value);
+
+        } else {
+            ngx_rbtree_init(&shard->rbtree, &shard->sentinel,
+                            ngx_http_limit_req_rbtree_insert_cvalue);
+        }
+
+        ngx_queue_init(&shard->queue);
+
+        shard->pending = 0;
+    }
+
     return NGX_OK;
 }
 
@@ -700,6 +1929,7 @@ ngx_http_limit_req_create_conf(ngx_conf_t *cf)
 
     conf->limit_log_level = NGX_CONF_UNSET_UINT;
     conf->status_code = NGX_CONF_UNSET_UINT;
+    conf->dry_run = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -724,6 +1954,8 @@ ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->status_code, prev->status_code,
                               NGX_HTTP_SERVICE_UNAVAILABLE);
 
+    ngx_conf_merge_value(conf->dry_run, prev->dry_run, 0);
+
     return NGX_CONF_OK;
 }
 
@@ -735,8 +1967,8 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                     len;
     ssize_t                    size;
     ngx_str_t                 *value, name, s;
-    ngx_int_t                  rate, scale;
-    ngx_uint_t                 i;
+    ngx_int_t                  rate, scale, shards, local;
+    ngx_uint_t                 i, algorithm, sync;
     ngx_shm_zone_t            *shm_zone;
     ngx_http_limit_req_ctx_t  *ctx;
 
@@ -746,6 +1978,10 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     rate = 1;
     scale = 1;
+    shards = 0;
+    local = 0;
+    algorithm = NGX_HTTP_LIMIT_REQ_LEAKY;
+    sync = 0;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -808,6 +2044,60 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > NGX_HTTP_LIMIT_REQ_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "sync") == 0) {
+            sync = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "algorithm=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            if (ngx_strcmp(s.data, "leaky_bucket") == 0) {
+                algorithm = NGX_HTTP_LIMIT_REQ_LEAKY;
+
+            } else if (ngx_strcmp(s.data, "gcra") == 0) {
+                algorithm = NGX_HTTP_LIMIT_REQ_GCRA;
+
+            } else if (ngx_strcmp(s.data, "sliding_window") == 0) {
+                algorithm = NGX_HTTP_LIMIT_REQ_WINDOW;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid algorithm \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "local=", 6) == 0) {
+
+            local = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (local <= 0 || local > 65535) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of local tokens \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -848,6 +2138,33 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->rate = rate * 1000 / scale;
+    ctx->algorithm = algorithm;
+    ctx->window = (scale == 60) ? 60000 : 1000;
+    ctx->window_limit = rate * 1000;
+    ctx->interval = (uint64_t) 1000000 * scale / rate;
+
+    if (algorithm == NGX_HTTP_LIMIT_REQ_GCRA && ctx->interval == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "rate of more than 1000000 r/s "
+                           "is not supported by gcra");
+        return NGX_CONF_ERROR;
+    }
+    ctx->shards = shards;
+    ctx->local = local;
+    ctx->sync = sync;
+
+    if (local > 1) {
+        ctx->cache = ngx_pcalloc(cf->pool, NGX_HTTP_LIMIT_REQ_LOCAL_SIZE
+                                           * sizeof(ngx_http_limit_req_local_t));
+        if (ctx->cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ctx->event.handler = ngx_http_limit_req_local_expire;
+        ctx->event.data = ctx;
+        ctx->event.log = &cf->cycle->new_log;
+        ctx->event.cancelable = 1;
+    }
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
@@ -867,6 +2184,15 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     shm_zone->init = ngx_http_limit_req_init_zone;
     shm_zone->data = ctx;
 
+    if (sync
+        && ngx_http_limit_sync_add_zone(cf, shm_zone,
+                                        ngx_http_limit_req_sync_collect,
+                                        ngx_http_limit_req_sync_merge)
+           != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -876,10 +2202,12 @@ ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_limit_req_conf_t  *lrcf = conf;
 
+    uint64_t                     horizon;
     ngx_int_t                    burst;
     ngx_str_t                   *value, s;
     ngx_uint_t                   i, nodelay;
     ngx_shm_zone_t              *shm_zone;
+    ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_limit_t  *limit, *limits;
 
     value = cf->args->elts;
@@ -966,10 +2294,104 @@ ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     limit->burst = burst * 1000;
     limit->nodelay = nodelay;
 
+    ctx = shm_zone->data;
+
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_GCRA) {
+
+        /* the theoretical arrival time is at most burst + 1 intervals ahead */
+
+        horizon = (uint64_t) (burst + 1) * ctx->interval / 1000 + 1;
+
+        if (horizon > NGX_MAX_INT32_VALUE / 2) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "burst of %i requests at the rate of "
+                               "zone \"%V\" exceeds 12 days",
+                               burst, &shm_zone->shm.name);
+            return NGX_CONF_ERROR;
+        }
+
+        if ((ngx_msec_int_t) horizon > ctx->horizon) {
+            ctx->horizon = (ngx_msec_int_t) horizon;
+        }
+    }
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_limit_req_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    if (r->main->limit_req_status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = ngx_http_limit_req_status[r->main->limit_req_status - 1].len;
+    v->data = ngx_http_limit_req_status[r->main->limit_req_status - 1].data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_dry_run_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                      *p;
+    ngx_uint_t                   i, n;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_limit_t  *limits;
+
+    lrcf = ngx_http_get_module_loc_conf(r, ngx_http_limit_req_module);
+
+    limits = lrcf->limits.elts;
+    n = 0;
+
+    for (i = 0; i < lrcf->limits.nelts; i++) {
+        ctx = limits[i].shm_zone->data;
+        n += *(ngx_atomic_t *) ((u_char *) ctx->sh + data);
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", n) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_limit_req_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_init(ngx_conf_t *cf)
 {
@@ -0,0 +1,1219 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_http_limit_sync_module.h>
+
+#if (NGX_OPENSSL)
+#include <openssl/hmac.h>
+#endif
+
+
+/*
+ * a datagram consists of the "LS" signature, the version, the 64-bit time
+ * of the sender in milliseconds, the 64-bit sequence number of the sender,
+ * the zone name length, the zone name, the records of the zone, and,
+ * if "limit_sync_key" is set, the HMAC-SHA256 of all the preceding bytes
+ */
+
+#define NGX_HTTP_LIMIT_SYNC_VERSION  3
+#define NGX_HTTP_LIMIT_SYNC_MTU      1400
+#define NGX_HTTP_LIMIT_SYNC_HEADER   20
+#define NGX_HTTP_LIMIT_SYNC_MAC_LEN  32
+
+/* the datagrams sent more than 10 seconds ago are stale */
+
+#define NGX_HTTP_LIMIT_SYNC_MAX_AGE  10000
+
+/* the sequence numbers below the highest one seen by more than 64 are old */
+
+#define NGX_HTTP_LIMIT_SYNC_WINDOW   64
+
+
+typedef struct {
+    ngx_shm_zone_t                  *shm_zone;
+    ngx_http_limit_sync_collect_pt   collect;
+    ngx_http_limit_sync_merge_pt     merge;
+} ngx_http_limit_sync_zone_t;
+
+
+typedef struct {
+    uint32_t                         peer;
+    uint64_t                         last;
+    /* bit n is set if the sequence number "last - n" was seen */
+    uint64_t                         window;
+} ngx_http_limit_sync_replay_t;
+
+
+typedef struct {
+    /* the last sequence number sent by the workers */
+    uint64_t                         sequence;
+    ngx_http_limit_sync_replay_t     peers[1];
+} ngx_http_limit_sync_shctx_t;
+
+
+typedef struct {
+    ngx_addr_t                      *listen;
+    ngx_array_t                     *peers;
+    ngx_array_t                     *zones;
+    ngx_msec_t                       interval;
+    ngx_str_t                        key;
+
+    ngx_shm_zone_t                  *shm_zone;
+    ngx_slab_pool_t                 *shpool;
+    ngx_http_limit_sync_shctx_t     *sh;
+
+    ngx_socket_t                     fd;
+    ngx_connection_t                *connection;
+    ngx_event_t                      event;
+} ngx_http_limit_sync_main_conf_t;
+
+
+static void ngx_http_limit_sync_flush_handler(ngx_event_t *ev);
+static void ngx_http_limit_sync_flush(ngx_http_limit_sync_main_conf_t *lsmcf,
+    ngx_log_t *log);
+static void ngx_http_limit_sync_send(ngx_http_limit_sync_main_conf_t *lsmcf,
+    u_char *buf, size_t len, ngx_log_t *log);
+static void ngx_http_limit_sync_read_handler(ngx_event_t *rev);
+static void ngx_http_limit_sync_process(ngx_http_limit_sync_main_conf_t *lsmcf,
+    u_char *buf, size_t len, ngx_uint_t peer, ngx_log_t *log);
+static ngx_uint_t ngx_http_limit_sync_replayed(
+    ngx_http_limit_sync_main_conf_t *lsmcf, ngx_uint_t peer,
+    uint64_t sequence);
+static ngx_int_t ngx_http_limit_sync_sign(
+    ngx_http_limit_sync_main_conf_t *lsmcf, u_char *buf, size_t len,
+    u_char *mac);
+static uint64_t ngx_http_limit_sync_time(void);
+static ngx_int_t ngx_http_limit_sync_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void ngx_http_limit_sync_close(void *data);
+static ngx_uint_t ngx_http_limit_sync_local(
+    ngx_http_limit_sync_main_conf_t *lsmcf, ngx_addr_t *peer);
+
+static void *ngx_http_limit_sync_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_limit_sync_init_main_conf(ngx_conf_t *cf, void *conf);
+static char *ngx_http_limit_sync_listen(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_limit_sync_peer(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_limit_sync_key(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_limit_sync_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_limit_sync_init_process(ngx_cycle_t *cycle);
+static void ngx_http_limit_sync_exit_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_limit_sync_commands[] = {
+
+    { ngx_string("limit_sync_listen"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_sync_listen,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_sync_peer"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_sync_peer,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_sync_interval"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_limit_sync_main_conf_t, interval),
+      NULL },
+
+    { ngx_string("limit_sync_key"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_sync_key,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_limit_sync_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_limit_sync_create_main_conf,  /* create main configuration */
+    ngx_http_limit_sync_init_main_conf,    /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_limit_sync_module = {
+    NGX_MODULE_V1,
+    &ngx_http_limit_sync_module_ctx,       /* module context */
+    ngx_http_limit_sync_commands,          /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    ngx_http_limit_sync_init_module,       /* init module */
+    ngx_http_limit_sync_init_process,      /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_http_limit_sync_exit_process,      /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+ngx_int_t
+ngx_http_limit_sync_add_zone(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_sync_collect_pt collect, ngx_http_limit_sync_merge_pt merge)
+{
+    ngx_http_limit_sync_zone_t       *zone;
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_limit_sync_module);
+
+    if (shm_zone->shm.name.len > 255) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the name of the synchronized zone \"%V\" "
+                           "is too long", &shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+
+    if (lsmcf->zones == NULL) {
+        lsmcf->zones = ngx_array_create(cf->pool, 2,
+                                        sizeof(ngx_http_limit_sync_zone_t));
+        if (lsmcf->zones == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    zone = ngx_array_push(lsmcf->zones);
+    if (zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    zone->shm_zone = shm_zone;
+    zone->collect = collect;
+    zone->merge = merge;
+
+    return NGX_OK;
+}
+
+
+u_char *
+ngx_http_limit_sync_write(u_char *p, u_char *data, size_t len,
+    ngx_uint_t value)
+{
+    uint16_t  n;
+
+    n = (uint16_t) ngx_min(value, 0xffff);
+
+    *p++ = (u_char) len;
+    p = ngx_cpymem(p, data, len);
+
+    *p++ = (u_char) (n >> 8);
+    *p++ = (u_char) n;
+
+    return p;
+}
+
+
+static void
+ngx_http_limit_sync_flush_handler(ngx_event_t *ev)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = ev->data;
+
+    ngx_http_limit_sync_flush(lsmcf, ev->log);
+
+    if (!ngx_exiting) {
+        ngx_add_timer(ev, lsmcf->interval);
+    }
+}
+
+
+static void
+ngx_http_limit_sync_flush(ngx_http_limit_sync_main_conf_t *lsmcf,
+    ngx_log_t *log)
+{
+    u_char                      *p;
+    uint64_t                     now, sequence;
+    ngx_buf_t                    b;
+    ngx_int_t                    rc;
+    ngx_uint_t                   i, n;
+    ngx_http_limit_sync_zone_t  *zone;
+    u_char                       buf[NGX_HTTP_LIMIT_SYNC_MTU];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "limit sync flush");
+
+    now = ngx_http_limit_sync_time();
+
+    zone = lsmcf->zones->elts;
+
+    for (i = 0; i < lsmcf->zones->nelts; i++) {
+
+        p = buf;
+
+        *p++ = 'L';
+        *p++ = 'S';
+        *p++ = NGX_HTTP_LIMIT_SYNC_VERSION;
+
+        for (n = 0; n < 8; n++) {
+            *p++ = (u_char) (now >> (56 - n * 8));
+        }
+
+        /* the sequence number is set for each datagram */
+
+        p += 8;
+
+        *p++ = (u_char) zone[i].shm_zone->shm.name.len;
+
+        p = ngx_cpymem(p, zone[i].shm_zone->shm.name.data,
+                       zone[i].shm_zone->shm.name.len);
+
+        ngx_memzero(&b, sizeof(ngx_buf_t));
+
+        b.start = buf;
+        b.pos = buf;
+        b.end = buf + NGX_HTTP_LIMIT_SYNC_MTU;
+
+        if (lsmcf->key.len) {
+            b.end -= NGX_HTTP_LIMIT_SYNC_MAC_LEN;
+        }
+
+        do {
+            b.last = p;
+
+            rc = zone[i].collect(zone[i].shm_zone, &b);
+
+            if (b.last == p) {
+                break;
+            }
+
+            ngx_shmtx_lock(&lsmcf->shpool->mutex);
+
+            sequence = ++lsmcf->sh->sequence;
+
+            ngx_shmtx_unlock(&lsmcf->shpool->mutex);
+
+            for (n = 0; n < 8; n++) {
+                buf[11 + n] = (u_char) (sequence >> (56 - n * 8));
+            }
+
+            ngx_http_limit_sync_send(lsmcf, buf, b.last - buf, log);
+
+        } while (rc == NGX_AGAIN);
+    }
+}
+
+
+static void
+ngx_http_limit_sync_send(ngx_http_limit_sync_main_conf_t *lsmcf, u_char *buf,
+    size_t len, ngx_log_t *log)
+{
+    ssize_t      n;
+    ngx_uint_t   i;
+    ngx_addr_t  *peer;
+
+    if (lsmcf->key.len) {
+        if (ngx_http_limit_sync_sign(lsmcf, buf, len, buf + len) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "could not sign limit sync datagram");
+            return;
+        }
+
+        len += NGX_HTTP_LIMIT_SYNC_MAC_LEN;
+    }
+
+    peer = lsmcf->peers->elts;
+
+    for (i = 0; i < lsmcf->peers->nelts; i++) {
+
+        n = sendto(lsmcf->fd, buf, len, 0, peer[i].sockaddr, peer[i].socklen);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "limit sync sendto %V: %z of %uz",
+                       &peer[i].name, n, len);
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ERR, log, ngx_socket_errno,
+                          "sendto() to limit sync peer %V failed",
+                          &peer[i].name);
+        }
+    }
+}
+
+
+static void
+ngx_http_limit_sync_read_handler(ngx_event_t *rev)
+{
+    ssize_t                           n;
+    ngx_err_t                         err;
+    ngx_uint_t                        i;
+    socklen_t                         socklen;
+    ngx_addr_t                       *peer;
+    ngx_connection_t                 *c;
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+    u_char                            sa[NGX_SOCKADDRLEN];
+    u_char                            buf[NGX_HTTP_LIMIT_SYNC_MTU];
+
+    c = rev->data;
+    lsmcf = c->data;
+
+    for ( ;; ) {
+        socklen = NGX_SOCKADDRLEN;
+
+        n = recvfrom(c->fd, buf, NGX_HTTP_LIMIT_SYNC_MTU, 0,
+                     (struct sockaddr *) sa, &socklen);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                break;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                          "recvfrom() failed in limit sync");
+            break;
+        }
+
+        /*
+         * only the configured peers are trusted; a peer sends from its
+         * listen socket, so the port tells apart the servers on one host
+         */
+
+        peer = lsmcf->peers ? lsmcf->peers->elts : NULL;
+
+        for (i = 0; peer && i < lsmcf->peers->nelts; i++) {
+            if (ngx_cmp_sockaddr((struct sockaddr *) sa, socklen,
+                                 peer[i].sockaddr, peer[i].socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer == NULL || i == lsmcf->peers->nelts) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "limit sync datagram from unknown peer");
+            continue;
+        }
+
+        ngx_http_limit_sync_process(lsmcf, buf, n, i, c->log);
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "could not handle limit sync read event");
+    }
+}
+
+
+static void
+ngx_http_limit_sync_process(ngx_http_limit_sync_main_conf_t *lsmcf,
+    u_char *buf, size_t len, ngx_uint_t peer, ngx_log_t *log)
+{
+    u_char                      *p, *last, *data;
+    size_t                       n;
+    u_char                       diff;
+    uint32_t                     hash;
+    uint64_t                     time, now, sequence;
+    ngx_str_t                    name;
+    ngx_uint_t                   i, value;
+    ngx_addr_t                  *addr;
+    ngx_http_limit_sync_zone_t  *zone;
+    u_char                       mac[NGX_HTTP_LIMIT_SYNC_MAC_LEN];
+
+    if (len < NGX_HTTP_LIMIT_SYNC_HEADER
+        || buf[0] != 'L' || buf[1] != 'S'
+        || buf[2] != NGX_HTTP_LIMIT_SYNC_VERSION)
+    {
+        goto invalid;
+    }
+
+    /* the unsigned datagrams are rejected if the key is set */
+
+    if (lsmcf->key.len) {
+
+        if (len < NGX_HTTP_LIMIT_SYNC_HEADER + NGX_HTTP_LIMIT_SYNC_MAC_LEN) {
+            goto invalid;
+        }
+
+        len -= NGX_HTTP_LIMIT_SYNC_MAC_LEN;
+
+        if (ngx_http_limit_sync_sign(lsmcf, buf, len, mac) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "could not verify limit sync datagram");
+            return;
+        }
+
+        diff = 0;
+
+        for (i = 0; i < NGX_HTTP_LIMIT_SYNC_MAC_LEN; i++) {
+            diff |= mac[i] ^ buf[len + i];
+        }
+
+        if (diff) {
+            ngx_log_error(NGX_LOG_INFO, log, 0,
+                          "limit sync datagram with invalid signature");
+            return;
+        }
+    }
+
+    last = buf + len;
+
+    time = 0;
+
+    for (p = buf + 3; p < buf + 11; p++) {
+        time = (time << 8) | *p;
+    }
+
+    now = ngx_http_limit_sync_time();
+
+    if (time + NGX_HTTP_LIMIT_SYNC_MAX_AGE < now
+        || time > now + NGX_HTTP_LIMIT_SYNC_MAX_AGE)
+    {
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "stale limit sync datagram, time difference %L ms",
+                      (int64_t) (now - time));
+        return;
+    }
+
+    if ((size_t) buf[19] > len - NGX_HTTP_LIMIT_SYNC_HEADER) {
+        goto invalid;
+    }
+
+    sequence = 0;
+
+    for (p = buf + 11; p < buf + 19; p++) {
+        sequence = (sequence << 8) | *p;
+    }
+
+    addr = lsmcf->peers->elts;
+
+    if (ngx_http_limit_sync_replayed(lsmcf, peer, sequence)) {
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "replayed limit sync datagram %uL from %V",
+                      sequence, &addr[peer].name);
+        return;
+    }
+
+    hash = ngx_crc32_short(addr[peer].name.data, addr[peer].name.len);
+
+    name.len = buf[19];
+    name.data = buf + NGX_HTTP_LIMIT_SYNC_HEADER;
+
+    if (lsmcf->zones == NULL) {
+        return;
+    }
+
+    zone = lsmcf->zones->elts;
+
+    for (i = 0; i < lsmcf->zones->nelts; i++) {
+        if (zone[i].shm_zone->shm.name.len == name.len
+            && ngx_strncmp(zone[i].shm_zone->shm.name.data, name.data,
+                           name.len)
+               == 0)
+        {
+            break;
+        }
+    }
+
+    if (i == lsmcf->zones->nelts) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "limit sync unknown zone \"%V\"", &name);
+        return;
+    }
+
+    zone = &zone[i];
+
+    for (p = name.data + name.len; p < last; /* void */) {
+
+        n = *p++;
+
+        if ((size_t) (last - p) < n + 2) {
+            goto invalid;
+        }
+
+        data = p;
+        p += n;
+
+        value = (p[0] << 8) | p[1];
+        p += 2;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "limit sync merge \"%V\" %uz %ui", &name, n, value);
+
+        if (n == 0) {
+            continue;
+        }
+
+        zone->merge(zone->shm_zone, data, n, value, hash, time);
+    }
+
+    return;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_INFO, log, 0, "invalid limit sync datagram");
+}
+
+
+static ngx_uint_t
+ngx_http_limit_sync_replayed(ngx_http_limit_sync_main_conf_t *lsmcf,
+    ngx_uint_t peer, uint64_t sequence)
+{
+    uint64_t                       n;
+    ngx_uint_t                     replayed;
+    ngx_http_limit_sync_replay_t  *rp;
+
+    /*
+     * the workers of a peer send in parallel, so the datagrams may come
+     * out of order: a sequence number is accepted once if it is within
+     * the window below the highest one seen
+     */
+
+    replayed = 0;
+
+    ngx_shmtx_lock(&lsmcf->shpool->mutex);
+
+    rp = &lsmcf->sh->peers[peer];
+
+    if (sequence > rp->last) {
+        n = sequence - rp->last;
+
+        rp->window = (n < NGX_HTTP_LIMIT_SYNC_WINDOW) ? (rp->window << n) | 1
+                                                      : 1;
+        rp->last = sequence;
+
+    } else {
+        n = rp->last - sequence;
+
+        if (n >= NGX_HTTP_LIMIT_SYNC_WINDOW
+            || (rp->window & ((uint64_t) 1 << n)))
+        {
+            replayed = 1;
+
+        } else {
+            rp->window |= (uint64_t) 1 << n;
+        }
+    }
+
+    ngx_shmtx_unlock(&lsmcf->shpool->mutex);
+
+    return replayed;
+}
+
+
+static ngx_int_t
+ngx_http_limit_sync_sign(ngx_http_limit_sync_main_conf_t *lsmcf, u_char *buf,
+    size_t len, u_char *mac)
+{
+#if (NGX_OPENSSL)
+
+    unsigned int  n;
+
+    n = NGX_HTTP_LIMIT_SYNC_MAC_LEN;
+
+    if (HMAC(EVP_sha256(), lsmcf->key.data, lsmcf->key.len, buf, len, mac, &n)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+#else
+
+    return NGX_ERROR;
+
+#endif
+}
+
+
+static uint64_t
+ngx_http_limit_sync_time(void)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return (uint64_t) tp->sec * 1000 + tp->msec;
+}
+
+
+static ngx_int_t
+ngx_http_limit_sync_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_limit_sync_main_conf_t  *olsmcf = data;
+
+    size_t                            size;
+    uint32_t                          hash;
+    ngx_uint_t                        i;
+    ngx_addr_t                       *peer;
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = shm_zone->data;
+
+    peer = lsmcf->peers->elts;
+
+    if (olsmcf) {
+
+        /*
+         * the zone size depends on the number of peers, so the number
+         * is the same; the state of the replaced peers is reset
+         */
+
+        lsmcf->shpool = olsmcf->shpool;
+        lsmcf->sh = olsmcf->sh;
+
+        ngx_shmtx_lock(&lsmcf->shpool->mutex);
+
+        for (i = 0; i < lsmcf->peers->nelts; i++) {
+            hash = ngx_crc32_short(peer[i].name.data, peer[i].name.len);
+
+            if (lsmcf->sh->peers[i].peer != hash) {
+                lsmcf->sh->peers[i].peer = hash;
+                lsmcf->sh->peers[i].last = 0;
+                lsmcf->sh->peers[i].window = 0;
+            }
+        }
+
+        ngx_shmtx_unlock(&lsmcf->shpool->mutex);
+
+        return NGX_OK;
+    }
+
+    lsmcf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        lsmcf->sh = lsmcf->shpool->data;
+        return NGX_OK;
+    }
+
+    size = offsetof(ngx_http_limit_sync_shctx_t, peers)
+           + lsmcf->peers->nelts * sizeof(ngx_http_limit_sync_replay_t);
+
+    lsmcf->sh = ngx_slab_alloc(lsmcf->shpool, size);
+    if (lsmcf->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(lsmcf->sh, size);
+
+    lsmcf->shpool->data = lsmcf->sh;
+
+    /*
+     * the sequence numbers of a restarted server continue above the ones
+     * it sent before, unless it sent a million datagrams a second
+     */
+
+    lsmcf->sh->sequence = (uint64_t) ngx_time() * 1000000;
+
+    for (i = 0; i < lsmcf->peers->nelts; i++) {
+        lsmcf->sh->peers[i].peer = ngx_crc32_short(peer[i].name.data,
+                                                   peer[i].name.len);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_sync_close(void *data)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf = data;
+
+    if (lsmcf->fd == (ngx_socket_t) -1) {
+        return;
+    }
+
+    if (ngx_close_socket(lsmcf->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " limit sync socket failed");
+    }
+}
+
+
+static void *
+ngx_http_limit_sync_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_sync_main_conf_t));
+    if (lsmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     lsmcf->listen = NULL;
+     *     lsmcf->peers = NULL;
+     *     lsmcf->zones = NULL;
+     *     lsmcf->key = { 0, NULL };
+     *     lsmcf->shm_zone = NULL;
+     *     lsmcf->shpool = NULL;
+     *     lsmcf->sh = NULL;
+     *     lsmcf->connection = NULL;
+     */
+
+    lsmcf->interval = NGX_CONF_UNSET_MSEC;
+    lsmcf->fd = (ngx_socket_t) -1;
+
+    return lsmcf;
+}
+
+
+static char *
+ngx_http_limit_sync_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf = conf;
+
+    size_t       size;
+    ngx_str_t    name;
+    ngx_uint_t   i, n;
+    ngx_addr_t  *peer;
+
+    ngx_conf_init_msec_value(lsmcf->interval, 100);
+
+    if (lsmcf->zones && lsmcf->listen == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "synchronized zones require \"limit_sync_listen\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (lsmcf->listen && lsmcf->peers == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"limit_sync_listen\" requires "
+                           "\"limit_sync_peer\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (lsmcf->listen == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    /* the same peer list may be used on all servers, the server itself */
+
+    peer = lsmcf->peers->elts;
+    n = 0;
+
+    for (i = 0; i < lsmcf->peers->nelts; i++) {
+
+        if (ngx_http_limit_sync_local(lsmcf, &peer[i])) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                           "limit sync skips local peer %V", &peer[i].name);
+            continue;
+        }
+
+        peer[n++] = peer[i];
+    }
+
+    lsmcf->peers->nelts = n;
+
+    if (lsmcf->key.len == 0) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"limit_sync_listen\" is used without "
+                           "\"limit_sync_key\", the limits can be changed "
+                           "by anyone who can spoof a peer address");
+    }
+
+    /* the sequence numbers sent and seen */
+
+    ngx_str_set(&name, "limit_sync");
+
+    size = 8 * ngx_pagesize + n * sizeof(ngx_http_limit_sync_replay_t);
+
+    lsmcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                            &ngx_http_limit_sync_module);
+    if (lsmcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    lsmcf->shm_zone->init = ngx_http_limit_sync_init_zone;
+    lsmcf->shm_zone->data = lsmcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_limit_sync_local(ngx_http_limit_sync_main_conf_t *lsmcf,
+    ngx_addr_t *peer)
+{
+    int                   rc;
+    in_port_t             port, lport;
+    ngx_uint_t            wildcard;
+    ngx_socket_t          s;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+    u_char                sa[NGX_SOCKADDRLEN];
+
+    if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                         lsmcf->listen->sockaddr, lsmcf->listen->socklen, 1)
+        == NGX_OK)
+    {
+        return 1;
+    }
+
+    if (peer->sockaddr->sa_family != lsmcf->listen->sockaddr->sa_family
+        || peer->socklen > NGX_SOCKADDRLEN)
+    {
+        return 0;
+    }
+
+    ngx_memcpy(sa, peer->sockaddr, peer->socklen);
+
+    switch (peer->sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) lsmcf->listen->sockaddr;
+        wildcard = IN6_IS_ADDR_UNSPECIFIED(&sin6->sin6_addr);
+        lport = sin6->sin6_port;
+
+        sin6 = (struct sockaddr_in6 *) sa;
+        port = sin6->sin6_port;
+        sin6->sin6_port = 0;
+        break;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) lsmcf->listen->sockaddr;
+        wildcard = (sin->sin_addr.s_addr == INADDR_ANY);
+        lport = sin->sin_port;
+
+        sin = (struct sockaddr_in *) sa;
+        port = sin->sin_port;
+        sin->sin_port = 0;
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (!wildcard || port != lport) {
+        return 0;
+    }
+
+    /* an address of the wildcard listen socket is one that can be bound */
+
+    s = ngx_socket(peer->sockaddr->sa_family, SOCK_DGRAM, 0);
+
+    if (s == (ngx_socket_t) -1) {
+        return 0;
+    }
+
+    rc = bind(s, (struct sockaddr *) sa, peer->socklen);
+
+    ngx_close_socket(s);
+
+    return (rc == 0);
+}
+
+
+static char *
+ngx_http_limit_sync_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf = conf;
+
+    ngx_str_t  *value;
+    ngx_url_t   u;
+
+    if (lsmcf->listen) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.listen = 1;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\" of the \"limit_sync_listen\" "
+                               "directive", u.err, &u.url);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    lsmcf->listen = ngx_pcalloc(cf->pool, sizeof(ngx_addr_t));
+    if (lsmcf->listen == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    lsmcf->listen->socklen = u.socklen;
+    lsmcf->listen->name = u.url;
+
+    lsmcf->listen->sockaddr = ngx_pcalloc(cf->pool, u.socklen);
+    if (lsmcf->listen->sockaddr == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memcpy(lsmcf->listen->sockaddr, &u.sockaddr, u.socklen);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_limit_sync_peer(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf = conf;
+
+    ngx_str_t   *value;
+    ngx_url_t    u;
+    ngx_uint_t   i;
+    ngx_addr_t  *peer;
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in limit sync peer \"%V\"", u.err, &u.url);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.no_port) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no port in limit sync peer \"%V\"", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (lsmcf->peers == NULL) {
+        lsmcf->peers = ngx_array_create(cf->pool, 4, sizeof(ngx_addr_t));
+        if (lsmcf->peers == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 0; i < u.naddrs; i++) {
+        peer = ngx_array_push(lsmcf->peers);
+        if (peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *peer = u.addrs[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_limit_sync_key(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_OPENSSL)
+
+    ngx_http_limit_sync_main_conf_t  *lsmcf = conf;
+
+    ngx_str_t  *value;
+
+    if (lsmcf->key.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "empty key in \"limit_sync_key\"");
+        return NGX_CONF_ERROR;
+    }
+
+    lsmcf->key = value[1];
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"limit_sync_key\" requires OpenSSL, "
+                       "build nginx with ngx_http_ssl_module");
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_http_limit_sync_init_module(ngx_cycle_t *cycle)
+{
+    int                               reuseaddr;
+    ngx_socket_t                      s;
+    ngx_pool_cleanup_t               *cln;
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_sync_module);
+
+    if (lsmcf == NULL || lsmcf->listen == NULL || ngx_test_config) {
+        return NGX_OK;
+    }
+
+    /*
+     * the socket is opened by the master process and inherited
+     * by all worker processes; the address is reused because the socket
+     * of the previous configuration stays open until its workers exit
+     */
+
+    s = ngx_socket(lsmcf->listen->sockaddr->sa_family, SOCK_DGRAM, 0);
+
+    if (s == (ngx_socket_t) -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_socket_n " limit sync socket failed");
+        return NGX_OK;
+    }
+
+    reuseaddr = 1;
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *) &reuseaddr, sizeof(int))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_REUSEADDR) %V failed",
+                      &lsmcf->listen->name);
+        goto failed;
+    }
+
+    if (ngx_nonblocking(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_nonblocking_n " limit sync socket failed");
+        goto failed;
+    }
+
+    if (bind(s, lsmcf->listen->sockaddr, lsmcf->listen->socklen) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "bind() to %V failed, limit sync is disabled",
+                      &lsmcf->listen->name);
+        goto failed;
+    }
+
+    cln = ngx_pool_cleanup_add(cycle->pool, 0);
+    if (cln == NULL) {
+        goto failed;
+    }
+
+    lsmcf->fd = s;
+
+    cln->handler = ngx_http_limit_sync_close;
+    cln->data = lsmcf;
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " limit sync socket failed");
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_limit_sync_init_process(ngx_cycle_t *cycle)
+{
+    ngx_connection_t                 *c;
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_sync_module);
+
+    if (lsmcf == NULL || lsmcf->fd == (ngx_socket_t) -1) {
+        return NGX_OK;
+    }
+
+    c = ngx_get_connection(lsmcf->fd, cycle->log);
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->data = lsmcf;
+
+    c->read->handler = ngx_http_limit_sync_read_handler;
+    c->read->log = cycle->log;
+    c->write->log = cycle->log;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    lsmcf->connection = c;
+
+    if (lsmcf->zones == NULL) {
+        return NGX_OK;
+    }
+
+    /* every worker flushes the values it finds pending in the zones */
+
+    lsmcf->event.handler = ngx_http_limit_sync_flush_handler;
+    lsmcf->event.data = lsmcf;
+    lsmcf->event.log = cycle->log;
+    lsmcf->event.cancelable = 1;
+
+    ngx_add_timer(&lsmcf->event, lsmcf->interval);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_sync_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_http_limit_sync_main_conf_t  *lsmcf;
+
+    lsmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_sync_module);
+
+    if (lsmcf == NULL || lsmcf->connection == NULL) {
+        return;
+    }
+
+    /* the changes made since the last flush are not lost */
+
+    if (lsmcf->zones) {
+        if (lsmcf->event.timer_set) {
+            ngx_del_timer(&lsmcf->event);
+        }
+
+        ngx_http_limit_sync_flush(lsmcf, cycle->log);
+    }
+
+    ngx_close_connection(lsmcf->connection);
+
+    lsmcf->connection = NULL;
+    lsmcf->fd = (ngx_socket_t) -1;
+}
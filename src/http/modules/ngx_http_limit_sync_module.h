@@ -0,0 +1,42 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_LIMIT_SYNC_H_INCLUDED_
+#define _NGX_HTTP_LIMIT_SYNC_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/* a record is the key length, the key, and the 16-bit value */
+
+#define NGX_HTTP_LIMIT_SYNC_RECORD_LEN(len)  (size_t) (1 + (len) + 2)
+
+
+/*
+ * the collect handler moves the pending values of a zone to the buffer,
+ * it returns NGX_AGAIN if the buffer is full; the merge handler applies
+ * the value of a key received from a peer, the peer is identified by
+ * a hash of its address, and the time is the sender's time of the datagram
+ * in milliseconds
+ */
+
+typedef ngx_int_t (*ngx_http_limit_sync_collect_pt)(ngx_shm_zone_t *shm_zone,
+    ngx_buf_t *b);
+typedef void (*ngx_http_limit_sync_merge_pt)(ngx_shm_zone_t *shm_zone,
+    u_char *data, size_t len, ngx_uint_t value, uint32_t peer, uint64_t time);
+
+
+ngx_int_t ngx_http_limit_sync_add_zone(ngx_conf_t *cf,
+    ngx_shm_zone_t *shm_zone, ngx_http_limit_sync_collect_pt collect,
+    ngx_http_limit_sync_merge_pt merge);
+u_char *ngx_http_limit_sync_write(u_char *p, u_char *data, size_t len,
+    ngx_uint_t value);
+
+
+#endif /* _NGX_HTTP_LIMIT_SYNC_H_INCLUDED_ */
@@ -13,6 +13,10 @@
 #include <zlib.h>
 #endif
 
+#if (NGX_HAVE_PTHREAD)
+#include <pthread.h>
+#endif
+
 
 typedef struct ngx_http_log_op_s  ngx_http_log_op_t;
 
@@ -35,15 +39,22 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+    ngx_uint_t                  binary;     /* unsigned  binary:1 */
 } ngx_http_log_fmt_t;
 
 
 typedef struct {
     ngx_array_t                 formats;    /* array of ngx_http_log_fmt_t */
     ngx_uint_t                  combined_used; /* unsigned  combined_used:1 */
+#if (NGX_HAVE_PTHREAD)
+    ngx_array_t                *asyncs;     /* array of ngx_http_log_async_t * */
+#endif
 } ngx_http_log_main_conf_t;
 
 
+typedef struct ngx_http_log_async_s  ngx_http_log_async_t;
+
+
 typedef struct {
     u_char                     *start;
     u_char                     *pos;
@@ -52,9 +63,72 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+    ngx_syslog_peer_t          *syslog;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_async_t       *async;
+#endif
 } ngx_http_log_buf_t;
 
 
+#if (NGX_HAVE_PTHREAD)
+
+/*
+ * An asynchronous log has a ring of NGX_HTTP_LOG_ASYNC_BUFS buffers of
+ * the same size with a single producer and a single consumer.  The worker
+ * appends lines to the current buffer, queues a filled buffer by advancing
+ * the head, and continues with the next free buffer; the flusher thread
+ * writes the buffer and advances the tail.  If the ring is full, the lines
+ * are dropped or, with the "block" policy, the worker waits for the flusher
+ * to free a buffer, so the file is only written by the flusher.  The flusher
+ * does not log, the results of its writes are logged by the worker.
+ *
+ * The mutex is only taken to sleep and to wake up a sleeping side: the
+ * flusher sleeps on "cond" while the ring is empty, and the worker sleeps
+ * on "done" while it waits for the flusher.
+ */
+
+#define NGX_HTTP_LOG_ASYNC_BUFS   4
+
+#define NGX_HTTP_LOG_ASYNC_BLOCK  1
+#define NGX_HTTP_LOG_ASYNC_DROP   2
+
+
+struct ngx_http_log_async_s {
+    u_char                     *start[NGX_HTTP_LOG_ASYNC_BUFS];
+    size_t                      len[NGX_HTTP_LOG_ASYNC_BUFS];
+    ssize_t                     written[NGX_HTTP_LOG_ASYNC_BUFS];
+    ngx_err_t                   err[NGX_HTTP_LOG_ASYNC_BUFS];
+    size_t                      size;
+    ngx_int_t                   gzip;
+
+    ngx_atomic_t                head;       /* next buffer to queue */
+    ngx_atomic_t                tail;       /* next buffer to write */
+    ngx_uint_t                  checked;    /* next write to report */
+    ngx_atomic_t                exiting;
+    ngx_atomic_t                sleeping;   /* the flusher waits on cond */
+    ngx_atomic_t                waiting;    /* the worker waits on done */
+
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;
+    pthread_cond_t              done;
+
+    ngx_open_file_t            *file;
+    ngx_log_t                   log;        /* the silent log of flusher */
+
+    pthread_t                   tid;
+
+    ngx_uint_t                  overflow;
+    ngx_uint_t                  dropped;
+    time_t                      drop_log_time;
+
+    unsigned                    running:1;
+};
+
+#endif
+
+
 typedef struct {
     ngx_array_t                *lengths;
     ngx_array_t                *values;
@@ -66,7 +140,13 @@ typedef struct {
     ngx_http_log_script_t      *script;
     time_t                      disk_full_time;
     time_t                      error_log_time;
+    ngx_syslog_peer_t          *syslog;
     ngx_http_log_fmt_t         *format;
+    ngx_http_complex_value_t   *filter;
+
+    /* a request is sampled if its key hash is below the threshold */
+    uint32_t                    sample;
+    ngx_http_complex_value_t   *sample_key;
 } ngx_http_log_t;
 
 
@@ -85,9 +165,22 @@ typedef struct {
     ngx_str_t                   name;
     size_t                      len;
     ngx_http_log_op_run_pt      run;
+    ngx_http_log_op_run_pt      json;       /* NULL for strings */
+    ngx_http_log_op_run_pt      msgpack;    /* NULL for strings */
 } ngx_http_log_var_t;
 
 
+#define NGX_HTTP_LOG_TEXT         0
+#define NGX_HTTP_LOG_JSON         1
+#define NGX_HTTP_LOG_MSGPACK      2
+
+/* the interval to retry sending to a busy syslog receiver */
+#define NGX_HTTP_LOG_SYSLOG_RETRY  10
+
+/* the largest msgpack number: a type byte and 8 bytes of data */
+#define NGX_HTTP_LOG_MSGPACK_NUM  9
+
+
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -101,9 +194,36 @@ static void *ngx_http_log_gzip_alloc(void *opaque, u_int items, u_int size);
 static void ngx_http_log_gzip_free(void *opaque, void *address);
 #endif
 
+static void ngx_http_log_flush_buf(ngx_open_file_t *file, u_char *buf,
+    size_t len, ngx_int_t gzip, ngx_log_t *log);
+static ssize_t ngx_http_log_write_buf(ngx_open_file_t *file, u_char *buf,
+    size_t len, ngx_int_t gzip, ngx_log_t *log);
+static void ngx_http_log_write_error(ngx_open_file_t *file, ssize_t n,
+    size_t len, ngx_err_t err, ngx_log_t *log);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+static void ngx_http_log_syslog_flush(ngx_http_log_buf_t *buffer,
+    ngx_log_t *log);
+static void ngx_http_log_syslog_drop(ngx_syslog_peer_t *peer, u_char *buf,
+    size_t len, ngx_log_t *log);
+
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_log_async_queue(ngx_http_log_buf_t *buffer,
+    ngx_log_t *log);
+static void ngx_http_log_async_wait(ngx_http_log_async_t *async,
+    ngx_uint_t n);
+static void ngx_http_log_async_drain(ngx_http_log_buf_t *buffer,
+    ngx_log_t *log);
+static void ngx_http_log_async_check(ngx_http_log_async_t *async,
+    ngx_log_t *log);
+static void *ngx_http_log_async_thread(void *data);
+static void ngx_http_log_async_report(ngx_http_log_async_t *async,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_log_init_process(ngx_cycle_t *cycle);
+static void ngx_http_log_exit_process(ngx_cycle_t *cycle);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -123,6 +243,21 @@ static u_char *ngx_http_log_body_bytes_sent(ngx_http_request_t *r,
 static u_char *ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 
+static u_char *ngx_http_log_json_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_msgpack_msec(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_msgpack_request_time(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_msgpack_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_msgpack_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_msgpack_body_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_msgpack_request_length(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+
 static ngx_int_t ngx_http_log_variable_compile(ngx_conf_t *cf,
     ngx_http_log_op_t *op, ngx_str_t *value);
 static size_t ngx_http_log_variable_getlen(ngx_http_request_t *r,
@@ -131,6 +266,17 @@ static u_char *ngx_http_log_variable(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static uintptr_t ngx_http_log_escape(u_char *dst, u_char *src, size_t size);
 
+static size_t ngx_http_log_json_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static uintptr_t ngx_http_log_json_escape(u_char *dst, u_char *src,
+    size_t size);
+static size_t ngx_http_log_msgpack_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_msgpack_variable(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+
 
 static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_log_create_loc_conf(ngx_conf_t *cf);
@@ -142,6 +288,15 @@ static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
     ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+static char *ngx_http_log_compile_structured(ngx_conf_t *cf,
+    ngx_http_log_fmt_t *fmt, ngx_uint_t format, ngx_array_t *args,
+    ngx_uint_t s);
+static ngx_int_t ngx_http_log_compile_literal(ngx_conf_t *cf,
+    ngx_array_t *ops, ngx_array_t *literal);
+static void ngx_http_log_set_literal(ngx_http_log_op_t *op, u_char *data,
+    size_t len, u_char *p);
+static ngx_http_complex_value_t *ngx_http_log_compile_value(ngx_conf_t *cf,
+    ngx_str_t *value);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
@@ -197,10 +352,18 @@ ngx_module_t  ngx_http_log_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_init_process,             /* init process */
+#else
     NULL,                                  /* init process */
+#endif
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_exit_process,             /* exit process */
+#else
     NULL,                                  /* exit process */
+#endif
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -216,22 +379,33 @@ static ngx_str_t  ngx_http_combined_fmt =
 
 
 static ngx_http_log_var_t  ngx_http_log_vars[] = {
-    { ngx_string("pipe"), 1, ngx_http_log_pipe },
+    { ngx_string("pipe"), 1, ngx_http_log_pipe, NULL, NULL },
     { ngx_string("time_local"), sizeof("28/Sep/1970:12:00:00 +0600") - 1,
-                          ngx_http_log_time },
+                          ngx_http_log_time, NULL, NULL },
     { ngx_string("time_iso8601"), sizeof("1970-09-28T12:00:00+06:00") - 1,
-                          ngx_http_log_iso8601 },
-    { ngx_string("msec"), NGX_TIME_T_LEN + 4, ngx_http_log_msec },
+                          ngx_http_log_iso8601, NULL, NULL },
+    { ngx_string("msec"), NGX_TIME_T_LEN + 4, ngx_http_log_msec,
+                          ngx_http_log_msec, ngx_http_log_msgpack_msec },
     { ngx_string("request_time"), NGX_TIME_T_LEN + 4,
-                          ngx_http_log_request_time },
-    { ngx_string("status"), NGX_INT_T_LEN, ngx_http_log_status },
-    { ngx_string("bytes_sent"), NGX_OFF_T_LEN, ngx_http_log_bytes_sent },
+                          ngx_http_log_request_time,
+                          ngx_http_log_request_time,
+                          ngx_http_log_msgpack_request_time },
+    { ngx_string("status"), NGX_INT_T_LEN, ngx_http_log_status,
+                          ngx_http_log_json_status,
+                          ngx_http_log_msgpack_status },
+    { ngx_string("bytes_sent"), NGX_OFF_T_LEN, ngx_http_log_bytes_sent,
+                          ngx_http_log_bytes_sent,
+                          ngx_http_log_msgpack_bytes_sent },
     { ngx_string("body_bytes_sent"), NGX_OFF_T_LEN,
-                          ngx_http_log_body_bytes_sent },
+                          ngx_http_log_body_bytes_sent,
+                          ngx_http_log_body_bytes_sent,
+                          ngx_http_log_msgpack_body_bytes_sent },
     { ngx_string("request_length"), NGX_SIZE_T_LEN,
-                          ngx_http_log_request_length },
+                          ngx_http_log_request_length,
+                          ngx_http_log_request_length,
+                          ngx_http_log_msgpack_request_length },
 
-    { ngx_null_string, 0, NULL }
+    { ngx_null_string, 0, NULL, NULL, NULL }
 };
 
 
@@ -240,7 +414,9 @@ ngx_http_log_handler(ngx_http_request_t *r)
 {
     u_char                   *line, *p;
     size_t                    len;
-    ngx_uint_t                i, l;
+    uint32_t                  hash;
+    ngx_str_t                 val;
+    ngx_uint_t                i, l, key[2];
     ngx_http_log_t           *log;
     ngx_http_log_op_t        *op;
     ngx_http_log_buf_t       *buffer;
@@ -258,6 +434,41 @@ ngx_http_log_handler(ngx_http_request_t *r)
     log = lcf->logs->elts;
     for (l = 0; l < lcf->logs->nelts; l++) {
 
+        /* the skipped requests are not formatted at all */
+
+        if (log[l].filter) {
+            if (ngx_http_complex_value(r, log[l].filter, &val) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            if (val.len == 0 || (val.len == 1 && val.data[0] == '0')) {
+                continue;
+            }
+        }
+
+        if (log[l].sample) {
+
+            if (log[l].sample_key) {
+                if (ngx_http_complex_value(r, log[l].sample_key, &val)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                hash = ngx_murmur_hash2(val.data, val.len);
+
+            } else {
+                key[0] = r->connection->number;
+                key[1] = r->connection->requests;
+
+                hash = ngx_murmur_hash2((u_char *) key, sizeof(key));
+            }
+
+            if (hash >= log[l].sample) {
+                continue;
+            }
+        }
+
         if (ngx_time() == log[l].disk_full_time) {
 
             /*
@@ -282,18 +493,69 @@ ngx_http_log_handler(ngx_http_request_t *r)
             }
         }
 
-        len += NGX_LINEFEED_SIZE;
+        if (!log[l].format->binary) {
+            len += NGX_LINEFEED_SIZE;
+        }
+
+        if (log[l].syslog) {
+            len += ngx_syslog_header_len(log[l].syslog);
+        }
 
         buffer = log[l].file ? log[l].file->data : NULL;
 
         if (buffer) {
 
+            if (buffer->syslog
+                && len > (size_t) (buffer->last - buffer->pos)
+                && len <= (size_t) (buffer->last - buffer->start))
+            {
+                ngx_http_log_syslog_flush(buffer, r->connection->log);
+
+                if (len > (size_t) (buffer->last - buffer->pos)) {
+                    /* the receiver does not keep up, drop the line */
+                    buffer->syslog->dropped++;
+                    ngx_http_log_syslog_drop(buffer->syslog, NULL, 0,
+                                             r->connection->log);
+                    continue;
+                }
+            }
+
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
+#if (NGX_HAVE_PTHREAD)
+                if (buffer->async && buffer->async->running) {
+
+                    if (ngx_http_log_async_queue(buffer, r->connection->log)
+                        != NGX_OK)
+                    {
+                        if (buffer->async->overflow
+                            == NGX_HTTP_LOG_ASYNC_DROP)
+                        {
+                            buffer->async->dropped++;
+                            continue;
+                        }
+
+                        /* all buffers are busy, wait for a free one */
+
+                        ngx_http_log_async_wait(buffer->async,
+                                                NGX_HTTP_LOG_ASYNC_BUFS - 2);
+
+                        (void) ngx_http_log_async_queue(buffer,
+                                                        r->connection->log);
+                    }
+
+                } else {
+                    ngx_http_log_write(r, &log[l], buffer->start,
+                                       buffer->pos - buffer->start);
+
+                    buffer->pos = buffer->start;
+                }
+#else
                 ngx_http_log_write(r, &log[l], buffer->start,
                                    buffer->pos - buffer->start);
 
                 buffer->pos = buffer->start;
+#endif
             }
 
             if (len <= (size_t) (buffer->last - buffer->pos)) {
@@ -304,11 +566,17 @@ ngx_http_log_handler(ngx_http_request_t *r)
                     ngx_add_timer(buffer->event, buffer->flush);
                 }
 
+                if (log[l].syslog) {
+                    p = ngx_syslog_add_header(log[l].syslog, p);
+                }
+
                 for (i = 0; i < log[l].format->ops->nelts; i++) {
                     p = op[i].run(r, p, &op[i]);
                 }
 
-                ngx_linefeed(p);
+                if (!log[l].format->binary) {
+                    ngx_linefeed(p);
+                }
 
                 buffer->pos = p;
 
@@ -327,11 +595,17 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         p = line;
 
+        if (log[l].syslog) {
+            p = ngx_syslog_add_header(log[l].syslog, p);
+        }
+
         for (i = 0; i < log[l].format->ops->nelts; i++) {
             p = op[i].run(r, p, &op[i]);
         }
 
-        ngx_linefeed(p);
+        if (!log[l].format->binary) {
+            ngx_linefeed(p);
+        }
 
         ngx_http_log_write(r, &log[l], line, p - line);
     }
@@ -352,6 +626,17 @@ ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
     ngx_http_log_buf_t  *buffer;
 #endif
 
+    if (log->syslog) {
+        n = ngx_syslog_send_lines(log->syslog, buf, len);
+
+        if ((size_t) n != len) {
+            ngx_http_log_syslog_drop(log->syslog, buf + n, len - n,
+                                     r->connection->log);
+        }
+
+        return;
+    }
+
     if (log->script == NULL) {
         name = log->file->name.data;
 
@@ -649,32 +934,37 @@ ngx_http_log_gzip_free(void *opaque, void *address)
 
 
 static void
-ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+ngx_http_log_flush_buf(ngx_open_file_t *file, u_char *buf, size_t len,
+    ngx_int_t gzip, ngx_log_t *log)
 {
-    size_t               len;
-    ssize_t              n;
-    ngx_http_log_buf_t  *buffer;
+    ssize_t  n;
 
-    buffer = file->data;
+    n = ngx_http_log_write_buf(file, buf, len, gzip, log);
 
-    len = buffer->pos - buffer->start;
+    ngx_http_log_write_error(file, n, len, (n == -1) ? ngx_errno : 0, log);
+}
 
-    if (len == 0) {
-        return;
-    }
 
+static ssize_t
+ngx_http_log_write_buf(ngx_open_file_t *file, u_char *buf, size_t len,
+    ngx_int_t gzip, ngx_log_t *log)
+{
 #if (NGX_ZLIB)
-    if (buffer->gzip) {
-        n = ngx_http_log_gzip(file->fd, buffer->start, len, buffer->gzip, log);
-    } else {
-        n = ngx_write_fd(file->fd, buffer->start, len);
+    if (gzip) {
+        return ngx_http_log_gzip(file->fd, buf, len, gzip, log);
     }
-#else
-    n = ngx_write_fd(file->fd, buffer->start, len);
 #endif
 
+    return ngx_write_fd(file->fd, buf, len);
+}
+
+
+static void
+ngx_http_log_write_error(ngx_open_file_t *file, ssize_t n, size_t len,
+    ngx_err_t err, ngx_log_t *log)
+{
     if (n == -1) {
-        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+        ngx_log_error(NGX_LOG_ALERT, log, err,
                       ngx_write_fd_n " to \"%s\" failed",
                       file->name.data);
 
@@ -683,165 +973,861 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
                       ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
                       file->name.data, n, len);
     }
-
-    buffer->pos = buffer->start;
-
-    if (buffer->event && buffer->event->timer_set) {
-        ngx_del_timer(buffer->event);
-    }
 }
 
 
 static void
-ngx_http_log_flush_handler(ngx_event_t *ev)
+ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 {
-    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
-                   "http log buffer flush handler");
+    size_t               len, n;
+    ngx_http_log_buf_t  *buffer;
 
-    ngx_http_log_flush(ev->data, ev->log);
-}
+    buffer = file->data;
 
+#if (NGX_HAVE_PTHREAD)
 
-static u_char *
-ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    size_t     len;
-    uintptr_t  data;
+    if (buffer->async && buffer->async->running) {
 
-    len = op->len;
-    data = op->data;
+        /*
+         * the file is going to be reopened or closed,
+         * so wait until all queued buffers are written
+         */
 
-    while (len--) {
-        *buf++ = (u_char) (data & 0xff);
-        data >>= 8;
+        ngx_http_log_async_drain(buffer, log);
+
+        if (buffer->event && buffer->event->timer_set) {
+            ngx_del_timer(buffer->event);
+        }
+
+        return;
     }
 
-    return buf;
-}
+#endif
 
+    len = buffer->pos - buffer->start;
 
-static u_char *
-ngx_http_log_copy_long(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, (u_char *) op->data, op->len);
-}
+    if (len == 0) {
+        return;
+    }
 
+    if (buffer->syslog) {
+        n = ngx_syslog_send_lines(buffer->syslog, buffer->start, len);
+
+        if (n != len || buffer->syslog->dropped) {
+            /* the log is going to be closed, report the drops now */
+            buffer->syslog->drop_log_time = 0;
+
+            ngx_http_log_syslog_drop(buffer->syslog, buffer->start + n,
+                                     len - n, log);
+        }
 
-static u_char *
-ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    if (r->pipeline) {
-        *buf = 'p';
     } else {
-        *buf = '.';
+        ngx_http_log_flush_buf(file, buffer->start, len, buffer->gzip, log);
     }
 
-    return buf + 1;
+    buffer->pos = buffer->start;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
 }
 
 
-static u_char *
-ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+static void
+ngx_http_log_flush_handler(ngx_event_t *ev)
 {
-    return ngx_cpymem(buf, ngx_cached_http_log_time.data,
-                      ngx_cached_http_log_time.len);
-}
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
 
-static u_char *
-ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
-                      ngx_cached_http_log_iso8601.len);
-}
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "http log buffer flush handler");
 
-static u_char *
-ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    ngx_time_t  *tp;
+    file = ev->data;
+    buffer = file->data;
 
-    tp = ngx_timeofday();
+    if (buffer->syslog) {
+        ngx_http_log_syslog_flush(buffer, ev->log);
+        return;
+    }
 
-    return ngx_sprintf(buf, "%T.%03M", tp->sec, tp->msec);
-}
+#if (NGX_HAVE_PTHREAD)
 
+    if (buffer->async && buffer->async->running) {
 
-static u_char *
-ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    ngx_time_t      *tp;
-    ngx_msec_int_t   ms;
+        if (ngx_http_log_async_queue(buffer, ev->log) != NGX_OK) {
+            /* all buffers are busy, try again later */
+            ngx_add_timer(ev, buffer->flush);
+        }
 
-    tp = ngx_timeofday();
+        return;
+    }
 
-    ms = (ngx_msec_int_t)
-             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
-    ms = ngx_max(ms, 0);
+#endif
 
-    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+    ngx_http_log_flush(file, ev->log);
 }
 
 
-static u_char *
-ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+static void
+ngx_http_log_syslog_flush(ngx_http_log_buf_t *buffer, ngx_log_t *log)
 {
-    ngx_uint_t  status;
+    size_t  len, n;
 
-    if (r->err_status) {
-        status = r->err_status;
+    len = buffer->pos - buffer->start;
+
+    if (len == 0) {
+        return;
+    }
 
-    } else if (r->headers_out.status) {
-        status = r->headers_out.status;
+    n = ngx_syslog_send_lines(buffer->syslog, buffer->start, len);
 
-    } else if (r->http_version == NGX_HTTP_VERSION_9) {
-        status = 9;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log syslog flush %uz of %uz", n, len);
+
+    if (n == len) {
+        buffer->pos = buffer->start;
+
+        if (buffer->event->timer_set) {
+            ngx_del_timer(buffer->event);
+        }
 
     } else {
-        status = 0;
+        ngx_memmove(buffer->start, buffer->start + n, len - n);
+        buffer->pos = buffer->start + len - n;
+
+        /*
+         * the receiver is busy, the rest is retried shortly; an exiting
+         * worker waits for its timers, so it leaves the rest to the flush
+         * on exit instead
+         */
+
+        if (!ngx_exiting) {
+            ngx_add_timer(buffer->event, NGX_HTTP_LOG_SYSLOG_RETRY);
+        }
     }
 
-    return ngx_sprintf(buf, "%03ui", status);
+    if (buffer->syslog->dropped) {
+        ngx_http_log_syslog_drop(buffer->syslog, NULL, 0, log);
+    }
 }
 
 
-static u_char *
-ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
+static void
+ngx_http_log_syslog_drop(ngx_syslog_peer_t *peer, u_char *buf, size_t len,
+    ngx_log_t *log)
 {
-    return ngx_sprintf(buf, "%O", r->connection->sent);
-}
+    u_char  *p, *last;
+    time_t   now;
 
+    last = buf + len;
 
-/*
- * although there is a real $body_bytes_sent variable,
- * this log operation code function is more optimized for logging
- */
-
-static u_char *
-ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    off_t  length;
+    for (p = buf; p < last; p++) {
+        if (*p == LF) {
+            peer->dropped++;
+        }
+    }
 
-    length = r->connection->sent - r->header_size;
+    now = ngx_time();
 
-    if (length > 0) {
-        return ngx_sprintf(buf, "%O", length);
+    if (peer->dropped == 0 || now - peer->drop_log_time < 60) {
+        return;
     }
 
-    *buf = '0';
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "%ui lines dropped from access_log to syslog server %V",
+                  peer->dropped, &peer->server.name);
 
-    return buf + 1;
+    peer->dropped = 0;
+    peer->drop_log_time = now;
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+static ngx_int_t
+ngx_http_log_async_queue(ngx_http_log_buf_t *buffer, ngx_log_t *log)
+{
+    u_char                *p;
+    ngx_uint_t             n, head;
+    ngx_http_log_async_t  *async;
+
+    async = buffer->async;
+
+    ngx_http_log_async_check(async, log);
+
+    if (buffer->pos == buffer->start) {
+        return NGX_OK;
+    }
+
+    head = async->head;
+
+    /* the current buffer is never busy, so one buffer is kept free */
+
+    if (head - async->tail == NGX_HTTP_LOG_ASYNC_BUFS - 1) {
+        return NGX_BUSY;
+    }
+
+    n = head % NGX_HTTP_LOG_ASYNC_BUFS;
+
+    async->len[n] = buffer->pos - buffer->start;
+
+    /*
+     * the buffer is complete before the flusher can see it; the atomic
+     * increment is a full barrier, so either the flusher sees the new head
+     * or it is seen sleeping and is woken up
+     */
+
+    ngx_memory_barrier();
+
+    (void) ngx_atomic_fetch_add(&async->head, 1);
+
+    if (async->sleeping) {
+        (void) pthread_mutex_lock(&async->mutex);
+        (void) pthread_cond_signal(&async->cond);
+        (void) pthread_mutex_unlock(&async->mutex);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log async queue #%ui %uz", head, async->len[n]);
+
+    p = async->start[(head + 1) % NGX_HTTP_LOG_ASYNC_BUFS];
+
+    buffer->start = p;
+    buffer->pos = p;
+    buffer->last = p + async->size;
+
+    if (async->dropped) {
+        ngx_http_log_async_report(async, log);
+    }
+
+    return NGX_OK;
+}
+
+
+/* waits until no more than n buffers are queued */
+
+static void
+ngx_http_log_async_wait(ngx_http_log_async_t *async, ngx_uint_t n)
+{
+    (void) pthread_mutex_lock(&async->mutex);
+
+    (void) ngx_atomic_cmp_set(&async->waiting, 0, 1);
+
+    while (async->head - async->tail > n) {
+        (void) pthread_cond_wait(&async->done, &async->mutex);
+    }
+
+    async->waiting = 0;
+
+    (void) pthread_mutex_unlock(&async->mutex);
+}
+
+
+static void
+ngx_http_log_async_drain(ngx_http_log_buf_t *buffer, ngx_log_t *log)
+{
+    ngx_http_log_async_t  *async;
+
+    async = buffer->async;
+
+    /* the file is reopened or closed only after all buffers are written */
+
+    if (ngx_http_log_async_queue(buffer, log) == NGX_BUSY) {
+        ngx_http_log_async_wait(async, NGX_HTTP_LOG_ASYNC_BUFS - 2);
+        (void) ngx_http_log_async_queue(buffer, log);
+    }
+
+    ngx_http_log_async_wait(async, 0);
+
+    ngx_http_log_async_check(async, log);
+}
+
+
+static void
+ngx_http_log_async_check(ngx_http_log_async_t *async, ngx_log_t *log)
+{
+    ngx_uint_t  n, tail;
+
+    tail = async->tail;
+
+    /* the results are read after the tail */
+
+    ngx_memory_barrier();
+
+    while (async->checked != tail) {
+        n = async->checked % NGX_HTTP_LOG_ASYNC_BUFS;
+
+        ngx_http_log_write_error(async->file, async->written[n],
+                                 async->len[n], async->err[n], log);
+
+        async->checked++;
+    }
+}
+
+
+static void *
+ngx_http_log_async_thread(void *data)
+{
+    ngx_http_log_async_t  *async = data;
+
+    ssize_t     written;
+    ngx_uint_t  n, tail;
+
+    for ( ;; ) {
+
+        tail = async->tail;
+
+        if (tail == async->head) {
+
+            (void) pthread_mutex_lock(&async->mutex);
+
+            /* a full barrier, see ngx_http_log_async_queue() */
+
+            (void) ngx_atomic_cmp_set(&async->sleeping, 0, 1);
+
+            while (tail == async->head && !async->exiting) {
+                (void) pthread_cond_wait(&async->cond, &async->mutex);
+            }
+
+            async->sleeping = 0;
+
+            (void) pthread_mutex_unlock(&async->mutex);
+
+            if (tail == async->head) {
+                /* exiting */
+                break;
+            }
+
+            continue;
+        }
+
+        /* the buffer is read after the head */
+
+        ngx_memory_barrier();
+
+        n = tail % NGX_HTTP_LOG_ASYNC_BUFS;
+
+        written = ngx_http_log_write_buf(async->file, async->start[n],
+                                         async->len[n], async->gzip,
+                                         &async->log);
+
+        async->err[n] = (written == -1) ? ngx_errno : 0;
+        async->written[n] = written;
+
+        /* the result is stored before the buffer is released */
+
+        ngx_memory_barrier();
+
+        (void) ngx_atomic_fetch_add(&async->tail, 1);
+
+        if (async->waiting) {
+            (void) pthread_mutex_lock(&async->mutex);
+            (void) pthread_cond_signal(&async->done);
+            (void) pthread_mutex_unlock(&async->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_log_async_report(ngx_http_log_async_t *async, ngx_log_t *log)
+{
+    time_t  now;
+
+    now = ngx_time();
+
+    if (now - async->drop_log_time < 60 && !async->exiting) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "%ui lines dropped from access_log \"%s\"",
+                  async->dropped, async->file->name.data);
+
+    async->dropped = 0;
+    async->drop_log_time = now;
+}
+
+
+static ngx_int_t
+ngx_http_log_init_process(ngx_cycle_t *cycle)
+{
+    ngx_err_t                  err;
+    sigset_t                   set, old;
+    ngx_uint_t                 i;
+    ngx_http_log_async_t     **async;
+    ngx_http_log_main_conf_t  *lmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        /* the cache manager and loader do not write access logs */
+        return NGX_OK;
+    }
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->asyncs == NULL) {
+        return NGX_OK;
+    }
+
+    /* the flusher threads do not handle signals */
+
+    sigfillset(&set);
+
+    if (pthread_sigmask(SIG_SETMASK, &set, &old) != 0) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "pthread_sigmask() failed");
+        return NGX_OK;
+    }
+
+    async = lmcf->asyncs->elts;
+
+    for (i = 0; i < lmcf->asyncs->nelts; i++) {
+
+        /* the flusher uses a log that never writes anything */
+
+        async[i]->log.file = cycle->log->file;
+        async[i]->log.log_level = 0;
+
+        err = pthread_mutex_init(&async[i]->mutex, NULL);
+
+        if (err == 0) {
+            err = pthread_cond_init(&async[i]->cond, NULL);
+
+            if (err == 0) {
+                err = pthread_cond_init(&async[i]->done, NULL);
+            }
+        }
+
+        if (err == 0) {
+            err = pthread_create(&async[i]->tid, NULL,
+                                 ngx_http_log_async_thread, async[i]);
+        }
+
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                          "failed to start flusher thread, "
+                          "access_log \"%s\" is written synchronously",
+                          async[i]->file->name.data);
+            continue;
+        }
+
+        async[i]->running = 1;
+    }
+
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_log_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i;
+    ngx_http_log_buf_t        *buffer;
+    ngx_http_log_async_t     **async;
+    ngx_http_log_main_conf_t  *lmcf;
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->asyncs == NULL) {
+        return;
+    }
+
+    async = lmcf->asyncs->elts;
+
+    for (i = 0; i < lmcf->asyncs->nelts; i++) {
+
+        if (!async[i]->running) {
+            continue;
+        }
+
+        buffer = async[i]->file->data;
+
+        ngx_http_log_async_drain(buffer, cycle->log);
+
+        async[i]->exiting = 1;
+
+        (void) pthread_mutex_lock(&async[i]->mutex);
+        (void) pthread_cond_signal(&async[i]->cond);
+        (void) pthread_mutex_unlock(&async[i]->mutex);
+
+        (void) pthread_join(async[i]->tid, NULL);
+
+        /* the rest is written synchronously */
+
+        async[i]->running = 0;
+
+        if (async[i]->dropped) {
+            ngx_http_log_async_report(async[i], cycle->log);
+        }
+    }
+}
+
+#endif
+
+
+static u_char *
+ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    size_t     len;
+    uintptr_t  data;
+
+    len = op->len;
+    data = op->data;
+
+    while (len--) {
+        *buf++ = (u_char) (data & 0xff);
+        data >>= 8;
+    }
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_copy_long(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, (u_char *) op->data, op->len);
+}
+
+
+static u_char *
+ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    if (r->pipeline) {
+        *buf = 'p';
+    } else {
+        *buf = '.';
+    }
+
+    return buf + 1;
+}
+
+
+static u_char *
+ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, ngx_cached_http_log_time.data,
+                      ngx_cached_http_log_time.len);
+}
+
+static u_char *
+ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
+                      ngx_cached_http_log_iso8601.len);
+}
+
+/*
+ * the numbers are written directly instead of using ngx_sprintf(),
+ * the text output is the same as of "%T.%03M", "%03ui", and "%O"
+ */
+
+static ngx_inline u_char *
+ngx_http_log_number(u_char *buf, uint64_t n)
+{
+    u_char  *p, tmp[NGX_INT64_LEN];
+
+    p = tmp + NGX_INT64_LEN;
+
+    do {
+        *--p = (u_char) (n % 10 + '0');
+        n /= 10;
+    } while (n);
+
+    return ngx_cpymem(buf, p, tmp + NGX_INT64_LEN - p);
+}
+
+
+static ngx_inline u_char *
+ngx_http_log_msecs(u_char *buf, uint64_t sec, ngx_uint_t msec)
+{
+    buf = ngx_http_log_number(buf, sec);
+
+    *buf++ = '.';
+    *buf++ = (u_char) (msec / 100 + '0');
+    *buf++ = (u_char) (msec / 10 % 10 + '0');
+    *buf++ = (u_char) (msec % 10 + '0');
+
+    return buf;
+}
+
+
+static ngx_inline ngx_msec_int_t
+ngx_http_log_request_msec(ngx_http_request_t *r)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+    return ngx_max(ms, 0);
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_http_log_status_value(ngx_http_request_t *r)
+{
+    if (r->err_status) {
+        return r->err_status;
+    }
+
+    if (r->headers_out.status) {
+        return r->headers_out.status;
+    }
+
+    if (r->http_version == NGX_HTTP_VERSION_9) {
+        return 9;
+    }
+
+    return 0;
+}
+
+
+static u_char *
+ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_http_log_msecs(buf, tp->sec, tp->msec);
+}
+
+
+static u_char *
+ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_msec_int_t  ms;
+
+    ms = ngx_http_log_request_msec(r);
+
+    return ngx_http_log_msecs(buf, ms / 1000, ms % 1000);
+}
+
+
+static u_char *
+ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_uint_t  status;
+
+    status = ngx_http_log_status_value(r);
+
+    if (status > 999) {
+        return ngx_http_log_number(buf, status);
+    }
+
+    *buf++ = (u_char) (status / 100 + '0');
+    *buf++ = (u_char) (status / 10 % 10 + '0');
+    *buf++ = (u_char) (status % 10 + '0');
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_number(buf, r->connection->sent);
+}
+
+
+/*
+ * although there is a real $body_bytes_sent variable,
+ * this log operation code function is more optimized for logging
+ */
+
+static u_char *
+ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    if (length > 0) {
+        return ngx_http_log_number(buf, length);
+    }
+
+    *buf = '0';
+
+    return buf + 1;
+}
+
+
+static u_char *
+ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_number(buf, r->request_length);
+}
+
+
+/* JSON numbers cannot have leading zeros */
+
+static u_char *
+ngx_http_log_json_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_number(buf, ngx_http_log_status_value(r));
+}
+
+
+static u_char *
+ngx_http_log_msgpack_uint(u_char *buf, uint64_t n)
+{
+    ngx_uint_t  len;
+
+    if (n < 0x80) {
+        *buf++ = (u_char) n;
+        return buf;
+    }
+
+    if (n <= 0xff) {
+        *buf++ = 0xcc;
+        len = 1;
+
+    } else if (n <= 0xffff) {
+        *buf++ = 0xcd;
+        len = 2;
+
+    } else if (n <= 0xffffffff) {
+        *buf++ = 0xce;
+        len = 4;
+
+    } else {
+        *buf++ = 0xcf;
+        len = 8;
+    }
+
+    /* big-endian */
+
+    while (len--) {
+        *buf++ = (u_char) (n >> (len * 8));
+    }
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_msgpack_double(u_char *buf, double d)
+{
+    ngx_uint_t  len;
+    union {
+        double     d;
+        uint64_t   n;
+    } v;
+
+    v.d = d;
+
+    *buf++ = 0xcb;
+
+    for (len = 8; len--; /* void */) {
+        *buf++ = (u_char) (v.n >> (len * 8));
+    }
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_msgpack_str(u_char *buf, size_t len)
+{
+    if (len < 32) {
+        *buf++ = (u_char) (0xa0 | len);
+
+    } else if (len <= 0xff) {
+        *buf++ = 0xd9;
+        *buf++ = (u_char) len;
+
+    } else if (len <= 0xffff) {
+        *buf++ = 0xda;
+        *buf++ = (u_char) (len >> 8);
+        *buf++ = (u_char) len;
+
+    } else {
+        *buf++ = 0xdb;
+        *buf++ = (u_char) (len >> 24);
+        *buf++ = (u_char) (len >> 16);
+        *buf++ = (u_char) (len >> 8);
+        *buf++ = (u_char) len;
+    }
+
+    return buf;
+}
+
+
+#define ngx_http_log_msgpack_str_len(len)                                     \
+    ((len) < 32 ? 1 : ((len) <= 0xff ? 2 : ((len) <= 0xffff ? 3 : 5)))
+
+
 static u_char *
-ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
+ngx_http_log_msgpack_msec(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_http_log_msgpack_double(buf, tp->sec + tp->msec / 1000.0);
+}
+
+
+static u_char *
+ngx_http_log_msgpack_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_msgpack_double(buf,
+                                       ngx_http_log_request_msec(r) / 1000.0);
+}
+
+
+static u_char *
+ngx_http_log_msgpack_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_msgpack_uint(buf, ngx_http_log_status_value(r));
+}
+
+
+static u_char *
+ngx_http_log_msgpack_bytes_sent(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
 {
-    return ngx_sprintf(buf, "%O", r->request_length);
+    return ngx_http_log_msgpack_uint(buf, r->connection->sent);
+}
+
+
+static u_char *
+ngx_http_log_msgpack_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    return ngx_http_log_msgpack_uint(buf, length > 0 ? length : 0);
+}
+
+
+static u_char *
+ngx_http_log_msgpack_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_msgpack_uint(buf, r->request_length);
 }
 
 
@@ -906,9 +1892,25 @@ ngx_http_log_variable(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 }
 
 
+/*
+ * The escaping scans test 8 bytes at once: ngx_http_log_has_less() is
+ * non-zero if any byte of the word is less than n (n <= 128), and
+ * ngx_http_log_has_byte() is non-zero if any byte of the word equals c.
+ */
+
+#define NGX_HTTP_LOG_ONES  ((uint64_t) 0x0101010101010101LL)
+
+#define ngx_http_log_has_less(w, n)                                           \
+    (((w) - NGX_HTTP_LOG_ONES * (n)) & ~(w) & (NGX_HTTP_LOG_ONES * 0x80))
+
+#define ngx_http_log_has_byte(w, c)                                           \
+    ngx_http_log_has_less((w) ^ (NGX_HTTP_LOG_ONES * (c)), 1)
+
+
 static uintptr_t
 ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
 {
+    uint64_t        w;
     ngx_uint_t      n;
     static u_char   hex[] = "0123456789ABCDEF";
 
@@ -938,6 +1940,24 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
         n = 0;
 
         while (size) {
+
+            if (size >= 8) {
+                ngx_memcpy(&w, src, 8);
+
+                /* skip the words that need no escaping */
+
+                if (!(ngx_http_log_has_less(w, 0x20)
+                      | (w & (NGX_HTTP_LOG_ONES * 0x80))
+                      | ngx_http_log_has_byte(w, '"')
+                      | ngx_http_log_has_byte(w, '\\')
+                      | ngx_http_log_has_byte(w, 0x7f)))
+                {
+                    src += 8;
+                    size -= 8;
+                    continue;
+                }
+            }
+
             if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
                 n++;
             }
@@ -966,6 +1986,160 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
 }
 
 
+static size_t
+ngx_http_log_json_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    uintptr_t                   len;
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return sizeof("null") - 1;
+    }
+
+    len = ngx_http_log_json_escape(NULL, value->data, value->len);
+
+    value->escape = len ? 1 : 0;
+
+    return sizeof("\"\"") - 1 + value->len + len;
+}
+
+
+static u_char *
+ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        return ngx_cpymem(buf, "null", sizeof("null") - 1);
+    }
+
+    *buf++ = '"';
+
+    if (value->escape == 0) {
+        buf = ngx_cpymem(buf, value->data, value->len);
+
+    } else {
+        buf = (u_char *) ngx_http_log_json_escape(buf, value->data,
+                                                  value->len);
+    }
+
+    *buf++ = '"';
+
+    return buf;
+}
+
+
+/*
+ * escapes '"', '\\', and control characters,
+ * returns the number of the extra bytes if dst is NULL
+ */
+
+static uintptr_t
+ngx_http_log_json_escape(u_char *dst, u_char *src, size_t size)
+{
+    u_char          ch;
+    uint64_t        w;
+    ngx_uint_t      len;
+    static u_char   hex[] = "0123456789abcdef";
+
+    if (dst == NULL) {
+        len = 0;
+
+        while (size) {
+
+            if (size >= 8) {
+                ngx_memcpy(&w, src, 8);
+
+                if (!(ngx_http_log_has_less(w, 0x20)
+                      | ngx_http_log_has_byte(w, '"')
+                      | ngx_http_log_has_byte(w, '\\')))
+                {
+                    src += 8;
+                    size -= 8;
+                    continue;
+                }
+            }
+
+            ch = *src++;
+
+            if (ch == '"' || ch == '\\') {
+                len++;
+
+            } else if (ch < 0x20) {
+                len += sizeof("\\u001f") - 2;
+            }
+
+            size--;
+        }
+
+        return (uintptr_t) len;
+    }
+
+    while (size) {
+        ch = *src++;
+
+        if (ch == '"' || ch == '\\') {
+            *dst++ = '\\';
+            *dst++ = ch;
+
+        } else if (ch < 0x20) {
+            *dst++ = '\\';
+            *dst++ = 'u';
+            *dst++ = '0';
+            *dst++ = '0';
+            *dst++ = hex[ch >> 4];
+            *dst++ = hex[ch & 0xf];
+
+        } else {
+            *dst++ = ch;
+        }
+
+        size--;
+    }
+
+    return (uintptr_t) dst;
+}
+
+
+static size_t
+ngx_http_log_msgpack_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    return ngx_http_log_msgpack_str_len(value->len) + value->len;
+}
+
+
+static u_char *
+ngx_http_log_msgpack_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf = 0xc0;  /* nil */
+        return buf + 1;
+    }
+
+    buf = ngx_http_log_msgpack_str(buf, value->len);
+
+    return ngx_cpymem(buf, value->data, value->len);
+}
+
+
 static void *
 ngx_http_log_create_main_conf(ngx_conf_t *cf)
 {
@@ -992,6 +2166,7 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
     ngx_str_set(&fmt->name, "combined");
 
     fmt->flushes = NULL;
+    fmt->binary = 0;
 
     fmt->ops = ngx_array_create(cf->pool, 16, sizeof(ngx_http_log_op_t));
     if (fmt->ops == NULL) {
@@ -1085,6 +2260,7 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_log_loc_conf_t *llcf = conf;
 
+    u_char                     *p;
     ssize_t                     size;
     ngx_int_t                   gzip;
     ngx_uint_t                  i, n;
@@ -1093,8 +2269,14 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_t             *log;
     ngx_http_log_buf_t         *buffer;
     ngx_http_log_fmt_t         *fmt;
+    ngx_int_t                   sm, sn;
+    ngx_syslog_peer_t          *peer;
     ngx_http_log_main_conf_t   *lmcf;
     ngx_http_script_compile_t   sc;
+#if (NGX_HAVE_PTHREAD)
+    ngx_uint_t                  j, overflow;
+    ngx_http_log_async_t       *async, **pasync;
+#endif
 
     value = cf->args->elts;
 
@@ -1125,6 +2307,37 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ngx_memzero(log, sizeof(ngx_http_log_t));
 
+    if (ngx_strncmp(value[1].data, "syslog:", 7) == 0) {
+
+        peer = ngx_pcalloc(cf->pool, sizeof(ngx_syslog_peer_t));
+        if (peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_syslog_process_conf(cf, peer) != NGX_CONF_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        log->syslog = peer;
+
+        /*
+         * the nameless file is never opened or reopened,
+         * it is only used to flush the buffer on exit
+         */
+
+        log->file = ngx_list_push(&cf->cycle->open_files);
+        if (log->file == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        log->file->fd = NGX_INVALID_FILE;
+        ngx_str_null(&log->file->name);
+        log->file->flush = NULL;
+        log->file->data = NULL;
+
+        goto process_formats;
+    }
+
     n = ngx_http_script_variables_count(&value[1]);
 
     if (n == 0) {
@@ -1158,6 +2371,8 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+process_formats:
+
     if (cf->args->nelts >= 3) {
         name = value[2];
 
@@ -1189,6 +2404,9 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     flush = 0;
     gzip = 0;
+#if (NGX_HAVE_PTHREAD)
+    overflow = 0;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1246,18 +2464,144 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
 
-            continue;
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without zlib support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "async", 5) == 0
+            && (value[i].len == 5 || value[i].data[5] == '='))
+        {
+#if (NGX_HAVE_PTHREAD && NGX_HAVE_ATOMIC_OPS)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            if (value[i].len == 5
+                || ngx_strcmp(value[i].data + 6, "drop") == 0)
+            {
+                overflow = NGX_HTTP_LOG_ASYNC_DROP;
+                continue;
+            }
+
+            if (ngx_strcmp(value[i].data + 6, "block") == 0) {
+                overflow = NGX_HTTP_LOG_ASYNC_BLOCK;
+                continue;
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid overflow policy \"%s\", "
+                               "it must be \"block\" or \"drop\"",
+                               value[i].data + 6);
+            return NGX_CONF_ERROR;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "async logs are not supported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
+            s.len = value[i].len - 3;
+            s.data = value[i].data + 3;
+
+            log->filter = ngx_http_log_compile_value(cf, &s);
+            if (log->filter == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "sample=", 7) == 0) {
+            s.data = value[i].data + 7;
+            p = (u_char *) ngx_strchr(s.data, '/');
+
+            if (p == NULL) {
+                goto invalid_sample;
+            }
+
+            sm = ngx_atoi(s.data, p - s.data);
+            sn = ngx_atoi(p + 1, value[i].data + value[i].len - p - 1);
+
+            if (sm <= 0 || sn <= 0 || sm > sn) {
+                goto invalid_sample;
+            }
+
+            if (sm < sn) {
+                log->sample = (uint32_t) (((uint64_t) sm << 32) / sn);
+
+                if (log->sample == 0) {
+                    log->sample = 1;
+                }
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "sample_key=", 11) == 0) {
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            log->sample_key = ngx_http_log_compile_value(cf, &s);
+            if (log->sample_key == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+
+    invalid_sample:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid sample rate \"%s\", "
+                           "it must be \"M/N\" with M not greater than N",
+                           value[i].data + 7);
+        return NGX_CONF_ERROR;
+    }
+
+    if (log->syslog) {
+
+        if (log->format->binary) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "log format \"%V\" cannot be sent to syslog",
+                               &log->format->name);
+            return NGX_CONF_ERROR;
+        }
+
+        if (gzip) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "syslog logs cannot be compressed");
+            return NGX_CONF_ERROR;
+        }
 
-#else
+#if (NGX_HAVE_PTHREAD)
+        if (overflow) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "nginx was built without zlib support");
+                               "syslog logs cannot be async");
             return NGX_CONF_ERROR;
+        }
 #endif
+
+        /* the lines are always batched to avoid a syscall per line */
+
+        if (size == 0) {
+            size = 64 * 1024;
         }
 
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid parameter \"%V\"", &value[i]);
-        return NGX_CONF_ERROR;
+        if (flush == 0) {
+            flush = 1000;
+        }
     }
 
     if (flush && size == 0) {
@@ -1280,7 +2624,11 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+#if (NGX_HAVE_PTHREAD)
+                || (buffer->async ? buffer->async->overflow : 0) != overflow
+#endif
+                )
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1319,6 +2667,49 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
 
         buffer->gzip = gzip;
+        buffer->syslog = log->syslog;
+
+#if (NGX_HAVE_PTHREAD)
+
+        if (overflow) {
+            async = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_async_t));
+            if (async == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            async->start[0] = buffer->start;
+
+            for (j = 1; j < NGX_HTTP_LOG_ASYNC_BUFS; j++) {
+                async->start[j] = ngx_pnalloc(cf->pool, size);
+                if (async->start[j] == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            async->size = size;
+            async->gzip = gzip;
+            async->file = log->file;
+            async->overflow = overflow;
+
+            if (lmcf->asyncs == NULL) {
+                lmcf->asyncs = ngx_array_create(cf->pool, 2,
+                                                sizeof(ngx_http_log_async_t *));
+                if (lmcf->asyncs == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            pasync = ngx_array_push(lmcf->asyncs);
+            if (pasync == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *pasync = async;
+
+            buffer->async = async;
+        }
+
+#endif
 
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
@@ -1363,6 +2754,7 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     fmt->name = value[1];
+    fmt->binary = 0;
 
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
     if (fmt->flushes == NULL) {
@@ -1374,6 +2766,32 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (cf->args->nelts > 2
+        && ngx_strncmp(value[2].data, "format=", 7) == 0)
+    {
+        if (ngx_strcmp(value[2].data + 7, "json") == 0) {
+            return ngx_http_log_compile_structured(cf, fmt, NGX_HTTP_LOG_JSON,
+                                                   cf->args, 3);
+        }
+
+        if (ngx_strcmp(value[2].data + 7, "msgpack") == 0) {
+            fmt->binary = 1;
+            return ngx_http_log_compile_structured(cf, fmt,
+                                                   NGX_HTTP_LOG_MSGPACK,
+                                                   cf->args, 3);
+        }
+
+        if (ngx_strcmp(value[2].data + 7, "text") != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown log format type \"%s\"",
+                               value[2].data + 7);
+            return NGX_CONF_ERROR;
+        }
+
+        return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops,
+                                           cf->args, 3);
+    }
+
     return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
 }
 
@@ -1499,29 +2917,17 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
 
             if (len) {
 
-                op->len = len;
-                op->getlen = NULL;
-
                 if (len <= sizeof(uintptr_t)) {
-                    op->run = ngx_http_log_copy_short;
-                    op->data = 0;
-
-                    while (len--) {
-                        op->data <<= 8;
-                        op->data |= data[len];
-                    }
+                    p = NULL;
 
                 } else {
-                    op->run = ngx_http_log_copy_long;
-
                     p = ngx_pnalloc(cf->pool, len);
                     if (p == NULL) {
                         return NGX_CONF_ERROR;
                     }
-
-                    ngx_memcpy(p, data, len);
-                    op->data = (uintptr_t) p;
                 }
+
+                ngx_http_log_set_literal(op, data, len, p);
             }
         }
     }
@@ -1536,6 +2942,380 @@ invalid:
 }
 
 
+static void
+ngx_http_log_set_literal(ngx_http_log_op_t *op, u_char *data, size_t len,
+    u_char *p)
+{
+    op->len = len;
+    op->getlen = NULL;
+
+    if (len <= sizeof(uintptr_t)) {
+        op->run = ngx_http_log_copy_short;
+        op->data = 0;
+
+        while (len--) {
+            op->data <<= 8;
+            op->data |= data[len];
+        }
+
+    } else {
+        op->run = ngx_http_log_copy_long;
+
+        ngx_memcpy(p, data, len);
+        op->data = (uintptr_t) p;
+    }
+}
+
+
+/*
+ * In the structured formats all constant parts of a line, that is
+ * the keys, the delimiters, and the msgpack headers, are collected at
+ * configuration time in one literal between the two adjacent values.
+ */
+
+static char *
+ngx_http_log_compile_structured(ngx_conf_t *cf, ngx_http_log_fmt_t *fmt,
+    ngx_uint_t format, ngx_array_t *args, ngx_uint_t s)
+{
+    u_char              *p;
+    size_t               n;
+    ngx_str_t           *value, key, var;
+    ngx_int_t           *flush;
+    ngx_uint_t           i, nfields;
+    ngx_array_t          literal;
+    ngx_http_log_op_t   *op;
+    ngx_http_log_var_t  *v;
+
+    value = args->elts;
+
+    nfields = args->nelts - s;
+
+    if (nfields == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "no log format fields");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_array_init(&literal, cf->temp_pool, 64, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    /* the map header */
+
+    if (format == NGX_HTTP_LOG_JSON) {
+        p = ngx_array_push(&literal);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *p = '{';
+
+    } else {
+        p = ngx_array_push_n(&literal, 3);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (nfields < 16) {
+            *p = (u_char) (0x80 | nfields);
+            literal.nelts -= 2;
+
+        } else if (nfields <= 0xffff) {
+            *p++ = 0xde;
+            *p++ = (u_char) (nfields >> 8);
+            *p = (u_char) nfields;
+
+        } else {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "too many log format fields");
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = s; i < args->nelts; i++) {
+
+        p = (u_char *) ngx_strlchr(value[i].data, value[i].data + value[i].len,
+                                   '=');
+
+        if (p == NULL || p == value[i].data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid log format field \"%V\", "
+                               "it must be \"key=value\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        key.data = value[i].data;
+        key.len = p - value[i].data;
+
+        var.data = p + 1;
+        var.len = value[i].data + value[i].len - var.data;
+
+        /* the key */
+
+        if (format == NGX_HTTP_LOG_JSON) {
+            n = ngx_http_log_json_escape(NULL, key.data, key.len);
+
+            p = ngx_array_push_n(&literal, key.len + n + 4);
+            if (p == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (i != s) {
+                *p++ = ',';
+
+            } else {
+                literal.nelts--;
+            }
+
+            *p++ = '"';
+            p = (u_char *) ngx_http_log_json_escape(p, key.data, key.len);
+            *p++ = '"';
+            *p++ = ':';
+
+        } else {
+            if (key.len > 0xff) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "too long log format key \"%V\"", &key);
+                return NGX_CONF_ERROR;
+            }
+
+            p = ngx_array_push_n(&literal,
+                                 ngx_http_log_msgpack_str_len(key.len)
+                                 + key.len);
+            if (p == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            p = ngx_http_log_msgpack_str(p, key.len);
+            ngx_memcpy(p, key.data, key.len);
+        }
+
+        /* the value */
+
+        if (var.len == 0 || var.data[0] != '$') {
+
+            /* a constant string */
+
+            if (format == NGX_HTTP_LOG_JSON) {
+                n = ngx_http_log_json_escape(NULL, var.data, var.len);
+
+                p = ngx_array_push_n(&literal, var.len + n + 2);
+                if (p == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                *p++ = '"';
+                p = (u_char *) ngx_http_log_json_escape(p, var.data, var.len);
+                *p = '"';
+
+            } else {
+                p = ngx_array_push_n(&literal,
+                                     ngx_http_log_msgpack_str_len(var.len)
+                                     + var.len);
+                if (p == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                p = ngx_http_log_msgpack_str(p, var.len);
+                ngx_memcpy(p, var.data, var.len);
+            }
+
+            continue;
+        }
+
+        var.data++;
+        var.len--;
+
+        if (var.len > 1 && var.data[0] == '{'
+            && var.data[var.len - 1] == '}')
+        {
+            var.data++;
+            var.len -= 2;
+        }
+
+        for (n = 0; n < var.len; n++) {
+            if ((var.data[n] >= 'A' && var.data[n] <= 'Z')
+                || (var.data[n] >= 'a' && var.data[n] <= 'z')
+                || (var.data[n] >= '0' && var.data[n] <= '9')
+                || var.data[n] == '_')
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        if (var.len == 0 || n != var.len) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the value of log format field \"%V\" "
+                               "must be one variable or a constant",
+                               &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        for (v = ngx_http_log_vars; v->name.len; v++) {
+
+            if (v->name.len == var.len
+                && ngx_strncmp(v->name.data, var.data, var.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (v->name.len && v->json == NULL) {
+
+            /* a fixed length string, its quotes or header are constant */
+
+            if (format == NGX_HTTP_LOG_JSON) {
+                p = ngx_array_push(&literal);
+                if (p == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                *p = '"';
+
+            } else {
+                p = ngx_array_push_n(&literal,
+                                     ngx_http_log_msgpack_str_len(v->len));
+                if (p == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                (void) ngx_http_log_msgpack_str(p, v->len);
+            }
+        }
+
+        if (ngx_http_log_compile_literal(cf, fmt->ops, &literal) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        op = ngx_array_push(fmt->ops);
+        if (op == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (v->name.len) {
+            op->getlen = NULL;
+            op->data = 0;
+
+            if (v->json == NULL) {
+                op->len = v->len;
+                op->run = v->run;
+
+                if (format == NGX_HTTP_LOG_JSON) {
+                    p = ngx_array_push(&literal);
+                    if (p == NULL) {
+                        return NGX_CONF_ERROR;
+                    }
+
+                    *p = '"';
+                }
+
+            } else if (format == NGX_HTTP_LOG_JSON) {
+                op->len = v->len;
+                op->run = v->json;
+
+            } else {
+                op->len = NGX_HTTP_LOG_MSGPACK_NUM;
+                op->run = v->msgpack;
+            }
+
+            continue;
+        }
+
+        if (ngx_http_log_variable_compile(cf, op, &var) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (format == NGX_HTTP_LOG_JSON) {
+            op->getlen = ngx_http_log_json_variable_getlen;
+            op->run = ngx_http_log_json_variable;
+
+        } else {
+            op->getlen = ngx_http_log_msgpack_variable_getlen;
+            op->run = ngx_http_log_msgpack_variable;
+        }
+
+        flush = ngx_array_push(fmt->flushes);
+        if (flush == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *flush = op->data; /* variable index */
+    }
+
+    if (format == NGX_HTTP_LOG_JSON) {
+        p = ngx_array_push(&literal);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *p = '}';
+    }
+
+    if (ngx_http_log_compile_literal(cf, fmt->ops, &literal) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_log_compile_literal(ngx_conf_t *cf, ngx_array_t *ops,
+    ngx_array_t *literal)
+{
+    u_char             *p;
+    ngx_http_log_op_t  *op;
+
+    if (literal->nelts == 0) {
+        return NGX_OK;
+    }
+
+    op = ngx_array_push(ops);
+    if (op == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = NULL;
+
+    if (literal->nelts > sizeof(uintptr_t)) {
+        p = ngx_pnalloc(cf->pool, literal->nelts);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_http_log_set_literal(op, literal->elts, literal->nelts, p);
+
+    literal->nelts = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_complex_value_t *
+ngx_http_log_compile_value(ngx_conf_t *cf, ngx_str_t *value)
+{
+    ngx_http_compile_complex_value_t  ccv;
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = value;
+    ccv.complex_value = ngx_palloc(cf->pool,
+                                   sizeof(ngx_http_complex_value_t));
+    if (ccv.complex_value == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NULL;
+    }
+
+    return ccv.complex_value;
+}
+
+
 static char *
 ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
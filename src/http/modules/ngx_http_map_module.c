@@ -352,6 +352,31 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         map->map.nregex = ctx.regexes.nelts;
     }
 
+    if (ctx.regexes.nelts > 1) {
+        ngx_uint_t             i;
+        ngx_http_regex_t     **rex;
+        ngx_http_map_regex_t  *reg;
+
+        rex = ngx_palloc(pool, ctx.regexes.nelts * sizeof(ngx_http_regex_t *));
+        if (rex == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        reg = ctx.regexes.elts;
+
+        for (i = 0; i < ctx.regexes.nelts; i++) {
+            rex[i] = reg[i].regex;
+        }
+
+        map->map.regex_set = ngx_http_regex_set_compile(cf, rex,
+                                                        ctx.regexes.nelts);
+        if (map->map.regex_set == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+    }
+
 #endif
 
     ngx_destroy_pool(pool);
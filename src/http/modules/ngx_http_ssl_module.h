@@ -28,6 +28,15 @@ typedef struct {
 
     size_t                          buffer_size;
 
+    ngx_flag_t                      dyn_rec_enable;
+    ngx_msec_t                      dyn_rec_timeout;
+    size_t                          dyn_rec_size_lo;
+    size_t                          dyn_rec_size_hi;
+    size_t                          dyn_rec_threshold;
+
+    ngx_flag_t                      async;
+    ngx_flag_t                      ktls;
+
     ssize_t                         builtin_session_cache;
 
     time_t                          session_timeout;
@@ -51,6 +60,8 @@ typedef struct {
     ngx_flag_t                      stapling_verify;
     ngx_str_t                       stapling_file;
     ngx_str_t                       stapling_responder;
+    ngx_shm_zone_t                 *stapling_shm_zone;
+    ngx_str_t                       stapling_path;
 
     u_char                         *file;
     ngx_uint_t                      line;
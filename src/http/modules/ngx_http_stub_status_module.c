@@ -12,6 +12,12 @@
 
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_stub_status_event_loop_variable(
+    ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+#if (NGX_SSL)
+static ngx_int_t ngx_http_stub_status_ssl_histogram_variable(
+    ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+#endif
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
 
 static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -76,6 +82,35 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("event_loop_histogram"), NULL,
+      ngx_http_stub_status_event_loop_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("event_loop_p50"), NULL,
+      ngx_http_stub_status_event_loop_variable,
+      50, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("event_loop_p99"), NULL,
+      ngx_http_stub_status_event_loop_variable,
+      99, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+#if (NGX_SSL)
+
+    { ngx_string("ssl_records_small"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("ssl_records_medium"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("ssl_records_large"), NULL, ngx_http_stub_status_variable,
+      6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("ssl_handshake_histogram"), NULL,
+      ngx_http_stub_status_ssl_histogram_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+#endif
+
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
 
@@ -188,6 +223,22 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+#if (NGX_SSL)
+
+    case 4:
+        value = *ngx_stat_ssl_records_small;
+        break;
+
+    case 5:
+        value = *ngx_stat_ssl_records_medium;
+        break;
+
+    case 6:
+        value = *ngx_stat_ssl_records_large;
+        break;
+
+#endif
+
     /* suppress warning */
     default:
         value = 0;
@@ -204,6 +255,58 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_stub_status_event_loop_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(r->pool, NGX_EVENT_LOOP_HISTOGRAM_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (data) {
+        v->len = ngx_event_loop_percentile(p, data) - p;
+
+    } else {
+        v->len = ngx_event_loop_histogram(p) - p;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_SSL)
+
+static ngx_int_t
+ngx_http_stub_status_ssl_histogram_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(r->pool, NGX_SSL_HANDSHAKE_HISTOGRAM_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_ssl_handshake_histogram(p) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 {
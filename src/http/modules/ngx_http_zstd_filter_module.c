@@ -0,0 +1,959 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include <zstd.h>
+
+
+/*
+ * "dcz" stream header: a skippable frame magic number and size
+ * followed by the dictionary SHA-256
+ */
+
+#define NGX_HTTP_ZSTD_DCZ_HEADER_LEN  40
+
+#define NGX_HTTP_ZSTD_MIN_WINDOW_BITS  10
+#define NGX_HTTP_ZSTD_MAX_WINDOW_BITS  23
+
+
+typedef struct {
+    ngx_http_encoding_dict_t  *dict;
+    u_char                     header[NGX_HTTP_ZSTD_DCZ_HEADER_LEN];
+} ngx_http_zstd_dict_t;
+
+
+typedef struct {
+    ngx_flag_t           enable;
+
+    ngx_hash_t           types;
+
+    ngx_bufs_t           bufs;
+
+    ngx_int_t            level;
+    ssize_t              min_length;
+
+    ngx_http_zstd_dict_t  *dictionary;
+    ZSTD_CDict          *cdict;
+
+    ngx_array_t         *types_keys;
+} ngx_http_zstd_conf_t;
+
+
+typedef struct {
+    ngx_chain_t         *in;
+    ngx_chain_t         *free;
+    ngx_chain_t         *busy;
+    ngx_chain_t         *out;
+    ngx_chain_t        **last_out;
+
+    ngx_buf_t           *in_buf;
+    ngx_buf_t           *out_buf;
+    ngx_int_t            bufs;
+
+    u_char              *next_in;
+    size_t               avail_in;
+    u_char              *next_out;
+    size_t               avail_out;
+
+    int                  wbits;
+
+    ZSTD_EndDirective    flush;
+
+    unsigned             redo:1;
+    unsigned             done:1;
+    unsigned             nomem:1;
+    unsigned             dictionary:1;
+    unsigned             header:1;
+
+    ZSTD_CCtx           *cctx;
+    ngx_http_request_t  *request;
+} ngx_http_zstd_ctx_t;
+
+
+static ngx_int_t ngx_http_zstd_filter_start(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_header(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_add_data(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_get_buf(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_compress(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_end(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static void ngx_http_zstd_filter_cleanup(void *data);
+
+static ngx_int_t ngx_http_zstd_filter_init(ngx_conf_t *cf);
+static void *ngx_http_zstd_create_conf(ngx_conf_t *cf);
+static char *ngx_http_zstd_merge_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static char *ngx_http_zstd_dictionary(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void ngx_http_zstd_cdict_cleanup(void *data);
+
+
+static ngx_conf_num_bounds_t  ngx_http_zstd_comp_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 19
+};
+
+
+static ngx_command_t  ngx_http_zstd_filter_commands[] = {
+
+    { ngx_string("zstd"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, enable),
+      NULL },
+
+    { ngx_string("zstd_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, bufs),
+      NULL },
+
+    { ngx_string("zstd_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, types_keys),
+      &ngx_http_html_default_types[0] },
+
+    { ngx_string("zstd_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, level),
+      &ngx_http_zstd_comp_level_bounds },
+
+    { ngx_string("zstd_min_length"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, min_length),
+      NULL },
+
+    { ngx_string("zstd_dictionary"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_zstd_dictionary,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_zstd_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_zstd_filter_init,             /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_zstd_create_conf,             /* create location configuration */
+    ngx_http_zstd_merge_conf               /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_zstd_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_zstd_filter_module_ctx,      /* module context */
+    ngx_http_zstd_filter_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+
+static ngx_int_t
+ngx_http_zstd_filter_test(ngx_http_request_t *r)
+{
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (!conf->enable
+        || (r->headers_out.content_length_n != -1
+            && r->headers_out.content_length_n < conf->min_length)
+        || ngx_http_test_content_type(r, &conf->types) == NULL)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_encoding_dict_t *
+ngx_http_zstd_filter_dictionary(ngx_http_request_t *r)
+{
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (!conf->enable || conf->dictionary == NULL) {
+        return NULL;
+    }
+
+    return conf->dictionary->dict;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_header_filter(ngx_http_request_t *r)
+{
+    ngx_uint_t             dictionary;
+    ngx_table_elt_t       *h;
+    ngx_http_zstd_ctx_t   *ctx;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if ((r->headers_out.status != NGX_HTTP_OK
+         && r->headers_out.status != NGX_HTTP_FORBIDDEN
+         && r->headers_out.status != NGX_HTTP_NOT_FOUND)
+        || (r->headers_out.content_encoding
+            && r->headers_out.content_encoding->value.len)
+        || r->header_only
+        || ngx_http_zstd_filter_test(r) != NGX_OK)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    r->gzip_vary = 1;
+
+#if (NGX_HTTP_DEGRADATION)
+    {
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->gzip_disable_degradation && ngx_http_degraded(r)) {
+        return ngx_http_next_header_filter(r);
+    }
+    }
+#endif
+
+    dictionary = (conf->dictionary
+                  && ngx_http_encoding_ok(r, NGX_HTTP_ENCODING_DCZ) == NGX_OK);
+
+    if (!dictionary
+        && ngx_http_encoding_ok(r, NGX_HTTP_ENCODING_ZSTD) != NGX_OK)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_zstd_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_zstd_filter_module);
+
+    ctx->request = r;
+    ctx->dictionary = dictionary;
+
+    if (r->headers_out.content_length_n > 0
+        && r->headers_out.content_length_n
+           < (1 << (NGX_HTTP_ZSTD_MAX_WINDOW_BITS - 1)))
+    {
+        /* a window larger than the response is a waste of memory */
+
+        ctx->wbits = NGX_HTTP_ZSTD_MAX_WINDOW_BITS;
+
+        while (ctx->wbits > NGX_HTTP_ZSTD_MIN_WINDOW_BITS
+               && r->headers_out.content_length_n < (1 << (ctx->wbits - 1)))
+        {
+            ctx->wbits--;
+        }
+    }
+
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->hash = 1;
+    ngx_str_set(&h->key, "Content-Encoding");
+
+    if (dictionary) {
+        ngx_str_set(&h->value, "dcz");
+
+    } else {
+        ngx_str_set(&h->value, "zstd");
+    }
+
+    r->headers_out.content_encoding = h;
+
+    r->main_filter_need_in_memory = 1;
+
+    ngx_http_clear_content_length(r);
+    ngx_http_clear_accept_ranges(r);
+    ngx_http_clear_etag(r);
+
+    return ngx_http_next_header_filter(r);
+}
+
+
+static ngx_int_t
+ngx_http_zstd_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_int_t             rc;
+    ngx_chain_t          *cl;
+    ngx_http_zstd_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_zstd_filter_module);
+
+    if (ctx == NULL || ctx->done || r->header_only) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http zstd filter");
+
+    if (ctx->cctx == NULL) {
+        if (ngx_http_zstd_filter_start(r, ctx) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    if (in) {
+        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+            goto failed;
+        }
+
+        r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
+    }
+
+    if (ctx->nomem || in == NULL) {
+
+        /* flush busy buffers */
+
+        if (ngx_http_next_body_filter(r, NULL) == NGX_ERROR) {
+            goto failed;
+        }
+
+        cl = NULL;
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_zstd_filter_module);
+        ctx->nomem = 0;
+    }
+
+    for ( ;; ) {
+
+        /* cycle while we can write to a client */
+
+        for ( ;; ) {
+
+            /* cycle while there is data to feed the encoder and ... */
+
+            rc = ngx_http_zstd_filter_add_data(r, ctx);
+
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+
+            if (rc == NGX_AGAIN) {
+                continue;
+            }
+
+
+            /* ... there are buffers to write the encoder output */
+
+            rc = ngx_http_zstd_filter_get_buf(r, ctx);
+
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+
+            rc = ngx_http_zstd_filter_compress(r, ctx);
+
+            if (rc == NGX_OK) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+            /* rc == NGX_AGAIN */
+        }
+
+        if (ctx->out == NULL) {
+            return ctx->busy ? NGX_AGAIN : NGX_OK;
+        }
+
+        if (ctx->dictionary && !ctx->header) {
+            if (ngx_http_zstd_filter_header(r, ctx) != NGX_OK) {
+                goto failed;
+            }
+        }
+
+        rc = ngx_http_next_body_filter(r, ctx->out);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                (ngx_buf_tag_t) &ngx_http_zstd_filter_module);
+        ctx->last_out = &ctx->out;
+
+        ctx->nomem = 0;
+
+        if (ctx->done) {
+            return rc;
+        }
+    }
+
+    /* unreachable */
+
+failed:
+
+    ctx->done = 1;
+
+    if (ctx->cctx) {
+        ZSTD_freeCCtx(ctx->cctx);
+        ctx->cctx = NULL;
+    }
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_start(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    size_t                 rc;
+    ngx_pool_cleanup_t    *cln;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->cctx = ZSTD_createCCtx();
+
+    if (ctx->cctx == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_createCCtx() failed");
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_zstd_filter_cleanup;
+    cln->data = ctx;
+
+    if (ctx->dictionary) {
+        rc = ZSTD_CCtx_refCDict(ctx->cctx, conf->cdict);
+
+        if (ZSTD_isError(rc)) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "ZSTD_CCtx_refCDict() failed: %s",
+                          ZSTD_getErrorName(rc));
+            return NGX_ERROR;
+        }
+    }
+
+    rc = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel,
+                                (int) conf->level);
+
+    if (!ZSTD_isError(rc) && ctx->wbits) {
+        rc = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_windowLog, ctx->wbits);
+    }
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_CCtx_setParameter() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    ctx->last_out = &ctx->out;
+    ctx->flush = ZSTD_e_continue;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_header(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->memory = 1;
+    b->pos = conf->dictionary->header;
+    b->last = b->pos + NGX_HTTP_ZSTD_DCZ_HEADER_LEN;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = ctx->out;
+    ctx->out = cl;
+
+    ctx->header = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_add_data(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    if (ctx->avail_in || ctx->flush != ZSTD_e_continue || ctx->redo) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd in: %p", ctx->in);
+
+    if (ctx->in == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ctx->in_buf = ctx->in->buf;
+    ctx->in = ctx->in->next;
+
+    ctx->next_in = ctx->in_buf->pos;
+    ctx->avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd in_buf:%p ni:%p ai:%uz",
+                   ctx->in_buf, ctx->next_in, ctx->avail_in);
+
+    if (ctx->in_buf->last_buf) {
+        ctx->flush = ZSTD_e_end;
+
+    } else if (ctx->in_buf->flush) {
+        ctx->flush = ZSTD_e_flush;
+    }
+
+    if (ctx->avail_in == 0 && ctx->flush == ZSTD_e_continue) {
+        return NGX_AGAIN;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_get_buf(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_http_zstd_conf_t  *conf;
+
+    if (ctx->avail_out) {
+        return NGX_OK;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (ctx->free) {
+        ctx->out_buf = ctx->free->buf;
+        ctx->free = ctx->free->next;
+
+    } else if (ctx->bufs < conf->bufs.num) {
+
+        ctx->out_buf = ngx_create_temp_buf(r->pool, conf->bufs.size);
+        if (ctx->out_buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->out_buf->tag = (ngx_buf_tag_t) &ngx_http_zstd_filter_module;
+        ctx->out_buf->recycled = 1;
+        ctx->bufs++;
+
+    } else {
+        ctx->nomem = 1;
+        return NGX_DECLINED;
+    }
+
+    ctx->next_out = ctx->out_buf->pos;
+    ctx->avail_out = conf->bufs.size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_compress(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    size_t           rc;
+    ngx_buf_t       *b;
+    ngx_chain_t     *cl;
+    ZSTD_inBuffer    input;
+    ZSTD_outBuffer   output;
+
+    ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd compress in: ni:%p no:%p ai:%uz ao:%uz "
+                   "fl:%d redo:%d",
+                   ctx->next_in, ctx->next_out, ctx->avail_in, ctx->avail_out,
+                   ctx->flush, ctx->redo);
+
+    input.src = ctx->next_in;
+    input.size = ctx->avail_in;
+    input.pos = 0;
+
+    output.dst = ctx->next_out;
+    output.size = ctx->avail_out;
+    output.pos = 0;
+
+    rc = ZSTD_compressStream2(ctx->cctx, &output, &input, ctx->flush);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_compressStream2() failed: %d, %s",
+                      ctx->flush, ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    ctx->next_out += output.pos;
+    ctx->avail_out -= output.pos;
+
+    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd compress out: ni:%p no:%p ai:%uz ao:%uz rc:%uz",
+                   ctx->next_in + input.pos, ctx->next_out,
+                   ctx->avail_in - input.pos, ctx->avail_out, rc);
+
+    if (ctx->next_in) {
+        ctx->next_in += input.pos;
+        ctx->avail_in -= input.pos;
+
+        ctx->in_buf->pos = ctx->next_in;
+
+        if (ctx->avail_in == 0) {
+            ctx->next_in = NULL;
+        }
+    }
+
+    ctx->out_buf->last = ctx->next_out;
+
+    if (ctx->avail_out == 0) {
+
+        /* the encoder wants to output some more data */
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ctx->out_buf;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        ctx->redo = 1;
+
+        return NGX_AGAIN;
+    }
+
+    if (ctx->flush != ZSTD_e_continue && rc != 0) {
+
+        /* the frame is not flushed completely yet */
+
+        ctx->redo = 1;
+        return NGX_AGAIN;
+    }
+
+    ctx->redo = 0;
+
+    if (ctx->flush == ZSTD_e_flush) {
+
+        ctx->flush = ZSTD_e_continue;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = ctx->out_buf;
+
+        if (ngx_buf_size(b) == 0) {
+
+            b = ngx_calloc_buf(ctx->request->pool);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            ctx->avail_out = 0;
+        }
+
+        b->flush = 1;
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+        return NGX_OK;
+    }
+
+    if (ctx->flush == ZSTD_e_end) {
+
+        if (ngx_http_zstd_filter_end(r, ctx) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_end(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_chain_t  *cl;
+
+    ZSTD_freeCCtx(ctx->cctx);
+    ctx->cctx = NULL;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->out_buf->last_buf = 1;
+
+    cl->buf = ctx->out_buf;
+    cl->next = NULL;
+    *ctx->last_out = cl;
+    ctx->last_out = &cl->next;
+
+    ctx->avail_in = 0;
+    ctx->avail_out = 0;
+
+    ctx->done = 1;
+
+    r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_zstd_filter_cleanup(void *data)
+{
+    ngx_http_zstd_ctx_t  *ctx = data;
+
+    if (ctx->cctx) {
+        ZSTD_freeCCtx(ctx->cctx);
+        ctx->cctx = NULL;
+    }
+}
+
+
+static void *
+ngx_http_zstd_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_zstd_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->bufs.num = 0;
+     *     conf->types = { NULL };
+     *     conf->types_keys = NULL;
+     *     conf->cdict = NULL;
+     */
+
+    conf->enable = NGX_CONF_UNSET;
+
+    conf->level = NGX_CONF_UNSET;
+    conf->min_length = NGX_CONF_UNSET;
+    conf->dictionary = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_zstd_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_zstd_conf_t *prev = parent;
+    ngx_http_zstd_conf_t *conf = child;
+
+    ngx_pool_cleanup_t  *cln;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+
+    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs,
+                              (128 * 1024) / ngx_pagesize, ngx_pagesize);
+
+    ngx_conf_merge_value(conf->level, prev->level, 3);
+    ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+    ngx_conf_merge_ptr_value(conf->dictionary, prev->dictionary, NULL);
+
+    if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
+                             &prev->types_keys, &prev->types,
+                             ngx_http_html_default_types)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->dictionary == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    /* the digested dictionary depends on the compression level */
+
+    if (conf->dictionary == prev->dictionary
+        && conf->level == prev->level
+        && prev->cdict)
+    {
+        conf->cdict = prev->cdict;
+        return NGX_CONF_OK;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    conf->cdict = ZSTD_createCDict(conf->dictionary->dict->data.data,
+                                   conf->dictionary->dict->data.len,
+                                   (int) conf->level);
+    if (conf->cdict == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "ZSTD_createCDict(\"%V\") failed",
+                           &conf->dictionary->dict->name);
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_zstd_cdict_cleanup;
+    cln->data = conf->cdict;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_zstd_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_zstd_body_filter;
+
+    ngx_http_encoding_filters[NGX_HTTP_ENCODING_ZSTD].test =
+                                                     ngx_http_zstd_filter_test;
+    ngx_http_encoding_filters[NGX_HTTP_ENCODING_DCZ].test =
+                                                     ngx_http_zstd_filter_test;
+    ngx_http_encoding_filters[NGX_HTTP_ENCODING_DCZ].dictionary =
+                                               ngx_http_zstd_filter_dictionary;
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_zstd_dictionary(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_zstd_conf_t *zcf = conf;
+
+    char                  *rv;
+    ngx_str_t             *value;
+    ngx_http_zstd_dict_t  *dict;
+
+    if (zcf->dictionary != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        zcf->dictionary = NULL;
+        return NGX_CONF_OK;
+    }
+
+    dict = ngx_pcalloc(cf->pool, sizeof(ngx_http_zstd_dict_t));
+    if (dict == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    rv = ngx_http_encoding_dictionary(cf, &value[1], &dict->dict);
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    /* the "dcz" stream header: a 32-byte skippable frame with the hash */
+
+    dict->header[0] = 0x5e;
+    dict->header[1] = 0x2a;
+    dict->header[2] = 0x4d;
+    dict->header[3] = 0x18;
+    dict->header[4] = 0x20;
+    dict->header[5] = 0x00;
+    dict->header[6] = 0x00;
+    dict->header[7] = 0x00;
+    ngx_memcpy(&dict->header[8], dict->dict->hash,
+               NGX_HTTP_ENCODING_DICT_HASH_LEN);
+
+    zcf->dictionary = dict;
+
+    return NGX_CONF_OK;
+}
+
+
+static void
+ngx_http_zstd_cdict_cleanup(void *data)
+{
+    ZSTD_CDict  *cdict = data;
+
+    ZSTD_freeCDict(cdict);
+}
@@ -676,8 +676,9 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_location_queue_t   *lq;
     ngx_http_core_loc_conf_t   **clcfp;
 #if (NGX_PCRE)
-    ngx_uint_t                   r;
+    ngx_uint_t                   r, i;
     ngx_queue_t                 *regex;
+    ngx_http_regex_t           **rex;
 #endif
 
     locations = pclcf->locations;
@@ -786,6 +787,22 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 
         *clcfp = NULL;
 
+        if (r > 1) {
+            rex = ngx_palloc(cf->temp_pool, r * sizeof(ngx_http_regex_t *));
+            if (rex == NULL) {
+                return NGX_ERROR;
+            }
+
+            for (i = 0; i < r; i++) {
+                rex[i] = pclcf->regex_locations[i]->regex;
+            }
+
+            pclcf->regex_locations_set = ngx_http_regex_set_compile(cf, rex, r);
+            if (pclcf->regex_locations_set == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
         ngx_queue_split(locations, regex, &tail);
     }
 
@@ -1817,6 +1834,14 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->fastopen = addr->opt.fastopen;
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+    ls->busy_poll = addr->opt.busy_poll;
+#endif
+
+#if (NGX_HAVE_INCOMING_CPU)
+    ls->incoming_cpu = addr->opt.incoming_cpu;
+#endif
+
     return ls;
 }
 
@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HTTP_ENCODING && NGX_OPENSSL)
+#include <openssl/sha.h>
+#endif
+
 
 typedef struct {
     u_char    *name;
@@ -71,11 +75,16 @@ static char *ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_core_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #if (NGX_HTTP_GZIP)
+static ngx_int_t ngx_http_gzip_test(ngx_http_request_t *r);
 static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
 static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
+#if (NGX_HTTP_ENCODING)
+static ngx_uint_t ngx_http_encoding_filters_test(ngx_http_request_t *r);
+static ngx_int_t ngx_http_encoding_qvalue(u_char **pos, u_char *last);
+#endif
 static ngx_int_t ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r,
     ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_array_t *proxies,
     int recursive);
@@ -194,6 +203,23 @@ static ngx_str_t  ngx_http_gzip_private = ngx_string("private");
 #endif
 
 
+#if (NGX_HTTP_ENCODING)
+
+static ngx_str_t  ngx_http_encodings[] = {
+    ngx_string("gzip"),
+    ngx_string("zstd"),
+    ngx_string("br"),
+    ngx_string("dcz"),
+    ngx_string("dcb")
+};
+
+
+ngx_http_encoding_filter_t
+    ngx_http_encoding_filters[NGX_HTTP_ENCODING_DCB + 1];
+
+#endif
+
+
 static ngx_command_t  ngx_http_core_commands[] = {
 
     { ngx_string("variables_hash_max_size"),
@@ -691,7 +717,7 @@ static ngx_command_t  ngx_http_core_commands[] = {
       NULL },
 
     { ngx_string("open_file_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE123,
       ngx_http_core_open_file_cache,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_core_loc_conf_t, open_file_cache),
@@ -866,6 +892,9 @@ ngx_http_handler(ngx_http_request_t *r)          /*真正开始处理一个完
     r->gzip_ok = 0;
     r->gzip_vary = 0;
 #endif
+#if (NGX_HTTP_ENCODING)
+    r->dictionary_vary = 0;
+#endif
 
     r->write_event_handler = ngx_http_core_run_phases;          /*写事件回调函数, 在 ngx_http_request_handler()中调用 */
     ngx_http_core_run_phases(r);                                  /*开始状态机阶段处理*/
@@ -1546,8 +1575,8 @@ ngx_http_core_find_location(ngx_http_request_t *r)      /*location过程  find t
     ngx_int_t                  rc;
     ngx_http_core_loc_conf_t  *pclcf;
 #if (NGX_PCRE)
-    ngx_int_t                  n;
-    ngx_uint_t                 noregex;
+    ngx_int_t                  n, limit;
+    ngx_uint_t                 i, noregex;
     ngx_http_core_loc_conf_t  *clcf, **clcfp;
 
     noregex = 0;
@@ -1580,7 +1609,20 @@ ngx_http_core_find_location(ngx_http_request_t *r)      /*location过程  find t
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+        limit = pclcf->regex_locations_set
+                ? ngx_http_regex_set_exec(r, pclcf->regex_locations_set,
+                                          &r->uri)
+                : NGX_OK;
+
+        if (limit == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        for (clcfp = pclcf->regex_locations, i = 0; *clcfp; clcfp++, i++) {
+
+            if (ngx_http_regex_set_skip(pclcf->regex_locations_set, i, limit)) {
+                continue;
+            }
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
@@ -2128,11 +2170,7 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
 {
-    time_t                     date, expires;
-    ngx_uint_t                 p;
-    ngx_array_t               *cc;
-    ngx_table_elt_t           *e, *d, *ae;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_table_elt_t  *ae;
 
     r->gzip_tested = 1;
 
@@ -2171,6 +2209,139 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
+    if (ngx_http_gzip_test(r) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_ok = 1;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HTTP_ENCODING)
+
+ngx_int_t
+ngx_http_encoding_ok(ngx_http_request_t *r, ngx_uint_t encoding)
+{
+    ngx_int_t         q, n;
+    ngx_uint_t        i, encodings;
+    ngx_table_elt_t  *ae;
+
+    encodings = ngx_http_encoding_filters_test(r);
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_HTTP_SPDY)
+    if (r->spdy_stream && encoding == NGX_HTTP_ENCODING_GZIP) {
+        r->gzip_ok = 1;
+        return NGX_OK;
+    }
+#endif
+
+    ae = r->headers_in.accept_encoding;
+    if (ae == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (!(encodings & (1 << encoding))) {
+        return NGX_DECLINED;
+    }
+
+    q = ngx_http_encoding_quality(&ae->value, encoding);
+    if (q <= 0) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * decline if the client prefers another coding offered in this
+     * location and the filter of that coding will take the response;
+     * dictionary codings win ties as they compress best
+     */
+
+    for (i = NGX_HTTP_ENCODING_GZIP; i <= NGX_HTTP_ENCODING_DCB; i++) {
+
+        if (i == encoding || !(encodings & (1 << i))) {
+            continue;
+        }
+
+        n = ngx_http_encoding_quality(&ae->value, i);
+
+        if (n > q || (n == q && i > encoding)) {
+            return NGX_DECLINED;
+        }
+    }
+
+    return ngx_http_gzip_test(r);
+}
+
+
+/*
+ * a bitmask of the codings whose filters would compress the response,
+ * a dictionary coding also needs the dictionary announced by the client
+ */
+
+static ngx_uint_t
+ngx_http_encoding_filters_test(ngx_http_request_t *r)
+{
+    ngx_uint_t                   i, encodings;
+    ngx_table_elt_t             *ad;
+    ngx_http_encoding_dict_t    *dict;
+    ngx_http_encoding_filter_t  *filter;
+
+    encodings = 0;
+
+    for (i = NGX_HTTP_ENCODING_GZIP; i <= NGX_HTTP_ENCODING_DCB; i++) {
+
+        filter = &ngx_http_encoding_filters[i];
+
+        if (filter->test == NULL) {
+            continue;
+        }
+
+        if (i >= NGX_HTTP_ENCODING_DCZ) {
+
+            dict = filter->dictionary ? filter->dictionary(r) : NULL;
+
+            if (dict == NULL) {
+                continue;
+            }
+
+            r->dictionary_vary = 1;
+
+            ad = r->headers_in.available_dictionary;
+
+            if (ad == NULL
+                || ad->value.len != dict->id.len
+                || ngx_strncmp(ad->value.data, dict->id.data, dict->id.len)
+                   != 0)
+            {
+                continue;
+            }
+        }
+
+        if (filter->test(r) == NGX_OK) {
+            encodings |= 1 << i;
+        }
+    }
+
+    return encodings;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_gzip_test(ngx_http_request_t *r)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_array_t               *cc;
+    ngx_table_elt_t           *e, *d;
+    ngx_http_core_loc_conf_t  *clcf;
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_in.msie6 && clcf->gzip_disable_msie6) {
@@ -2287,8 +2458,6 @@ ok:
 
 #endif
 
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
@@ -2421,6 +2590,240 @@ ngx_http_gzip_quantity(u_char *p, u_char *last)
     return q;
 }
 
+
+#if (NGX_HTTP_ENCODING)
+
+/*
+ * returns the quality value of the coding multiplied by 1000, the quality
+ * value of "*" if the coding is not listed, or NGX_DECLINED if neither is;
+ * invalid quality values are treated as 0
+ */
+
+ngx_int_t
+ngx_http_encoding_quality(ngx_str_t *ae, ngx_uint_t encoding)
+{
+    u_char     *p, *start, *last;
+    size_t      len;
+    ngx_int_t   q, any;
+    ngx_str_t  *name;
+
+    name = &ngx_http_encodings[encoding];
+    any = NGX_DECLINED;
+
+    p = ae->data;
+    last = p + ae->len;
+
+    while (p < last) {
+
+        while (p < last && (*p == ',' || *p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        start = p;
+
+        while (p < last
+               && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+
+        len = p - start;
+
+        if (len == 0) {
+            break;
+        }
+
+        q = ngx_http_encoding_qvalue(&p, last);
+
+        if (len == name->len && ngx_strncasecmp(start, name->data, len) == 0) {
+            return q;
+        }
+
+        if (len == 1 && *start == '*') {
+            any = q;
+        }
+    }
+
+    return any;
+}
+
+
+static ngx_int_t
+ngx_http_encoding_qvalue(u_char **pos, u_char *last)
+{
+    u_char     *p;
+    ngx_int_t   q, n;
+
+    p = *pos;
+    q = 1000;
+
+    for ( ;; ) {
+
+        while (p < last && *p != ';' && *p != ',') {
+            p++;
+        }
+
+        if (p == last || *p == ',') {
+            break;
+        }
+
+        /* ";" */
+
+        p++;
+
+        while (p < last && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (last - p < 3 || (*p != 'q' && *p != 'Q') || p[1] != '=') {
+            continue;
+        }
+
+        p += 2;
+
+        if (*p != '0' && *p != '1') {
+            q = 0;
+            continue;
+        }
+
+        q = (*p++ - '0') * 1000;
+
+        if (p < last && *p == '.') {
+            p++;
+
+            for (n = 100; n && p < last && *p >= '0' && *p <= '9'; n /= 10) {
+                q += (*p++ - '0') * n;
+            }
+        }
+
+        if (q > 1000 || (p < last && *p != ' ' && *p != '\t' && *p != ';'
+                         && *p != ','))
+        {
+            q = 0;
+        }
+    }
+
+    *pos = p;
+
+    return q;
+}
+
+
+char *
+ngx_http_encoding_dictionary(ngx_conf_t *cf, ngx_str_t *name,
+    ngx_http_encoding_dict_t **dictp)
+{
+#if (NGX_OPENSSL)
+
+    char                      *rv;
+    ssize_t                    n;
+    ngx_str_t                  hash, b64;
+    ngx_file_t                 file;
+    ngx_file_info_t            fi;
+    ngx_http_encoding_dict_t  *dict;
+
+    dict = ngx_pcalloc(cf->pool, sizeof(ngx_http_encoding_dict_t));
+    if (dict == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    dict->name = *name;
+
+    if (ngx_conf_full_name(cf->cycle, &dict->name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = dict->name;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, 0, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%V\" failed", &file.name);
+        return NGX_CONF_ERROR;
+    }
+
+    rv = NGX_CONF_ERROR;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%V\" failed", &file.name);
+        goto done;
+    }
+
+    dict->data.len = (size_t) ngx_file_size(&fi);
+
+    if (dict->data.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "dictionary \"%V\" is empty", &file.name);
+        goto done;
+    }
+
+    dict->data.data = ngx_pnalloc(cf->pool, dict->data.len);
+    if (dict->data.data == NULL) {
+        goto done;
+    }
+
+    n = ngx_read_file(&file, dict->data.data, dict->data.len, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_read_file_n " \"%V\" failed", &file.name);
+        goto done;
+    }
+
+    if ((size_t) n != dict->data.len) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           ngx_read_file_n " \"%V\" returned only "
+                           "%z bytes instead of %uz",
+                           &file.name, n, dict->data.len);
+        goto done;
+    }
+
+    SHA256(dict->data.data, dict->data.len, dict->hash);
+
+    /* a structured field byte sequence, ":<base64>:" */
+
+    dict->id.data = ngx_pnalloc(cf->pool,
+                       ngx_base64_encoded_length(sizeof(dict->hash)) + 2);
+    if (dict->id.data == NULL) {
+        goto done;
+    }
+
+    hash.data = dict->hash;
+    hash.len = sizeof(dict->hash);
+
+    b64.data = dict->id.data + 1;
+
+    ngx_encode_base64(&b64, &hash);
+
+    dict->id.data[0] = ':';
+    dict->id.data[b64.len + 1] = ':';
+    dict->id.len = b64.len + 2;
+
+    *dictp = dict;
+
+    rv = NGX_CONF_OK;
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_ALERT, cf, ngx_errno,
+                           ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    return rv;
+
+#else
+
+    return "requires OpenSSL to hash the dictionary";
+
+#endif
+}
+
+#endif
+
 #endif
 
 
@@ -3051,6 +3454,12 @@ ngx_http_core_server(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 #endif
 #if (NGX_HAVE_TCP_FASTOPEN)
         lsopt.fastopen = -1;
+#endif
+#if (NGX_HAVE_BUSY_POLL)
+        lsopt.busy_poll = -1;
+#endif
+#if (NGX_HAVE_INCOMING_CPU)
+        lsopt.incoming_cpu = -1;
 #endif
         lsopt.wildcard = 1;
 
@@ -3992,6 +4401,12 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
 #if (NGX_HAVE_TCP_FASTOPEN)
     lsopt.fastopen = -1;
+#endif
+#if (NGX_HAVE_BUSY_POLL)
+    lsopt.busy_poll = -1;
+#endif
+#if (NGX_HAVE_INCOMING_CPU)
+    lsopt.incoming_cpu = -1;
 #endif
     lsopt.wildcard = u.wildcard;
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
@@ -4048,6 +4463,39 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+        if (ngx_strncmp(value[n].data, "busy_poll=", 10) == 0) {
+            lsopt.busy_poll = ngx_atoi(value[n].data + 10, value[n].len - 10);
+            lsopt.set = 1;
+            lsopt.bind = 1;
+
+            if (lsopt.busy_poll == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid busy_poll \"%V\"", &value[n]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
+#if (NGX_HAVE_INCOMING_CPU)
+        if (ngx_strncmp(value[n].data, "incoming_cpu=", 13) == 0) {
+            lsopt.incoming_cpu = ngx_atoi(value[n].data + 13,
+                                          value[n].len - 13);
+            lsopt.set = 1;
+            lsopt.bind = 1;
+
+            if (lsopt.incoming_cpu == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid incoming_cpu \"%V\"", &value[n]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
         if (ngx_strncmp(value[n].data, "backlog=", 8) == 0) {
             lsopt.backlog = ngx_atoi(value[n].data + 8, value[n].len - 8);
             lsopt.set = 1;
@@ -4850,8 +5298,10 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_core_loc_conf_t *clcf = conf;
 
+    u_char      *p;
     time_t       inactive;
-    ngx_str_t   *value, s;
+    ssize_t      size;
+    ngx_str_t   *value, s, name;
     ngx_int_t    max;
     ngx_uint_t   i;
 
@@ -4863,6 +5313,8 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     max = 0;
     inactive = 60;
+    size = 0;
+    ngx_str_null(&name);
 
     for (i = 1; i < cf->args->nelts; i++) {
 
@@ -4889,6 +5341,36 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL || p == name.data) {
+                goto failed;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                goto failed;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strcmp(value[i].data, "off") == 0) {
 
             clcf->open_file_cache = NULL;
@@ -4915,11 +5397,19 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     clcf->open_file_cache = ngx_open_file_cache_init(cf->pool, max, inactive);
-    if (clcf->open_file_cache) {
-        return NGX_CONF_OK;
+    if (clcf->open_file_cache == NULL) {
+        return NGX_CONF_ERROR;
     }
 
-    return NGX_CONF_ERROR;
+    if (name.len
+        && ngx_open_file_cache_add_zone(cf, clcf->open_file_cache, &name,
+                                        size, &ngx_http_core_module)
+           != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
 }
 
 
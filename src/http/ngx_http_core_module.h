@@ -25,6 +25,17 @@
 #define NGX_HTTP_GZIP_PROXIED_ANY       0x0200
 
 
+/* content codings in the order of preference on equal quality values */
+
+#define NGX_HTTP_ENCODING_GZIP          0
+#define NGX_HTTP_ENCODING_ZSTD          1
+#define NGX_HTTP_ENCODING_BROTLI        2
+#define NGX_HTTP_ENCODING_DCZ           3
+#define NGX_HTTP_ENCODING_DCB           4
+
+#define NGX_HTTP_ENCODING_DICT_HASH_LEN  32
+
+
 #define NGX_HTTP_AIO_OFF                0
 #define NGX_HTTP_AIO_ON                 1
 #define NGX_HTTP_AIO_SENDFILE           2
@@ -49,6 +60,35 @@
 #define NGX_HTTP_KEEPALIVE_DISABLE_SAFARI  0x0008
 
 
+#if (NGX_HTTP_ENCODING)
+
+typedef struct {
+    ngx_str_t                  name;
+    ngx_str_t                  data;
+
+    /* SHA-256 of the data and its "Available-Dictionary" representation */
+    u_char                     hash[NGX_HTTP_ENCODING_DICT_HASH_LEN];
+    ngx_str_t                  id;
+} ngx_http_encoding_dict_t;
+
+
+typedef ngx_http_encoding_dict_t *(*ngx_http_encoding_dict_pt)
+    (ngx_http_request_t *r);
+
+/*
+ * set by a compression filter for each of its codings: the test declines
+ * if the filter would not compress the response, e.g. by its type, and
+ * the dictionary is that of the location, NULL if none is configured
+ */
+
+typedef struct {
+    ngx_http_handler_pt        test;
+    ngx_http_encoding_dict_pt  dictionary;
+} ngx_http_encoding_filter_t;
+
+#endif
+
+
 typedef struct ngx_http_location_tree_node_s  ngx_http_location_tree_node_t;
 typedef struct ngx_http_core_loc_conf_s  ngx_http_core_loc_conf_t;
 
@@ -93,6 +133,12 @@ typedef struct {
 #if (NGX_HAVE_TCP_FASTOPEN)
     int                        fastopen;
 #endif
+#if (NGX_HAVE_BUSY_POLL)
+    int                        busy_poll;
+#endif
+#if (NGX_HAVE_INCOMING_CPU)
+    int                        incoming_cpu;
+#endif
 #if (NGX_HAVE_KEEPALIVE_TUNABLE)
     int                        tcp_keepidle;
     int                        tcp_keepintvl;
@@ -339,6 +385,7 @@ struct ngx_http_core_loc_conf_s { /*第一个http类型模块的配置上下文
     ngx_http_location_tree_node_t   *static_locations;        /*静态二叉树*/
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_http_regex_set_t            *regex_locations_set;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -509,6 +556,14 @@ ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
 #endif
+#if (NGX_HTTP_ENCODING)
+extern ngx_http_encoding_filter_t  ngx_http_encoding_filters[];
+
+ngx_int_t ngx_http_encoding_ok(ngx_http_request_t *r, ngx_uint_t encoding);
+ngx_int_t ngx_http_encoding_quality(ngx_str_t *ae, ngx_uint_t encoding);
+char *ngx_http_encoding_dictionary(ngx_conf_t *cf, ngx_str_t *name,
+    ngx_http_encoding_dict_t **dictp);
+#endif
 
 
 ngx_int_t ngx_http_subrequest(ngx_http_request_t *r,
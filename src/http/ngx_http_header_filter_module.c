@@ -409,6 +409,12 @@ ngx_http_header_filter(ngx_http_request_t *r)        /*将headers_out的内容
         if (clcf->gzip_vary) {
             len += sizeof("Vary: Accept-Encoding" CRLF) - 1;
 
+#if (NGX_HTTP_ENCODING)
+            if (r->dictionary_vary) {
+                len += sizeof(", Available-Dictionary") - 1;
+            }
+#endif
+
         } else {
             r->gzip_vary = 0;
         }
@@ -574,8 +580,17 @@ ngx_http_header_filter(ngx_http_request_t *r)        /*将headers_out的内容
 
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
-        b->last = ngx_cpymem(b->last, "Vary: Accept-Encoding" CRLF,
-                             sizeof("Vary: Accept-Encoding" CRLF) - 1);
+        b->last = ngx_cpymem(b->last, "Vary: Accept-Encoding",
+                             sizeof("Vary: Accept-Encoding") - 1);
+
+#if (NGX_HTTP_ENCODING)
+        if (r->dictionary_vary) {
+            b->last = ngx_cpymem(b->last, ", Available-Dictionary",
+                                 sizeof(", Available-Dictionary") - 1);
+        }
+#endif
+
+        *b->last++ = CR; *b->last++ = LF;
     }
 #endif
 
@@ -142,6 +142,12 @@ ngx_http_header_t  ngx_http_headers_in[] = {
                  ngx_http_process_header_line },
 #endif
 
+#if (NGX_HTTP_ENCODING)
+    { ngx_string("Available-Dictionary"),
+                 offsetof(ngx_http_headers_in_t, available_dictionary),
+                 ngx_http_process_unique_header_line },
+#endif
+
     { ngx_string("Authorization"),
                  offsetof(ngx_http_headers_in_t, authorization),
                  ngx_http_process_unique_header_line },
@@ -571,7 +577,7 @@ ngx_http_create_request(ngx_connection_t *c) /*创建一个请求结构*/
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
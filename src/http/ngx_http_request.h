@@ -194,6 +194,9 @@ typedef struct {
     ngx_table_elt_t                  *accept_encoding;
     ngx_table_elt_t                  *via;
 #endif
+#if (NGX_HTTP_ENCODING)
+    ngx_table_elt_t                  *available_dictionary;
+#endif
 
     ngx_table_elt_t                  *authorization;
 
@@ -414,6 +417,9 @@ struct ngx_http_request_s { /*表示一个客户端请求*/
 
     ngx_http_variable_value_t        *variables;
 
+    ngx_http_param_index_t           *args_index;
+    ngx_http_param_index_t           *cookies_index;
+
 #if (NGX_PCRE)
     ngx_uint_t                        ncaptures;
     int                              *captures;
@@ -486,6 +492,9 @@ struct ngx_http_request_s { /*表示一个客户端请求*/
     unsigned                          gzip_ok:1;
     unsigned                          gzip_vary:1;
 #endif
+#if (NGX_HTTP_ENCODING)
+    unsigned                          dictionary_vary:1;
+#endif
 
     unsigned                          proxy:1;
     unsigned                          bypass_cache:1;
@@ -498,6 +507,7 @@ struct ngx_http_request_s { /*表示一个客户端请求*/
      */
     unsigned                          limit_conn_set:1;
     unsigned                          limit_req_set:1;
+    unsigned                          limit_req_status:3;
 
 #if 0
     unsigned                          cacheable:1;
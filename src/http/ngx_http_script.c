@@ -10,6 +10,10 @@
 #include <ngx_http.h>
 
 
+static ngx_int_t ngx_http_complex_value_var(ngx_http_request_t *r,
+    ngx_http_complex_var_t *var, ngx_str_t *value);
+static ngx_int_t ngx_http_compile_complex_var(ngx_conf_t *cf,
+    ngx_http_complex_value_t *cv);
 static ngx_int_t ngx_http_script_init_arrays(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_done(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_add_copy_code(ngx_http_script_compile_t *sc,
@@ -68,6 +72,10 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
         return NGX_OK;
     }
 
+    if (val->var) {
+        return ngx_http_complex_value_var(r, val->var, value);
+    }
+
     ngx_http_script_flush_complex_value(r, val);
 
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
@@ -104,6 +112,42 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 }
 
 
+static ngx_int_t
+ngx_http_complex_value_var(ngx_http_request_t *r, ngx_http_complex_var_t *var,
+    ngx_str_t *value)
+{
+    u_char                     *p;
+    ngx_http_variable_value_t  *vv;
+
+    vv = ngx_http_get_flushed_variable(r, var->index);
+
+    if (vv && vv->not_found) {
+        vv = NULL;
+    }
+
+    /* the sizes are known, so the length and copy passes are fused */
+
+    value->len = var->prefix.len + var->suffix.len + (vv ? vv->len : 0);
+    value->data = ngx_pnalloc(r->pool, value->len);
+    if (value->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(value->data, var->prefix.data, var->prefix.len);
+
+    if (vv) {
+        p = ngx_cpymem(p, vv->data, vv->len);
+    }
+
+    ngx_memcpy(p, var->suffix.data, var->suffix.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http complex value: \"%V\"", value);
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
 {
@@ -143,6 +187,7 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->var = NULL;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -204,6 +249,94 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    if (nv == 1 && nc == 0
+        && ngx_http_compile_complex_var(ccv->cf, ccv->complex_value)
+           == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * the most common complex values are a single variable optionally
+ * surrounded by constant strings, e.g. "$host" or "http://$host/",
+ * they are recognized in the compiled codes and are evaluated directly
+ */
+
+static ngx_int_t
+ngx_http_compile_complex_var(ngx_conf_t *cf, ngx_http_complex_value_t *cv)
+{
+    u_char                       *ip;
+    ngx_str_t                     prefix, suffix, *s;
+    ngx_uint_t                    index, found;
+    ngx_http_complex_var_t       *var;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_var_code_t   *vcode;
+    ngx_http_script_copy_code_t  *ccode;
+
+    ngx_str_null(&prefix);
+    ngx_str_null(&suffix);
+
+    index = 0;
+    found = 0;
+
+    for (ip = cv->values; *(uintptr_t *) ip; /* void */ ) {
+
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            ccode = (ngx_http_script_copy_code_t *) ip;
+
+            s = found ? &suffix : &prefix;
+
+            if (s->len) {
+                return NGX_DECLINED;
+            }
+
+            s->len = ccode->len;
+            s->data = ip + sizeof(ngx_http_script_copy_code_t);
+
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((ccode->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+            continue;
+        }
+
+        if (code == ngx_http_script_copy_var_code && !found) {
+            vcode = (ngx_http_script_var_code_t *) ip;
+
+            index = vcode->index;
+            found = 1;
+
+            ip += sizeof(ngx_http_script_var_code_t);
+
+            continue;
+        }
+
+        /* the full name or capture codes are not specialized */
+
+        return NGX_DECLINED;
+    }
+
+    if (!found) {
+        return NGX_DECLINED;
+    }
+
+    var = ngx_palloc(cf->pool, sizeof(ngx_http_complex_var_t));
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->prefix = prefix;
+    var->suffix = suffix;
+    var->index = index;
+
+    cv->var = var;
+
     return NGX_OK;
 }
 
@@ -63,11 +63,21 @@ typedef struct {
 } ngx_http_script_compile_t;
 
 
+typedef struct {
+    ngx_str_t                   prefix;
+    ngx_str_t                   suffix;
+    ngx_uint_t                  index;
+} ngx_http_complex_var_t;
+
+
 typedef struct {
     ngx_str_t                   value;
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
+
+    /* the "prefix$variable suffix" value evaluated without the codes */
+    ngx_http_complex_var_t     *var;
 } ngx_http_complex_value_t;
 
 
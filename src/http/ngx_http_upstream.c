@@ -22,6 +22,9 @@ static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
 #endif
 
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
+static void ngx_http_upstream_resolve(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_resolver_handler_pt handler);
+static void ngx_http_upstream_resolve_srv_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r);
 static void ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r);
@@ -479,7 +482,6 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
 {
     ngx_str_t                      *host;
     ngx_uint_t                      i;
-    ngx_resolver_ctx_t             *ctx, temp;
     ngx_http_cleanup_t             *cln;
     ngx_http_upstream_t            *u;
     ngx_http_core_loc_conf_t       *clcf;
@@ -618,45 +620,24 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
             }
         }
 
-        if (u->resolved->port == 0) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "no port in upstream \"%V\"", host);
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
-
-        temp.name = *host;
+        /* "_service._proto.name" without a port is an SRV name */
 
-        ctx = ngx_resolve_start(clcf->resolver, &temp);
-        if (ctx == NULL) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+        if (u->resolved->no_port && host->len && host->data[0] == '_') {
+            ngx_http_upstream_resolve(r, u,
+                                      ngx_http_upstream_resolve_srv_handler);
             return;
         }
 
-        if (ctx == NGX_NO_RESOLVER) {
+        if (u->resolved->port == 0) {
             ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "no resolver defined to resolve %V", host);
-
-            ngx_http_upstream_finalize_request(r, u, NGX_HTTP_BAD_GATEWAY);
-            return;
-        }
-
-        ctx->name = *host;
-        ctx->handler = ngx_http_upstream_resolve_handler;
-        ctx->data = r;
-        ctx->timeout = clcf->resolver_timeout;
-
-        u->resolved->ctx = ctx;
-
-        if (ngx_resolve_name(ctx) != NGX_OK) {
-            u->resolved->ctx = NULL;
+                          "no port in upstream \"%V\"", host);
             ngx_http_upstream_finalize_request(r, u,
                                                NGX_HTTP_INTERNAL_SERVER_ERROR);
             return;
         }
 
+        ngx_http_upstream_resolve(r, u, ngx_http_upstream_resolve_handler);
+
         return;
     }
 
@@ -888,6 +869,137 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
 #endif
 
 
+static void
+ngx_http_upstream_resolve(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_resolver_handler_pt handler)
+{
+    ngx_int_t                  rc;
+    ngx_str_t                 *host;
+    ngx_resolver_ctx_t        *ctx, temp;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    host = &u->resolved->host;
+
+    temp.name = *host;
+
+    ctx = ngx_resolve_start(clcf->resolver, &temp);
+    if (ctx == NULL) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "no resolver defined to resolve %V", host);
+
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_BAD_GATEWAY);
+        return;
+    }
+
+    ctx->name = *host;
+    ctx->handler = handler;
+    ctx->data = r;
+    ctx->timeout = clcf->resolver_timeout;
+
+    u->resolved->ctx = ctx;
+
+    if (handler == ngx_http_upstream_resolve_srv_handler) {
+        rc = ngx_resolve_srv(ctx);
+
+    } else {
+        rc = ngx_resolve_name(ctx);
+    }
+
+    if (rc != NGX_OK) {
+        u->resolved->ctx = NULL;
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+    }
+}
+
+
+static void
+ngx_http_upstream_resolve_srv_handler(ngx_resolver_ctx_t *ctx)
+{
+    ngx_uint_t                     i, n, weight;
+    ngx_connection_t              *c;
+    ngx_http_request_t            *r;
+    ngx_resolver_srv_t            *srv;
+    ngx_http_upstream_t           *u;
+    ngx_http_upstream_resolved_t  *ur;
+
+    r = ctx->data;
+    c = r->connection;
+
+    u = r->upstream;
+    ur = u->resolved;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "%V could not be resolved (%i: %s)",
+                      &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_BAD_GATEWAY);
+        goto failed;
+    }
+
+    /*
+     * the records are sorted by priority, a target of the best priority
+     * is chosen randomly in proportion to the weights
+     */
+
+    srv = ctx->srvs;
+    weight = 0;
+
+    for (n = 0; n < ctx->nsrvs; n++) {
+        if (srv[n].priority != srv[0].priority) {
+            break;
+        }
+
+        weight += srv[n].weight;
+    }
+
+    i = 0;
+
+    if (weight) {
+        weight = ngx_random() % weight;
+
+        while (weight >= srv[i].weight) {
+            weight -= srv[i].weight;
+            i++;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "service %V was resolved to %V:%d",
+                   &ctx->name, &srv[i].name, srv[i].port);
+
+    ur->host.data = ngx_pstrdup(r->pool, &srv[i].name);
+    if (ur->host.data == NULL) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        goto failed;
+    }
+
+    ur->host.len = srv[i].name.len;
+    ur->port = srv[i].port;
+    ur->no_port = 0;
+
+    ngx_resolve_srv_done(ctx);
+    ur->ctx = NULL;
+
+    ngx_http_upstream_resolve(r, u, ngx_http_upstream_resolve_handler);
+
+failed:
+
+    ngx_http_run_posted_requests(c);
+}
+
+
 static void
 ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx)
 {
@@ -3420,7 +3532,16 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     }
 
     if (u->resolved && u->resolved->ctx) {
-        ngx_resolve_name_done(u->resolved->ctx);
+
+        if (u->resolved->ctx->handler
+            == ngx_http_upstream_resolve_srv_handler)
+        {
+            ngx_resolve_srv_done(u->resolved->ctx);
+
+        } else {
+            ngx_resolve_name_done(u->resolved->ctx);
+        }
+
         u->resolved->ctx = NULL;
     }
 
@@ -11,6 +11,8 @@
 #include <nginx.h>
 
 
+static ngx_http_variable_t *ngx_http_variable_find_prefix(ngx_str_t *name);
+
 static ngx_int_t ngx_http_variable_request(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static void ngx_http_variable_request_set(ngx_http_request_t *r,
@@ -39,6 +41,16 @@ static ngx_int_t ngx_http_variable_cookie(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_argument(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_param_index_t *ngx_http_variable_args_index(
+    ngx_http_request_t *r);
+static ngx_http_param_index_t *ngx_http_variable_cookies_index(
+    ngx_http_request_t *r);
+static ngx_http_param_index_t *ngx_http_param_index_create(ngx_pool_t *pool,
+    ngx_uint_t n);
+static void ngx_http_param_index_add(ngx_http_param_index_t *index,
+    u_char *name, size_t len, u_char *value, size_t size);
+static ngx_int_t ngx_http_param_index_find(ngx_http_param_index_t *index,
+    u_char *name, size_t len, ngx_str_t *value);
 #if (NGX_HAVE_TCP_INFO)
 static ngx_int_t ngx_http_variable_tcpinfo(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -345,6 +357,32 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
 };
 
 
+/*
+ * the prefix variables are resolved to the indexed handlers while
+ * the configuration is being initialized, so the per name lookups
+ * are only needed for the names unknown at the configuration time
+ */
+
+static ngx_http_variable_t  ngx_http_prefix_variables[] = {
+
+    { ngx_string("http_"), NULL, ngx_http_variable_unknown_header_in,
+      0, 0, 0 },
+
+    { ngx_string("sent_http_"), NULL, ngx_http_variable_unknown_header_out,
+      0, 0, 0 },
+
+    { ngx_string("upstream_http_"), NULL, ngx_http_upstream_header_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("cookie_"), NULL, ngx_http_variable_cookie, 0, 0, 0 },
+
+    { ngx_string("arg_"), NULL, ngx_http_variable_argument,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
 ngx_http_variable_value_t  ngx_http_variable_null_value =
     ngx_http_variable("");
 ngx_http_variable_value_t  ngx_http_variable_true_value =
@@ -542,7 +580,7 @@ ngx_http_get_flushed_variable(ngx_http_request_t *r, ngx_uint_t index)
 ngx_http_variable_value_t *
 ngx_http_get_variable(ngx_http_request_t *r, ngx_str_t *name, ngx_uint_t key)
 {
-    ngx_http_variable_t        *v;
+    ngx_http_variable_t        *v, *pv;
     ngx_http_variable_value_t  *vv;
     ngx_http_core_main_conf_t  *cmcf;
 
@@ -571,60 +609,37 @@ ngx_http_get_variable(ngx_http_request_t *r, ngx_str_t *name, ngx_uint_t key)
         return NULL;
     }
 
-    if (ngx_strncmp(name->data, "http_", 5) == 0) {
-
-        if (ngx_http_variable_unknown_header_in(r, vv, (uintptr_t) name)
-            == NGX_OK)
-        {
-            return vv;
-        }
-
-        return NULL;
-    }
-
-    if (ngx_strncmp(name->data, "sent_http_", 10) == 0) {
+    pv = ngx_http_variable_find_prefix(name);
 
-        if (ngx_http_variable_unknown_header_out(r, vv, (uintptr_t) name)
-            == NGX_OK)
-        {
+    if (pv) {
+        if (pv->get_handler(r, vv, (uintptr_t) name) == NGX_OK) {
             return vv;
         }
 
         return NULL;
     }
 
-    if (ngx_strncmp(name->data, "upstream_http_", 14) == 0) {
-
-        if (ngx_http_upstream_header_variable(r, vv, (uintptr_t) name)
-            == NGX_OK)
-        {
-            return vv;
-        }
-
-        return NULL;
-    }
+    vv->not_found = 1;
 
-    if (ngx_strncmp(name->data, "cookie_", 7) == 0) {
+    return vv;
+}
 
-        if (ngx_http_variable_cookie(r, vv, (uintptr_t) name) == NGX_OK) {
-            return vv;
-        }
 
-        return NULL;
-    }
+static ngx_http_variable_t *
+ngx_http_variable_find_prefix(ngx_str_t *name)
+{
+    ngx_http_variable_t  *pv;
 
-    if (ngx_strncmp(name->data, "arg_", 4) == 0) {
+    for (pv = ngx_http_prefix_variables; pv->name.len; pv++) {
 
-        if (ngx_http_variable_argument(r, vv, (uintptr_t) name) == NGX_OK) {
-            return vv;
+        if (name->len >= pv->name.len
+            && ngx_strncmp(name->data, pv->name.data, pv->name.len) == 0)
+        {
+            return pv;
         }
-
-        return NULL;
     }
 
-    vv->not_found = 1;
-
-    return vv;
+    return NULL;
 }
 
 
@@ -944,14 +959,26 @@ ngx_http_variable_cookie(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_str_t *name = (ngx_str_t *) data;
 
-    ngx_str_t  cookie, s;
+    u_char                  *p;
+    size_t                   len;
+    ngx_str_t                cookie;
+    ngx_http_param_index_t  *index;
 
-    s.len = name->len - (sizeof("cookie_") - 1);
-    s.data = name->data + sizeof("cookie_") - 1;
+    len = name->len - (sizeof("cookie_") - 1);
+    p = name->data + sizeof("cookie_") - 1;
 
-    if (ngx_http_parse_multi_header_lines(&r->headers_in.cookies, &s, &cookie)
-        == NGX_DECLINED)
-    {
+    index = ngx_http_variable_cookies_index(r);
+
+    if (index == NULL) {
+        if (r->headers_in.cookies.nelts) {
+            return NGX_ERROR;
+        }
+
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    if (ngx_http_param_index_find(index, p, len, &cookie) != NGX_OK) {
         v->not_found = 1;
         return NGX_OK;
     }
@@ -972,14 +999,26 @@ ngx_http_variable_argument(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_str_t *name = (ngx_str_t *) data;
 
-    u_char     *arg;
-    size_t      len;
-    ngx_str_t   value;
+    u_char                  *arg;
+    size_t                   len;
+    ngx_str_t                value;
+    ngx_http_param_index_t  *index;
 
     len = name->len - (sizeof("arg_") - 1);
     arg = name->data + sizeof("arg_") - 1;
 
-    if (ngx_http_arg(r, arg, len, &value) != NGX_OK) {
+    index = ngx_http_variable_args_index(r);
+
+    if (index == NULL) {
+        if (r->args.len) {
+            return NGX_ERROR;
+        }
+
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    if (ngx_http_param_index_find(index, arg, len, &value) != NGX_OK) {
         v->not_found = 1;
         return NGX_OK;
     }
@@ -994,6 +1033,276 @@ ngx_http_variable_argument(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+/*
+ * the index follows the ngx_http_arg() rules: an argument name
+ * is matched case-insensitively, it ends at the first "=", and
+ * the first argument with the name wins
+ */
+
+static ngx_http_param_index_t *
+ngx_http_variable_args_index(ngx_http_request_t *r)
+{
+    u_char                  *p, *eq, *end, *last;
+    ngx_uint_t               n;
+    ngx_http_param_index_t  *index;
+
+    index = r->args_index;
+
+    if (r->args.len == 0) {
+        return NULL;
+    }
+
+    if (index
+        && index->source == r->args.data
+        && index->len == r->args.len)
+    {
+        return index;
+    }
+
+    p = r->args.data;
+    last = p + r->args.len;
+
+    for (n = 1; p < last; p++) {
+        if (*p == '&') {
+            n++;
+        }
+    }
+
+    index = ngx_http_param_index_create(r->pool, n);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    for (p = r->args.data; p < last; p = end + 1) {
+
+        end = ngx_strlchr(p, last, '&');
+
+        if (end == NULL) {
+            end = last;
+        }
+
+        eq = ngx_strlchr(p, end, '=');
+
+        if (eq && eq != p) {
+            ngx_http_param_index_add(index, p, eq - p, eq + 1, end - eq - 1);
+        }
+    }
+
+    index->source = r->args.data;
+    index->len = r->args.len;
+
+    r->args_index = index;
+
+    return index;
+}
+
+
+/*
+ * the index follows the ngx_http_parse_multi_header_lines() rules:
+ * a cookie may start at the beginning of a header line or after
+ * ";" or ",", the spaces around "=" are skipped, and a value lasts
+ * up to the next ";"
+ */
+
+static ngx_http_param_index_t *
+ngx_http_variable_cookies_index(ngx_http_request_t *r)
+{
+    u_char                  *start, *end, *p, *last, *name, ch;
+    ngx_uint_t               i, n;
+    ngx_table_elt_t        **h;
+    ngx_http_param_index_t  *index;
+
+    index = r->cookies_index;
+
+    if (r->headers_in.cookies.nelts == 0) {
+        return NULL;
+    }
+
+    h = r->headers_in.cookies.elts;
+
+    if (index
+        && index->source == h
+        && index->len == r->headers_in.cookies.nelts)
+    {
+        return index;
+    }
+
+    n = 0;
+
+    for (i = 0; i < r->headers_in.cookies.nelts; i++) {
+
+        n++;
+
+        start = h[i]->value.data;
+        end = start + h[i]->value.len;
+
+        for ( /* void */ ; start < end; start++) {
+            if (*start == ';' || *start == ',') {
+                n++;
+            }
+        }
+    }
+
+    index = ngx_http_param_index_create(r->pool, n);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < r->headers_in.cookies.nelts; i++) {
+
+        start = h[i]->value.data;
+        end = start + h[i]->value.len;
+
+        while (start < end) {
+
+            name = start;
+
+            for (p = start; p < end; p++) {
+                if (*p == '=' || *p == ';' || *p == ',') {
+                    break;
+                }
+            }
+
+            if (p < end && *p == '=') {
+
+                for (last = p; last > name && *(last - 1) == ' '; last--) {
+                    /* void */
+                }
+
+                for (p++; p < end && *p == ' '; p++) { /* void */ }
+
+                for (start = p; start < end && *start != ';'; start++) {
+                    /* void */
+                }
+
+                if (last != name) {
+                    ngx_http_param_index_add(index, name, last - name,
+                                             p, start - p);
+                }
+
+                start = name;
+            }
+
+            while (start < end) {
+                ch = *start++;
+                if (ch == ';' || ch == ',') {
+                    break;
+                }
+            }
+
+            while (start < end && *start == ' ') { start++; }
+        }
+    }
+
+    index->source = h;
+    index->len = r->headers_in.cookies.nelts;
+
+    r->cookies_index = index;
+
+    return index;
+}
+
+
+static ngx_http_param_index_t *
+ngx_http_param_index_create(ngx_pool_t *pool, ngx_uint_t n)
+{
+    ngx_uint_t               size;
+    ngx_http_param_index_t  *index;
+
+    index = ngx_palloc(pool, sizeof(ngx_http_param_index_t));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    /* keep the open addressed table at most half full */
+
+    for (size = 8; size < 2 * n; size <<= 1) { /* void */ }
+
+    index->elts = ngx_pcalloc(pool, size * sizeof(ngx_http_param_t));
+    if (index->elts == NULL) {
+        return NULL;
+    }
+
+    index->mask = size - 1;
+
+    return index;
+}
+
+
+static void
+ngx_http_param_index_add(ngx_http_param_index_t *index, u_char *name,
+    size_t len, u_char *value, size_t size)
+{
+    ngx_uint_t         i, key;
+    ngx_http_param_t  *param;
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, ngx_tolower(name[i]));
+    }
+
+    for (i = key & index->mask; /* void */ ; i = (i + 1) & index->mask) {
+
+        param = &index->elts[i];
+
+        if (param->name.len == 0) {
+            break;
+        }
+
+        if (param->key == key
+            && param->name.len == len
+            && ngx_strncasecmp(param->name.data, name, len) == 0)
+        {
+            /* the first occurrence wins */
+            return;
+        }
+    }
+
+    param->key = key;
+    param->name.len = len;
+    param->name.data = name;
+    param->value.len = size;
+    param->value.data = value;
+}
+
+
+static ngx_int_t
+ngx_http_param_index_find(ngx_http_param_index_t *index, u_char *name,
+    size_t len, ngx_str_t *value)
+{
+    ngx_uint_t         i, key;
+    ngx_http_param_t  *param;
+
+    if (len == 0) {
+        return NGX_DECLINED;
+    }
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, ngx_tolower(name[i]));
+    }
+
+    for (i = key & index->mask; /* void */ ; i = (i + 1) & index->mask) {
+
+        param = &index->elts[i];
+
+        if (param->name.len == 0) {
+            return NGX_DECLINED;
+        }
+
+        if (param->key == key
+            && param->name.len == len
+            && ngx_strncasecmp(param->name.data, name, len) == 0)
+        {
+            *value = param->value;
+            return NGX_OK;
+        }
+    }
+}
+
+
 #if (NGX_HAVE_TCP_INFO)
 
 static ngx_int_t
@@ -2224,14 +2533,26 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 #if (NGX_PCRE)
 
     if (len && map->nregex) {
-        ngx_int_t              n;
+        ngx_int_t              n, limit;
         ngx_uint_t             i;
         ngx_http_map_regex_t  *reg;
 
         reg = map->regex;
 
+        limit = map->regex_set ? ngx_http_regex_set_exec(r, map->regex_set,
+                                                         match)
+                               : NGX_OK;
+
+        if (limit == NGX_ERROR) {
+            return NULL;
+        }
+
         for (i = 0; i < map->nregex; i++) {
 
+            if (ngx_http_regex_set_skip(map->regex_set, i, limit)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
             if (n == NGX_OK) {
@@ -2292,6 +2613,7 @@ ngx_http_regex_compile(ngx_conf_t *cf, ngx_regex_compile_t *rc)
     re->regex = rc->regex;
     re->ncaptures = rc->captures;
     re->name = rc->pattern;
+    re->options = rc->options;
 
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
     cmcf->ncaptures = ngx_max(cmcf->ncaptures, re->ncaptures);
@@ -2406,6 +2728,201 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     return NGX_OK;
 }
 
+
+static ngx_uint_t
+ngx_http_regex_combinable(ngx_http_regex_t *re)
+{
+    u_char  *p, *last;
+
+    if (re->nvariables) {
+        return 0;
+    }
+
+    p = re->name.data;
+    last = p + re->name.len;
+
+    if (last - p > 1 && p[0] == '(' && p[1] == '*') {
+        /* the "(*VERB)" settings are valid at the pattern start only */
+        return 0;
+    }
+
+    for ( /* void */ ; p < last - 1; p++) {
+
+        if (p[0] == '\\') {
+            if (p[1] == 'Q' || p[1] == 'g' || p[1] == 'k'
+                || (p[1] >= '1' && p[1] <= '9'))
+            {
+                /* quoting or references to the group numbers */
+                return 0;
+            }
+
+            p++;
+            continue;
+        }
+
+        if (p[0] == '(' && p[1] == '?' && p + 2 < last) {
+            switch (p[2]) {
+            case 'R': case '&': case 'P': case '(': case '+': case '-':
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                /* recursion, subroutine calls, and conditions */
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * the regexes are combined as "(re1)|((?i)re2)|...": the alternation
+ * matches if any of them does, and the first set wrapper group points
+ * to the regex which matched at the leftmost position, so the regexes
+ * after it need not be tried; the regexes which may depend on their
+ * own group numbers or on the pattern start are left out of the set
+ */
+
+ngx_http_regex_set_t *
+ngx_http_regex_set_compile(ngx_conf_t *cf, ngx_http_regex_t **regex,
+    ngx_uint_t n)
+{
+    u_char                *p;
+    size_t                 len;
+    ngx_uint_t             i, group, combined;
+    ngx_regex_compile_t    rc;
+    ngx_http_regex_set_t  *set;
+    u_char                 errstr[NGX_MAX_CONF_ERRSTR];
+
+    set = ngx_pcalloc(cf->pool, sizeof(ngx_http_regex_set_t));
+    if (set == NULL) {
+        return NULL;
+    }
+
+    set->groups = ngx_pcalloc(cf->pool, n * sizeof(ngx_uint_t));
+    if (set->groups == NULL) {
+        return NULL;
+    }
+
+    set->nelts = n;
+
+    len = 0;
+    group = 1;
+    combined = 0;
+
+    for (i = 0; i < n; i++) {
+
+        if (!ngx_http_regex_combinable(regex[i])) {
+            continue;
+        }
+
+        set->groups[i] = group;
+        group += 1 + regex[i]->ncaptures;
+
+        len += regex[i]->name.len + sizeof("|((?i))") - 1;
+        combined++;
+    }
+
+    if (combined < 2) {
+        return set;
+    }
+
+    p = ngx_pnalloc(cf->pool, len + 1);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+    rc.pool = cf->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    for (i = 0; i < n; i++) {
+
+        if (set->groups[i] == 0) {
+            continue;
+        }
+
+        if (p != rc.pattern.data) {
+            *p++ = '|';
+        }
+
+        *p++ = '(';
+
+        if (regex[i]->options & NGX_REGEX_CASELESS) {
+            p = ngx_cpymem(p, "(?i)", sizeof("(?i)") - 1);
+        }
+
+        p = ngx_cpymem(p, regex[i]->name.data, regex[i]->name.len);
+        *p++ = ')';
+    }
+
+    *p = '\0';
+    rc.pattern.len = p - rc.pattern.data;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, cf->log, 0,
+                      "regexes are matched one by one: %V", &rc.err);
+
+        ngx_memzero(set->groups, n * sizeof(ngx_uint_t));
+        return set;
+    }
+
+    set->regex = rc.regex;
+    set->ncaptures = (rc.captures + 1) * 3;
+
+    set->captures = ngx_palloc(cf->pool, set->ncaptures * sizeof(int));
+    if (set->captures == NULL) {
+        return NULL;
+    }
+
+    return set;
+}
+
+
+ngx_int_t
+ngx_http_regex_set_exec(ngx_http_request_t *r, ngx_http_regex_set_t *set,
+    ngx_str_t *s)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  i, g;
+
+    if (set->regex == NULL) {
+        return NGX_OK;
+    }
+
+    rc = ngx_regex_exec(set->regex, s, set->captures, set->ncaptures);
+
+    if (rc == NGX_REGEX_NO_MATCHED) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "regex set: no match on \"%V\"", s);
+        return NGX_DECLINED;
+    }
+
+    if (rc < 0) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      ngx_regex_exec_n " failed: %i on \"%V\" using "
+                      "the combined regex", rc, s);
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < set->nelts; i++) {
+        g = set->groups[i];
+
+        if (g && (rc == 0 || g < (ngx_uint_t) rc)
+            && set->captures[2 * g] >= 0)
+        {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "regex set: match %ui on \"%V\"", i, s);
+            return i;
+        }
+    }
+
+    return set->nelts;
+}
+
 #endif
 
 
@@ -2463,75 +2980,77 @@ ngx_http_variables_add_core_vars(ngx_conf_t *cf)
 ngx_int_t
 ngx_http_variables_init_vars(ngx_conf_t *cf)
 {
+    ngx_int_t                   rc;
     ngx_uint_t                  i, n;
+    ngx_hash_t                  names;
     ngx_hash_key_t             *key;
     ngx_hash_init_t             hash;
-    ngx_http_variable_t        *v, *av;
+    ngx_http_variable_t        *v, *av, *pv;
     ngx_http_core_main_conf_t  *cmcf;
 
-    /* set the handlers for the indexed http variables */
-
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
-    v = cmcf->variables.elts;
-    key = cmcf->variables_keys->keys.elts;
+    /*
+     * the indexed variables are resolved through a temporary hash
+     * of all variables, including the ones not to be hashed at run time
+     */
 
-    for (i = 0; i < cmcf->variables.nelts; i++) {
+    hash.hash = &names;
+    hash.key = ngx_hash_key;
+    hash.max_size = cmcf->variables_hash_max_size;
+    hash.bucket_size = cmcf->variables_hash_bucket_size;
+    hash.name = "variables_hash";
+    hash.pool = cf->temp_pool;
+    hash.temp_pool = NULL;
 
-        for (n = 0; n < cmcf->variables_keys->keys.nelts; n++) {
+    if (ngx_hash_init(&hash, cmcf->variables_keys->keys.elts,
+                      cmcf->variables_keys->keys.nelts)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
-            av = key[n].value;
+    /* set the handlers for the indexed http variables */
 
-            if (av->get_handler
-                && v[i].name.len == key[n].key.len
-                && ngx_strncmp(v[i].name.data, key[n].key.data, v[i].name.len)
-                   == 0)
-            {
-                v[i].get_handler = av->get_handler;
-                v[i].data = av->data;
+    v = cmcf->variables.elts;
 
-                av->flags |= NGX_HTTP_VAR_INDEXED;
-                v[i].flags = av->flags;
+    for (i = 0; i < cmcf->variables.nelts; i++) {
 
-                av->index = i;
+        n = ngx_hash_key(v[i].name.data, v[i].name.len);
 
-                goto next;
-            }
-        }
+        av = ngx_hash_find(&names, n, v[i].name.data, v[i].name.len);
 
-        if (ngx_strncmp(v[i].name.data, "http_", 5) == 0) {
-            v[i].get_handler = ngx_http_variable_unknown_header_in;
-            v[i].data = (uintptr_t) &v[i].name;
+        if (av && av->get_handler) {
+            v[i].get_handler = av->get_handler;
+            v[i].data = av->data;
 
-            continue;
-        }
+            av->flags |= NGX_HTTP_VAR_INDEXED;
+            v[i].flags = av->flags;
 
-        if (ngx_strncmp(v[i].name.data, "sent_http_", 10) == 0) {
-            v[i].get_handler = ngx_http_variable_unknown_header_out;
-            v[i].data = (uintptr_t) &v[i].name;
+            av->index = i;
 
             continue;
         }
 
-        if (ngx_strncmp(v[i].name.data, "upstream_http_", 14) == 0) {
-            v[i].get_handler = ngx_http_upstream_header_variable;
-            v[i].data = (uintptr_t) &v[i].name;
-            v[i].flags = NGX_HTTP_VAR_NOCACHEABLE;
+        pv = ngx_http_variable_find_prefix(&v[i].name);
 
-            continue;
-        }
-
-        if (ngx_strncmp(v[i].name.data, "cookie_", 7) == 0) {
-            v[i].get_handler = ngx_http_variable_cookie;
+        if (pv) {
+            v[i].get_handler = pv->get_handler;
             v[i].data = (uintptr_t) &v[i].name;
+            v[i].flags = pv->flags|NGX_HTTP_VAR_INDEXED;
 
-            continue;
-        }
+            /*
+             * make the resolved name visible to ngx_http_get_variable(),
+             * so the runtime lookups reuse the indexed slot instead of
+             * matching the prefixes and calling the handler every time
+             */
 
-        if (ngx_strncmp(v[i].name.data, "arg_", 4) == 0) {
-            v[i].get_handler = ngx_http_variable_argument;
-            v[i].data = (uintptr_t) &v[i].name;
-            v[i].flags = NGX_HTTP_VAR_NOCACHEABLE;
+            rc = ngx_hash_add_key(cmcf->variables_keys, &v[i].name, &v[i],
+                                  NGX_HASH_READONLY_KEY);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
 
             continue;
         }
@@ -2540,12 +3059,11 @@ ngx_http_variables_init_vars(ngx_conf_t *cf)
                       "unknown \"%V\" variable", &v[i].name);
 
         return NGX_ERROR;
-
-    next:
-        continue;
     }
 
 
+    key = cmcf->variables_keys->keys.elts;
+
     for (n = 0; n < cmcf->variables_keys->keys.nelts; n++) {
         av = key[n].value;
 
@@ -42,6 +42,27 @@ struct ngx_http_variable_s {
 };
 
 
+typedef struct {
+    ngx_uint_t                    key;
+    ngx_str_t                     name;
+    ngx_str_t                     value;
+} ngx_http_param_t;
+
+
+/*
+ * the name/value index of the request arguments or cookies,
+ * it is built on the first $arg_* or $cookie_* access and is
+ * reused while the indexed source stays the same
+ */
+
+typedef struct {
+    ngx_http_param_t             *elts;
+    ngx_uint_t                    mask;
+    void                         *source;
+    size_t                        len;
+} ngx_http_param_index_t;
+
+
 ngx_http_variable_t *ngx_http_add_variable(ngx_conf_t *cf, ngx_str_t *name,
     ngx_uint_t flags);
 ngx_int_t ngx_http_get_variable_index(ngx_conf_t *cf, ngx_str_t *name);
@@ -71,9 +92,24 @@ typedef struct {
     ngx_http_regex_variable_t    *variables;
     ngx_uint_t                    nvariables;
     ngx_str_t                     name;
+    ngx_int_t                     options;
 } ngx_http_regex_t;
 
 
+/*
+ * the ordered regexes combined into a single alternation,
+ * so a miss costs one match instead of one match per regex
+ */
+
+typedef struct {
+    ngx_regex_t                  *regex;
+    ngx_uint_t                   *groups;   /* 0 if a regex is not combined */
+    ngx_uint_t                    nelts;
+    int                          *captures;
+    ngx_uint_t                    ncaptures;
+} ngx_http_regex_set_t;
+
+
 typedef struct {
     ngx_http_regex_t             *regex;
     void                         *value;
@@ -85,6 +121,20 @@ ngx_http_regex_t *ngx_http_regex_compile(ngx_conf_t *cf,
 ngx_int_t ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re,
     ngx_str_t *s);
 
+ngx_http_regex_set_t *ngx_http_regex_set_compile(ngx_conf_t *cf,
+    ngx_http_regex_t **regex, ngx_uint_t n);
+ngx_int_t ngx_http_regex_set_exec(ngx_http_request_t *r,
+    ngx_http_regex_set_t *set, ngx_str_t *s);
+
+/*
+ * the limit is the ngx_http_regex_set_exec() result: the combined regexes
+ * after it, or all of them if it is NGX_DECLINED, are known not to match
+ */
+
+#define ngx_http_regex_set_skip(set, i, limit)                               \
+    ((set) && (set)->groups[i]                                                \
+     && ((limit) == NGX_DECLINED || (ngx_int_t) (i) > (limit)))
+
 #endif
 
 
@@ -93,6 +143,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
     ngx_uint_t                    nregex;
+    ngx_http_regex_set_t         *regex_set;
 #endif
 } ngx_http_map_t;
 
@@ -53,6 +53,9 @@ typedef int               ngx_err_t; 		/*错误结构*/
 #define NGX_ENOMOREFILES  0
 #define NGX_ELOOP         ELOOP
 #define NGX_EBADF         EBADF
+#define NGX_EMSGSIZE      EMSGSIZE
+#define NGX_ENOBUFS       ENOBUFS
+#define NGX_EPROTOTYPE    EPROTOTYPE
 
 #if (NGX_HAVE_OPENAT)
 #define NGX_EMLINK        EMLINK
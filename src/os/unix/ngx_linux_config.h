@@ -64,6 +64,11 @@
 #endif
 
 
+#if (NGX_HAVE_DLADDR)
+#include <dlfcn.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_PRCTL_H)
 #include <sys/prctl.h>
 #endif
@@ -93,6 +98,18 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IOURING)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#endif
+
+
+#if (NGX_HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
+
+
 #if (NGX_HAVE_FILE_AIO)
 #include <sys/syscall.h>
 #include <linux/aio_abi.h>
@@ -65,6 +65,11 @@
 #endif
 
 
+#if (NGX_HAVE_DLADDR)
+#include <dlfcn.h>
+#endif
+
+
 #if (NGX_HAVE_POLL)
 #include <poll.h>
 #endif
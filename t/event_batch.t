@@ -0,0 +1,91 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for "event_batch".
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use IO::Socket;
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has(qw/--with-debug/);
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+    event_batch 1;
+}
+
+http {
+    access_log off;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            return 200 "ok\n";
+        }
+    }
+}
+
+EOF
+
+$t->run()->plan(2);
+
+###############################################################################
+
+# the requests sent at once are reported by a single wait, and all but
+# one are left for the next loop iterations
+
+my @s = map {
+	IO::Socket::INET->new(Proto => 'tcp', PeerAddr => '127.0.0.1:8080')
+		or die "Can't connect: $!\n"
+} 1 .. 10;
+
+http_get('/');
+
+$_->print("GET / HTTP/1.0\nHost: localhost\n\n") for @s;
+
+my $ok = grep { /ok/ } map { read_reply($_) } @s;
+
+is($ok, 10, 'all requests handled');
+
+like($t->read_file('logs/error.log'), qr/posted events delayed/,
+	'events delayed');
+
+###############################################################################
+
+sub read_reply {
+	my ($s) = @_;
+	my $reply;
+
+	local $SIG{ALRM} = sub { die "timeout\n" };
+	alarm(5);
+
+	eval {
+		local $/;
+		$reply = $s->getline();
+	};
+
+	alarm(0);
+
+	return $reply || '';
+}
+
+###############################################################################
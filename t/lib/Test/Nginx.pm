@@ -0,0 +1,218 @@
+package Test::Nginx;
+
+# (C) Nginx, Inc.
+
+# A minimal harness for the tests in this directory: it writes the
+# configuration to a temporary directory, starts the binary given by
+# TEST_NGINX_BINARY (../objs/nginx by default) and stops it at the end.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use base qw/ Exporter /;
+
+our @EXPORT = qw/ http_get http /;
+
+use File::Path qw/ rmtree /;
+use File::Temp qw/ tempdir /;
+use IO::Socket;
+use POSIX qw/ waitpid WNOHANG /;
+use Test::More qw//;
+use Time::HiRes qw/ sleep /;
+
+our $NGINX = defined $ENV{TEST_NGINX_BINARY} ? $ENV{TEST_NGINX_BINARY}
+	: '../objs/nginx';
+
+###############################################################################
+
+sub new {
+	my $self = {};
+	bless $self;
+
+	$self->{_testdir} = tempdir(
+		'nginx-test-XXXXXXXXXX',
+		TMPDIR => 1,
+		CLEANUP => not $ENV{TEST_NGINX_LEAVE}
+	);
+
+	mkdir "$self->{_testdir}/logs";
+
+	return $self;
+}
+
+sub DESTROY {
+	my ($self) = @_;
+	$self->stop();
+}
+
+sub testdir {
+	my ($self) = @_;
+	return $self->{_testdir};
+}
+
+sub has_version {
+	my ($self, $feature) = @_;
+
+	my $v = `$NGINX -V 2>&1`;
+	return $v =~ /\Q$feature\E/;
+}
+
+sub has {
+	my ($self, @features) = @_;
+
+	Test::More::plan(skip_all => "$NGINX not found") unless -x $NGINX;
+
+	foreach my $feature (@features) {
+		Test::More::plan(skip_all => "no $feature")
+			unless $self->has_version($feature);
+	}
+
+	return $self;
+}
+
+sub plan {
+	my ($self, $plan) = @_;
+
+	Test::More::plan(tests => $plan);
+
+	return $self;
+}
+
+sub write_file {
+	my ($self, $name, $content) = @_;
+
+	open F, '>', $self->{_testdir} . '/' . $name
+		or die "Can't create $name: $!";
+	print F $content;
+	close F;
+
+	return $self;
+}
+
+sub write_file_expand {
+	my ($self, $name, $content) = @_;
+
+	$content =~ s/%%TEST_GLOBALS%%/$self->test_globals()/gme;
+	$content =~ s/%%TESTDIR%%/$self->{_testdir}/gms;
+
+	return $self->write_file($name, $content);
+}
+
+sub read_file {
+	my ($self, $name) = @_;
+	local $/;
+
+	open F, '<', $self->{_testdir} . '/' . $name
+		or die "Can't open $name: $!";
+	my $content = <F>;
+	close F;
+
+	return $content;
+}
+
+sub test_globals {
+	my ($self) = @_;
+
+	my $s = "pid $self->{_testdir}/nginx.pid;\n"
+		. "error_log $self->{_testdir}/logs/error.log debug;\n";
+
+	# the workers must be able to read the test directory
+
+	$s .= "user root;\n" if $> == 0;
+
+	return $s;
+}
+
+sub run {
+	my ($self) = @_;
+
+	my $testdir = $self->{_testdir};
+
+	my $pid = fork();
+	die "Unable to fork(): $!\n" unless defined $pid;
+
+	if ($pid == 0) {
+		my @args = ('-p', "$testdir/", '-c', 'nginx.conf',
+			'-g', 'daemon off;');
+		exec($NGINX, @args) or die "Unable to exec(): $!\n";
+	}
+
+	$self->{_pid} = $pid;
+
+	for (1 .. 50) {
+		last if -e "$testdir/nginx.pid";
+		die "nginx exited, see $testdir/logs/error.log\n"
+			if waitpid($pid, WNOHANG) == $pid;
+		sleep 0.1;
+	}
+
+	die "Can't start nginx" unless -e "$testdir/nginx.pid";
+
+	return $self;
+}
+
+sub stop {
+	my ($self) = @_;
+
+	my $pid = $self->{_pid};
+
+	return $self unless defined $pid;
+
+	kill 'QUIT', $pid;
+
+	for (1 .. 50) {
+		last if waitpid($pid, WNOHANG) == $pid;
+		sleep 0.1;
+	}
+
+	if (kill 0, $pid) {
+		kill 'KILL', $pid;
+		waitpid($pid, 0);
+	}
+
+	delete $self->{_pid};
+
+	return $self;
+}
+
+###############################################################################
+
+sub http_get {
+	my ($url, %extra) = @_;
+	return http(<<EOF, %extra);
+GET $url HTTP/1.0
+Host: localhost
+
+EOF
+}
+
+sub http {
+	my ($request, %extra) = @_;
+	my $reply;
+
+	my $s = IO::Socket::INET->new(
+		Proto => 'tcp',
+		PeerAddr => '127.0.0.1:' . ($extra{port} || 8080)
+	) or return undef;
+
+	local $SIG{ALRM} = sub { die "timeout\n" };
+	alarm(5);
+
+	eval {
+		$s->print($request);
+		local $/;
+		$reply = $s->getline();
+	};
+
+	alarm(0);
+
+	return $reply;
+}
+
+###############################################################################
+
+1;
+
+###############################################################################
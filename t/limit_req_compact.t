@@ -0,0 +1,105 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for the GCRA and sliding window algorithms of limit_req
+# combined with other limits.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has();
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    limit_req_zone  $host  zone=gcra:1m    rate=30r/m  algorithm=gcra;
+    limit_req_zone  $host  zone=window:1m  rate=2r/m   algorithm=sliding_window;
+    limit_req_zone  $host  zone=delay:1m   rate=10r/s  algorithm=gcra;
+    limit_req_zone  $host  zone=strict:1m  rate=1r/m;
+    limit_req_zone  $host  zone=strict2:1m rate=1r/m;
+    limit_req_zone  $host  zone=loose:1m   rate=1000r/s;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /gcra {
+            limit_req  zone=gcra burst=3 nodelay;
+            limit_req  zone=strict;
+        }
+
+        location /gcra_only {
+            limit_req  zone=gcra burst=3 nodelay;
+        }
+
+        location /window {
+            limit_req  zone=window;
+            limit_req  zone=strict2;
+        }
+
+        location /window_only {
+            limit_req  zone=window;
+        }
+
+        location /delay {
+            limit_req  zone=delay burst=5;
+            limit_req  zone=loose burst=100 nodelay;
+        }
+    }
+}
+
+EOF
+
+mkdir $t->testdir() . '/html';
+
+$t->run()->plan(8);
+
+###############################################################################
+
+# the requests rejected by a later limit are not counted by the earlier one
+
+like(http_get('/gcra'), qr/ 404 /, 'gcra passed');
+my @r = map { http_get('/gcra') } 1 .. 10;
+is(scalar(grep { / 503 / } @r), 10, 'gcra rejected by next limit');
+
+@r = map { http_get('/gcra_only') } 1 .. 4;
+is(join(' ', map { / (\d{3}) / } @r), '404 404 404 503', 'gcra not counted');
+
+like(http_get('/window'), qr/ 404 /, 'window passed');
+@r = map { http_get('/window') } 1 .. 5;
+is(scalar(grep { / 503 / } @r), 5, 'window rejected by next limit');
+
+@r = map { http_get('/window_only') } 1 .. 2;
+is(join(' ', map { / (\d{3}) / } @r), '404 503', 'window not counted');
+
+# an earlier gcra limit still delays, by the state of the account stage
+
+like(http_get('/delay'), qr/ 404 /, 'delay first');
+
+my $start = time();
+http_get('/delay');
+cmp_ok(time() - $start, '>=', 0.08, 'delayed by gcra');
+
+###############################################################################
@@ -0,0 +1,107 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for the tokens taken in advance by a worker process, "local".
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Time::HiRes qw/ sleep /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has('--with-debug');
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    limit_req_zone  $arg_k  zone=leaky:1m   rate=1r/m  local=5;
+    limit_req_zone  $arg_k  zone=gcra:1m    rate=1r/m  local=5  algorithm=gcra;
+    limit_req_zone  $arg_k  zone=window:1m  rate=1r/m  local=5
+                            algorithm=sliding_window;
+    limit_req_zone  $arg_k  zone=strict:1m  rate=1r/m;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /leaky {
+            limit_req  zone=leaky burst=4 nodelay;
+        }
+
+        location /gcra {
+            limit_req  zone=gcra burst=4 nodelay;
+        }
+
+        location /window {
+            limit_req  zone=window burst=4 nodelay;
+        }
+
+        location /chain {
+            limit_req  zone=gcra burst=4 nodelay;
+            limit_req  zone=strict;
+        }
+    }
+}
+
+EOF
+
+mkdir $t->testdir() . '/html';
+
+$t->run()->plan(10);
+
+###############################################################################
+
+# the burst is the same with the tokens spent locally
+
+for my $zone (qw/ leaky gcra window /) {
+	is(codes("/$zone?k=a", 6), '404 404 404 404 404 503', "$zone burst");
+}
+
+# the tokens not spent are returned to the zone when they expire
+
+for my $zone (qw/ leaky gcra window /) {
+	http_get("/$zone?k=b");
+}
+
+sleep 1.5;
+
+for my $zone (qw/ leaky gcra window /) {
+	is(codes("/$zone?k=b", 5), '404 404 404 404 503', "$zone returned");
+}
+
+like($t->read_file('logs/error.log'), qr/limit_req return 4 tokens of "b"/,
+	'returned tokens logged');
+
+# a token is kept when a later limit rejects the request
+
+like(http_get('/chain?k=c'), qr/ 404 /, 'chain passed');
+is(codes('/chain?k=c', 3), '503 503 503', 'chain rejected');
+is(codes('/gcra?k=c', 5), '404 404 404 404 503', 'tokens kept');
+
+###############################################################################
+
+sub codes {
+	my ($uri, $n) = @_;
+	return join ' ', map { http_get($uri) =~ / (\d{3}) / } 1 .. $n;
+}
+
+###############################################################################
@@ -0,0 +1,119 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for limit_req zones synchronized between two servers on loopback.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use IO::Socket;
+use Test::More;
+use Time::HiRes qw/ sleep /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $a = Test::Nginx->new()->has();
+my $b = Test::Nginx->new();
+
+# the test itself listens as one more peer of both servers
+
+my $peer = IO::Socket::INET->new(Proto => 'udp',
+	LocalAddr => '127.0.0.1:8093')
+	or die "Can't create peer socket: $!\n";
+
+# the datagrams are signed if the key can be used
+
+my $key = $a->has_version('http_ssl_module') ? 'limit_sync_key  secret;' : '';
+
+$a->write_file_expand('nginx.conf', conf(8080, 8091, 8092));
+$b->write_file_expand('nginx.conf', conf(8081, 8092, 8091));
+
+$a->run();
+$b->run()->plan(5);
+
+###############################################################################
+
+unlike(http_get('/'), qr/ 503 /, 'passed');
+like(http_get('/'), qr/ 503 /, 'limited');
+
+sleep 0.5;
+
+like(http_get('/', port => 8081), qr/ 503 /, 'limited by peer');
+
+# a datagram of the first server is accepted only once
+
+my $dgram = '';
+
+local $SIG{ALRM} = sub { die "timeout\n" };
+alarm(5);
+
+eval {
+	while (my $from = $peer->recv(my $buf, 1500)) {
+		my ($port) = unpack_sockaddr_in($from);
+		if ($port == 8091) {
+			$dgram = $buf;
+			last;
+		}
+	}
+};
+
+alarm(0);
+
+ok(length $dgram, 'datagram sent');
+
+$peer->send($dgram, 0, pack_sockaddr_in(8092, inet_aton('127.0.0.1'))) for 1 .. 2;
+
+sleep 0.5;
+
+my $log = $b->read_file('logs/error.log');
+my $replayed = () = $log =~ /replayed limit sync datagram/g;
+
+is($replayed, 1, 'replay rejected');
+
+###############################################################################
+
+sub conf {
+	my ($port, $sync, $other) = @_;
+
+	return <<"EOF";
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    limit_sync_listen    127.0.0.1:$sync;
+    limit_sync_peer      127.0.0.1:$other;
+    limit_sync_peer      127.0.0.1:8093;
+    limit_sync_interval  100ms;
+    $key
+
+    limit_req_zone  \$host  zone=one:1m  rate=1r/m  sync;
+
+    server {
+        listen       127.0.0.1:$port;
+        server_name  localhost;
+
+        location / {
+            limit_req  zone=one;
+        }
+    }
+}
+
+EOF
+}
+
+###############################################################################
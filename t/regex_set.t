@@ -0,0 +1,161 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for the regex locations and the map regexes matched through
+# a combined regex: the first regex in the configuration order wins
+# and sets the captures, the same as when they are tried one by one.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has();
+
+# overlapping regexes, some caseless, some not combined (the named capture
+# and the back reference), in the configuration order
+
+my @regexes = (
+	[ '~',  '^/a/(\d+)/(x|y)$' ],
+	[ '~*', '^/A/(\d+)' ],
+	[ '~',  '/(\w+)\.php$' ],
+	[ '~*', '\.(PHP|html)$' ],
+	[ '~',  '^/(a)(b)?/c' ],
+	[ '~',  '(foo)|(bar)' ],
+	[ '~',  '^/n/(?<name>\w+)' ],
+	[ '~',  '^/n/(\w+)/(\w+)' ],
+	[ '~',  '/(x)/\1' ],
+	[ '~*', '^/case/([a-z]+)$' ],
+	[ '~',  '(\d)(\d)' ],
+);
+
+my ($locations, $map) = ('', '');
+
+for my $i (0 .. $#regexes) {
+	my ($op, $re) = @{$regexes[$i]};
+	my $n = $i + 1;
+
+	$locations .= <<"EOF";
+        location $op "$re" {
+            return 200 "$n:\$1:\$2";
+        }
+
+EOF
+
+	$map .= "        \"$op$re\"  $n;\n";
+}
+
+$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    map \$uri \$match {
+        default  0;
+$map    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+$locations        location / {
+            return 200 "0:\$1:\$2";
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "\$match:\$1:\$2";
+        }
+    }
+}
+
+EOF
+
+# the handpicked cases, and random ones from the pieces of the regexes
+
+my @uris = (
+	'/a/1/x', '/a/1/X', '/A/1/x', '/a/12/y.php', '/foo/t.php', '/t.PHP',
+	'/x.html', '/ab/c', '/a/c', '/a/cfoo', '/barfoo', '/n/one',
+	'/n/one/two', '/x/x', '/case/abc', '/CASE/AbC', '/case/ab1',
+	'/q12', '/none',
+);
+
+my @paths = qw{ /a /A /ab /c /n /x /X /y /case /CASE /foo /bar /1 /22 /t };
+my @pieces = (@paths, qw{ abc .php .PHP .html });
+
+srand(20261019);
+
+for (1 .. 300) {
+	push @uris, join '', $paths[int rand @paths],
+		map { $pieces[int rand @pieces] } 1 .. int rand 5;
+}
+
+$t->run()->plan(2 * @uris + 2);
+
+###############################################################################
+
+for my $uri (@uris) {
+	my $expect = first_match($uri);
+
+	is(get($uri, 8080), $expect, "location $uri");
+	is(get($uri, 8081), $expect, "map $uri");
+}
+
+# the uris were matched with the combined regexes
+
+SKIP: {
+skip 'no debug', 2 unless $t->has_version('--with-debug');
+
+my $log = $t->read_file('logs/error.log');
+my $sets = () = $log =~ /regex set: (?:no )?match /g;
+
+is($sets, 2 * @uris, 'matched by regex set');
+like($log, qr/regex set: no match on "\/none"/, 'no match by regex set');
+
+}
+
+###############################################################################
+
+sub first_match {
+	my ($uri) = @_;
+
+	for my $i (0 .. $#regexes) {
+		my ($op, $re) = @{$regexes[$i]};
+		$re = $op eq '~*' ? qr/$re/i : qr/$re/;
+
+		next unless $uri =~ $re;
+
+		return join ':', $i + 1, map { defined $_ ? $_ : '' } $1, $2;
+	}
+
+	return '0::';
+}
+
+sub get {
+	my ($uri, $port) = @_;
+	my $r = http_get($uri, port => $port);
+	return $r =~ /\x0d\x0a\x0d\x0a(.*)/s ? $1 : $r;
+}
+
+###############################################################################
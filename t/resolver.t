@@ -0,0 +1,188 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for the resolver: SRV names in proxy_pass, retrying truncated
+# responses over TCP.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use IO::Select;
+use IO::Socket;
+use POSIX qw//;
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has();
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        resolver          127.0.0.1:8053;
+        resolver_timeout  2s;
+
+        location / {
+            proxy_pass  http://$arg_h;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "backend\n";
+        }
+    }
+}
+
+EOF
+
+my $d = $t->testdir();
+
+my $udp = IO::Socket::INET->new(Proto => 'udp', LocalAddr => '127.0.0.1:8053')
+	or die "Can't create DNS socket: $!\n";
+my $tcp = IO::Socket::INET->new(Proto => 'tcp', LocalAddr => '127.0.0.1:8053',
+	Listen => 5, Reuse => 1)
+	or die "Can't create DNS socket: $!\n";
+
+my $pid = fork();
+die "Can't fork: $!\n" unless defined $pid;
+
+if ($pid == 0) {
+	dns_daemon($udp, $tcp, "$d/tcp.log");
+	POSIX::_exit(0);
+}
+
+$t->run()->plan(6);
+
+###############################################################################
+
+like(http_get('/?h=_http._tcp.example.net'), qr/backend/, 'srv');
+like(http_get('/?h=_http._tcp.example.net'), qr/backend/, 'srv cached');
+like(http_get('/?h=_none._tcp.example.net'), qr/ 502 /, 'srv nxdomain');
+
+like(http_get('/?h=tc.example.net:8081'), qr/backend/, 'truncated over tcp');
+
+# a truncated response with a wrong ident does not start a TCP query,
+# the valid answer which follows it is used
+
+like(http_get('/?h=spoof.example.net:8081'), qr/backend/, 'spoofed ignored');
+
+is($t->read_file('tcp.log'), "tc.example.net\n", 'tcp queries');
+
+kill 'TERM', $pid;
+waitpid($pid, 0);
+
+###############################################################################
+
+sub reply {
+	my ($req, $tc, $wrong) = @_;
+
+	my ($id, $flags) = unpack('nn', $req);
+	my ($name, $qlen) = ('', 12);
+
+	while (my $len = ord(substr($req, $qlen, 1))) {
+		$name .= substr($req, $qlen + 1, $len) . '.';
+		$qlen += 1 + $len;
+	}
+
+	$name =~ s/\.$//;
+	$qlen += 5;
+
+	my $type = unpack('n', substr($req, $qlen - 4, 2));
+	my @an;
+
+	if ($name eq '_http._tcp.example.net' && $type == 33) {
+		my $target = join '', map { chr(length) . $_ }
+			split /\./, 'backend.example.net';
+		push @an, [33, pack('nnn', 10, 5, 8081) . $target . "\0"];
+
+	} elsif ($name =~ /^(backend|tc|spoof)\.example\.net$/ && $type == 1) {
+		push @an, [1, pack('C4', 127, 0, 0, 1)] unless $tc;
+	}
+
+	my $rcode = $name =~ /^(_http\._tcp|backend|tc|spoof)\./ ? 0 : 3;
+
+	$id = ($id + 1) & 0xffff if $wrong;
+
+	my $resp = pack('nnnnnn', $id, 0x8180 | ($tc ? 0x0200 : 0) | $rcode,
+		1, scalar @an, 0, 0) . substr($req, 12, $qlen - 12);
+
+	for my $an (@an) {
+		$resp .= pack('nnnNn', 0xc00c, $an->[0], 1, 3600,
+			length $an->[1]) . $an->[1];
+	}
+
+	return ($name, $resp);
+}
+
+sub dns_daemon {
+	my ($udp, $tcp, $log) = @_;
+
+	my $sel = IO::Select->new($udp, $tcp);
+	my $parent = getppid();
+
+	# the daemon exits with the test
+
+	while (getppid() == $parent) {
+		for my $s ($sel->can_read(1)) {
+			if ($s == $udp) {
+				my $req;
+				my $peer = $udp->recv($req, 512) or next;
+
+				my ($name) = reply($req);
+
+				if ($name eq 'tc.example.net') {
+					$udp->send((reply($req, 1))[1], 0, $peer);
+
+				} elsif ($name eq 'spoof.example.net') {
+					$udp->send((reply($req, 1, 1))[1], 0, $peer);
+					$udp->send((reply($req))[1], 0, $peer);
+
+				} else {
+					$udp->send((reply($req))[1], 0, $peer);
+				}
+
+			} elsif ($s == $tcp) {
+				my $c = $tcp->accept() or next;
+
+				$c->read(my $len, 2);
+				$c->read(my $req, unpack('n', $len));
+
+				my ($name, $resp) = reply($req);
+
+				open my $fh, '>>', $log or die "Can't open $log: $!\n";
+				print $fh "$name\n";
+				close $fh;
+
+				$c->print(pack('n', length $resp) . $resp);
+				$c->close();
+			}
+		}
+	}
+}
+
+###############################################################################
@@ -0,0 +1,139 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for the private key operations offload of "ssl_async".
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use POSIX qw//;
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has(qw/http_ssl_module --with-debug/);
+
+plan(skip_all => 'no curl') unless `curl --version 2>&1` =~ /SSL/;
+plan(skip_all => 'no openssl') unless `openssl version 2>&1` =~ /SSL/;
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+ssl_async_threads 2;
+
+events {
+}
+
+http {
+    access_log off;
+
+    server {
+        listen       127.0.0.1:8443 ssl;
+        server_name  localhost;
+
+        ssl_certificate      localhost.crt;
+        ssl_certificate_key  localhost.key;
+
+        ssl_async  on;
+
+        location / {
+            return 200 "$ssl_protocol $ssl_session_reused\n";
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8444 ssl;
+        server_name  localhost;
+
+        ssl_certificate      localhost.crt;
+        ssl_certificate_key  localhost.key;
+
+        location / {
+            return 200 "$ssl_protocol\n";
+        }
+    }
+}
+
+EOF
+
+my $d = $t->testdir();
+
+system('openssl req -x509 -newkey rsa:2048 -nodes -days 1 '
+	. "-subj /CN=localhost -keyout $d/localhost.key -out $d/localhost.crt "
+	. ">>$d/openssl.out 2>&1") == 0
+	or die "Can't create certificate: $!\n";
+
+$t->run()->plan(6);
+
+###############################################################################
+
+like(get(8443, '--tlsv1.2 --tls-max 1.2'), qr/^TLSv1.2 \./, 'tls 1.2');
+
+SKIP: {
+skip 'no tls 1.3', 1 unless `openssl s_client -help 2>&1` =~ /-tls1_3/;
+
+like(get(8443, '--tlsv1.3'), qr/^TLSv1.3 \./, 'tls 1.3');
+
+}
+
+# each handshake paused its job until a thread signed
+
+my $log = $t->read_file('logs/error.log');
+my $signs = () = $log =~ /SSL offload sign/g;
+my $fds = () = $log =~ /SSL async fd/g;
+
+ok($signs >= 1, 'signed in thread');
+ok($fds >= $signs, 'handshake waited for thread');
+
+# concurrent handshakes complete, each gets its own wait fd
+
+my @pids;
+
+for my $i (1 .. 20) {
+	my $pid = open(my $fh, '-|');
+	die "Can't fork: $!\n" unless defined $pid;
+
+	if ($pid == 0) {
+		print get(8443, '--tlsv1.2 --tls-max 1.2');
+		close STDOUT;
+		POSIX::_exit(0);
+	}
+
+	push @pids, $fh;
+}
+
+my $ok = grep { my $r = join '', <$_>; close $_; $r =~ /^TLSv1.2/ } @pids;
+
+is($ok, 20, 'concurrent handshakes');
+
+# the server without "ssl_async" keeps the synchronous path
+
+$log = $t->read_file('logs/error.log');
+$signs = () = $log =~ /SSL offload sign/g;
+
+get(8444, '--tlsv1.2 --tls-max 1.2');
+
+$log = $t->read_file('logs/error.log');
+my $after = () = $log =~ /SSL offload sign/g;
+
+is($after, $signs, 'no offload without ssl_async');
+
+###############################################################################
+
+sub get {
+	my ($port, $opts) = @_;
+	return `curl -sk --max-time 5 $opts https://127.0.0.1:$port/ 2>&1`;
+}
+
+###############################################################################
@@ -0,0 +1,102 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for dynamic TLS record sizing, "ssl_dyn_rec_enable".
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has(qw/http_ssl_module --with-debug/);
+
+plan(skip_all => 'no curl') unless `curl --version 2>&1` =~ /SSL/;
+plan(skip_all => 'no openssl') unless `openssl version 2>&1` =~ /SSL/;
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    server {
+        listen       127.0.0.1:8443 ssl;
+        server_name  localhost;
+
+        ssl_certificate      localhost.crt;
+        ssl_certificate_key  localhost.key;
+
+        ssl_dyn_rec_enable     on;
+        ssl_dyn_rec_size_lo    1369;
+        ssl_dyn_rec_size_hi    4229;
+        ssl_dyn_rec_threshold  13690;
+
+        root %%TESTDIR%%/html;
+        sendfile off;
+    }
+}
+
+EOF
+
+my $d = $t->testdir();
+
+system('openssl req -x509 -newkey rsa:2048 -nodes -days 1 '
+	. "-subj /CN=localhost -keyout $d/localhost.key -out $d/localhost.crt "
+	. ">>$d/openssl.out 2>&1") == 0
+	or die "Can't create certificate: $!\n";
+
+mkdir "$d/html";
+
+$t->write_file('html/file', join '', map { chr(65 + $_ % 26) } 0 .. 99999);
+
+$t->run()->plan(6);
+
+###############################################################################
+
+is(`curl -sk --max-time 10 https://127.0.0.1:8443/file`,
+	$t->read_file('html/file'), 'file');
+
+# the records grow after the threshold bytes in each size
+
+my @writes = $t->read_file('logs/error.log') =~ /SSL to write: (\d+)/g;
+
+is(scalar(grep { $_ == 1369 } @writes), 10, 'small records');
+is(scalar(grep { $_ == 4229 } @writes), 4, 'medium records');
+ok(scalar(grep { $_ == 16384 } @writes), 'full records');
+
+# the sizes are checked when the configuration is loaded
+
+like(check('ssl_dyn_rec_size_lo +1369', 'ssl_dyn_rec_size_lo 5000'),
+	qr/"ssl_dyn_rec_size_lo" must be less/, 'size_lo above size_hi');
+like(check('ssl_dyn_rec_size_hi +4229', 'ssl_dyn_rec_size_hi 20k'),
+	qr/"ssl_dyn_rec_size_hi" must be less/, 'size_hi above buffer size');
+
+###############################################################################
+
+sub check {
+	my ($from, $to) = @_;
+
+	my $conf = $t->read_file('nginx.conf');
+	$conf =~ s/$from/$to/;
+	$t->write_file('check.conf', $conf);
+
+	return `$Test::Nginx::NGINX -p $d/ -c check.conf -t 2>&1`;
+}
+
+###############################################################################
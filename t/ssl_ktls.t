@@ -0,0 +1,126 @@
+#!/usr/bin/perl
+
+# (C) Nginx, Inc.
+
+# Tests for sending files with kernel TLS, "ssl_ktls".
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+my $t = Test::Nginx->new()->has(qw/http_ssl_module --with-debug/);
+
+plan(skip_all => 'no curl') unless `curl --version 2>&1` =~ /SSL/;
+plan(skip_all => 'no openssl') unless `openssl version 2>&1` =~ /SSL/;
+
+$t->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    access_log off;
+
+    server {
+        listen       127.0.0.1:8443 ssl;
+        server_name  localhost;
+
+        ssl_certificate      localhost.crt;
+        ssl_certificate_key  localhost.key;
+
+        ssl_ktls  on;
+
+        root %%TESTDIR%%/html;
+
+        location / {
+            sendfile  on;
+        }
+
+        location /copy/ {
+            alias     %%TESTDIR%%/html/;
+            sendfile  off;
+        }
+
+        location /limit/ {
+            alias       %%TESTDIR%%/html/;
+            sendfile    on;
+            limit_rate  8m;
+        }
+    }
+}
+
+EOF
+
+my $d = $t->testdir();
+
+system('openssl req -x509 -newkey rsa:2048 -nodes -days 1 '
+	. "-subj /CN=localhost -keyout $d/localhost.key -out $d/localhost.crt "
+	. ">>$d/openssl.out 2>&1") == 0
+	or die "Can't create certificate: $!\n";
+
+mkdir "$d/html";
+
+my %files = (small => 1, medium => 20000, large => 3000000);
+
+for my $name (keys %files) {
+	$t->write_file("html/$name",
+		join '', map { chr(65 + $_ % 26) } 0 .. $files{$name} - 1);
+}
+
+$t->run()->plan(11);
+
+###############################################################################
+
+for my $name (qw/ small medium large /) {
+	is(get("/$name"), $t->read_file("html/$name"), "file $name");
+}
+
+is(get('/large', '-r 1000-1999'),
+	substr($t->read_file('html/large'), 1000, 1000), 'range');
+
+is(get('/copy/large'), $t->read_file('html/large'), 'sendfile off');
+is(get('/limit/large'), $t->read_file('html/large'), 'limit rate');
+
+is(get('/medium', '--tlsv1.2 --tls-max 1.2'), $t->read_file('html/medium'),
+	'tls 1.2');
+
+# with the kernel offload, the file bodies bypass SSL_write()
+
+my $log = $t->read_file('logs/error.log');
+
+SKIP: {
+skip 'no kernel TLS', 4 unless $log =~ /SSL kernel TLS send enabled/;
+
+like($log, qr/SSL_sendfile: \@0 3000000/, 'large file sent by kernel');
+like($log, qr/SSL_sendfile: \@1000 1000/, 'range sent by kernel');
+
+my @copies = $log =~ /SSL_sendfile: \@\d+ (\d+)/g;
+ok(scalar @copies, 'sendfile used');
+
+unlike($log, qr/SSL_sendfile\(\) failed/, 'no sendfile errors');
+
+}
+
+###############################################################################
+
+sub get {
+	my ($uri, $opts) = @_;
+	$opts = '' unless defined $opts;
+	return `curl -sk --max-time 10 $opts https://127.0.0.1:8443$uri`;
+}
+
+###############################################################################